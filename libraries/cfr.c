@@ -22,31 +22,301 @@ static char *lb_new_record(struct lb_header *header)
 	return header->buffer;
 }
 
+/* MSB-first CRC32 with polynomial 0x04C11DB7, one entry per byte value */
+static const uint32_t crc32_table[256] = {
+	0x00000000, 0x04c11db7, 0x09823b6e, 0x0d4326d9, 0x130476dc, 0x17c56b6b,
+	0x1a864db2, 0x1e475005, 0x2608edb8, 0x22c9f00f, 0x2f8ad6d6, 0x2b4bcb61,
+	0x350c9b64, 0x31cd86d3, 0x3c8ea00a, 0x384fbdbd, 0x4c11db70, 0x48d0c6c7,
+	0x4593e01e, 0x4152fda9, 0x5f15adac, 0x5bd4b01b, 0x569796c2, 0x52568b75,
+	0x6a1936c8, 0x6ed82b7f, 0x639b0da6, 0x675a1011, 0x791d4014, 0x7ddc5da3,
+	0x709f7b7a, 0x745e66cd, 0x9823b6e0, 0x9ce2ab57, 0x91a18d8e, 0x95609039,
+	0x8b27c03c, 0x8fe6dd8b, 0x82a5fb52, 0x8664e6e5, 0xbe2b5b58, 0xbaea46ef,
+	0xb7a96036, 0xb3687d81, 0xad2f2d84, 0xa9ee3033, 0xa4ad16ea, 0xa06c0b5d,
+	0xd4326d90, 0xd0f37027, 0xddb056fe, 0xd9714b49, 0xc7361b4c, 0xc3f706fb,
+	0xceb42022, 0xca753d95, 0xf23a8028, 0xf6fb9d9f, 0xfbb8bb46, 0xff79a6f1,
+	0xe13ef6f4, 0xe5ffeb43, 0xe8bccd9a, 0xec7dd02d, 0x34867077, 0x30476dc0,
+	0x3d044b19, 0x39c556ae, 0x278206ab, 0x23431b1c, 0x2e003dc5, 0x2ac12072,
+	0x128e9dcf, 0x164f8078, 0x1b0ca6a1, 0x1fcdbb16, 0x018aeb13, 0x054bf6a4,
+	0x0808d07d, 0x0cc9cdca, 0x7897ab07, 0x7c56b6b0, 0x71159069, 0x75d48dde,
+	0x6b93dddb, 0x6f52c06c, 0x6211e6b5, 0x66d0fb02, 0x5e9f46bf, 0x5a5e5b08,
+	0x571d7dd1, 0x53dc6066, 0x4d9b3063, 0x495a2dd4, 0x44190b0d, 0x40d816ba,
+	0xaca5c697, 0xa864db20, 0xa527fdf9, 0xa1e6e04e, 0xbfa1b04b, 0xbb60adfc,
+	0xb6238b25, 0xb2e29692, 0x8aad2b2f, 0x8e6c3698, 0x832f1041, 0x87ee0df6,
+	0x99a95df3, 0x9d684044, 0x902b669d, 0x94ea7b2a, 0xe0b41de7, 0xe4750050,
+	0xe9362689, 0xedf73b3e, 0xf3b06b3b, 0xf771768c, 0xfa325055, 0xfef34de2,
+	0xc6bcf05f, 0xc27dede8, 0xcf3ecb31, 0xcbffd686, 0xd5b88683, 0xd1799b34,
+	0xdc3abded, 0xd8fba05a, 0x690ce0ee, 0x6dcdfd59, 0x608edb80, 0x644fc637,
+	0x7a089632, 0x7ec98b85, 0x738aad5c, 0x774bb0eb, 0x4f040d56, 0x4bc510e1,
+	0x46863638, 0x42472b8f, 0x5c007b8a, 0x58c1663d, 0x558240e4, 0x51435d53,
+	0x251d3b9e, 0x21dc2629, 0x2c9f00f0, 0x285e1d47, 0x36194d42, 0x32d850f5,
+	0x3f9b762c, 0x3b5a6b9b, 0x0315d626, 0x07d4cb91, 0x0a97ed48, 0x0e56f0ff,
+	0x1011a0fa, 0x14d0bd4d, 0x19939b94, 0x1d528623, 0xf12f560e, 0xf5ee4bb9,
+	0xf8ad6d60, 0xfc6c70d7, 0xe22b20d2, 0xe6ea3d65, 0xeba91bbc, 0xef68060b,
+	0xd727bbb6, 0xd3e6a601, 0xdea580d8, 0xda649d6f, 0xc423cd6a, 0xc0e2d0dd,
+	0xcda1f604, 0xc960ebb3, 0xbd3e8d7e, 0xb9ff90c9, 0xb4bcb610, 0xb07daba7,
+	0xae3afba2, 0xaafbe615, 0xa7b8c0cc, 0xa379dd7b, 0x9b3660c6, 0x9ff77d71,
+	0x92b45ba8, 0x9675461f, 0x8832161a, 0x8cf30bad, 0x81b02d74, 0x857130c3,
+	0x5d8a9099, 0x594b8d2e, 0x5408abf7, 0x50c9b640, 0x4e8ee645, 0x4a4ffbf2,
+	0x470cdd2b, 0x43cdc09c, 0x7b827d21, 0x7f436096, 0x7200464f, 0x76c15bf8,
+	0x68860bfd, 0x6c47164a, 0x61043093, 0x65c52d24, 0x119b4be9, 0x155a565e,
+	0x18197087, 0x1cd86d30, 0x029f3d35, 0x065e2082, 0x0b1d065b, 0x0fdc1bec,
+	0x3793a651, 0x3352bbe6, 0x3e119d3f, 0x3ad08088, 0x2497d08d, 0x2056cd3a,
+	0x2d15ebe3, 0x29d4f654, 0xc5a92679, 0xc1683bce, 0xcc2b1d17, 0xc8ea00a0,
+	0xd6ad50a5, 0xd26c4d12, 0xdf2f6bcb, 0xdbee767c, 0xe3a1cbc1, 0xe760d676,
+	0xea23f0af, 0xeee2ed18, 0xf0a5bd1d, 0xf464a0aa, 0xf9278673, 0xfde69bc4,
+	0x89b8fd09, 0x8d79e0be, 0x803ac667, 0x84fbdbd0, 0x9abc8bd5, 0x9e7d9662,
+	0x933eb0bb, 0x97ffad0c, 0xafb010b1, 0xab710d06, 0xa6322bdf, 0xa2f33668,
+	0xbcb4666d, 0xb8757bda, 0xb5365d03, 0xb1f740b4,
+};
+
 static uint32_t crc32_byte(uint32_t prev_crc, uint8_t data)
 {
-	prev_crc ^= (uint32_t)data << 24;
-
-	for (int i = 0; i < 8; i++) {
-		if ((prev_crc & 0x80000000UL) != 0)
-			prev_crc = ((prev_crc << 1) ^ 0x04C11DB7UL);
-		else
-			prev_crc <<= 1;
-	}
-
-	return prev_crc;
+	return (prev_crc << 8) ^ crc32_table[(prev_crc >> 24) ^ data];
 }
 
-static uint32_t crc32(const uint8_t *buf, size_t size)
+static uint32_t crc32_continue(uint32_t result, const uint8_t *buf, size_t size)
 {
-	uint32_t result = 0;
 	while (size--) {
 		result = crc32_byte(result, *buf++);
 	}
 	return result;
 }
 
+static uint32_t crc32(const uint8_t *buf, size_t size)
+{
+	return crc32_continue(0, buf, size);
+}
+
 #define CRC(buf, size, crc_func) crc32((const uint8_t *)(buf), (size))
 
+uint32_t cfr_crc32(const void *buf, size_t size)
+{
+	return CRC(buf, size, crc32_byte);
+}
+
+/* Multiplies two polynomials modulo the CRC32 polynomial, MSB first like the table */
+static uint32_t crc32_multiply(uint32_t a, uint32_t b)
+{
+	uint32_t product = 0;
+
+	for (uint32_t bit = 1u << 31; bit; bit >>= 1) {
+		product = (product << 1) ^ (product & (1u << 31) ? 0x04c11db7 : 0);
+		if (b & bit) {
+			product ^= a;
+		}
+	}
+	return product;
+}
+
+/*
+ * Without an initial value or final XOR, appending `len_b` zero bytes
+ * multiplies the CRC by x^(8 * len_b), and the CRC of `b` can be added
+ * on top. The power is built by squaring, so this takes O(log(len_b)).
+ */
+uint32_t cfr_crc32_combine(uint32_t crc_a, uint32_t crc_b, size_t len_b)
+{
+	uint32_t power = 1u << 8;	/* x^8, a single zero byte */
+
+	for (; len_b; len_b >>= 1) {
+		if (len_b & 1) {
+			crc_a = crc32_multiply(crc_a, power);
+		}
+		power = crc32_multiply(power, power);
+	}
+	return crc_a ^ crc_b;
+}
+
+bool cfr_root_checksum_ok(const char *blob)
+{
+	static const uint8_t zero[sizeof(uint32_t)];
+	const struct lb_cfr *root = (const struct lb_cfr *)blob;
+	const uint8_t *const start = (const uint8_t *)blob;
+	const uint8_t *const field = (const uint8_t *)&root->checksum;
+	const uint8_t *const rest = field + sizeof(root->checksum);
+	const uint32_t size = cfr_le32_to_cpu(root->size);
+
+	if (size < sizeof(*root)) {
+		return false;
+	}
+	uint32_t crc = crc32_continue(0, start, field - start);
+	crc = crc32_continue(crc, zero, sizeof(zero));
+	crc = crc32_continue(crc, rest, start + size - rest);
+	return crc == cfr_le32_to_cpu(root->checksum);
+}
+
+size_t cfr_record_header_size(uint32_t tag)
+{
+	switch (tag) {
+	case LB_TAG_CFR:
+		return sizeof(struct lb_cfr);
+	case LB_TAG_CFR_OPTION_FORM:
+		return sizeof(struct lb_cfr_option_form);
+	case LB_TAG_CFR_ENUM_VALUE:
+		return sizeof(struct lb_cfr_enum_value);
+	case LB_TAG_CFR_ENUM_RANGE:
+		return sizeof(struct lb_cfr_enum_range);
+	case LB_TAG_CFR_OPTION_ENUM:
+	case LB_TAG_CFR_OPTION_NUMBER:
+	case LB_TAG_CFR_OPTION_BOOL:
+		return sizeof(struct lb_cfr_numeric_option);
+	case LB_TAG_CFR_OPTION_VARCHAR:
+		return sizeof(struct lb_cfr_varchar_option);
+	case LB_TAG_CFR_OPTION_COMMENT:
+		return sizeof(struct lb_cfr_option_comment);
+	default:
+		return 0;
+	}
+}
+
+/* The data of the first child if it is a string with `tag`, or "" */
+static const char *child_string(const char *record, size_t header_size, uint32_t tag)
+{
+	const struct lb_record *rec = (const struct lb_record *)record;
+	const struct lb_cfr_varbinary *str = (const struct lb_cfr_varbinary *)(record + header_size);
+	const uint32_t size = cfr_le32_to_cpu(rec->size);
+
+	if (size < header_size + sizeof(*str) || cfr_le32_to_cpu(str->tag) != tag) {
+		return "";
+	}
+	const uint32_t data_length = cfr_le32_to_cpu(str->data_length);
+	if (!data_length || data_length > size - header_size - sizeof(*str) ||
+	    str->data[data_length - 1] != '\0') {
+		return "";
+	}
+	return (const char *)str->data;
+}
+
+bool cfr_enum_range_fits(uint32_t start, uint32_t count, uint32_t step)
+{
+	return count <= CFR_ENUM_RANGE_MAX &&
+	       (!count || start + (uint64_t)(count - 1) * step <= UINT32_MAX);
+}
+
+uint32_t cfr_enum_range_value(const struct lb_cfr_enum_range *range, uint32_t index)
+{
+	return cfr_le32_to_cpu(range->start) + index * cfr_le32_to_cpu(range->step);
+}
+
+void cfr_enum_range_label(const struct lb_cfr_enum_range *range, uint32_t index,
+			  char buf[CFR_ENUM_LABEL_MAX])
+{
+	const char *format = child_string((const char *)range, sizeof(*range),
+					  LB_TAG_CFR_VARCHAR_UI_NAME);
+	const uint32_t value = cfr_enum_range_value(range, index);
+	uint32_t decimals = cfr_le32_to_cpu(range->decimals);
+	if (decimals > 9) {
+		decimals = 9;
+	}
+	uint32_t scale = 1;
+	for (uint32_t i = 0; i < decimals; i++) {
+		scale *= 10;
+	}
+
+	size_t len = 0;
+	for (const char *p = format; *p && len < CFR_ENUM_LABEL_MAX - 1; p++) {
+		if (p[0] == '%' && p[1] == '%') {
+			buf[len++] = '%';
+			p++;
+		} else if (p[0] == '%' && p[1] == 'v') {
+			const int n = decimals ?
+				snprintf(buf + len, CFR_ENUM_LABEL_MAX - len, "%u.%0*u",
+					 value / scale, (int)decimals, value % scale) :
+				snprintf(buf + len, CFR_ENUM_LABEL_MAX - len, "%u", value);
+			len += (size_t)n < CFR_ENUM_LABEL_MAX - len ? (size_t)n : CFR_ENUM_LABEL_MAX - 1 - len;
+			p++;
+		} else {
+			buf[len++] = *p;
+		}
+	}
+	buf[len] = '\0';
+}
+
+/* Whether `value` is in the range, which takes no more than a division */
+static bool enum_range_has_value(const struct lb_cfr_enum_range *range, uint32_t value)
+{
+	const uint32_t count = cfr_le32_to_cpu(range->count);
+	const uint32_t step = cfr_le32_to_cpu(range->step);
+	const uint32_t delta = value - cfr_le32_to_cpu(range->start);
+
+	if (!count) {
+		return false;
+	}
+	if (!step) {
+		return !delta;
+	}
+	return delta % step == 0 && delta / step < count;
+}
+
+bool cfr_enum_has_value(const struct lb_cfr_numeric_option *option, uint32_t value)
+{
+	const char *current = (const char *)option + sizeof(*option);
+	const char *const limit = (const char *)option + cfr_le32_to_cpu(option->size);
+
+	while (current < limit && (size_t)(limit - current) >= sizeof(struct lb_record)) {
+		const struct lb_record *rec = (const struct lb_record *)current;
+		const uint32_t size = cfr_le32_to_cpu(rec->size);
+		if (size < sizeof(*rec) || size > (size_t)(limit - current)) {
+			break;
+		}
+		switch (cfr_le32_to_cpu(rec->tag)) {
+		case LB_TAG_CFR_ENUM_VALUE:
+			if (size >= sizeof(struct lb_cfr_enum_value) &&
+			    cfr_le32_to_cpu(((const struct lb_cfr_enum_value *)rec)->value) == value) {
+				return true;
+			}
+			break;
+		case LB_TAG_CFR_ENUM_RANGE:
+			if (size >= sizeof(struct lb_cfr_enum_range) &&
+			    enum_range_has_value((const struct lb_cfr_enum_range *)rec, value)) {
+				return true;
+			}
+			break;
+		}
+		current += size;
+	}
+	return false;
+}
+
+void cfr_enum_iter_init(struct cfr_enum_iter *it, const struct lb_cfr_numeric_option *option)
+{
+	it->current = (const char *)option + sizeof(*option);
+	it->limit = (const char *)option + cfr_le32_to_cpu(option->size);
+	it->index = 0;
+}
+
+bool cfr_enum_iter_next(struct cfr_enum_iter *it)
+{
+	while (it->current < it->limit && (size_t)(it->limit - it->current) >= sizeof(struct lb_record)) {
+		const struct lb_record *rec = (const struct lb_record *)it->current;
+		const uint32_t size = cfr_le32_to_cpu(rec->size);
+		if (size < sizeof(*rec) || size > (size_t)(it->limit - it->current)) {
+			break;
+		}
+
+		const uint32_t tag = cfr_le32_to_cpu(rec->tag);
+		if (tag == LB_TAG_CFR_ENUM_VALUE && size >= sizeof(struct lb_cfr_enum_value)) {
+			it->value = cfr_le32_to_cpu(((const struct lb_cfr_enum_value *)rec)->value);
+			it->ui_name = child_string(it->current, sizeof(struct lb_cfr_enum_value),
+						   LB_TAG_CFR_VARCHAR_UI_NAME);
+			it->current += size;
+			return true;
+		}
+		if (tag == LB_TAG_CFR_ENUM_RANGE && size >= sizeof(struct lb_cfr_enum_range)) {
+			const struct lb_cfr_enum_range *range = (const struct lb_cfr_enum_range *)rec;
+			if (it->index < cfr_le32_to_cpu(range->count)) {
+				it->value = cfr_enum_range_value(range, it->index);
+				cfr_enum_range_label(range, it->index, it->label);
+				it->ui_name = it->label;
+				it->index++;
+				return true;
+			}
+			it->index = 0;
+		}
+		it->current += size;
+	}
+	return false;
+}
+
 static uint32_t cfr_record_size(const char *startp, const char *endp)
 {
 	const uintptr_t start = (uintptr_t)startp;
@@ -70,11 +340,13 @@ static uint32_t write_cfr_varchar(char *current, const char *string, uint32_t ta
 	assert(string);
 
 	struct lb_cfr_varbinary *cfr_str = (struct lb_cfr_varbinary *)current;
-	cfr_str->tag = tag;
-	cfr_str->data_length = strlen(string) + 1;
-	memcpy(cfr_str->data, string, cfr_str->data_length);
-	cfr_str->size = ALIGN_UP(sizeof(*cfr_str) + cfr_str->data_length, LB_ENTRY_ALIGN);
-	return cfr_str->size;
+	const uint32_t data_length = strlen(string) + 1;
+	const uint32_t size = ALIGN_UP(sizeof(*cfr_str) + data_length, LB_ENTRY_ALIGN);
+	cfr_str->tag = cfr_cpu_to_le32(tag);
+	cfr_str->data_length = cfr_cpu_to_le32(data_length);
+	memcpy(cfr_str->data, string, data_length);
+	cfr_str->size = cfr_cpu_to_le32(size);
+	return size;
 }
 
 static uint32_t sm_write_string_default_value(char *current, const char *string)
@@ -100,122 +372,167 @@ static uint32_t sm_write_ui_helptext(char *current, const char *string)
 	return write_cfr_varchar(current, string, LB_TAG_CFR_VARCHAR_UI_HELPTEXT);
 }
 
+static uint32_t sm_write_enum_range(char *current, const struct sm_enum_range *r)
+{
+	if (!cfr_enum_range_fits(r->start, r->count, r->step)) {
+		/* Menus are checked by the builder, static ones should know better */
+		fprintf(stderr, "%s: range '%s' of %u values from %u every %u does not fit\n",
+			__func__, r->label, r->count, r->start, r->step);
+		exit(-1);
+	}
+
+	struct lb_cfr_enum_range *range = (struct lb_cfr_enum_range *)current;
+	range->tag = cfr_cpu_to_le32(LB_TAG_CFR_ENUM_RANGE);
+	range->start = cfr_cpu_to_le32(r->start);
+	range->count = cfr_cpu_to_le32(r->count);
+	range->step = cfr_cpu_to_le32(r->step);
+	range->decimals = cfr_cpu_to_le32(r->decimals);
+
+	current += sizeof(*range);
+	current += sm_write_ui_name(current, r->label);
+
+	const uint32_t size = cfr_record_size((char *)range, current);
+	range->size = cfr_cpu_to_le32(size);
+	return size;
+}
+
 static uint32_t sm_write_enum_value(char *current, const struct sm_enum_value *e)
 {
 	struct lb_cfr_enum_value *enum_val = (struct lb_cfr_enum_value *)current;
-	enum_val->tag = LB_TAG_CFR_ENUM_VALUE;
-	enum_val->value = e->value;
-	enum_val->size = sizeof(*enum_val);
+	enum_val->tag = cfr_cpu_to_le32(LB_TAG_CFR_ENUM_VALUE);
+	enum_val->value = cfr_cpu_to_le32(e->value);
 
-	current += enum_val->size;
+	current += sizeof(*enum_val);
 	current += sm_write_ui_name(current, e->ui_name);
 
-	enum_val->size = cfr_record_size((char *)enum_val, current);
-	return enum_val->size;
+	const uint32_t size = cfr_record_size((char *)enum_val, current);
+	enum_val->size = cfr_cpu_to_le32(size);
+	return size;
 }
 
 static uint32_t write_numeric_option(char *current, uint32_t tag, uint32_t object_id,
 		const char *opt_name, const char *ui_name, const char *ui_helptext,
-		uint32_t flags, uint32_t default_value, const struct sm_enum_value *values)
+		uint32_t flags, uint32_t default_value, const struct sm_enum_range *ranges,
+		const struct sm_enum_value *values)
 {
 	struct lb_cfr_numeric_option *option = (struct lb_cfr_numeric_option *)current;
-	option->tag = tag;
-	option->object_id = object_id;
-	option->flags = flags;
-	option->default_value = default_value;
-	option->size = sizeof(*option);
+	option->tag = cfr_cpu_to_le32(tag);
+	option->object_id = cfr_cpu_to_le32(object_id);
+	option->flags = cfr_cpu_to_le32(flags);
+	option->default_value = cfr_cpu_to_le32(default_value);
 
-	current += option->size;
+	current += sizeof(*option);
 	current += sm_write_opt_name(current, opt_name);
 	current += sm_write_ui_name(current, ui_name);
 	current += sm_write_ui_helptext(current, ui_helptext);
 
-	if (option->tag == LB_TAG_CFR_OPTION_ENUM && values) {
+	if (tag == LB_TAG_CFR_OPTION_ENUM && ranges) {
+		for (const struct sm_enum_range *r = ranges; r->label; r++) {
+			current += sm_write_enum_range(current, r);
+		}
+	}
+	if (tag == LB_TAG_CFR_OPTION_ENUM && values) {
 		for (const struct sm_enum_value *e = values; e->ui_name; e++) {
 			current += sm_write_enum_value(current, e);
 		}
 	}
 
-	option->size = cfr_record_size((char *)option, current);
-	return option->size;
+	const uint32_t size = cfr_record_size((char *)option, current);
+	option->size = cfr_cpu_to_le32(size);
+	return size;
 }
 
 static uint32_t sm_write_opt_enum(char *current, const struct sm_obj_enum *sm_enum)
 {
 	return write_numeric_option(current, LB_TAG_CFR_OPTION_ENUM, sm_enum->object_id,
 			sm_enum->opt_name, sm_enum->ui_name, sm_enum->ui_helptext,
-			sm_enum->flags, sm_enum->default_value, sm_enum->values);
+			sm_enum->flags, sm_enum->default_value, sm_enum->ranges, sm_enum->values);
 }
 
 static uint32_t sm_write_opt_number(char *current, const struct sm_obj_number *sm_number)
 {
 	return write_numeric_option(current, LB_TAG_CFR_OPTION_NUMBER, sm_number->object_id,
 			sm_number->opt_name, sm_number->ui_name, sm_number->ui_helptext,
-			sm_number->flags, sm_number->default_value, NULL);
+			sm_number->flags, sm_number->default_value, NULL, NULL);
 }
 
 static uint32_t sm_write_opt_bool(char *current, const struct sm_obj_bool *sm_bool)
 {
 	return write_numeric_option(current, LB_TAG_CFR_OPTION_BOOL, sm_bool->object_id,
 			sm_bool->opt_name, sm_bool->ui_name, sm_bool->ui_helptext,
-			sm_bool->flags, sm_bool->default_value, NULL);
+			sm_bool->flags, sm_bool->default_value, NULL, NULL);
 }
 
 static uint32_t sm_write_opt_varchar(char *current, const struct sm_obj_varchar *sm_varchar)
 {
 	struct lb_cfr_varchar_option *option = (struct lb_cfr_varchar_option *)current;
-	option->tag = LB_TAG_CFR_OPTION_VARCHAR;
-	option->object_id = sm_varchar->object_id;
-	option->flags = sm_varchar->flags;
-	option->size = sizeof(*option);
+	option->tag = cfr_cpu_to_le32(LB_TAG_CFR_OPTION_VARCHAR);
+	option->object_id = cfr_cpu_to_le32(sm_varchar->object_id);
+	option->flags = cfr_cpu_to_le32(sm_varchar->flags);
 
-	current += option->size;
+	current += sizeof(*option);
 	current += sm_write_string_default_value(current, sm_varchar->default_value);
 	current += sm_write_opt_name(current, sm_varchar->opt_name);
 	current += sm_write_ui_name(current, sm_varchar->ui_name);
 	current += sm_write_ui_helptext(current, sm_varchar->ui_helptext);
 
-	option->size = cfr_record_size((char *)option, current);
-	return option->size;
+	const uint32_t size = cfr_record_size((char *)option, current);
+	option->size = cfr_cpu_to_le32(size);
+	return size;
 }
 
 static uint32_t sm_write_opt_comment(char *current, const struct sm_obj_comment *sm_comment)
 {
 	struct lb_cfr_option_comment *comment = (struct lb_cfr_option_comment *)current;
-	comment->tag = LB_TAG_CFR_OPTION_COMMENT;
-	comment->object_id = sm_comment->object_id;
-	comment->flags = sm_comment->flags;
-	comment->size = sizeof(*comment);
+	comment->tag = cfr_cpu_to_le32(LB_TAG_CFR_OPTION_COMMENT);
+	comment->object_id = cfr_cpu_to_le32(sm_comment->object_id);
+	comment->flags = cfr_cpu_to_le32(sm_comment->flags);
 
-	current += comment->size;
+	current += sizeof(*comment);
 	current += sm_write_ui_name(current, sm_comment->ui_name);
 	current += sm_write_ui_helptext(current, sm_comment->ui_helptext);
 
-	comment->size = cfr_record_size((char *)comment, current);
-	return comment->size;
+	const uint32_t size = cfr_record_size((char *)comment, current);
+	comment->size = cfr_cpu_to_le32(size);
+	return size;
 }
 
-static uint32_t sm_write_object(char *current, const struct sm_object *sm_obj);
+static uint32_t sm_write_object(char *current, const struct sm_object *sm_obj, bool checksums);
 
-static uint32_t sm_write_form(char *current, const struct sm_obj_form *sm_form)
+static uint32_t sm_write_form(char *current, const struct sm_obj_form *sm_form, bool checksums)
 {
 	struct lb_cfr_option_form *form = (struct lb_cfr_option_form *)current;
-	form->tag = LB_TAG_CFR_OPTION_FORM;
-	form->object_id = sm_form->object_id;
-	form->flags = sm_form->flags;
-	form->size = sizeof(*form);
+	form->tag = cfr_cpu_to_le32(LB_TAG_CFR_OPTION_FORM);
+	form->object_id = cfr_cpu_to_le32(sm_form->object_id);
+	form->flags = cfr_cpu_to_le32(sm_form->flags);
 
-	current += form->size;
+	current += sizeof(*form);
 	current += sm_write_ui_name(current, sm_form->ui_name);
+
+	/* Nested forms get their CRC first, the outer one covers it */
+	struct lb_cfr_form_checksum *crc = NULL;
+	if (checksums) {
+		crc = (struct lb_cfr_form_checksum *)current;
+		crc->tag = cfr_cpu_to_le32(LB_TAG_CFR_FORM_CHECKSUM);
+		crc->size = cfr_cpu_to_le32(sizeof(*crc));
+		crc->checksum = 0;
+		current += sizeof(*crc);
+	}
+
 	for (size_t i = 0; i < sm_form->num_objects; i++) {
-		current += sm_write_object(current, &sm_form->obj_list[i]);
+		current += sm_write_object(current, &sm_form->obj_list[i], checksums);
 	}
 
-	form->size = cfr_record_size((char *)form, current);
-	return form->size;
+	const uint32_t size = cfr_record_size((char *)form, current);
+	form->size = cfr_cpu_to_le32(size);
+
+	if (crc) {
+		crc->checksum = cfr_cpu_to_le32(CRC(form, size, crc32_byte));
+	}
+	return size;
 }
 
-static uint32_t sm_write_object(char *current, const struct sm_object *sm_obj)
+static uint32_t sm_write_object(char *current, const struct sm_object *sm_obj, bool checksums)
 {
 	assert(sm_obj);
 
@@ -233,32 +550,431 @@ static uint32_t sm_write_object(char *current, const struct sm_object *sm_obj)
 	case SM_OBJ_COMMENT:
 		return sm_write_opt_comment(current, &sm_obj->sm_comment);
 	case SM_OBJ_FORM:
-		return sm_write_form(current, &sm_obj->sm_form);
+		return sm_write_form(current, &sm_obj->sm_form, checksums);
 	default:
 		fprintf(stderr, "Unknown setup menu object kind %u, ignoring\n", sm_obj->kind);
 		return 0;
 	}
 }
 
+static uint32_t sm_count_forms(const struct sm_obj_form *sm_form, bool nested)
+{
+	uint32_t count = 1;
+
+	for (size_t i = 0; nested && i < sm_form->num_objects; i++) {
+		if (sm_form->obj_list[i].kind == SM_OBJ_FORM) {
+			count += sm_count_forms(&sm_form->obj_list[i].sm_form, nested);
+		}
+	}
+	return count;
+}
+
+/* Lists the forms in `parent` once they have been written, returns the next entry */
+static uint32_t fill_form_directory(const char *blob, struct lb_cfr_form_directory_entry *entries,
+				    uint32_t index, uint32_t parent, uint32_t depth, bool nested)
+{
+	const struct lb_record *rec = (const struct lb_record *)(blob + parent);
+	const uint32_t end = parent + cfr_le32_to_cpu(rec->size);
+
+	uint32_t off = parent + cfr_record_header_size(cfr_le32_to_cpu(rec->tag));
+	while (off < end) {
+		const struct lb_cfr_option_form *form = (const struct lb_cfr_option_form *)(blob + off);
+		if (cfr_le32_to_cpu(form->tag) == LB_TAG_CFR_OPTION_FORM) {
+			entries[index++] = (struct lb_cfr_form_directory_entry) {
+				.object_id	= form->object_id,
+				.offset		= cfr_cpu_to_le32(off),
+				.depth		= cfr_cpu_to_le32(depth),
+			};
+			if (nested) {
+				index = fill_form_directory(blob, entries, index, off, depth + 1, nested);
+			}
+		}
+		off += cfr_le32_to_cpu(form->size);
+	}
+	return index;
+}
+
+/*
+ * Sizes of what the sm_write_*() functions above produce, so that the
+ * output buffer can be allocated up front. These must be kept in sync.
+ */
+static size_t sm_varchar_size(const char *string)
+{
+	return ALIGN_UP(sizeof(struct lb_cfr_varbinary) + strlen(string) + 1, LB_ENTRY_ALIGN);
+}
+
+static size_t sm_helptext_size(const char *string)
+{
+	return string && *string ? sm_varchar_size(string) : 0;
+}
+
+static size_t sm_enum_size(const struct sm_obj_enum *sm_enum)
+{
+	size_t size = sizeof(struct lb_cfr_numeric_option) + sm_varchar_size(sm_enum->opt_name) +
+		      sm_varchar_size(sm_enum->ui_name) + sm_helptext_size(sm_enum->ui_helptext);
+
+	for (const struct sm_enum_range *r = sm_enum->ranges; r && r->label; r++) {
+		size += sizeof(struct lb_cfr_enum_range) + sm_varchar_size(r->label);
+	}
+	for (const struct sm_enum_value *e = sm_enum->values; e && e->ui_name; e++) {
+		size += sizeof(struct lb_cfr_enum_value) + sm_varchar_size(e->ui_name);
+	}
+	return size;
+}
+
+static size_t sm_form_size(const struct sm_obj_form *sm_form, bool checksums);
+
+static size_t sm_object_size(const struct sm_object *sm_obj, bool checksums)
+{
+	switch (sm_obj->kind) {
+	case SM_OBJ_ENUM:
+		return sm_enum_size(&sm_obj->sm_enum);
+	case SM_OBJ_NUMBER: {
+		const struct sm_obj_number *o = &sm_obj->sm_number;
+		return sizeof(struct lb_cfr_numeric_option) + sm_varchar_size(o->opt_name) +
+		       sm_varchar_size(o->ui_name) + sm_helptext_size(o->ui_helptext);
+	}
+	case SM_OBJ_BOOL: {
+		const struct sm_obj_bool *o = &sm_obj->sm_bool;
+		return sizeof(struct lb_cfr_numeric_option) + sm_varchar_size(o->opt_name) +
+		       sm_varchar_size(o->ui_name) + sm_helptext_size(o->ui_helptext);
+	}
+	case SM_OBJ_VARCHAR: {
+		const struct sm_obj_varchar *o = &sm_obj->sm_varchar;
+		return sizeof(struct lb_cfr_varchar_option) + sm_varchar_size(o->default_value) +
+		       sm_varchar_size(o->opt_name) + sm_varchar_size(o->ui_name) +
+		       sm_helptext_size(o->ui_helptext);
+	}
+	case SM_OBJ_COMMENT: {
+		const struct sm_obj_comment *o = &sm_obj->sm_comment;
+		return sizeof(struct lb_cfr_option_comment) + sm_varchar_size(o->ui_name) +
+		       sm_helptext_size(o->ui_helptext);
+	}
+	case SM_OBJ_FORM:
+		return sm_form_size(&sm_obj->sm_form, checksums);
+	default:
+		return 0;
+	}
+}
+
+static size_t sm_form_size(const struct sm_obj_form *sm_form, bool checksums)
+{
+	size_t size = sizeof(struct lb_cfr_option_form) + sm_varchar_size(sm_form->ui_name);
+
+	if (checksums) {
+		size += sizeof(struct lb_cfr_form_checksum);
+	}
+	for (size_t i = 0; i < sm_form->num_objects; i++) {
+		size += sm_object_size(&sm_form->obj_list[i], checksums);
+	}
+	return size;
+}
+
+size_t cfr_setup_menu_size(const struct setup_menu_root *sm_root)
+{
+	size_t size = sizeof(struct lb_cfr);
+
+	if (sm_root->form_directory != CFR_FORM_DIRECTORY_NONE) {
+		const bool nested = sm_root->form_directory == CFR_FORM_DIRECTORY_ALL;
+		size += sizeof(struct lb_cfr_form_directory);
+		for (size_t i = 0; i < sm_root->num_forms; i++) {
+			size += sm_count_forms(&sm_root->form_list[i], nested) *
+				sizeof(struct lb_cfr_form_directory_entry);
+		}
+	}
+	for (size_t i = 0; i < sm_root->num_forms; i++) {
+		size += sm_form_size(&sm_root->form_list[i], sm_root->form_checksums);
+	}
+	return size;
+}
+
 void cfr_write_setup_menu(struct lb_header *header, const struct setup_menu_root *sm_root)
 {
 	assert(sm_root);
 
 	char *current = (char *)lb_new_record(header);
 	struct lb_cfr *menu = (struct lb_cfr *)current;
-	menu->tag = LB_TAG_CFR;
-	menu->size = sizeof(*menu);
+	menu->tag = cfr_cpu_to_le32(LB_TAG_CFR);
+
+	current += sizeof(*menu);
+
+	/* The directory has a fixed size, its entries are filled in at the end */
+	struct lb_cfr_form_directory *directory = NULL;
+	const bool nested = sm_root->form_directory == CFR_FORM_DIRECTORY_ALL;
+	uint32_t num_entries = 0;
+	if (sm_root->form_directory != CFR_FORM_DIRECTORY_NONE) {
+		for (size_t i = 0; i < sm_root->num_forms; i++) {
+			num_entries += sm_count_forms(&sm_root->form_list[i], nested);
+		}
+		directory = (struct lb_cfr_form_directory *)current;
+		const uint32_t size = sizeof(*directory) +
+			num_entries * sizeof(struct lb_cfr_form_directory_entry);
+		directory->tag = cfr_cpu_to_le32(LB_TAG_CFR_FORM_DIRECTORY);
+		directory->size = cfr_cpu_to_le32(size);
+		directory->num_entries = cfr_cpu_to_le32(num_entries);
+		current += size;
+	}
 
-	current += menu->size;
 	for (size_t i = 0; i < sm_root->num_forms; i++) {
-		current += sm_write_form(current, &sm_root->form_list[i]);
+		current += sm_write_form(current, &sm_root->form_list[i], sm_root->form_checksums);
 	}
 
-	menu->size = cfr_record_size((char *)menu, current);
+	const uint32_t size = cfr_record_size((char *)menu, current);
+	menu->size = cfr_cpu_to_le32(size);
+
+	if (directory) {
+		const uint32_t filled = fill_form_directory((char *)menu,
+				(struct lb_cfr_form_directory_entry *)(directory + 1), 0, 0, 0, nested);
+		assert(filled == num_entries);
+	}
 
 	menu->checksum = 0;
-	menu->checksum = CRC(menu, menu->size, crc32_byte);
+	const uint32_t checksum = CRC(menu, size, crc32_byte);
+	menu->checksum = cfr_cpu_to_le32(checksum);
+}
+
+const struct lb_cfr_form_directory *cfr_form_directory(const char *blob)
+{
+	const struct lb_cfr *root = (const struct lb_cfr *)blob;
+	const struct lb_cfr_form_directory *directory =
+		(const struct lb_cfr_form_directory *)(blob + sizeof(*root));
+	const uint32_t root_size = cfr_le32_to_cpu(root->size);
+
+	if (root_size < sizeof(*root) + sizeof(*directory) ||
+	    cfr_le32_to_cpu(directory->tag) != LB_TAG_CFR_FORM_DIRECTORY) {
+		return NULL;
+	}
+
+	const uint32_t size = cfr_le32_to_cpu(directory->size);
+	const uint32_t num_entries = cfr_le32_to_cpu(directory->num_entries);
+	if (size < sizeof(*directory) || size > root_size - sizeof(*root) ||
+	    num_entries > (size - sizeof(*directory)) / sizeof(struct lb_cfr_form_directory_entry)) {
+		return NULL;
+	}
+	return directory;
+}
+
+uint32_t cfr_first_form(const char *blob)
+{
+	const struct lb_cfr_form_directory *directory = cfr_form_directory(blob);
+
+	return sizeof(struct lb_cfr) + (directory ? cfr_le32_to_cpu(directory->size) : 0);
+}
+
+/* Directory entries are only trusted if they point at the form they claim to */
+static bool form_at(const char *blob, uint32_t offset, uint32_t object_id)
+{
+	const uint32_t root_size = cfr_le32_to_cpu(((const struct lb_cfr *)blob)->size);
+	const struct lb_cfr_option_form *form = (const struct lb_cfr_option_form *)(blob + offset);
+
+	return offset >= sizeof(struct lb_cfr) && offset <= root_size - sizeof(*form) &&
+	       IS_ALIGNED(offset, LB_ENTRY_ALIGN) &&
+	       cfr_le32_to_cpu(form->tag) == LB_TAG_CFR_OPTION_FORM &&
+	       cfr_le32_to_cpu(form->object_id) == object_id;
+}
+
+static uint32_t walk_find_form(const char *blob, uint32_t parent, uint32_t object_id)
+{
+	const struct lb_record *rec = (const struct lb_record *)(blob + parent);
+	const uint32_t end = parent + cfr_le32_to_cpu(rec->size);
+
+	uint32_t off = parent + cfr_record_header_size(cfr_le32_to_cpu(rec->tag));
+	while (off < end) {
+		const struct lb_cfr_option_form *form = (const struct lb_cfr_option_form *)(blob + off);
+		const uint32_t size = cfr_le32_to_cpu(form->size);
+		if (size < sizeof(struct lb_record) || size > end - off) {
+			return 0;
+		}
+		if (cfr_le32_to_cpu(form->tag) == LB_TAG_CFR_OPTION_FORM) {
+			if (cfr_le32_to_cpu(form->object_id) == object_id) {
+				return off;
+			}
+			const uint32_t found = walk_find_form(blob, off, object_id);
+			if (found) {
+				return found;
+			}
+		}
+		off += size;
+	}
+	return 0;
+}
+
+uint32_t cfr_find_form(const char *blob, uint32_t object_id)
+{
+	const struct lb_cfr_form_directory *directory = cfr_form_directory(blob);
+
+	if (directory) {
+		const struct lb_cfr_form_directory_entry *entries =
+			(const struct lb_cfr_form_directory_entry *)(directory + 1);
+		const uint32_t num_entries = cfr_le32_to_cpu(directory->num_entries);
+		for (uint32_t i = 0; i < num_entries; i++) {
+			const uint32_t offset = cfr_le32_to_cpu(entries[i].offset);
+			if (cfr_le32_to_cpu(entries[i].object_id) == object_id &&
+			    form_at(blob, offset, object_id)) {
+				return offset;
+			}
+		}
+	}
+	return walk_find_form(blob, 0, object_id);
+}
+
+uint32_t cfr_nth_form(const char *blob, uint32_t index)
+{
+	const struct lb_cfr_form_directory *directory = cfr_form_directory(blob);
+
+	if (directory) {
+		const struct lb_cfr_form_directory_entry *entries =
+			(const struct lb_cfr_form_directory_entry *)(directory + 1);
+		const uint32_t num_entries = cfr_le32_to_cpu(directory->num_entries);
+		for (uint32_t i = 0; i < num_entries; i++) {
+			if (cfr_le32_to_cpu(entries[i].depth)) {
+				continue;
+			}
+			if (!index--) {
+				const uint32_t offset = cfr_le32_to_cpu(entries[i].offset);
+				const uint32_t object_id = cfr_le32_to_cpu(entries[i].object_id);
+				return form_at(blob, offset, object_id) ? offset : 0;
+			}
+		}
+		return 0;
+	}
+
+	const uint32_t end = cfr_le32_to_cpu(((const struct lb_cfr *)blob)->size);
+	for (uint32_t off = sizeof(struct lb_cfr); off < end;) {
+		const struct lb_record *rec = (const struct lb_record *)(blob + off);
+		const uint32_t size = cfr_le32_to_cpu(rec->size);
+		if (size < sizeof(*rec) || size > end - off) {
+			return 0;
+		}
+		if (cfr_le32_to_cpu(rec->tag) == LB_TAG_CFR_OPTION_FORM && !index--) {
+			return off;
+		}
+		off += size;
+	}
+	return 0;
+}
+
+void cfr_form_directory_move(char *blob, uint32_t offset, int32_t delta)
+{
+	struct lb_cfr_form_directory *directory =
+		(struct lb_cfr_form_directory *)cfr_form_directory(blob);
+
+	if (!directory) {
+		return;
+	}
+
+	struct lb_cfr_form_directory_entry *entries =
+		(struct lb_cfr_form_directory_entry *)(directory + 1);
+	const uint32_t num_entries = cfr_le32_to_cpu(directory->num_entries);
+	for (uint32_t i = 0; i < num_entries; i++) {
+		const uint32_t form = cfr_le32_to_cpu(entries[i].offset);
+		if (form > offset) {
+			entries[i].offset = cfr_cpu_to_le32(form + delta);
+		}
+	}
+}
+
+const struct lb_cfr_form_checksum *cfr_form_checksum(const struct lb_cfr_option_form *form)
+{
+	const char *const start = (const char *)form;
+	const uint32_t size = cfr_le32_to_cpu(form->size);
+
+	uint32_t off = sizeof(*form);
+	if (size > off && size - off >= sizeof(struct lb_record)) {
+		const struct lb_record *ui_name = (const struct lb_record *)(start + off);
+		if (cfr_le32_to_cpu(ui_name->tag) == LB_TAG_CFR_VARCHAR_UI_NAME &&
+		    cfr_le32_to_cpu(ui_name->size) <= size - off) {
+			off += cfr_le32_to_cpu(ui_name->size);
+		}
+	}
 
-	printf("CFR: Written %u bytes of CFR structures at %p, with CRC32 0x%08x\n",
-		menu->size, (char *)menu, menu->checksum);
+	const struct lb_cfr_form_checksum *crc = (const struct lb_cfr_form_checksum *)(start + off);
+	if (off > size || size - off < sizeof(*crc) ||
+	    cfr_le32_to_cpu(crc->tag) != LB_TAG_CFR_FORM_CHECKSUM ||
+	    cfr_le32_to_cpu(crc->size) != sizeof(*crc)) {
+		return NULL;
+	}
+	return crc;
+}
+
+/* The CRC of the form as if its checksum field at `field` was 0 */
+static uint32_t form_crc(const struct lb_cfr_option_form *form, const uint32_t *field)
+{
+	static const uint8_t zero[sizeof(*field)];
+	const uint8_t *const start = (const uint8_t *)form;
+	const uint8_t *const rest = (const uint8_t *)(field + 1);
+
+	uint32_t result = crc32_continue(0, start, (const uint8_t *)field - start);
+	result = crc32_continue(result, zero, sizeof(zero));
+	return crc32_continue(result, rest, start + cfr_le32_to_cpu(form->size) - rest);
+}
+
+uint32_t cfr_form_crc32(const struct lb_cfr_option_form *form)
+{
+	const uint32_t size = cfr_le32_to_cpu(form->size);
+	const struct lb_cfr_form_checksum *crc = cfr_form_checksum(form);
+	if (!crc) {
+		return CRC(form, size, crc32_byte);
+	}
+
+	/* The CRC32 is linear, so the stored field is simply added on top */
+	const uint8_t *const field_end = (const uint8_t *)(&crc->checksum + 1);
+	const uint32_t field = CRC(&crc->checksum, sizeof(crc->checksum), crc32_byte);
+	return cfr_le32_to_cpu(crc->checksum) ^
+	       cfr_crc32_combine(field, 0, (const uint8_t *)form + size - field_end);
+}
+
+int cfr_check_form(const struct lb_cfr_option_form *form)
+{
+	const struct lb_cfr_form_checksum *crc = cfr_form_checksum(form);
+	if (!crc) {
+		return 0;
+	}
+
+	const uint32_t expected = cfr_le32_to_cpu(crc->checksum);
+	const uint32_t actual = form_crc(form, &crc->checksum);
+	if (actual == expected) {
+		return 0;
+	}
+
+	/* The name is as likely to be corrupt as anything else in the form */
+	const char *ui_name = child_string((const char *)form, sizeof(*form),
+					   LB_TAG_CFR_VARCHAR_UI_NAME);
+	fprintf(stderr, "Form %u '%s' is corrupt: CRC32 is 0x%08x, expected 0x%08x\n",
+		cfr_le32_to_cpu(form->object_id), ui_name, actual, expected);
+	return -1;
+}
+
+static void update_form_checksums(char *blob, uint32_t parent, uint32_t offset)
+{
+	const struct lb_record *rec = (const struct lb_record *)(blob + parent);
+	const uint32_t end = parent + cfr_le32_to_cpu(rec->size);
+
+	uint32_t off = parent + cfr_record_header_size(cfr_le32_to_cpu(rec->tag));
+	while (off < end) {
+		struct lb_cfr_option_form *form = (struct lb_cfr_option_form *)(blob + off);
+		const uint32_t size = cfr_le32_to_cpu(form->size);
+		if (size < sizeof(struct lb_record) || size > end - off) {
+			return;
+		}
+		if (offset >= off && offset - off < size) {
+			if (cfr_le32_to_cpu(form->tag) != LB_TAG_CFR_OPTION_FORM) {
+				return;
+			}
+			update_form_checksums(blob, off, offset);
+
+			struct lb_cfr_form_checksum *crc =
+				(struct lb_cfr_form_checksum *)cfr_form_checksum(form);
+			if (crc) {
+				crc->checksum = cfr_cpu_to_le32(form_crc(form, &crc->checksum));
+			}
+			return;
+		}
+		off += size;
+	}
+}
+
+void cfr_update_form_checksums(char *blob, uint32_t offset)
+{
+	update_form_checksums(blob, 0, offset);
 }
@@ -23,10 +23,33 @@ enum {
 	LB_TAG_CFR_VARCHAR_UI_HELPTEXT	= 0x0109,
 	LB_TAG_CFR_VARCHAR_DEF_VALUE	= 0x010a,
 	LB_TAG_CFR_OPTION_COMMENT	= 0x010b,
+	LB_TAG_CFR_COMPRESSED		= 0x010c,
+	LB_TAG_CFR_FORM_DIRECTORY	= 0x010d,
+	LB_TAG_CFR_FORM_CHECKSUM	= 0x010e,
+	LB_TAG_CFR_ENUM_RANGE		= 0x010f,
 };
 
 #define LB_ENTRY_ALIGN 4
 
+/*
+ * CFR data is always little-endian, including the checksum. The structs
+ * below overlay it directly, so every field must go through these when
+ * read or written. They are no-ops on little-endian hosts.
+ */
+static inline uint32_t cfr_le32_to_cpu(uint32_t value)
+{
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+	return __builtin_bswap32(value);
+#else
+	return value;
+#endif
+}
+
+static inline uint32_t cfr_cpu_to_le32(uint32_t value)
+{
+	return cfr_le32_to_cpu(value);
+}
+
 /* Not the real thing */
 struct lb_header {
 	char *buffer;
@@ -52,6 +75,17 @@ struct sm_enum_value {
 
 #define SM_ENUM_VALUE_END	((struct sm_enum_value) {0})
 
+/* `count` values from `start` on, every `step`, see struct lb_cfr_enum_range */
+struct sm_enum_range {
+	const char *label;
+	uint32_t start;
+	uint32_t count;
+	uint32_t step;
+	uint32_t decimals;
+};
+
+#define SM_ENUM_RANGE_END	((struct sm_enum_range) {0})
+
 struct sm_obj_enum {
 	uint32_t object_id;
 	uint32_t flags;
@@ -59,6 +93,7 @@ struct sm_obj_enum {
 	const char *ui_name;
 	const char *ui_helptext;
 	uint32_t default_value;
+	const struct sm_enum_range *ranges;	/* Come before the values */
 	const struct sm_enum_value *values;
 };
 
@@ -128,14 +163,130 @@ struct sm_object {
 	};
 };
 
+enum cfr_form_directory_mode {
+	CFR_FORM_DIRECTORY_NONE = 0,
+	CFR_FORM_DIRECTORY_TOP_LEVEL,	/* Only forms directly in the root record */
+	CFR_FORM_DIRECTORY_ALL,		/* Nested forms too */
+};
+
 /* The top-level form */
 struct setup_menu_root {
 	const struct sm_obj_form *form_list;
 	size_t num_forms;
+	enum cfr_form_directory_mode form_directory;
+	bool form_checksums;	/* Give every form its own CRC */
 };
 
 void cfr_write_setup_menu(struct lb_header *header, const struct setup_menu_root *sm_root);
 
+/* The exact number of bytes cfr_write_setup_menu() writes for `sm_root` */
+size_t cfr_setup_menu_size(const struct setup_menu_root *sm_root);
+
+/* The CRC32 flavour used for `lb_cfr.checksum` */
+uint32_t cfr_crc32(const void *buf, size_t size);
+
+/* The CRC32 of `a` followed by `b`, from the CRC32 of both and the length of `b` */
+uint32_t cfr_crc32_combine(uint32_t crc_a, uint32_t crc_b, size_t len_b);
+
+/*
+ * Whether the root checksum matches the blob, which must hold the whole
+ * root record. The blob is not modified, so it can be mapped read-only.
+ */
+bool cfr_root_checksum_ok(const char *blob);
+
+/* Size of the fixed-length part of a record, or 0 for records without children */
+size_t cfr_record_header_size(uint32_t tag);
+
+/* Returns the form directory of the blob, or NULL if it has none */
+const struct lb_cfr_form_directory *cfr_form_directory(const char *blob);
+
+/* Offset of the first form in the root record, after the directory if any */
+uint32_t cfr_first_form(const char *blob);
+
+/*
+ * Returns the offset of the form with `object_id`, or 0 if there is none.
+ * Only the directory is searched if it lists the form, otherwise this
+ * walks the records of every form before it.
+ */
+uint32_t cfr_find_form(const char *blob, uint32_t object_id);
+
+/* Returns the offset of the `index`th top-level form, or 0 if there is none */
+uint32_t cfr_nth_form(const char *blob, uint32_t index);
+
+/* Moves the offsets of all forms after `offset` when a record before them changes size */
+void cfr_form_directory_move(char *blob, uint32_t offset, int32_t delta);
+
+struct lb_cfr_option_form;
+
+/* Returns the CRC record of the form, or NULL if it has none */
+const struct lb_cfr_form_checksum *cfr_form_checksum(const struct lb_cfr_option_form *form);
+
+/*
+ * The CRC32 of the whole form record as stored, for combining it into
+ * the checksum of a new root. If the form has a CRC record, this comes
+ * from there without reading the rest of the form.
+ */
+uint32_t cfr_form_crc32(const struct lb_cfr_option_form *form);
+
+/*
+ * Checks the CRC of a single form, without looking at the rest of the
+ * blob. Forms without a CRC record always pass. On a mismatch, prints
+ * which form is corrupt and returns -1.
+ */
+int cfr_check_form(const struct lb_cfr_option_form *form);
+
+/*
+ * Recomputes the CRC of every form containing `offset`, innermost first,
+ * after something in it changed. The root checksum is left alone.
+ */
+void cfr_update_form_checksums(char *blob, uint32_t offset);
+
+struct lb_cfr_enum_range;
+struct lb_cfr_numeric_option;
+
+/* Longest UI name cfr_enum_range_label() produces, including the NUL */
+#define CFR_ENUM_LABEL_MAX	128
+
+/* Most values in one range, readers refuse to expand larger ones */
+#define CFR_ENUM_RANGE_MAX	4096
+
+/*
+ * Whether a range has no more than CFR_ENUM_RANGE_MAX values, the last of
+ * which still fits in 32 bits. The writer, the renderer and the linter
+ * only accept ranges that do.
+ */
+bool cfr_enum_range_fits(uint32_t start, uint32_t count, uint32_t step);
+
+/* Value number `index` of the range, which must be less than its count */
+uint32_t cfr_enum_range_value(const struct lb_cfr_enum_range *range, uint32_t index);
+
+/* Writes the UI name of value number `index` of the range to `buf` */
+void cfr_enum_range_label(const struct lb_cfr_enum_range *range, uint32_t index,
+			  char buf[CFR_ENUM_LABEL_MAX]);
+
+/* Whether `value` is one of the values of an enum option, listed or in a range */
+bool cfr_enum_has_value(const struct lb_cfr_numeric_option *option, uint32_t value);
+
+/*
+ * Iterates over the values of an enum option in order, expanding ranges
+ * on the fly:
+ *
+ *	struct cfr_enum_iter it;
+ *	for (cfr_enum_iter_init(&it, option); cfr_enum_iter_next(&it);)
+ *		use(it.value, it.ui_name);
+ */
+struct cfr_enum_iter {
+	const char *current;
+	const char *limit;
+	uint32_t index;		/* Next value in the range at `current` */
+	uint32_t value;
+	const char *ui_name;	/* Only valid until the next call */
+	char label[CFR_ENUM_LABEL_MAX];
+};
+
+void cfr_enum_iter_init(struct cfr_enum_iter *it, const struct lb_cfr_numeric_option *option);
+bool cfr_enum_iter_next(struct cfr_enum_iter *it);
+
 /* Back-end */
 struct lb_cfr_varbinary {
 	uint32_t tag;		/* Any CFR_VARBINARY or CFR_VARCHAR */
@@ -169,6 +320,25 @@ struct lb_cfr_enum_value {
 	 */
 };
 
+/*
+ * Stands for `count` enum values, `start`, `start + step` and so on, so
+ * that long computed lists take a few dozen bytes. Their UI names come
+ * from the label format: "%v" is replaced by the value as a decimal
+ * number with `decimals` digits after the point, and "%%" by a single
+ * '%'. Everything else is copied as is.
+ */
+struct lb_cfr_enum_range {
+	uint32_t tag;		/* CFR_ENUM_RANGE */
+	uint32_t size;
+	uint32_t start;
+	uint32_t count;
+	uint32_t step;
+	uint32_t decimals;	/* At most 9 */
+	/*
+	 * CFR_UI_NAME label
+	 */
+};
+
 /* Supports multiple option types: ENUM, NUMBER, BOOL */
 struct lb_cfr_numeric_option {
 	uint32_t tag;		/* CFR_OPTION_ENUM, CFR_OPTION_NUMBER, CFR_OPTION_BOOL */
@@ -181,6 +351,7 @@ struct lb_cfr_numeric_option {
 	 * CFR_VARCHAR_UI_NAME		ui_name
 	 * CFR_VARCHAR_UI_HELPTEXT	ui_helptext (Optional)
 	 * CFR_ENUM_VALUE		enum_values[]
+	 *   or CFR_ENUM_RANGE
 	 */
 };
 
@@ -221,10 +392,22 @@ struct lb_cfr_option_form {
 	uint32_t flags;		/* enum cfr_option_flags */
 	/*
 	 * CFR_UI_NAME		ui_name
+	 * CFR_FORM_CHECKSUM	checksum (Optional)
 	 * <T in CFR_OPTION>	options[]
 	 */
 };
 
+/*
+ * Covers the whole form record that contains it, nested forms included,
+ * with this checksum field set to 0. It uses the same CRC32 as the root
+ * record, so a form can be validated on its own, once it gets opened.
+ */
+struct lb_cfr_form_checksum {
+	uint32_t tag;		/* CFR_FORM_CHECKSUM */
+	uint32_t size;
+	uint32_t checksum;
+};
+
 struct lb_cfr {
 	uint32_t tag;
 	uint32_t size;
@@ -232,4 +415,57 @@ struct lb_cfr {
 	/* CFR_FORM forms[] */
 };
 
+/*
+ * Optional list of forms, which must be the first record in the root if
+ * present. It lets readers seek to a form instead of walking the sizes
+ * of every record before it. Entries are in the order of the forms in
+ * the blob, so depth-first for nested ones, and the offsets count from
+ * the start of the root record.
+ */
+struct lb_cfr_form_directory {
+	uint32_t tag;		/* CFR_FORM_DIRECTORY */
+	uint32_t size;
+	uint32_t num_entries;
+	/*
+	 * struct lb_cfr_form_directory_entry entries[]
+	 */
+};
+
+struct lb_cfr_form_directory_entry {
+	uint32_t object_id;
+	uint32_t offset;	/* Of the CFR_OPTION_FORM record */
+	uint32_t depth;		/* 0 for top-level forms */
+};
+
+enum cfr_compression {
+	CFR_COMPRESSION_NONE	= 0,
+	CFR_COMPRESSION_LZ	= 1,	/* See cfr_lz.h */
+};
+
+/*
+ * Optional wrapper around a whole CFR blob, root record included. The
+ * data is split into chunks which are decompressed one after the other
+ * into a single buffer, so that only one chunk needs to be in memory.
+ * The root record fields are copied here, to avoid decompressing when
+ * only those are needed.
+ */
+struct lb_cfr_compressed {
+	uint32_t tag;		/* CFR_COMPRESSED */
+	uint32_t size;
+	uint32_t algorithm;	/* enum cfr_compression */
+	uint32_t data_size;	/* Once decompressed */
+	uint32_t root_size;
+	uint32_t root_checksum;
+	/*
+	 * struct lb_cfr_compressed_chunk chunks[]
+	 * Padding up to LB_ENTRY_ALIGN
+	 */
+};
+
+struct lb_cfr_compressed_chunk {
+	uint32_t compressed_size;	/* Same as data_size if stored as is */
+	uint32_t data_size;
+	uint8_t data[];
+};
+
 #endif	/* DRIVERS_OPTION_CFR_H */
@@ -0,0 +1,462 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+
+#include <stdalign.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cfr.h"
+#include "cfr_builder.h"
+
+#define ALIGN_UP(x, a)		(((x) + ((a) - 1)) & ~((__typeof__(x))(a) - 1))
+
+#define ARENA_BLOCK_SIZE	(64 * 1024)
+
+struct arena_block {
+	struct arena_block *next;
+	size_t used;
+	size_t size;
+	max_align_t data[];
+};
+
+struct builder_value {
+	struct sm_enum_value value;
+	struct builder_value *next;
+};
+
+/*
+ * Objects are kept as linked lists while the menu is being built, and
+ * only turned into the arrays of the front-end structures when it gets
+ * finished, once the number of children of every form is known.
+ */
+struct builder_object {
+	enum sm_object_kind kind;
+	union {
+		struct sm_obj_enum sm_enum;
+		struct sm_obj_number sm_number;
+		struct sm_obj_bool sm_bool;
+		struct sm_obj_varchar sm_varchar;
+		struct sm_obj_comment sm_comment;
+		struct sm_obj_form sm_form;
+	};
+	struct builder_object *next;		/* In the same form */
+
+	/* Forms */
+	struct builder_object *parent;		/* NULL for top-level forms */
+	struct builder_object *first_child;
+	struct builder_object *last_child;
+
+	/* Enums */
+	struct builder_value *first_value;
+	struct builder_value *last_value;
+	size_t num_values;
+};
+
+struct cfr_builder {
+	struct arena_block *blocks;		/* The newest one first */
+
+	struct builder_object *first_form;
+	struct builder_object *last_form;
+	struct builder_object *open_form;	/* Innermost form not ended yet */
+	struct builder_object *last_enum;
+};
+
+static void *arena_alloc(struct cfr_builder *builder, size_t size)
+{
+	size = ALIGN_UP(size, alignof(max_align_t));
+
+	struct arena_block *block = builder->blocks;
+	if (!block || block->size - block->used < size) {
+		size_t block_size = block ? block->size * 2 : ARENA_BLOCK_SIZE;
+		while (block_size < size) {
+			block_size *= 2;
+		}
+		block = malloc(sizeof(*block) + block_size);
+		if (!block) {
+			fprintf(stderr, "Could not allocate %zu bytes for the menu builder\n",
+				block_size);
+			return NULL;
+		}
+		block->next = builder->blocks;
+		block->used = 0;
+		block->size = block_size;
+		builder->blocks = block;
+	}
+
+	void *ptr = (char *)block->data + block->used;
+	block->used += size;
+	return ptr;
+}
+
+/* Copies `str` into the arena. Returns false if that fails, or if `str` is NULL but required. */
+static bool arena_strdup(struct cfr_builder *builder, const char **str, bool required,
+			 const char *what)
+{
+	if (!*str) {
+		if (required) {
+			fprintf(stderr, "Menu builder: %s is missing\n", what);
+		}
+		return !required;
+	}
+	const size_t len = strlen(*str) + 1;
+	char *copy = arena_alloc(builder, len);
+	if (!copy) {
+		return false;
+	}
+	memcpy(copy, *str, len);
+	*str = copy;
+	return true;
+}
+
+struct cfr_builder *cfr_builder_new(void)
+{
+	struct cfr_builder *builder = calloc(1, sizeof(*builder));
+	if (!builder) {
+		fprintf(stderr, "Could not allocate menu builder\n");
+	}
+	return builder;
+}
+
+void cfr_builder_free(struct cfr_builder *builder)
+{
+	if (!builder) {
+		return;
+	}
+	while (builder->blocks) {
+		struct arena_block *next = builder->blocks->next;
+		free(builder->blocks);
+		builder->blocks = next;
+	}
+	free(builder);
+}
+
+static struct builder_object *new_object(struct cfr_builder *builder, enum sm_object_kind kind)
+{
+	struct builder_object *obj = arena_alloc(builder, sizeof(*obj));
+	if (obj) {
+		memset(obj, 0, sizeof(*obj));
+		obj->kind = kind;
+	}
+	return obj;
+}
+
+static void link_object(struct cfr_builder *builder, struct builder_object *obj)
+{
+	struct builder_object *parent = builder->open_form;
+	struct builder_object **last = parent ? &parent->last_child : &builder->last_form;
+	struct builder_object **first = parent ? &parent->first_child : &builder->first_form;
+
+	if (*last) {
+		(*last)->next = obj;
+	} else {
+		*first = obj;
+	}
+	*last = obj;
+}
+
+/* Options need a form to go into, only forms can be at the top level */
+static struct builder_object *new_option(struct cfr_builder *builder, enum sm_object_kind kind)
+{
+	if (!builder->open_form) {
+		fprintf(stderr, "Menu builder: options must be added to a form\n");
+		return NULL;
+	}
+	return new_object(builder, kind);
+}
+
+int cfr_builder_form_begin(struct cfr_builder *builder, uint32_t object_id, uint32_t flags,
+			   const char *ui_name)
+{
+	struct builder_object *form = new_object(builder, SM_OBJ_FORM);
+	if (!form || !arena_strdup(builder, &ui_name, true, "form UI name")) {
+		return -1;
+	}
+	form->sm_form = (struct sm_obj_form) {
+		.object_id	= object_id,
+		.flags		= flags,
+		.ui_name	= ui_name,
+	};
+	form->parent = builder->open_form;
+	link_object(builder, form);
+	builder->open_form = form;
+	return 0;
+}
+
+int cfr_builder_form_end(struct cfr_builder *builder)
+{
+	if (!builder->open_form) {
+		fprintf(stderr, "Menu builder: no form to end\n");
+		return -1;
+	}
+	builder->open_form = builder->open_form->parent;
+	return 0;
+}
+
+int cfr_builder_add_enum_value(struct cfr_builder *builder, const char *ui_name, uint32_t value)
+{
+	struct builder_object *obj = builder->last_enum;
+	if (!obj) {
+		fprintf(stderr, "Menu builder: no enum to add value %u to\n", value);
+		return -1;
+	}
+
+	struct builder_value *v = arena_alloc(builder, sizeof(*v));
+	if (!v || !arena_strdup(builder, &ui_name, true, "enum value UI name")) {
+		return -1;
+	}
+	*v = (struct builder_value) {
+		.value = { .ui_name = ui_name, .value = value },
+	};
+	if (obj->last_value) {
+		obj->last_value->next = v;
+	} else {
+		obj->first_value = v;
+	}
+	obj->last_value = v;
+	obj->num_values++;
+	return 0;
+}
+
+int cfr_builder_add_enum(struct cfr_builder *builder, const struct sm_obj_enum *sm_enum)
+{
+	for (const struct sm_enum_range *r = sm_enum->ranges; r && r->label; r++) {
+		if (!cfr_enum_range_fits(r->start, r->count, r->step)) {
+			fprintf(stderr, "Enum range '%s' of %u values from %u every %u does not fit\n",
+				r->label, r->count, r->start, r->step);
+			return -1;
+		}
+	}
+
+	struct builder_object *obj = new_option(builder, SM_OBJ_ENUM);
+	if (!obj) {
+		return -1;
+	}
+	obj->sm_enum = *sm_enum;
+	obj->sm_enum.values = NULL;
+	if (!arena_strdup(builder, &obj->sm_enum.opt_name, true, "enum option name") ||
+	    !arena_strdup(builder, &obj->sm_enum.ui_name, true, "enum UI name") ||
+	    !arena_strdup(builder, &obj->sm_enum.ui_helptext, false, NULL)) {
+		return -1;
+	}
+
+	/* Ranges are final, so they can be copied as an array right away */
+	size_t num_ranges = 0;
+	while (sm_enum->ranges && sm_enum->ranges[num_ranges].label) {
+		num_ranges++;
+	}
+	if (num_ranges) {
+		struct sm_enum_range *ranges =
+			arena_alloc(builder, (num_ranges + 1) * sizeof(*ranges));
+		if (!ranges) {
+			return -1;
+		}
+		for (size_t i = 0; i < num_ranges; i++) {
+			ranges[i] = sm_enum->ranges[i];
+			if (!arena_strdup(builder, &ranges[i].label, true, "enum range label")) {
+				return -1;
+			}
+		}
+		ranges[num_ranges] = SM_ENUM_RANGE_END;
+		obj->sm_enum.ranges = ranges;
+	}
+
+	link_object(builder, obj);
+	builder->last_enum = obj;
+
+	for (const struct sm_enum_value *e = sm_enum->values; e && e->ui_name; e++) {
+		if (cfr_builder_add_enum_value(builder, e->ui_name, e->value)) {
+			return -1;
+		}
+	}
+	return 0;
+}
+
+int cfr_builder_add_number(struct cfr_builder *builder, const struct sm_obj_number *sm_number)
+{
+	struct builder_object *obj = new_option(builder, SM_OBJ_NUMBER);
+	if (!obj) {
+		return -1;
+	}
+	obj->sm_number = *sm_number;
+	if (!arena_strdup(builder, &obj->sm_number.opt_name, true, "number option name") ||
+	    !arena_strdup(builder, &obj->sm_number.ui_name, true, "number UI name") ||
+	    !arena_strdup(builder, &obj->sm_number.ui_helptext, false, NULL)) {
+		return -1;
+	}
+	link_object(builder, obj);
+	return 0;
+}
+
+int cfr_builder_add_bool(struct cfr_builder *builder, const struct sm_obj_bool *sm_bool)
+{
+	struct builder_object *obj = new_option(builder, SM_OBJ_BOOL);
+	if (!obj) {
+		return -1;
+	}
+	obj->sm_bool = *sm_bool;
+	if (!arena_strdup(builder, &obj->sm_bool.opt_name, true, "bool option name") ||
+	    !arena_strdup(builder, &obj->sm_bool.ui_name, true, "bool UI name") ||
+	    !arena_strdup(builder, &obj->sm_bool.ui_helptext, false, NULL)) {
+		return -1;
+	}
+	link_object(builder, obj);
+	return 0;
+}
+
+int cfr_builder_add_varchar(struct cfr_builder *builder, const struct sm_obj_varchar *sm_varchar)
+{
+	struct builder_object *obj = new_option(builder, SM_OBJ_VARCHAR);
+	if (!obj) {
+		return -1;
+	}
+	obj->sm_varchar = *sm_varchar;
+	if (!arena_strdup(builder, &obj->sm_varchar.opt_name, true, "varchar option name") ||
+	    !arena_strdup(builder, &obj->sm_varchar.ui_name, true, "varchar UI name") ||
+	    !arena_strdup(builder, &obj->sm_varchar.ui_helptext, false, NULL) ||
+	    !arena_strdup(builder, &obj->sm_varchar.default_value, true, "varchar default")) {
+		return -1;
+	}
+	link_object(builder, obj);
+	return 0;
+}
+
+int cfr_builder_add_comment(struct cfr_builder *builder, const struct sm_obj_comment *sm_comment)
+{
+	struct builder_object *obj = new_option(builder, SM_OBJ_COMMENT);
+	if (!obj) {
+		return -1;
+	}
+	obj->sm_comment = *sm_comment;
+	if (!arena_strdup(builder, &obj->sm_comment.ui_name, true, "comment UI name") ||
+	    !arena_strdup(builder, &obj->sm_comment.ui_helptext, false, NULL)) {
+		return -1;
+	}
+	link_object(builder, obj);
+	return 0;
+}
+
+static int finish_enum(struct cfr_builder *builder, struct builder_object *obj)
+{
+	struct sm_enum_value *values = arena_alloc(builder, (obj->num_values + 1) * sizeof(*values));
+	if (!values) {
+		return -1;
+	}
+	size_t i = 0;
+	for (const struct builder_value *v = obj->first_value; v; v = v->next) {
+		values[i++] = v->value;
+	}
+	values[i] = SM_ENUM_VALUE_END;
+	obj->sm_enum.values = values;
+	return 0;
+}
+
+static struct sm_object to_sm_object(const struct builder_object *obj)
+{
+	switch (obj->kind) {
+	case SM_OBJ_ENUM:
+		return (struct sm_object) { .kind = SM_OBJ_ENUM, .sm_enum = obj->sm_enum };
+	case SM_OBJ_NUMBER:
+		return (struct sm_object) { .kind = SM_OBJ_NUMBER, .sm_number = obj->sm_number };
+	case SM_OBJ_BOOL:
+		return (struct sm_object) { .kind = SM_OBJ_BOOL, .sm_bool = obj->sm_bool };
+	case SM_OBJ_VARCHAR:
+		return (struct sm_object) { .kind = SM_OBJ_VARCHAR, .sm_varchar = obj->sm_varchar };
+	case SM_OBJ_COMMENT:
+		return (struct sm_object) { .kind = SM_OBJ_COMMENT, .sm_comment = obj->sm_comment };
+	default:
+		return (struct sm_object) { .kind = SM_OBJ_FORM, .sm_form = obj->sm_form };
+	}
+}
+
+/* Fills in the object list of the form, and of all forms in it */
+static int finish_form(struct cfr_builder *builder, struct builder_object *form)
+{
+	size_t num_objects = 0;
+	for (const struct builder_object *obj = form->first_child; obj; obj = obj->next) {
+		num_objects++;
+	}
+
+	struct sm_object *objects = arena_alloc(builder, num_objects * sizeof(*objects));
+	if (num_objects && !objects) {
+		return -1;
+	}
+
+	size_t i = 0;
+	for (struct builder_object *obj = form->first_child; obj; obj = obj->next) {
+		if (obj->kind == SM_OBJ_ENUM && finish_enum(builder, obj)) {
+			return -1;
+		}
+		if (obj->kind == SM_OBJ_FORM && finish_form(builder, obj)) {
+			return -1;
+		}
+
+		/* The union members of struct sm_object are const, so it cannot be assigned */
+		const struct sm_object object = to_sm_object(obj);
+		memcpy(&objects[i++], &object, sizeof(object));
+	}
+
+	form->sm_form.obj_list = objects;
+	form->sm_form.num_objects = num_objects;
+	return 0;
+}
+
+int cfr_builder_finish(struct cfr_builder *builder, enum cfr_form_directory_mode form_directory,
+		       bool form_checksums, char **blob, size_t *size)
+{
+	if (builder->open_form) {
+		fprintf(stderr, "Menu builder: form %u was not ended\n",
+			builder->open_form->sm_form.object_id);
+		return -1;
+	}
+
+	size_t num_forms = 0;
+	for (const struct builder_object *form = builder->first_form; form; form = form->next) {
+		num_forms++;
+	}
+	struct sm_obj_form *forms = arena_alloc(builder, num_forms * sizeof(*forms));
+	if (num_forms && !forms) {
+		return -1;
+	}
+	size_t i = 0;
+	for (struct builder_object *form = builder->first_form; form; form = form->next) {
+		if (finish_form(builder, form)) {
+			return -1;
+		}
+		forms[i++] = form->sm_form;
+	}
+
+	const struct setup_menu_root sm_root = {
+		.form_list	= forms,
+		.num_forms	= num_forms,
+		.form_directory	= form_directory,
+		.form_checksums	= form_checksums,
+	};
+	const size_t length = cfr_setup_menu_size(&sm_root);
+	if (length > UINT32_MAX) {
+		fprintf(stderr, "Menu builder: menu of %zu bytes is too large\n", length);
+		return -1;
+	}
+
+	/* The writer skips over padding, so the buffer has to start out zeroed */
+	char *buffer = calloc(1, length);
+	if (!buffer) {
+		fprintf(stderr, "Could not allocate %zu bytes for the menu\n", length);
+		return -1;
+	}
+	struct lb_header header = { .buffer = buffer };
+	cfr_write_setup_menu(&header, &sm_root);
+
+	if (cfr_le32_to_cpu(((const struct lb_cfr *)buffer)->size) != length) {
+		fprintf(stderr, "Menu builder: wrote %u bytes instead of %zu\n",
+			cfr_le32_to_cpu(((const struct lb_cfr *)buffer)->size), length);
+		free(buffer);
+		return -1;
+	}
+
+	*blob = buffer;
+	*size = length;
+	return 0;
+}
@@ -0,0 +1,61 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+
+#ifndef CFR_BUILDER_H
+#define CFR_BUILDER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "cfr.h"
+
+/*
+ * Builds a setup menu at runtime, for menus that are generated from data
+ * rather than written out as const aggregates. Forms are opened and
+ * closed like scopes, and options are added to the innermost open form:
+ *
+ *	cfr_builder_form_begin(b, 1, 0, "Main");
+ *	cfr_builder_add_bool(b, &(struct sm_obj_bool) { ... });
+ *	cfr_builder_form_end(b);
+ *	cfr_builder_finish(b, CFR_FORM_DIRECTORY_NONE, false, &blob, &size);
+ *
+ * Every object, value list and string is copied into an arena owned by
+ * the builder, so callers can pass temporaries and computed strings and
+ * free nothing but the builder itself. The arena grows in large blocks,
+ * so even menus with tens of thousands of options take a handful of
+ * allocations.
+ *
+ * All functions return -1 and print why on errors, for example options
+ * outside of any form or missing names.
+ */
+
+struct cfr_builder;
+
+struct cfr_builder *cfr_builder_new(void);
+void cfr_builder_free(struct cfr_builder *builder);
+
+int cfr_builder_form_begin(struct cfr_builder *builder, uint32_t object_id, uint32_t flags,
+			   const char *ui_name);
+int cfr_builder_form_end(struct cfr_builder *builder);
+
+/*
+ * The `values` and `ranges` of the enum are copied too. Ranges must pass
+ * cfr_enum_range_fits().
+ */
+int cfr_builder_add_enum(struct cfr_builder *builder, const struct sm_obj_enum *sm_enum);
+/* Appends a value to the last enum added, after the ones it was added with */
+int cfr_builder_add_enum_value(struct cfr_builder *builder, const char *ui_name, uint32_t value);
+int cfr_builder_add_number(struct cfr_builder *builder, const struct sm_obj_number *sm_number);
+int cfr_builder_add_bool(struct cfr_builder *builder, const struct sm_obj_bool *sm_bool);
+int cfr_builder_add_varchar(struct cfr_builder *builder, const struct sm_obj_varchar *sm_varchar);
+int cfr_builder_add_comment(struct cfr_builder *builder, const struct sm_obj_comment *sm_comment);
+
+/*
+ * Writes the menu into a newly allocated buffer of exactly its size, to
+ * be freed by the caller. All forms must have been ended. The builder
+ * is left as it was, so it can be finished again with other options.
+ */
+int cfr_builder_finish(struct cfr_builder *builder, enum cfr_form_directory_mode form_directory,
+		       bool form_checksums, char **blob, size_t *size);
+
+#endif	/* CFR_BUILDER_H */
@@ -0,0 +1,526 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cfr.h"
+#include "cfr_delta.h"
+
+#define CFR_DELTA_HEADER_SIZE	(CFR_DELTA_MAGIC_LEN + 4 * sizeof(uint32_t))
+#define CFR_DELTA_MAX_DEPTH	32
+
+/* Copies shorter than this cost about as much as the literal bytes */
+#define MIN_COPY		8
+
+bool cfr_is_delta(const void *data, size_t len)
+{
+	return len >= CFR_DELTA_MAGIC_LEN && !memcmp(data, CFR_DELTA_MAGIC, CFR_DELTA_MAGIC_LEN);
+}
+
+static const struct lb_record *record_at(const char *blob, uint32_t offset)
+{
+	return (const struct lb_record *)(blob + offset);
+}
+
+static uint32_t record_tag(const char *blob, uint32_t offset)
+{
+	return cfr_le32_to_cpu(record_at(blob, offset)->tag);
+}
+
+static uint32_t record_size(const char *blob, uint32_t offset)
+{
+	return cfr_le32_to_cpu(record_at(blob, offset)->size);
+}
+
+/* Records with an object ID, the root and enum values are the exception */
+static bool is_object(uint32_t tag)
+{
+	return tag != LB_TAG_CFR && tag != LB_TAG_CFR_ENUM_VALUE && tag != LB_TAG_CFR_ENUM_RANGE &&
+	       cfr_record_header_size(tag);
+}
+
+static uint32_t object_id(const char *blob, uint32_t offset)
+{
+	/* All object records start with the same fields as a form */
+	return cfr_le32_to_cpu(((const struct lb_cfr_option_form *)record_at(blob, offset))->object_id);
+}
+
+/* Checks the size of every record once, so that nothing else needs to */
+static int check_records(const char *blob, uint32_t parent, unsigned int depth)
+{
+	const uint32_t end = parent + record_size(blob, parent);
+
+	if (depth > CFR_DELTA_MAX_DEPTH) {
+		fprintf(stderr, "Records nested too deep at offset 0x%x\n", parent);
+		return -1;
+	}
+	for (uint32_t off = parent + cfr_record_header_size(record_tag(blob, parent)); off < end;) {
+		const uint32_t remaining = end - off;
+		if (remaining < sizeof(struct lb_record)) {
+			fprintf(stderr, "Truncated record at offset 0x%x\n", off);
+			return -1;
+		}
+		const uint32_t size = record_size(blob, off);
+		if (size < sizeof(struct lb_record) || size > remaining || size % LB_ENTRY_ALIGN ||
+		    size < cfr_record_header_size(record_tag(blob, off))) {
+			fprintf(stderr, "Bad size %u of record at offset 0x%x\n", size, off);
+			return -1;
+		}
+		if (cfr_record_header_size(record_tag(blob, off)) &&
+		    check_records(blob, off, depth + 1)) {
+			return -1;
+		}
+		off += size;
+	}
+	return 0;
+}
+
+static int check_blob(const char *blob, const char *what)
+{
+	const struct lb_cfr *root = (const struct lb_cfr *)blob;
+
+	if (cfr_le32_to_cpu(root->tag) != LB_TAG_CFR ||
+	    cfr_le32_to_cpu(root->size) < sizeof(*root)) {
+		fprintf(stderr, "The %s is not a CFR blob\n", what);
+		return -1;
+	}
+	/* Op lengths are shifted left by one */
+	if (cfr_le32_to_cpu(root->size) > UINT32_MAX / 2) {
+		fprintf(stderr, "The %s is too large\n", what);
+		return -1;
+	}
+	return check_records(blob, 0, 0);
+}
+
+/*
+ * Object index of the source, from object ID to the offset of the first
+ * record with it. Offset 0 is the root, so it marks free slots.
+ */
+
+struct object_index {
+	uint32_t *offsets;
+	size_t capacity;	/* Power of two */
+	size_t count;
+};
+
+static size_t index_slot(const struct object_index *index, uint32_t id)
+{
+	return (id * 0x9e3779b1u) & (index->capacity - 1);
+}
+
+static int index_insert(struct object_index *index, const char *blob, uint32_t offset);
+
+static int index_grow(struct object_index *index, const char *blob)
+{
+	uint32_t *old = index->offsets;
+	const size_t old_capacity = index->capacity;
+
+	index->capacity = old_capacity ? old_capacity * 2 : 1024;
+	index->offsets = calloc(index->capacity, sizeof(*index->offsets));
+	if (!index->offsets) {
+		fprintf(stderr, "Could not allocate %zu object IDs\n", index->capacity);
+		free(old);
+		return -1;
+	}
+	index->count = 0;
+	for (size_t i = 0; i < old_capacity; i++) {
+		if (old[i]) {
+			index_insert(index, blob, old[i]);
+		}
+	}
+	free(old);
+	return 0;
+}
+
+static int index_insert(struct object_index *index, const char *blob, uint32_t offset)
+{
+	if (2 * (index->count + 1) > index->capacity && index_grow(index, blob)) {
+		return -1;
+	}
+
+	const uint32_t id = object_id(blob, offset);
+	size_t i = index_slot(index, id);
+	for (; index->offsets[i]; i = (i + 1) & (index->capacity - 1)) {
+		if (object_id(blob, index->offsets[i]) == id) {
+			return 0;
+		}
+	}
+	index->offsets[i] = offset;
+	index->count++;
+	return 0;
+}
+
+static int index_records(struct object_index *index, const char *blob, uint32_t parent)
+{
+	const uint32_t end = parent + record_size(blob, parent);
+
+	for (uint32_t off = parent + cfr_record_header_size(record_tag(blob, parent)); off < end;
+	     off += record_size(blob, off)) {
+		if (!is_object(record_tag(blob, off))) {
+			continue;
+		}
+		if (index_insert(index, blob, off) || index_records(index, blob, off)) {
+			return -1;
+		}
+	}
+	return 0;
+}
+
+/* Returns the offset of the source object with the ID and tag of the target one, or 0 */
+static uint32_t index_find(const struct object_index *index, const char *source,
+			   const char *target, uint32_t offset)
+{
+	const uint32_t id = object_id(target, offset);
+
+	for (size_t i = index_slot(index, id); index->offsets[i]; i = (i + 1) & (index->capacity - 1)) {
+		const uint32_t found = index->offsets[i];
+		if (object_id(source, found) == id) {
+			return record_tag(source, found) == record_tag(target, offset) ? found : 0;
+		}
+	}
+	return 0;
+}
+
+/*
+ * Encoder
+ */
+
+struct delta_encoder {
+	const char *source;
+	const char *target;
+	struct object_index index;
+
+	uint8_t *out;
+	size_t pos;
+	size_t capacity;
+
+	/* The op being built, which ends where the next target record starts */
+	bool literal;
+	uint32_t start;		/* In the source for copies, in the target for literals */
+	uint32_t length;
+};
+
+static int reserve(struct delta_encoder *e, size_t len)
+{
+	if (e->capacity - e->pos >= len) {
+		return 0;
+	}
+	size_t capacity = e->capacity ? e->capacity : 4096;
+	while (capacity - e->pos < len) {
+		capacity *= 2;
+	}
+	uint8_t *out = realloc(e->out, capacity);
+	if (!out) {
+		fprintf(stderr, "Could not allocate %zu bytes\n", capacity);
+		return -1;
+	}
+	e->out = out;
+	e->capacity = capacity;
+	return 0;
+}
+
+static size_t put_varint(uint8_t *dst, uint32_t value)
+{
+	size_t n = 0;
+	while (value >= 0x80) {
+		dst[n++] = (value & 0x7f) | 0x80;
+		value >>= 7;
+	}
+	dst[n++] = value;
+	return n;
+}
+
+static void put_le32(uint8_t *dst, uint32_t value)
+{
+	const uint32_t le = cfr_cpu_to_le32(value);
+	memcpy(dst, &le, sizeof(le));
+}
+
+static int flush_op(struct delta_encoder *e)
+{
+	if (!e->length) {
+		return 0;
+	}
+	/* Lengths are below 2^31, so both varints take at most 10 bytes */
+	if (reserve(e, 10 + (e->literal ? e->length : 0))) {
+		return -1;
+	}
+	e->pos += put_varint(e->out + e->pos, e->length << 1 | e->literal);
+	if (e->literal) {
+		memcpy(e->out + e->pos, e->target + e->start, e->length);
+		e->pos += e->length;
+	} else {
+		e->pos += put_varint(e->out + e->pos, e->start);
+	}
+	e->length = 0;
+	return 0;
+}
+
+/* Sends `length` bytes of the target at `offset` as they are */
+static int add_literal(struct delta_encoder *e, uint32_t offset, uint32_t length)
+{
+	if (!e->literal && flush_op(e)) {
+		return -1;
+	}
+	if (!e->length) {
+		e->literal = true;
+		e->start = offset;
+	}
+	e->length += length;
+	return 0;
+}
+
+/* Copies `length` bytes at `source` in the source to `target` in the target */
+static int add_copy(struct delta_encoder *e, uint32_t source, uint32_t target, uint32_t length)
+{
+	if (!e->literal && e->length && e->start + e->length == source) {
+		e->length += length;
+		return 0;
+	}
+	if (length < MIN_COPY && (e->literal || !e->length)) {
+		return add_literal(e, target, length);
+	}
+	if (flush_op(e)) {
+		return -1;
+	}
+	e->literal = false;
+	e->start = source;
+	e->length = length;
+	return 0;
+}
+
+static int diff_record(struct delta_encoder *e, uint32_t target, uint32_t source);
+
+/*
+ * Encodes the children of a target record against those of the source
+ * record it matched. Objects are looked up by ID, anything else (names,
+ * enum values, the form directory and CRC) is compared to the next child
+ * of the source with the same tag. That covers strings and values that
+ * changed in place, and leaves inserted values as literals.
+ */
+static int diff_children(struct delta_encoder *e, uint32_t target, uint32_t source)
+{
+	const char *src = e->source;
+	const char *dst = e->target;
+	const uint32_t src_end = source + record_size(src, source);
+	const uint32_t dst_end = target + record_size(dst, target);
+	uint32_t src_off = source + cfr_record_header_size(record_tag(src, source));
+
+	for (uint32_t off = target + cfr_record_header_size(record_tag(dst, target)); off < dst_end;
+	     off += record_size(dst, off)) {
+		const uint32_t tag = record_tag(dst, off);
+		if (is_object(tag)) {
+			if (diff_record(e, off, index_find(&e->index, src, dst, off))) {
+				return -1;
+			}
+			continue;
+		}
+
+		while (src_off < src_end && is_object(record_tag(src, src_off))) {
+			src_off += record_size(src, src_off);
+		}
+		if (src_off < src_end && record_tag(src, src_off) == tag) {
+			if (diff_record(e, off, src_off)) {
+				return -1;
+			}
+			src_off += record_size(src, src_off);
+		} else if (add_literal(e, off, record_size(dst, off))) {
+			return -1;
+		}
+	}
+	return 0;
+}
+
+/* Encodes the target record at `target`, given the matching source record or 0 if none */
+static int diff_record(struct delta_encoder *e, uint32_t target, uint32_t source)
+{
+	const uint32_t size = record_size(e->target, target);
+	const size_t header_size = cfr_record_header_size(record_tag(e->target, target));
+	/* Offset 0 is the root, which always matches the other root */
+	const bool matched = source || !target;
+
+	if (matched && record_size(e->source, source) == size &&
+	    !memcmp(e->source + source, e->target + target, size)) {
+		return add_copy(e, source, target, size);
+	}
+	if (!matched || !header_size) {
+		return add_literal(e, target, size);
+	}
+
+	/* Only the fields, without the children */
+	if (!memcmp(e->source + source, e->target + target, header_size)) {
+		if (add_copy(e, source, target, header_size)) {
+			return -1;
+		}
+	} else if (add_literal(e, target, header_size)) {
+		return -1;
+	}
+	return diff_children(e, target, source);
+}
+
+int cfr_delta_create(const char *source, const char *target, char **out, size_t *out_len)
+{
+	if (check_blob(source, "source") || check_blob(target, "target")) {
+		return -1;
+	}
+
+	struct delta_encoder e = {
+		.source	= source,
+		.target	= target,
+	};
+	const struct lb_cfr *src_root = (const struct lb_cfr *)source;
+	const struct lb_cfr *dst_root = (const struct lb_cfr *)target;
+
+	int ret = index_grow(&e.index, source);
+	if (!ret) {
+		ret = index_records(&e.index, source, 0);
+	}
+	if (!ret) {
+		ret = reserve(&e, CFR_DELTA_HEADER_SIZE);
+	}
+	if (!ret) {
+		memcpy(e.out, CFR_DELTA_MAGIC, CFR_DELTA_MAGIC_LEN);
+		put_le32(e.out + CFR_DELTA_MAGIC_LEN, cfr_le32_to_cpu(src_root->size));
+		put_le32(e.out + CFR_DELTA_MAGIC_LEN + 4, cfr_le32_to_cpu(src_root->checksum));
+		put_le32(e.out + CFR_DELTA_MAGIC_LEN + 8, cfr_le32_to_cpu(dst_root->size));
+		put_le32(e.out + CFR_DELTA_MAGIC_LEN + 12, cfr_le32_to_cpu(dst_root->checksum));
+		e.pos = CFR_DELTA_HEADER_SIZE;
+
+		ret = diff_record(&e, 0, 0);
+	}
+	if (!ret) {
+		ret = flush_op(&e);
+	}
+	free(e.index.offsets);
+
+	if (ret) {
+		free(e.out);
+		return -1;
+	}
+	*out = (char *)e.out;
+	*out_len = e.pos;
+	return 0;
+}
+
+/*
+ * Decoder
+ */
+
+static bool get_varint(const uint8_t **p, const uint8_t *end, uint32_t *value)
+{
+	uint32_t result = 0;
+
+	for (unsigned int shift = 0; shift < 35 && *p < end; shift += 7) {
+		const uint8_t b = *(*p)++;
+		if (shift == 28 && b > 0x0f) {
+			return false;
+		}
+		result |= (uint32_t)(b & 0x7f) << shift;
+		if (!(b & 0x80)) {
+			*value = result;
+			return true;
+		}
+	}
+	return false;
+}
+
+static uint32_t get_le32(const uint8_t *src)
+{
+	uint32_t le;
+	memcpy(&le, src, sizeof(le));
+	return cfr_le32_to_cpu(le);
+}
+
+int cfr_delta_apply(const char *source, const char *delta, size_t len, char **target)
+{
+	if (len < CFR_DELTA_HEADER_SIZE || !cfr_is_delta(delta, len)) {
+		fprintf(stderr, "Not a CFR delta\n");
+		return -1;
+	}
+
+	const uint8_t *p = (const uint8_t *)delta + CFR_DELTA_MAGIC_LEN;
+	const uint8_t *end = (const uint8_t *)delta + len;
+	const uint32_t source_size = get_le32(p);
+	const uint32_t source_checksum = get_le32(p + 4);
+	const uint32_t size = get_le32(p + 8);
+	const uint32_t checksum = get_le32(p + 12);
+	p += 16;
+
+	const struct lb_cfr *src_root = (const struct lb_cfr *)source;
+	if (cfr_le32_to_cpu(src_root->size) != source_size ||
+	    cfr_le32_to_cpu(src_root->checksum) != source_checksum) {
+		fprintf(stderr, "Delta is for a source of %u bytes with CRC32 0x%08x, "
+			"not %u bytes with CRC32 0x%08x\n", source_size, source_checksum,
+			cfr_le32_to_cpu(src_root->size), cfr_le32_to_cpu(src_root->checksum));
+		return -1;
+	}
+	if (size < sizeof(struct lb_cfr)) {
+		fprintf(stderr, "Bad target size %u in delta\n", size);
+		return -1;
+	}
+
+	char *out = malloc(size);
+	if (!out) {
+		fprintf(stderr, "Could not allocate %u bytes\n", size);
+		return -1;
+	}
+
+	uint32_t pos = 0;
+	while (pos < size) {
+		uint32_t op, start = 0;
+		if (!get_varint(&p, end, &op)) {
+			fprintf(stderr, "Truncated delta at target offset 0x%x\n", pos);
+			goto fail;
+		}
+		const uint32_t length = op >> 1;
+		const bool literal = op & 1;
+		if (!length || length > size - pos) {
+			fprintf(stderr, "Bad op length %u at target offset 0x%x\n", length, pos);
+			goto fail;
+		}
+		if (literal) {
+			if (length > (size_t)(end - p)) {
+				fprintf(stderr, "Truncated literal at target offset 0x%x\n", pos);
+				goto fail;
+			}
+			memcpy(out + pos, p, length);
+			p += length;
+		} else {
+			if (!get_varint(&p, end, &start) || start > source_size ||
+			    length > source_size - start) {
+				fprintf(stderr, "Bad copy at target offset 0x%x\n", pos);
+				goto fail;
+			}
+			memcpy(out + pos, source + start, length);
+		}
+		pos += length;
+	}
+	if (p != end) {
+		fprintf(stderr, "%zu bytes of trailing data in delta\n", (size_t)(end - p));
+		goto fail;
+	}
+
+	struct lb_cfr *root = (struct lb_cfr *)out;
+	if (cfr_le32_to_cpu(root->tag) != LB_TAG_CFR || cfr_le32_to_cpu(root->size) != size ||
+	    cfr_le32_to_cpu(root->checksum) != checksum) {
+		fprintf(stderr, "Delta did not produce the expected root record\n");
+		goto fail;
+	}
+	root->checksum = 0;
+	const uint32_t actual = cfr_crc32(out, size);
+	root->checksum = cfr_cpu_to_le32(checksum);
+	if (actual != checksum) {
+		fprintf(stderr, "Target checksum mismatch: expected 0x%08x, got 0x%08x\n",
+			checksum, actual);
+		goto fail;
+	}
+
+	*target = out;
+	return 0;
+fail:
+	free(out);
+	return -1;
+}
@@ -0,0 +1,51 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+
+#ifndef CFR_DELTA_H
+#define CFR_DELTA_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "cfr.h"
+
+/*
+ * Deltas rebuild a target blob from a source blob, so that updates only
+ * need to carry what changed:
+ *
+ *   "CFRD"  u32 source size  u32 source checksum
+ *           u32 target size  u32 target checksum  ops...
+ *
+ * and every op is
+ *
+ *   varint(length << 1)      varint(source offset)	copies source bytes
+ *   varint(length << 1 | 1)  bytes			inserts literal bytes
+ *
+ * The ops write the target front to back until it is complete. Sizes and
+ * checksums are little-endian, varints are unsigned LEB128 like in v2.
+ *
+ * Records are matched by object ID rather than by position, so options
+ * that moved, or forms after one that grew, are still copied. Records
+ * that changed are split into their fixed-length fields and children,
+ * and only the parts that differ are sent as literals. The form
+ * directory and the CRCs of changed forms come along as literals too,
+ * which keeps applying a delta a single pass of copies.
+ */
+
+#define CFR_DELTA_MAGIC		"CFRD"
+#define CFR_DELTA_MAGIC_LEN	4
+
+bool cfr_is_delta(const void *data, size_t len);
+
+/* Writes the delta from `source` to `target`, two v1 blobs, into a newly allocated `*out` */
+int cfr_delta_create(const char *source, const char *target, char **out, size_t *out_len);
+
+/*
+ * Applies the delta to `source`, which must be the blob it was made from,
+ * and returns the target in a newly allocated `*target`. The checksum of
+ * the result is verified, so a target is only returned if it is exactly
+ * the one the delta was made for.
+ */
+int cfr_delta_apply(const char *source, const char *delta, size_t len, char **target);
+
+#endif	/* CFR_DELTA_H */
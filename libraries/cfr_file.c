@@ -0,0 +1,246 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "cfr.h"
+#include "cfr_file.h"
+#include "cfr_lz.h"
+#include "cfr_v2.h"
+
+static int read_exact(void *buffer, size_t length, FILE *stream)
+{
+	const size_t read_size = fread(buffer, 1, length, stream);
+
+	if (read_size == length) {
+		return 0;
+	}
+
+	if (feof(stream)) {
+		fprintf(stderr, "Unexpected end of file while reading data\n");
+	} else if (ferror(stream)) {
+		perror("Error reading data");
+	} else {
+		fprintf(stderr, "Unknown error reading data\n");
+	}
+
+	return -1;
+}
+
+static int alloc_and_read(char **buffer, uint32_t length, struct lb_record *rec, FILE *stream)
+{
+	rewind(stream);
+
+	*buffer = malloc(length);
+	if (!*buffer) {
+		fprintf(stderr, "Could not allocate %u bytes\n", length);
+		return -1;
+	}
+
+	return read_exact(*buffer, length, stream);
+}
+
+/* Reads the whole compact blob in `stream` and decodes it */
+static int read_v2(char **buffer, FILE *stream)
+{
+	if (fseek(stream, 0, SEEK_END)) {
+		perror("Could not seek in input file");
+		return -1;
+	}
+	const long length = ftell(stream);
+	if (length < 0 || (unsigned long)length > UINT32_MAX) {
+		fprintf(stderr, "Bad input file size %ld\n", length);
+		return -1;
+	}
+
+	char *data;
+	if (alloc_and_read(&data, length, NULL, stream)) {
+		free(data);
+		return -1;
+	}
+
+	const int ret = cfr_v2_decode(data, length, buffer);
+	free(data);
+	return ret;
+}
+
+/*
+ * Decompresses the wrapped blob one chunk at a time, so that only the
+ * decompressed data needs to be in memory in full.
+ */
+static int read_compressed(char **buffer, FILE *stream)
+{
+	struct lb_cfr_compressed header;
+	rewind(stream);
+	if (read_exact(&header, sizeof(header), stream)) {
+		return -1;
+	}
+	const uint32_t algorithm = cfr_le32_to_cpu(header.algorithm);
+	if (algorithm != CFR_COMPRESSION_LZ) {
+		fprintf(stderr, "Unknown compression algorithm %u\n", algorithm);
+		return -1;
+	}
+
+	const uint32_t data_size = cfr_le32_to_cpu(header.data_size);
+	char *data = malloc(data_size);
+	struct lb_cfr_compressed_chunk *chunk =
+		malloc(sizeof(*chunk) + CFR_LZ_CHUNK_BOUND(CFR_LZ_CHUNK_SIZE));
+	if (!data || !chunk) {
+		fprintf(stderr, "Could not allocate %u bytes\n", data_size);
+		free(chunk);
+		free(data);
+		return -1;
+	}
+
+	int ret = 0;
+	for (size_t pos = 0; pos < data_size && !ret;) {
+		ret = read_exact(chunk, sizeof(*chunk), stream);
+		if (ret) {
+			break;
+		}
+		const uint32_t chunk_size = cfr_le32_to_cpu(chunk->data_size);
+		const uint32_t compressed_size = cfr_le32_to_cpu(chunk->compressed_size);
+		if (chunk_size > CFR_LZ_CHUNK_SIZE || !chunk_size ||
+		    compressed_size > CFR_LZ_CHUNK_BOUND(CFR_LZ_CHUNK_SIZE)) {
+			fprintf(stderr, "Bad compressed chunk at offset %zu\n", pos);
+			ret = -1;
+			break;
+		}
+		ret = read_exact(chunk->data, compressed_size, stream);
+		if (!ret) {
+			ret = cfr_lz_decompress_chunk(chunk, data, pos, data_size);
+		}
+		pos += chunk_size;
+	}
+	free(chunk);
+
+	char *blob = NULL;
+	if (!ret && cfr_is_v2(data, data_size)) {
+		ret = cfr_v2_decode(data, data_size, &blob);
+		free(data);
+	} else if (!ret) {
+		const struct lb_cfr *root = (const struct lb_cfr *)data;
+		if (data_size < sizeof(*root) || cfr_le32_to_cpu(root->tag) != LB_TAG_CFR ||
+		    cfr_le32_to_cpu(root->size) != data_size) {
+			fprintf(stderr, "Compressed data is not a CFR blob\n");
+			ret = -1;
+			free(data);
+		} else {
+			blob = data;
+		}
+	} else {
+		free(data);
+	}
+
+	/* What came out must be the blob the wrapper was made for */
+	if (!ret) {
+		const struct lb_cfr *root = (const struct lb_cfr *)blob;
+		if (root->size != header.root_size || root->checksum != header.root_checksum ||
+		    !cfr_root_checksum_ok(blob)) {
+			fprintf(stderr, "Compressed data does not match its root size and checksum\n");
+			free(blob);
+			return -1;
+		}
+		*buffer = blob;
+	}
+	return ret;
+}
+
+int cfr_read_file(char **buffer, const char *filename)
+{
+	FILE *stream = fopen(filename, "rb");
+	if (!stream) {
+		perror("Could not open input file");
+		return -1;
+	}
+
+	int ret = -1;
+
+	struct lb_record record = {0};
+	const size_t header_size = fread(&record, sizeof(record), 1, stream);
+
+	if (header_size == 1) {
+		const uint32_t tag = cfr_le32_to_cpu(record.tag);
+		if (tag == LB_TAG_CFR) {
+			ret = alloc_and_read(buffer, cfr_le32_to_cpu(record.size), &record, stream);
+		} else if (tag == LB_TAG_CFR_COMPRESSED) {
+			ret = read_compressed(buffer, stream);
+		} else if (cfr_is_v2(&record, sizeof(record))) {
+			ret = read_v2(buffer, stream);
+		} else {
+			fprintf(stderr, "Root record tag 0x%x is not a CFR root\n", tag);
+		}
+	} else {
+		if (feof(stream)) {
+			fprintf(stderr, "Unexpected end of file while reading record\n");
+		} else if (ferror(stream)) {
+			perror("Error reading record");
+		} else {
+			fprintf(stderr, "Unknown error reading record\n");
+		}
+	}
+
+	fclose(stream);
+	return ret;
+}
+
+int cfr_read_header(struct lb_cfr *root, const char *filename)
+{
+	FILE *stream = fopen(filename, "rb");
+	if (!stream) {
+		perror("Could not open input file");
+		return -1;
+	}
+
+	int ret = -1;
+	union {
+		char v2[CFR_V2_HEADER_MAX];
+		struct lb_cfr root;
+		struct lb_cfr_compressed compressed;
+	} header;
+	const size_t header_size = fread(&header, 1, sizeof(header), stream);
+
+	if (cfr_is_v2(header.v2, header_size)) {
+		ret = cfr_v2_read_header(header.v2, header_size, root);
+	} else if (header_size < sizeof(*root)) {
+		fprintf(stderr, "Could not read root record\n");
+	} else if (cfr_le32_to_cpu(header.root.tag) == LB_TAG_CFR) {
+		*root = header.root;
+		ret = 0;
+	} else if (cfr_le32_to_cpu(header.root.tag) == LB_TAG_CFR_COMPRESSED &&
+		   header_size == sizeof(header.compressed)) {
+		*root = (struct lb_cfr) {
+			.tag		= cfr_cpu_to_le32(LB_TAG_CFR),
+			.size		= header.compressed.root_size,
+			.checksum	= header.compressed.root_checksum,
+		};
+		ret = 0;
+	} else {
+		fprintf(stderr, "Root record tag 0x%x is not a CFR root\n",
+			cfr_le32_to_cpu(header.root.tag));
+	}
+
+	fclose(stream);
+	return ret;
+}
+
+int cfr_write_all(int fd, const void *data, size_t length)
+{
+	while (length) {
+		const ssize_t ret = write(fd, data, length);
+		if (ret < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			perror("Could not write output");
+			return -1;
+		}
+		data = (const char *)data + ret;
+		length -= ret;
+	}
+	return 0;
+}
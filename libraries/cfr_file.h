@@ -0,0 +1,19 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+
+#ifndef CFR_FILE_H
+#define CFR_FILE_H
+
+#include <stddef.h>
+
+#include "cfr.h"
+
+/* Reads the CFR blob in `filename` into a newly allocated `*buffer` */
+int cfr_read_file(char **buffer, const char *filename);
+
+/* Only reads the root record header, without the rest of the blob, as stored little-endian */
+int cfr_read_header(struct lb_cfr *root, const char *filename);
+
+/* Retries short writes until all `length` bytes have been written */
+int cfr_write_all(int fd, const void *data, size_t length);
+
+#endif	/* CFR_FILE_H */
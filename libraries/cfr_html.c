@@ -0,0 +1,1485 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/uio.h>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "cfr.h"
+#include "cfr_file.h"
+#include "cfr_html.h"
+
+#define HTML_OUT_INITIAL_SIZE	(256 * 1024)
+#define CFR_HTML_MAX_DEPTH	32
+
+void html_flush(struct html_out *out)
+{
+	if (out->fd < 0 || !out->len) {
+		return;
+	}
+	if (cfr_write_all(out->fd, out->data, out->len)) {
+		out->error = true;
+	}
+	out->len = 0;
+}
+
+/* Not exposed by limits.h in strict ISO C mode */
+#ifndef IOV_MAX
+#define IOV_MAX 1024
+#endif
+
+static int writev_all(int fd, struct iovec *iov, int iovcnt)
+{
+	while (iovcnt) {
+		const ssize_t ret = writev(fd, iov, iovcnt < IOV_MAX ? iovcnt : IOV_MAX);
+		if (ret < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			perror("Could not write output");
+			return -1;
+		}
+		size_t written = ret;
+		while (iovcnt && written >= iov->iov_len) {
+			written -= iov->iov_len;
+			iov++;
+			iovcnt--;
+		}
+		if (iovcnt) {
+			iov->iov_base = (char *)iov->iov_base + written;
+			iov->iov_len -= written;
+		}
+	}
+	return 0;
+}
+
+/*
+ * Returns a pointer to at least `n` bytes of free space at the end of the
+ * buffer, or NULL with `out->error` set if the buffer cannot grow.
+ */
+static char *hreserve(struct html_out *out, size_t n)
+{
+	if (out->cap - out->len >= n) {
+		return out->data + out->len;
+	}
+
+	html_flush(out);
+	if (out->cap - out->len >= n) {
+		return out->data + out->len;
+	}
+
+	size_t new_cap = out->cap ? out->cap : HTML_OUT_INITIAL_SIZE;
+	while (new_cap - out->len < n) {
+		new_cap *= 2;
+	}
+	char *new_data = realloc(out->data, new_cap);
+	if (!new_data) {
+		fprintf(stderr, "Could not grow output buffer to %zu bytes\n", new_cap);
+		out->error = true;
+		return NULL;
+	}
+	out->data = new_data;
+	out->cap = new_cap;
+	return out->data + out->len;
+}
+
+static void hwrite(struct html_out *out, const char *str, size_t length)
+{
+	char *dst = hreserve(out, length);
+	if (!dst) {
+		return;
+	}
+	memcpy(dst, str, length);
+	out->len += length;
+}
+
+/* Only for string literals, their length is known at compile time */
+#define hlit(out, lit)	hwrite((out), "" lit, sizeof(lit) - 1)
+
+static void hputs(struct html_out *out, const char *str)
+{
+	hwrite(out, str, strlen(str));
+}
+
+static void hu32(struct html_out *out, uint32_t val)
+{
+	char digits[10];
+	char *p = digits + sizeof(digits);
+
+	do {
+		*--p = '0' + val % 10;
+		val /= 10;
+	} while (val);
+
+	hwrite(out, p, digits + sizeof(digits) - p);
+}
+
+static void hh32(struct html_out *out, uint32_t val)
+{
+	static const char hex[] = "0123456789abcdef";
+	char *p = hreserve(out, 10);
+	if (!p) {
+		return;
+	}
+
+	p[0] = '0';
+	p[1] = 'x';
+	for (int i = 0; i < 8; i++) {
+		p[2 + i] = hex[(val >> (28 - 4 * i)) & 0xf];
+	}
+	out->len += 10;
+}
+
+static const char tabs[] = "\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t";
+
+static void hindent(struct html_out *out)
+{
+	if (out->minify) {
+		return;
+	}
+	size_t remaining = out->depth;
+	while (remaining) {
+		const size_t n = remaining < sizeof(tabs) - 1 ? remaining : sizeof(tabs) - 1;
+		hwrite(out, tabs, n);
+		remaining -= n;
+	}
+}
+
+static void hnewline(struct html_out *out)
+{
+	hlit(out, "\n");
+}
+
+/* Emits a whole line made of a single string literal */
+#define hline(out, lit) \
+	do { hindent(out); hlit(out, lit "\n"); } while (0)
+
+/*
+ * Text only needs '&', '<' and '>' escaped. Attribute values are quoted
+ * with single quotes, but escape both quote characters so that a value
+ * can never terminate its attribute regardless of the quoting style.
+ */
+enum html_context {
+	HTML_TEXT,
+	HTML_ATTR,
+};
+
+#define HTML_ESC_TEXT	(1 << HTML_TEXT)
+#define HTML_ESC_ATTR	(1 << HTML_ATTR)
+
+static const uint8_t html_esc_class[256] = {
+	['&']  = HTML_ESC_TEXT | HTML_ESC_ATTR,
+	['<']  = HTML_ESC_TEXT | HTML_ESC_ATTR,
+	['>']  = HTML_ESC_TEXT | HTML_ESC_ATTR,
+	['"']  = HTML_ESC_ATTR,
+	['\''] = HTML_ESC_ATTR,
+};
+
+static const char *html_entity(char c)
+{
+	switch (c) {
+	case '&':	return "&amp;";
+	case '<':	return "&lt;";
+	case '>':	return "&gt;";
+	case '"':	return "&quot;";
+	case '\'':	return "&#39;";
+	default:	return NULL;
+	}
+}
+
+/* Longest entity returned by html_entity() */
+#define HTML_ENTITY_MAX		6
+
+/* Returns the length of the leading run of `src` that needs no escaping */
+static size_t html_clean_run(const char *src, size_t len, enum html_context ctx)
+{
+	size_t i = 0;
+
+	/* Text context searches for '&' twice instead of for the quotes */
+	const char quot = ctx == HTML_ATTR ? '"'  : '&';
+	const char apos = ctx == HTML_ATTR ? '\'' : '&';
+
+#if defined(__AVX2__)
+	const __m256i v_amp  = _mm256_set1_epi8('&');
+	const __m256i v_lt   = _mm256_set1_epi8('<');
+	const __m256i v_gt   = _mm256_set1_epi8('>');
+	const __m256i v_quot = _mm256_set1_epi8(quot);
+	const __m256i v_apos = _mm256_set1_epi8(apos);
+
+	for (; i + 32 <= len; i += 32) {
+		const __m256i v = _mm256_loadu_si256((const __m256i *)(src + i));
+		__m256i hit = _mm256_cmpeq_epi8(v, v_amp);
+		hit = _mm256_or_si256(hit, _mm256_cmpeq_epi8(v, v_lt));
+		hit = _mm256_or_si256(hit, _mm256_cmpeq_epi8(v, v_gt));
+		hit = _mm256_or_si256(hit, _mm256_cmpeq_epi8(v, v_quot));
+		hit = _mm256_or_si256(hit, _mm256_cmpeq_epi8(v, v_apos));
+		const uint32_t mask = (uint32_t)_mm256_movemask_epi8(hit);
+		if (mask) {
+			return i + __builtin_ctz(mask);
+		}
+	}
+#elif defined(__SSE2__)
+	const __m128i v_amp  = _mm_set1_epi8('&');
+	const __m128i v_lt   = _mm_set1_epi8('<');
+	const __m128i v_gt   = _mm_set1_epi8('>');
+	const __m128i v_quot = _mm_set1_epi8(quot);
+	const __m128i v_apos = _mm_set1_epi8(apos);
+
+	for (; i + 16 <= len; i += 16) {
+		const __m128i v = _mm_loadu_si128((const __m128i *)(src + i));
+		__m128i hit = _mm_cmpeq_epi8(v, v_amp);
+		hit = _mm_or_si128(hit, _mm_cmpeq_epi8(v, v_lt));
+		hit = _mm_or_si128(hit, _mm_cmpeq_epi8(v, v_gt));
+		hit = _mm_or_si128(hit, _mm_cmpeq_epi8(v, v_quot));
+		hit = _mm_or_si128(hit, _mm_cmpeq_epi8(v, v_apos));
+		const uint32_t mask = (uint32_t)_mm_movemask_epi8(hit);
+		if (mask) {
+			return i + __builtin_ctz(mask);
+		}
+	}
+#else
+	(void)quot;
+	(void)apos;
+#endif
+
+	const uint8_t esc = 1 << ctx;
+	for (; i < len; i++) {
+		if (html_esc_class[(uint8_t)src[i]] & esc) {
+			break;
+		}
+	}
+	return i;
+}
+
+/*
+ * Escapes `len` bytes of `src` into `dst`, which must have room for at
+ * least `len * HTML_ENTITY_MAX` bytes. Returns the escaped length.
+ */
+static size_t html_escape(char *dst, const char *src, size_t len, enum html_context ctx)
+{
+	char *const start = dst;
+
+	while (len) {
+		const size_t run = html_clean_run(src, len, ctx);
+		memcpy(dst, src, run);
+		dst += run;
+		src += run;
+		len -= run;
+		if (!len) {
+			break;
+		}
+		const char *entity = html_entity(*src);
+		const size_t entity_len = strlen(entity);
+		memcpy(dst, entity, entity_len);
+		dst += entity_len;
+		src++;
+		len--;
+	}
+	return dst - start;
+}
+
+/* Points into the CFR blob, not NULL-terminated */
+struct cfr_str {
+	const char *data;
+	size_t len;
+};
+
+static void hescape(struct html_out *out, const struct cfr_str *str, enum html_context ctx)
+{
+	char *dst = hreserve(out, str->len * HTML_ENTITY_MAX);
+	if (dst) {
+		out->len += html_escape(dst, str->data, str->len, ctx);
+	}
+}
+
+static bool _tag_neq(const struct lb_record *rec, uint32_t tag, const char *f)
+{
+	if (cfr_le32_to_cpu(rec->tag) != tag && tag != LB_TAG_CFR_VARCHAR_UI_HELPTEXT) {
+		fprintf(stderr, "%s: expected tag 0x%x but ", f, tag);
+		fprintf(stderr, "got tag 0x%x instead\n", cfr_le32_to_cpu(rec->tag));
+	}
+	return cfr_le32_to_cpu(rec->tag) != tag;
+}
+
+#define tag_mismatch(_rec, _tag) _tag_neq((const struct lb_record *)(_rec), (_tag), __func__)
+
+/* Records with the wrong tag are skipped, and fail the rendering */
+static bool _tag_ok(struct html_out *out, const struct lb_record *rec, uint32_t tag,
+		    const char *f)
+{
+	if (cfr_le32_to_cpu(rec->tag) != tag) {
+		fprintf(stderr, "%s: expected tag 0x%x but ", f, tag);
+		fprintf(stderr, "got tag 0x%x instead, skipping it\n", cfr_le32_to_cpu(rec->tag));
+		out->error = true;
+		return false;
+	}
+	return true;
+}
+
+#define ensure_tag_ok(_out, _rec, _tag) \
+	_tag_ok((_out), (const struct lb_record *)(_rec), (_tag), __func__)
+
+static void hflags(struct html_out *out, uint32_t flags)
+{
+	/* This is only accurate from a visual standpoint. It won't work properly. */
+	if (flags & CFR_OPTFLAG_READONLY)
+		hlit(out, " readonly");
+	if (flags & CFR_OPTFLAG_GRAYOUT)
+		hlit(out, " disabled");
+	if (flags & CFR_OPTFLAG_SUPPRESS)
+		hlit(out, " hidden");
+}
+
+static void hpropval(struct html_out *out, const char *prop, uint32_t val)
+{
+	hindent(out);
+	hlit(out, "<label>");
+	hputs(out, prop);
+	hnewline(out);
+	out->depth++;
+	hindent(out);
+	hlit(out, "<input type='text' name='");
+	hputs(out, prop);
+	hlit(out, "' value='");
+	hh32(out, val);
+	hlit(out, "' readonly>\n");
+	out->depth--;
+	hline(out, "</label>");
+}
+
+/*
+ * Missing strings read as empty. Only the help text is optional, a record
+ * in the place of any other string is skipped and fails the rendering.
+ */
+static uint32_t read_cfr_varchar(struct html_out *html, struct cfr_str *out, char *current,
+				 uint32_t tag)
+{
+	struct lb_cfr_varbinary *cfr_str = (struct lb_cfr_varbinary *)current;
+
+	if (tag_mismatch(cfr_str, tag)) {
+		*out = (struct cfr_str) { .data = "", .len = 0 };
+		if (tag == LB_TAG_CFR_VARCHAR_UI_HELPTEXT) {
+			return 0;
+		}
+		fprintf(stderr, "Could not find required varchar with tag 0x%x\n", tag);
+		html->error = true;
+		return cfr_le32_to_cpu(cfr_str->size);
+	}
+
+	assert(cfr_le32_to_cpu(cfr_str->size) > cfr_le32_to_cpu(cfr_str->data_length));
+	assert(cfr_le32_to_cpu(cfr_str->data_length) > 0);
+
+	const char *data = (const char *)cfr_str->data;
+	const char *nul = memchr(data, '\0', cfr_le32_to_cpu(cfr_str->data_length));
+
+	out->data = data;
+	out->len = nul ? (size_t)(nul - data) : cfr_le32_to_cpu(cfr_str->data_length);
+
+	return cfr_le32_to_cpu(cfr_str->size);
+}
+
+static uint32_t sm_read_string_default_value(struct html_out *html, struct cfr_str *out, char *current)
+{
+	return read_cfr_varchar(html, out, current, LB_TAG_CFR_VARCHAR_DEF_VALUE);
+}
+
+static uint32_t sm_read_opt_name(struct html_out *html, struct cfr_str *out, char *current)
+{
+	return read_cfr_varchar(html, out, current, LB_TAG_CFR_VARCHAR_OPT_NAME);
+}
+
+static uint32_t sm_read_ui_name(struct html_out *html, struct cfr_str *out, char *current)
+{
+	return read_cfr_varchar(html, out, current, LB_TAG_CFR_VARCHAR_UI_NAME);
+}
+
+/* The help text is optional, so it may also be missing at the very end of the option */
+static uint32_t sm_read_ui_helptext(struct html_out *html, struct cfr_str *out, char *current,
+				    char *const limit)
+{
+	if (current == limit) {
+		*out = (struct cfr_str) { .data = "", .len = 0 };
+		return 0;
+	}
+	return read_cfr_varchar(html, out, current, LB_TAG_CFR_VARCHAR_UI_HELPTEXT);
+}
+
+/* Emits the opening of an element with an `object-<id>` ID, leaving the tag open */
+static void hobject_open(struct html_out *out, const char *element, uint32_t object_id)
+{
+	hindent(out);
+	hputs(out, element);
+	hlit(out, " id='object-");
+	hu32(out, object_id);
+	hlit(out, "'");
+}
+
+static void hname_attr(struct html_out *out, const struct cfr_str *opt_name)
+{
+	hlit(out, " name='");
+	hescape(out, opt_name, HTML_ATTR);
+	hlit(out, "'");
+}
+
+static void html_ui_name_cell(struct html_out *out, uint32_t object_id,
+			      const struct cfr_str *ui_name)
+{
+	hline(out, "<td class='ui-name'>");
+	out->depth++;
+	hindent(out);
+	hlit(out, "<label for='object-");
+	hu32(out, object_id);
+	hlit(out, "'>");
+	hescape(out, ui_name, HTML_TEXT);
+	hlit(out, "</label>\n");
+	out->depth--;
+	hline(out, "</td>");
+}
+
+static void html_helptext_cell(struct html_out *out, const struct cfr_str *ui_helptext)
+{
+	hline(out, "<td>");
+	out->depth++;
+	hindent(out);
+	hlit(out, "<span>");
+	hescape(out, ui_helptext, HTML_TEXT);
+	hlit(out, "</span>\n");
+	out->depth--;
+	hline(out, "</td>");
+}
+
+static void html_enum_option(struct html_out *out, uint32_t value,
+			     const struct cfr_str *ui_name, uint32_t default_value)
+{
+	hindent(out);
+	hlit(out, "<option value='");
+	hu32(out, value);
+	hlit(out, "'");
+	if (value == default_value) {
+		hlit(out, " selected");
+	}
+	hlit(out, ">");
+	hescape(out, ui_name, HTML_TEXT);
+	hlit(out, "</option>\n");
+}
+
+static uint32_t sm_read_enum_value(struct html_out *out, char *current, uint32_t default_value)
+{
+	struct lb_cfr_enum_value *enum_val = (struct lb_cfr_enum_value *)current;
+	char *const limit = current + cfr_le32_to_cpu(enum_val->size);
+
+	if (!ensure_tag_ok(out, enum_val, LB_TAG_CFR_ENUM_VALUE)) {
+		return cfr_le32_to_cpu(enum_val->size);
+	}
+
+	struct cfr_str ui_name;
+
+	current += sizeof(*enum_val);
+	current += sm_read_ui_name(out, &ui_name, current);
+
+	html_enum_option(out, cfr_le32_to_cpu(enum_val->value), &ui_name, default_value);
+
+	assert(current == limit);
+	return cfr_le32_to_cpu(enum_val->size);
+}
+
+/* The values of a range are only ever expanded here, one label at a time */
+static uint32_t sm_read_enum_range(struct html_out *out, char *current, uint32_t default_value)
+{
+	struct lb_cfr_enum_range *range = (struct lb_cfr_enum_range *)current;
+	char label[CFR_ENUM_LABEL_MAX];
+
+	for (uint32_t i = 0; i < cfr_le32_to_cpu(range->count); i++) {
+		cfr_enum_range_label(range, i, label);
+		const struct cfr_str ui_name = { .data = label, .len = strlen(label) };
+		html_enum_option(out, cfr_enum_range_value(range, i), &ui_name, default_value);
+	}
+	return cfr_le32_to_cpu(range->size);
+}
+
+static uint32_t sm_read_opt_enum(struct html_out *out, char *current)
+{
+	struct lb_cfr_numeric_option *option = (struct lb_cfr_numeric_option *)current;
+	char *const limit = current + cfr_le32_to_cpu(option->size);
+
+	struct cfr_str opt_name;
+	struct cfr_str ui_name;
+	struct cfr_str ui_helptext;
+
+	if (!ensure_tag_ok(out, option, LB_TAG_CFR_OPTION_ENUM)) {
+		return cfr_le32_to_cpu(option->size);
+	}
+
+	current += sizeof(*option);
+	current += sm_read_opt_name(out, &opt_name, current);
+	current += sm_read_ui_name(out, &ui_name, current);
+	current += sm_read_ui_helptext(out, &ui_helptext, current, limit);
+
+	html_ui_name_cell(out, cfr_le32_to_cpu(option->object_id), &ui_name);
+	hline(out, "<td class='ui-input'>");
+	out->depth++;
+	hobject_open(out, "<select", cfr_le32_to_cpu(option->object_id));
+	hname_attr(out, &opt_name);
+	hflags(out, cfr_le32_to_cpu(option->flags));
+	hlit(out, ">\n");
+	out->depth++;
+	while (current < limit) {
+		const uint32_t default_value = cfr_le32_to_cpu(option->default_value);
+		if (cfr_le32_to_cpu(((struct lb_record *)current)->tag) == LB_TAG_CFR_ENUM_RANGE) {
+			current += sm_read_enum_range(out, current, default_value);
+		} else {
+			current += sm_read_enum_value(out, current, default_value);
+		}
+	}
+	out->depth--;
+	hline(out, "</select>");
+	out->depth--;
+	hline(out, "</td>");
+	html_helptext_cell(out, &ui_helptext);
+
+	assert(current == limit);
+	return cfr_le32_to_cpu(option->size);
+}
+
+static uint32_t sm_read_opt_number(struct html_out *out, char *current)
+{
+	struct lb_cfr_numeric_option *option = (struct lb_cfr_numeric_option *)current;
+	char *const limit = current + cfr_le32_to_cpu(option->size);
+
+	struct cfr_str opt_name;
+	struct cfr_str ui_name;
+	struct cfr_str ui_helptext;
+
+	if (!ensure_tag_ok(out, option, LB_TAG_CFR_OPTION_NUMBER)) {
+		return cfr_le32_to_cpu(option->size);
+	}
+
+	current += sizeof(*option);
+	current += sm_read_opt_name(out, &opt_name, current);
+	current += sm_read_ui_name(out, &ui_name, current);
+	current += sm_read_ui_helptext(out, &ui_helptext, current, limit);
+
+	html_ui_name_cell(out, cfr_le32_to_cpu(option->object_id), &ui_name);
+	hline(out, "<td class='ui-input'>");
+	out->depth++;
+	hobject_open(out, "<input type='number'", cfr_le32_to_cpu(option->object_id));
+	hname_attr(out, &opt_name);
+	hlit(out, " value='");
+	hu32(out, cfr_le32_to_cpu(option->default_value));
+	hlit(out, "'");
+	hflags(out, cfr_le32_to_cpu(option->flags));
+	hlit(out, ">\n");
+	out->depth--;
+	hline(out, "</td>");
+	html_helptext_cell(out, &ui_helptext);
+
+	assert(current == limit);
+	return cfr_le32_to_cpu(option->size);
+}
+
+static uint32_t sm_read_opt_bool(struct html_out *out, char *current)
+{
+	struct lb_cfr_numeric_option *option = (struct lb_cfr_numeric_option *)current;
+	char *const limit = current + cfr_le32_to_cpu(option->size);
+
+	struct cfr_str opt_name;
+	struct cfr_str ui_name;
+	struct cfr_str ui_helptext;
+
+	if (!ensure_tag_ok(out, option, LB_TAG_CFR_OPTION_BOOL)) {
+		return cfr_le32_to_cpu(option->size);
+	}
+
+	current += sizeof(*option);
+	current += sm_read_opt_name(out, &opt_name, current);
+	current += sm_read_ui_name(out, &ui_name, current);
+	current += sm_read_ui_helptext(out, &ui_helptext, current, limit);
+
+	html_ui_name_cell(out, cfr_le32_to_cpu(option->object_id), &ui_name);
+	hline(out, "<td class='ui-input'>");
+	out->depth++;
+	if (out->form_action && !(cfr_le32_to_cpu(option->flags) & CFR_OPTFLAG_GRAYOUT)) {
+		/* Unchecked checkboxes are not submitted, this one is then */
+		hindent(out);
+		hlit(out, "<input type='hidden'");
+		hname_attr(out, &opt_name);
+		hlit(out, " value='0'>\n");
+	}
+	hobject_open(out, "<input type='checkbox'", cfr_le32_to_cpu(option->object_id));
+	hname_attr(out, &opt_name);
+	if (cfr_le32_to_cpu(option->default_value)) {
+		hlit(out, " checked");
+	}
+	hflags(out, cfr_le32_to_cpu(option->flags));
+	hlit(out, ">\n");
+	out->depth--;
+	hline(out, "</td>");
+	html_helptext_cell(out, &ui_helptext);
+
+	assert(current == limit);
+	return cfr_le32_to_cpu(option->size);
+}
+
+static uint32_t sm_read_opt_varchar(struct html_out *out, char *current)
+{
+	struct lb_cfr_varchar_option *option = (struct lb_cfr_varchar_option *)current;
+	char *const limit = current + cfr_le32_to_cpu(option->size);
+
+	struct cfr_str opt_name;
+	struct cfr_str ui_name;
+	struct cfr_str ui_helptext;
+	struct cfr_str default_value;
+
+	if (!ensure_tag_ok(out, option, LB_TAG_CFR_OPTION_VARCHAR)) {
+		return cfr_le32_to_cpu(option->size);
+	}
+
+	current += sizeof(*option);
+	current += sm_read_string_default_value(out, &default_value, current);
+	current += sm_read_opt_name(out, &opt_name, current);
+	current += sm_read_ui_name(out, &ui_name, current);
+	current += sm_read_ui_helptext(out, &ui_helptext, current, limit);
+
+	html_ui_name_cell(out, cfr_le32_to_cpu(option->object_id), &ui_name);
+	hline(out, "<td class='ui-input'>");
+	out->depth++;
+	hobject_open(out, "<input type='text'", cfr_le32_to_cpu(option->object_id));
+	hname_attr(out, &opt_name);
+	hlit(out, " value='");
+	hescape(out, &default_value, HTML_ATTR);
+	hlit(out, "'");
+	hflags(out, cfr_le32_to_cpu(option->flags));
+	hlit(out, ">\n");
+	out->depth--;
+	hline(out, "</td>");
+	html_helptext_cell(out, &ui_helptext);
+
+	assert(current == limit);
+	return cfr_le32_to_cpu(option->size);
+}
+
+static uint32_t sm_read_opt_comment(struct html_out *out, char *current)
+{
+	struct lb_cfr_option_comment *comment = (struct lb_cfr_option_comment *)current;
+	char *const limit = current + cfr_le32_to_cpu(comment->size);
+
+	struct cfr_str ui_name;
+	struct cfr_str ui_helptext;
+
+	if (!ensure_tag_ok(out, comment, LB_TAG_CFR_OPTION_COMMENT)) {
+		return cfr_le32_to_cpu(comment->size);
+	}
+
+	current += sizeof(*comment);
+	current += sm_read_ui_name(out, &ui_name, current);
+	current += sm_read_ui_helptext(out, &ui_helptext, current, limit);
+
+	hline(out, "<td class='ui-name' colspan='2'>");
+	out->depth++;
+	hobject_open(out, "<span", cfr_le32_to_cpu(comment->object_id));
+	hflags(out, cfr_le32_to_cpu(comment->flags));
+	hlit(out, ">");
+	hescape(out, &ui_name, HTML_TEXT);
+	hlit(out, "</span>\n");
+	out->depth--;
+	hline(out, "</td>");
+	html_helptext_cell(out, &ui_helptext);
+
+	assert(current == limit);
+	return cfr_le32_to_cpu(comment->size);
+}
+
+static uint32_t sm_read_object(struct html_out *out, char *current);
+
+static void html_form_table(struct html_out *out, char *current, char *const limit)
+{
+	hline(out, "<table>");
+	out->depth++;
+
+	while (current < limit) {
+		current += sm_read_object(out, current);
+	}
+
+	out->depth--;
+	hline(out, "</table>");
+
+	assert(current == limit);
+}
+
+/*
+ * In paginated mode, the objects of every form are written to their own
+ * `form-<object ID>.html` fragment, which the page fetches on demand.
+ */
+static void html_form_fragment(struct html_out *parent, uint32_t object_id,
+			       char *current, char *const limit)
+{
+	const size_t path_size = strlen(parent->fragment_dir) + sizeof("/form-4294967295.html");
+	char *path = malloc(path_size);
+	if (!path) {
+		fprintf(stderr, "Could not allocate %zu bytes for fragment path\n", path_size);
+		parent->error = true;
+		return;
+	}
+	snprintf(path, path_size, "%s/form-%u.html", parent->fragment_dir, object_id);
+
+	struct html_out frag = {
+		.fd		= open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644),
+		.minify		= parent->minify,
+		.fragment_dir	= parent->fragment_dir,
+	};
+	if (frag.fd < 0) {
+		fprintf(stderr, "Could not open '%s': %s\n", path, strerror(errno));
+		parent->error = true;
+		free(path);
+		return;
+	}
+
+	html_form_table(&frag, current, limit);
+	html_flush(&frag);
+
+	parent->error |= frag.error;
+	close(frag.fd);
+	free(frag.data);
+	free(path);
+}
+
+/*
+ * Steps `current` over the checksum of the form, if it has one. Forms that
+ * do not match it are not rendered at all, rather than shown with values
+ * that may be wrong, and make the rendering fail.
+ */
+static bool html_check_form(struct html_out *out, const struct lb_cfr_option_form *form,
+			    char **current)
+{
+	const struct lb_cfr_form_checksum *crc = cfr_form_checksum(form);
+	if (!crc) {
+		return true;
+	}
+	if (cfr_check_form(form)) {
+		out->error = true;
+		return false;
+	}
+	*current += cfr_le32_to_cpu(crc->size);
+	return true;
+}
+
+static void hfragment_src(struct html_out *out, uint32_t object_id)
+{
+	hlit(out, " data-src='form-");
+	hu32(out, object_id);
+	hlit(out, ".html'");
+}
+
+static uint32_t sm_read_form(struct html_out *out, char *current)
+{
+	struct lb_cfr_option_form *form = (struct lb_cfr_option_form *)current;
+	char *const limit = current + cfr_le32_to_cpu(form->size);
+
+	struct cfr_str ui_name;
+
+	if (!ensure_tag_ok(out, form, LB_TAG_CFR_OPTION_FORM)) {
+		return cfr_le32_to_cpu(form->size);
+	}
+
+	current += sizeof(*form);
+	current += sm_read_ui_name(out, &ui_name, current);
+	if (!html_check_form(out, form, &current)) {
+		return cfr_le32_to_cpu(form->size);
+	}
+
+	/* TODO: Decide what to do here */
+	hobject_open(out, "<div", cfr_le32_to_cpu(form->object_id));
+	hflags(out, cfr_le32_to_cpu(form->flags));
+	if (out->fragment_dir) {
+		hfragment_src(out, cfr_le32_to_cpu(form->object_id));
+		hlit(out, "></div>\n");
+		html_form_fragment(out, cfr_le32_to_cpu(form->object_id), current, limit);
+		return cfr_le32_to_cpu(form->size);
+	}
+	hlit(out, ">\n");
+	out->depth++;
+	html_form_table(out, current, limit);
+	out->depth--;
+	hline(out, "</div>");
+
+	return cfr_le32_to_cpu(form->size);
+}
+
+static uint32_t sm_read_form_tab(struct html_out *out, char *current, unsigned int tab_idx)
+{
+	struct lb_cfr_option_form *form = (struct lb_cfr_option_form *)current;
+	char *const limit = current + cfr_le32_to_cpu(form->size);
+
+	struct cfr_str ui_name;
+
+	if (!ensure_tag_ok(out, form, LB_TAG_CFR_OPTION_FORM)) {
+		return cfr_le32_to_cpu(form->size);
+	}
+
+	current += sizeof(*form);
+	current += sm_read_ui_name(out, &ui_name, current);
+	if (!html_check_form(out, form, &current)) {
+		return cfr_le32_to_cpu(form->size);
+	}
+
+	hobject_open(out, "<div class='tab'", cfr_le32_to_cpu(form->object_id));
+	hflags(out, cfr_le32_to_cpu(form->flags));
+	hlit(out, ">\n");
+	out->depth++;
+	hindent(out);
+	hlit(out, "<input type='radio' id='tab-");
+	hu32(out, cfr_le32_to_cpu(form->object_id));
+	hlit(out, "' name='tab-group'");
+	if (tab_idx == 1) {
+		hlit(out, " checked");
+	}
+	hlit(out, ">\n");
+	hindent(out);
+	hlit(out, "<label class='tab-label' for='tab-");
+	hu32(out, cfr_le32_to_cpu(form->object_id));
+	hlit(out, "'>");
+	hescape(out, &ui_name, HTML_TEXT);
+	hlit(out, "</label>\n");
+	if (out->fragment_dir) {
+		hindent(out);
+		hlit(out, "<div class='tab-content'");
+		hfragment_src(out, cfr_le32_to_cpu(form->object_id));
+		hlit(out, "></div>\n");
+		html_form_fragment(out, cfr_le32_to_cpu(form->object_id), current, limit);
+	} else {
+		hline(out, "<div class='tab-content'>");
+		out->depth++;
+		html_form_table(out, current, limit);
+		out->depth--;
+		hline(out, "</div>");
+	}
+	out->depth--;
+	hline(out, "</div>");
+
+	return cfr_le32_to_cpu(form->size);
+}
+
+static uint32_t _sm_read_object(struct html_out *out, char *current)
+{
+	struct lb_record *rec = (struct lb_record *)current;
+
+	switch (cfr_le32_to_cpu(rec->tag)) {
+	case LB_TAG_CFR_OPTION_ENUM:
+		return sm_read_opt_enum(out, current);
+	case LB_TAG_CFR_OPTION_NUMBER:
+		return sm_read_opt_number(out, current);
+	case LB_TAG_CFR_OPTION_BOOL:
+		return sm_read_opt_bool(out, current);
+	case LB_TAG_CFR_OPTION_VARCHAR:
+		return sm_read_opt_varchar(out, current);
+	case LB_TAG_CFR_OPTION_COMMENT:
+		return sm_read_opt_comment(out, current);
+	case LB_TAG_CFR_OPTION_FORM:
+		return sm_read_form(out, current);
+	default:
+		return cfr_le32_to_cpu(rec->size);
+	}
+}
+
+static uint32_t sm_read_object(struct html_out *out, char *current)
+{
+	hline(out, "<tr>");
+	out->depth++;
+	const uint32_t ret = _sm_read_object(out, current);
+	out->depth--;
+	hline(out, "</tr>");
+	return ret;
+}
+
+/*
+ * Each top-level form is rendered into its own buffer, starting at the
+ * same depth it would have in serial mode. Once all forms are done, the
+ * buffers are written out in their original order.
+ */
+struct form_job {
+	char *form;
+	unsigned int tab_idx;
+	struct html_out out;
+};
+
+struct form_pool {
+	struct form_job *jobs;
+	size_t num_jobs;
+	atomic_size_t next_job;
+};
+
+static void *form_worker(void *arg)
+{
+	struct form_pool *pool = arg;
+
+	size_t i;
+	while ((i = atomic_fetch_add(&pool->next_job, 1)) < pool->num_jobs) {
+		struct form_job *job = &pool->jobs[i];
+		if (job->form) {
+			sm_read_form_tab(&job->out, job->form, job->tab_idx);
+		}
+	}
+	return NULL;
+}
+
+/*
+ * Runs the jobs on up to `max_threads` threads, including the calling one,
+ * which does all of them if no other thread can be started.
+ */
+static void html_run_jobs(struct form_pool *pool, unsigned int max_threads)
+{
+	const unsigned int num_threads = max_threads < pool->num_jobs ? max_threads : pool->num_jobs;
+	pthread_t *threads = num_threads > 1 ? calloc(num_threads, sizeof(*threads)) : NULL;
+	if (!threads) {
+		form_worker(pool);
+		return;
+	}
+
+	unsigned int started = 1;
+	for (; started < num_threads; started++) {
+		if (pthread_create(&threads[started], NULL, form_worker, pool)) {
+			break;
+		}
+	}
+	form_worker(pool);
+	for (unsigned int i = 1; i < started; i++) {
+		pthread_join(threads[i], NULL);
+	}
+	free(threads);
+}
+
+static void html_append_jobs(struct html_out *out, struct form_job *jobs, size_t num_jobs)
+{
+	if (out->fd < 0) {
+		for (size_t i = 0; i < num_jobs; i++) {
+			hwrite(out, jobs[i].out.data, jobs[i].out.len);
+		}
+		return;
+	}
+
+	/* Without vectors, the buffers are written one at a time */
+	struct iovec *iov = calloc(num_jobs + 1, sizeof(*iov));
+	if (!iov) {
+		html_flush(out);
+		for (size_t i = 0; i < num_jobs; i++) {
+			if (cfr_write_all(out->fd, jobs[i].out.data, jobs[i].out.len)) {
+				out->error = true;
+			}
+		}
+		return;
+	}
+	iov[0] = (struct iovec) { .iov_base = out->data, .iov_len = out->len };
+	for (size_t i = 0; i < num_jobs; i++) {
+		iov[i + 1] = (struct iovec) {
+			.iov_base = jobs[i].out.data,
+			.iov_len  = jobs[i].out.len,
+		};
+	}
+	if (writev_all(out->fd, iov, num_jobs + 1)) {
+		out->error = true;
+	}
+	out->len = 0;
+	free(iov);
+}
+
+static char *sm_read_form_tabs_parallel(struct html_out *out, char *current, char *const limit)
+{
+	size_t num_jobs = 0;
+	for (char *p = current; p < limit; p += cfr_le32_to_cpu(((struct lb_record *)p)->size)) {
+		num_jobs++;
+	}
+
+	/* Without jobs, the forms are rendered one after the other */
+	struct form_pool pool = {
+		.jobs = calloc(num_jobs, sizeof(*pool.jobs)),
+		.num_jobs = num_jobs,
+	};
+	if (!pool.jobs) {
+		for (unsigned int tab_idx = 1; current < limit; tab_idx++) {
+			current += sm_read_form_tab(out, current, tab_idx);
+		}
+		return current;
+	}
+
+	for (size_t i = 0; i < num_jobs; i++) {
+		pool.jobs[i] = (struct form_job) {
+			.form = current,
+			.tab_idx = i + 1,
+			.out = {
+				.fd		= -1,
+				.depth		= out->depth,
+				.minify		= out->minify,
+				.fragment_dir	= out->fragment_dir,
+			},
+		};
+		current += cfr_le32_to_cpu(((struct lb_record *)current)->size);
+	}
+
+	html_run_jobs(&pool, out->jobs);
+	html_append_jobs(out, pool.jobs, num_jobs);
+
+	for (size_t i = 0; i < num_jobs; i++) {
+		out->error |= pool.jobs[i].out.error;
+		free(pool.jobs[i].out.data);
+	}
+	free(pool.jobs);
+
+	return current;
+}
+
+/*
+ * Fetches the fragment of a tab the first time it gets opened. Fragments
+ * of nested forms are fetched concurrently once their parent is loaded.
+ */
+static void html_fragment_loader(struct html_out *out)
+{
+	hline(out, "<script>");
+	out->depth++;
+	hline(out, "function cfr_load(el) {");
+	out->depth++;
+	hline(out, "if (el.dataset.loaded) return Promise.resolve();");
+	hline(out, "el.dataset.loaded = '1';");
+	hline(out, "return fetch(el.dataset.src).then(r => r.text()).then(html => {");
+	out->depth++;
+	hline(out, "el.innerHTML = html;");
+	hline(out, "return Promise.all(Array.from(el.querySelectorAll('[data-src]'), cfr_load));");
+	out->depth--;
+	hline(out, "});");
+	out->depth--;
+	hline(out, "}");
+	hline(out, "document.querySelectorAll('.tab > [type=radio]').forEach(radio => {");
+	out->depth++;
+	hline(out, "const content = radio.parentNode.querySelector('.tab-content');");
+	hline(out, "radio.addEventListener('change', () => cfr_load(content));");
+	hline(out, "if (radio.checked) cfr_load(content);");
+	out->depth--;
+	hline(out, "});");
+	out->depth--;
+	hline(out, "</script>");
+}
+
+/* Everything up to the first tab */
+static void html_document_head(struct html_out *out, const struct lb_cfr *cfr_root)
+{
+	hline(out, "<!DOCTYPE html>");
+	hline(out, "<html>");
+	out->depth++;
+	hline(out, "<head>");
+	out->depth++;
+	hline(out, "<link rel='stylesheet' href='style.css'>");
+	out->depth--;
+	hline(out, "</head>");
+	hline(out, "<body>");
+	out->depth++;
+	hpropval(out, "checksum", cfr_le32_to_cpu(cfr_root->checksum));
+
+	if (out->form_action) {
+		hindent(out);
+		hlit(out, "<form method='post' action='");
+		hputs(out, out->form_action);
+		hlit(out, "'>\n");
+		out->depth++;
+	}
+
+	hline(out, "<div class='tabs'>");
+	out->depth++;
+}
+
+/* Everything after the last tab */
+static void html_document_tail(struct html_out *out)
+{
+	out->depth--;
+	hline(out, "</div>");
+
+	if (out->form_action) {
+		hline(out, "<input type='submit' value='Save'>");
+		out->depth--;
+		hline(out, "</form>");
+	}
+
+	if (out->fragment_dir) {
+		html_fragment_loader(out);
+	}
+
+	out->depth--;
+	hline(out, "</body>");
+	out->depth--;
+	hline(out, "</html>");
+}
+
+int cfr_html_render(struct html_out *out, char *current)
+{
+	struct lb_cfr *cfr_root = (struct lb_cfr *)current;
+	char *const limit = current + cfr_le32_to_cpu(cfr_root->size);
+
+	if (!ensure_tag_ok(out, cfr_root, LB_TAG_CFR)) {
+		return -1;
+	}
+
+	html_document_head(out, cfr_root);
+
+	current += cfr_first_form(current);
+	if (out->jobs > 1) {
+		current = sm_read_form_tabs_parallel(out, current, limit);
+	} else {
+		unsigned int tab_idx = 0;
+		while (current < limit) {
+			current += sm_read_form_tab(out, current, ++tab_idx);
+		}
+	}
+
+	assert(current == limit);
+
+	html_document_tail(out);
+	return out->error ? -1 : 0;
+}
+
+/*
+ * The renderer reads every record in the layout cfr_write_setup_menu()
+ * produces, and fails or asserts on anything else. These check that
+ * layout up front, so that rendering a blob which passes never reads
+ * outside of it.
+ */
+
+/* The size of the record at `off` if it fits before `end`, or 0 */
+static uint32_t html_record_size(const char *blob, uint32_t off, uint32_t end)
+{
+	const struct lb_record *rec = (const struct lb_record *)(blob + off);
+	if (end - off < sizeof(*rec)) {
+		return 0;
+	}
+	const uint32_t size = cfr_le32_to_cpu(rec->size);
+	if (size < sizeof(*rec) || size > end - off || size % LB_ENTRY_ALIGN ||
+	    size < cfr_record_header_size(cfr_le32_to_cpu(rec->tag))) {
+		return 0;
+	}
+	return size;
+}
+
+/* Checks the string with `tag` at `*off`, and moves past it. Help texts may be missing. */
+static bool html_string_ok(const char *blob, uint32_t *off, uint32_t end, uint32_t tag)
+{
+	const struct lb_cfr_varbinary *str = (const struct lb_cfr_varbinary *)(blob + *off);
+	const bool optional = tag == LB_TAG_CFR_VARCHAR_UI_HELPTEXT;
+
+	if (optional && (*off == end || cfr_le32_to_cpu(str->tag) != tag)) {
+		return true;
+	}
+	const uint32_t size = html_record_size(blob, *off, end);
+	if (!size || cfr_le32_to_cpu(str->tag) != tag || size < sizeof(*str) ||
+	    !cfr_le32_to_cpu(str->data_length) ||
+	    cfr_le32_to_cpu(str->data_length) > size - sizeof(*str)) {
+		return false;
+	}
+	*off += size;
+	return true;
+}
+
+static bool html_enum_values_ok(const char *blob, uint32_t off, uint32_t end)
+{
+	while (off < end) {
+		const uint32_t size = html_record_size(blob, off, end);
+		if (!size) {
+			return false;
+		}
+		switch (cfr_le32_to_cpu(((const struct lb_record *)(blob + off))->tag)) {
+		case LB_TAG_CFR_ENUM_RANGE: {
+			/* Every value of the range gets rendered */
+			const struct lb_cfr_enum_range *range =
+				(const struct lb_cfr_enum_range *)(blob + off);
+			uint32_t pos = off + sizeof(*range);
+			if (size < sizeof(*range) ||
+			    !cfr_enum_range_fits(cfr_le32_to_cpu(range->start),
+						 cfr_le32_to_cpu(range->count),
+						 cfr_le32_to_cpu(range->step)) ||
+			    !html_string_ok(blob, &pos, off + size, LB_TAG_CFR_VARCHAR_UI_NAME) ||
+			    pos != off + size) {
+				return false;
+			}
+			break;
+		}
+		case LB_TAG_CFR_ENUM_VALUE: {
+			uint32_t pos = off + sizeof(struct lb_cfr_enum_value);
+			if (!html_string_ok(blob, &pos, off + size, LB_TAG_CFR_VARCHAR_UI_NAME) ||
+			    pos != off + size) {
+				return false;
+			}
+			break;
+		}
+		default:
+			return false;
+		}
+		off += size;
+	}
+	return true;
+}
+
+/* The option name, UI name and help text, in the order the renderer reads them */
+static bool html_labels_ok(const char *blob, uint32_t *pos, uint32_t end, bool has_opt_name)
+{
+	return (!has_opt_name || html_string_ok(blob, pos, end, LB_TAG_CFR_VARCHAR_OPT_NAME)) &&
+	       html_string_ok(blob, pos, end, LB_TAG_CFR_VARCHAR_UI_NAME) &&
+	       html_string_ok(blob, pos, end, LB_TAG_CFR_VARCHAR_UI_HELPTEXT);
+}
+
+static bool html_form_ok(const char *blob, uint32_t off, unsigned int depth);
+
+/* Checks the object at `off`, whose size has already been checked */
+static bool html_object_ok(const char *blob, uint32_t off, unsigned int depth)
+{
+	const struct lb_record *rec = (const struct lb_record *)(blob + off);
+	const uint32_t tag = cfr_le32_to_cpu(rec->tag);
+	const uint32_t end = off + cfr_le32_to_cpu(rec->size);
+	uint32_t pos = off + cfr_record_header_size(tag);
+
+	switch (tag) {
+	case LB_TAG_CFR_OPTION_FORM:
+		return html_form_ok(blob, off, depth + 1);
+	case LB_TAG_CFR_OPTION_ENUM:
+		return html_labels_ok(blob, &pos, end, true) && html_enum_values_ok(blob, pos, end);
+	case LB_TAG_CFR_OPTION_NUMBER:
+	case LB_TAG_CFR_OPTION_BOOL:
+		return html_labels_ok(blob, &pos, end, true) && pos == end;
+	case LB_TAG_CFR_OPTION_VARCHAR:
+		return html_string_ok(blob, &pos, end, LB_TAG_CFR_VARCHAR_DEF_VALUE) &&
+		       html_labels_ok(blob, &pos, end, true) && pos == end;
+	case LB_TAG_CFR_OPTION_COMMENT:
+		return html_labels_ok(blob, &pos, end, false) && pos == end;
+	default:
+		/* Skipped by the renderer */
+		return true;
+	}
+}
+
+static bool html_form_ok(const char *blob, uint32_t off, unsigned int depth)
+{
+	const struct lb_cfr_option_form *form = (const struct lb_cfr_option_form *)(blob + off);
+	const uint32_t end = off + cfr_le32_to_cpu(form->size);
+	uint32_t pos = off + sizeof(*form);
+
+	if (depth > CFR_HTML_MAX_DEPTH ||
+	    !html_string_ok(blob, &pos, end, LB_TAG_CFR_VARCHAR_UI_NAME)) {
+		return false;
+	}
+	if (cfr_form_checksum(form)) {
+		pos += sizeof(struct lb_cfr_form_checksum);
+	}
+	while (pos < end) {
+		const uint32_t size = html_record_size(blob, pos, end);
+		if (!size || !html_object_ok(blob, pos, depth)) {
+			return false;
+		}
+		pos += size;
+	}
+	return true;
+}
+
+bool cfr_html_blob_ok(const char *blob, size_t len)
+{
+	const struct lb_cfr *cfr_root = (const struct lb_cfr *)blob;
+	if (len < sizeof(*cfr_root) || cfr_le32_to_cpu(cfr_root->tag) != LB_TAG_CFR ||
+	    cfr_le32_to_cpu(cfr_root->size) < sizeof(*cfr_root) ||
+	    cfr_le32_to_cpu(cfr_root->size) > len) {
+		return false;
+	}
+
+	const uint32_t end = cfr_le32_to_cpu(cfr_root->size);
+	uint32_t offset = cfr_first_form(blob);
+	if (offset % LB_ENTRY_ALIGN) {
+		return false;
+	}
+	while (offset < end) {
+		const uint32_t size = html_record_size(blob, offset, end);
+		if (!size ||
+		    cfr_le32_to_cpu(((const struct lb_record *)(blob + offset))->tag) !=
+		    LB_TAG_CFR_OPTION_FORM || !html_form_ok(blob, offset, 0)) {
+			return false;
+		}
+		offset += size;
+	}
+	return true;
+}
+
+int cfr_html_render_blob(struct html_out *out, char *blob, size_t len)
+{
+	if (!cfr_html_blob_ok(blob, len)) {
+		fprintf(stderr, "Not a valid CFR blob of %zu bytes\n", len);
+		return -1;
+	}
+	cfr_html_render(out, blob);
+	html_flush(out);
+	return out->error ? -1 : 0;
+}
+
+/*
+ * A tab can be reused if the form has the same object ID, size and CRC32
+ * as before, and is still the first tab or still not. The last tab to
+ * match is tried first, so that lookups stay linear when forms are only
+ * edited in place.
+ */
+static struct cfr_html_cached_form *html_cache_lookup(struct cfr_html_cache *cache,
+						       const struct cfr_html_cached_form *key,
+						       size_t *hint)
+{
+	for (size_t n = 0; n < cache->num_forms; n++) {
+		const size_t i = (*hint + n) % cache->num_forms;
+		struct cfr_html_cached_form *entry = &cache->forms[i];
+		if (entry->html && entry->object_id == key->object_id &&
+		    entry->size == key->size && entry->crc == key->crc &&
+		    entry->first == key->first) {
+			*hint = i + 1;
+			return entry;
+		}
+	}
+	return NULL;
+}
+
+size_t cfr_html_render_cached(struct html_out *out, char *current, struct cfr_html_cache *cache)
+{
+	struct lb_cfr *cfr_root = (struct lb_cfr *)current;
+	char *const limit = current + cfr_le32_to_cpu(cfr_root->size);
+
+	if (!ensure_tag_ok(out, cfr_root, LB_TAG_CFR)) {
+		return 0;
+	}
+	assert(!out->fragment_dir);
+
+	current += cfr_first_form(current);
+	size_t num_jobs = 0;
+	for (char *p = current; p < limit; p += cfr_le32_to_cpu(((struct lb_record *)p)->size)) {
+		num_jobs++;
+	}
+
+	struct form_pool pool = {
+		.jobs = calloc(num_jobs, sizeof(*pool.jobs)),
+		.num_jobs = num_jobs,
+	};
+	struct cfr_html_cached_form *forms = calloc(num_jobs, sizeof(*forms));
+	if (!pool.jobs || !forms) {
+		fprintf(stderr, "Could not allocate %zu form jobs\n", num_jobs);
+		free(pool.jobs);
+		free(forms);
+		out->error = true;
+		return 0;
+	}
+
+	html_document_head(out, cfr_root);
+
+	/* Unchanged forms take their HTML over from the cache, the others get rendered */
+	size_t hint = 0;
+	size_t num_rendered = 0;
+	for (size_t i = 0; i < num_jobs; i++) {
+		const struct lb_cfr_option_form *form = (const struct lb_cfr_option_form *)current;
+
+		pool.jobs[i] = (struct form_job) {
+			.tab_idx = i + 1,
+			.out = {
+				.fd		= -1,
+				.depth		= out->depth,
+				.minify		= out->minify,
+			},
+		};
+		if (!ensure_tag_ok(&pool.jobs[i].out, form, LB_TAG_CFR_OPTION_FORM)) {
+			current += cfr_le32_to_cpu(form->size);
+			continue;
+		}
+		forms[i] = (struct cfr_html_cached_form) {
+			.object_id	= cfr_le32_to_cpu(form->object_id),
+			.size		= cfr_le32_to_cpu(form->size),
+			.crc		= cfr_form_crc32(form),
+			.first		= i == 0,
+		};
+
+		/*
+		 * The key of forms with a CRC record is the stored CRC, which says
+		 * nothing about the rest of the form until it has been checked.
+		 * Forms that fail are left out like sm_read_form_tab() does.
+		 */
+		struct cfr_html_cached_form *cached;
+		if (cfr_check_form(form)) {
+			pool.jobs[i].out.error = true;
+		} else if ((cached = html_cache_lookup(cache, &forms[i], &hint))) {
+			pool.jobs[i].out.data = cached->html;
+			pool.jobs[i].out.len = cached->len;
+			cached->html = NULL;
+		} else {
+			pool.jobs[i].form = current;
+			num_rendered++;
+		}
+		current += forms[i].size;
+	}
+	assert(current == limit);
+
+	html_run_jobs(&pool, out->jobs);
+	html_append_jobs(out, pool.jobs, num_jobs);
+
+	/* Forms that failed to render are not kept, so they get retried next time */
+	cfr_html_cache_free(cache);
+	for (size_t i = 0; i < num_jobs; i++) {
+		if (pool.jobs[i].out.error) {
+			out->error = true;
+			free(pool.jobs[i].out.data);
+			continue;
+		}
+		forms[i].html = pool.jobs[i].out.data;
+		forms[i].len = pool.jobs[i].out.len;
+	}
+	cache->forms = forms;
+	cache->num_forms = num_jobs;
+	free(pool.jobs);
+
+	html_document_tail(out);
+	return num_rendered;
+}
+
+void cfr_html_cache_free(struct cfr_html_cache *cache)
+{
+	for (size_t i = 0; i < cache->num_forms; i++) {
+		free(cache->forms[i].html);
+	}
+	free(cache->forms);
+	cache->forms = NULL;
+	cache->num_forms = 0;
+}
+
+int cfr_html_render_form(struct html_out *out, char *blob, uint32_t object_id)
+{
+	const uint32_t offset = cfr_find_form(blob, object_id);
+	if (!offset) {
+		return -1;
+	}
+
+	char *current = blob + offset;
+	struct lb_cfr_option_form *form = (struct lb_cfr_option_form *)current;
+	char *const limit = current + cfr_le32_to_cpu(form->size);
+
+	struct cfr_str ui_name;
+
+	current += sizeof(*form);
+	current += sm_read_ui_name(out, &ui_name, current);
+	if (cfr_form_checksum(form)) {
+		if (cfr_check_form(form)) {
+			return -1;
+		}
+		current += sizeof(struct lb_cfr_form_checksum);
+	}
+
+	html_form_table(out, current, limit);
+	return out->error ? -1 : 0;
+}
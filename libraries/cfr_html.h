@@ -0,0 +1,90 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+
+#ifndef CFR_HTML_H
+#define CFR_HTML_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * All output is appended to a single growing buffer. When the buffer is
+ * backed by a file descriptor, it gets flushed with one large `write()`
+ * whenever it would otherwise have to grow, and once more at the end.
+ *
+ * This is all the state a rendering needs: documents can be rendered
+ * concurrently on any number of threads, as long as each has its own.
+ */
+struct html_out {
+	char *data;
+	size_t len;
+	size_t cap;
+	int fd;			/* -1 if the buffer is never flushed */
+	int depth;
+	bool minify;		/* Omit indentation */
+	bool error;
+	const char *fragment_dir; /* If set, forms are written to separate files */
+	unsigned int jobs;	/* Threads rendering top-level forms */
+	const char *form_action; /* If set, wrap the inputs in a form posting here */
+};
+
+void html_flush(struct html_out *out);
+
+/*
+ * Renders the CFR blob starting at `blob` as a complete HTML document.
+ * Errors, such as running out of memory or records that are not where
+ * they belong, are reported and set `out->error`, and the rendering goes
+ * on without the parts that failed. Returns -1 if `out->error` is set.
+ */
+int cfr_html_render(struct html_out *out, char *blob);
+
+/*
+ * Checks that every record of the blob fits into the `len` bytes and into
+ * its parent, and is laid out the way the renderer reads it, with forms
+ * nested no deeper than it is willing to go. Rendering a blob that passes
+ * never reads outside of it.
+ */
+bool cfr_html_blob_ok(const char *blob, size_t len);
+
+/*
+ * Same as cfr_html_render(), for blobs that are not trusted yet: checks
+ * them with cfr_html_blob_ok() first, and flushes the output. Returns -1
+ * if the check fails, or if writing the output failed.
+ */
+int cfr_html_render_blob(struct html_out *out, char *blob, size_t len);
+
+/* The HTML of one top-level form as it was last rendered */
+struct cfr_html_cached_form {
+	uint32_t object_id;
+	uint32_t size;
+	uint32_t crc;		/* CRC32 of the form, see cfr_form_crc32() */
+	bool first;		/* The first tab is the checked one */
+	char *html;
+	size_t len;
+};
+
+struct cfr_html_cache {
+	struct cfr_html_cached_form *forms;
+	size_t num_forms;
+};
+
+/*
+ * Renders the same document as cfr_html_render(), but only re-renders the
+ * top-level forms whose CRC32 differs from the one in `cache`. The HTML of
+ * all others is taken over from the cache, which is then replaced by the
+ * forms of this blob. Forms that do not match their CRC record are left
+ * out and set `out->error`, cached or not. Fragment mode is not supported.
+ * Returns the number of forms that had to be rendered.
+ */
+size_t cfr_html_render_cached(struct html_out *out, char *blob, struct cfr_html_cache *cache);
+void cfr_html_cache_free(struct cfr_html_cache *cache);
+
+/*
+ * Renders the objects of a single form, like a fragment in paginated
+ * mode. Only the records of that form are read if the blob has a form
+ * directory. Returns -1 if there is no such form, if its CRC does not
+ * match, or if `out->error` is set.
+ */
+int cfr_html_render_form(struct html_out *out, char *blob, uint32_t object_id);
+
+#endif	/* CFR_HTML_H */
@@ -0,0 +1,478 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+
+/* For getline() */
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cfr.h"
+#include "cfr_ids.h"
+
+#define CFR_IDS_MAX_DEPTH	32
+
+struct id_entry {
+	char *path;
+	uint32_t len;
+	uint32_t hash;		/* Of the path */
+	uint32_t id;
+	bool assigned;		/* To an object of the blob being processed */
+};
+
+struct cfr_id_map {
+	struct id_entry *entries;	/* In allocation order */
+	size_t num_entries;
+	size_t max_entries;
+
+	/* Open addressing indices into `entries`, plus one so that 0 marks free slots */
+	uint32_t *by_path;
+	uint32_t *by_id;
+	size_t capacity;		/* Power of two */
+};
+
+/* FNV-1a, continuing from `hash` */
+static uint32_t fnv1a(uint32_t hash, const void *data, size_t len)
+{
+	const uint8_t *bytes = data;
+	for (size_t i = 0; i < len; i++) {
+		hash = (hash ^ bytes[i]) * 0x01000193;
+	}
+	return hash;
+}
+
+static uint32_t path_hash(const char *path, size_t len)
+{
+	return fnv1a(0x811c9dc5, path, len);
+}
+
+/* The ID of the path on attempt number `salt`, 0 being the plain hash */
+static uint32_t stable_id(uint32_t hash, uint32_t salt)
+{
+	if (salt) {
+		const uint32_t le = cfr_cpu_to_le32(salt);
+		hash = fnv1a(fnv1a(hash, "#", 1), &le, sizeof(le));
+	}
+	/* Object ID 0 means someone messed up */
+	return hash ? hash : 1;
+}
+
+static size_t id_slot(const struct cfr_id_map *map, uint32_t id)
+{
+	return (id * 0x9e3779b1u) & (map->capacity - 1);
+}
+
+struct cfr_id_map *cfr_id_map_new(void)
+{
+	struct cfr_id_map *map = calloc(1, sizeof(*map));
+	if (!map) {
+		fprintf(stderr, "Could not allocate ID map\n");
+	}
+	return map;
+}
+
+void cfr_id_map_free(struct cfr_id_map *map)
+{
+	if (!map) {
+		return;
+	}
+	for (size_t i = 0; i < map->num_entries; i++) {
+		free(map->entries[i].path);
+	}
+	free(map->entries);
+	free(map->by_path);
+	free(map->by_id);
+	free(map);
+}
+
+static struct id_entry *find_path(const struct cfr_id_map *map, const char *path, uint32_t len,
+				  uint32_t hash)
+{
+	if (!map->capacity) {
+		return NULL;
+	}
+	for (size_t i = hash & (map->capacity - 1); map->by_path[i]; i = (i + 1) & (map->capacity - 1)) {
+		struct id_entry *entry = &map->entries[map->by_path[i] - 1];
+		if (entry->hash == hash && entry->len == len && !memcmp(entry->path, path, len)) {
+			return entry;
+		}
+	}
+	return NULL;
+}
+
+static struct id_entry *find_id(const struct cfr_id_map *map, uint32_t id)
+{
+	if (!map->capacity) {
+		return NULL;
+	}
+	for (size_t i = id_slot(map, id); map->by_id[i]; i = (i + 1) & (map->capacity - 1)) {
+		struct id_entry *entry = &map->entries[map->by_id[i] - 1];
+		if (entry->id == id) {
+			return entry;
+		}
+	}
+	return NULL;
+}
+
+static void index_entry(struct cfr_id_map *map, uint32_t index)
+{
+	const struct id_entry *entry = &map->entries[index];
+
+	size_t i = entry->hash & (map->capacity - 1);
+	while (map->by_path[i]) {
+		i = (i + 1) & (map->capacity - 1);
+	}
+	map->by_path[i] = index + 1;
+
+	i = id_slot(map, entry->id);
+	while (map->by_id[i]) {
+		i = (i + 1) & (map->capacity - 1);
+	}
+	map->by_id[i] = index + 1;
+}
+
+static int grow_indices(struct cfr_id_map *map)
+{
+	const size_t capacity = map->capacity ? map->capacity * 2 : 1024;
+	uint32_t *by_path = calloc(capacity, sizeof(*by_path));
+	uint32_t *by_id = calloc(capacity, sizeof(*by_id));
+	if (!by_path || !by_id) {
+		fprintf(stderr, "Could not allocate %zu ID map slots\n", capacity);
+		free(by_path);
+		free(by_id);
+		return -1;
+	}
+	free(map->by_path);
+	free(map->by_id);
+	map->by_path = by_path;
+	map->by_id = by_id;
+	map->capacity = capacity;
+
+	for (size_t i = 0; i < map->num_entries; i++) {
+		index_entry(map, i);
+	}
+	return 0;
+}
+
+/* The caller makes sure that neither the path nor the ID are in the map yet */
+static struct id_entry *add_entry(struct cfr_id_map *map, const char *path, uint32_t len,
+				  uint32_t hash, uint32_t id)
+{
+	if (2 * (map->num_entries + 1) > map->capacity && grow_indices(map)) {
+		return NULL;
+	}
+	if (map->num_entries == map->max_entries) {
+		const size_t max_entries = map->max_entries ? map->max_entries * 2 : 256;
+		struct id_entry *entries = realloc(map->entries, max_entries * sizeof(*entries));
+		if (!entries) {
+			fprintf(stderr, "Could not allocate %zu ID map entries\n", max_entries);
+			return NULL;
+		}
+		map->entries = entries;
+		map->max_entries = max_entries;
+	}
+
+	char *copy = malloc(len + 1);
+	if (!copy) {
+		fprintf(stderr, "Could not allocate %u bytes for a path\n", len + 1);
+		return NULL;
+	}
+	memcpy(copy, path, len);
+	copy[len] = '\0';
+
+	struct id_entry *entry = &map->entries[map->num_entries];
+	*entry = (struct id_entry) {
+		.path	= copy,
+		.len	= len,
+		.hash	= hash,
+		.id	= id,
+	};
+	index_entry(map, map->num_entries++);
+	return entry;
+}
+
+int cfr_id_map_load(struct cfr_id_map *map, const char *filename)
+{
+	FILE *stream = fopen(filename, "r");
+	if (!stream) {
+		if (errno == ENOENT) {
+			return 0;
+		}
+		fprintf(stderr, "Could not open '%s': %s\n", filename, strerror(errno));
+		return -1;
+	}
+
+	int ret = 0;
+	char *line = NULL;
+	size_t line_size = 0;
+	ssize_t len;
+	for (unsigned int line_number = 1; !ret && (len = getline(&line, &line_size, stream)) >= 0;
+	     line_number++) {
+		if (len && line[len - 1] == '\n') {
+			line[--len] = '\0';
+		}
+		if (!len || line[0] == '#') {
+			continue;
+		}
+
+		char *path;
+		const unsigned long id = strtoul(line, &path, 0);
+		if (path == line || *path != ' ' || !id || id > UINT32_MAX) {
+			fprintf(stderr, "%s:%u: expected '<object ID> <path>'\n", filename, line_number);
+			ret = -1;
+			break;
+		}
+		path++;
+
+		const uint32_t path_len = len - (path - line);
+		const uint32_t hash = path_hash(path, path_len);
+		if (find_path(map, path, path_len, hash) || find_id(map, id)) {
+			fprintf(stderr, "%s:%u: path or object ID listed twice\n", filename, line_number);
+			ret = -1;
+		} else if (!add_entry(map, path, path_len, hash, id)) {
+			ret = -1;
+		}
+	}
+	if (!ret && ferror(stream)) {
+		fprintf(stderr, "Could not read '%s'\n", filename);
+		ret = -1;
+	}
+
+	free(line);
+	fclose(stream);
+	return ret;
+}
+
+int cfr_id_map_save(const struct cfr_id_map *map, const char *filename)
+{
+	FILE *stream = fopen(filename, "w");
+	if (!stream) {
+		fprintf(stderr, "Could not open '%s': %s\n", filename, strerror(errno));
+		return -1;
+	}
+
+	fprintf(stream, "# CFR object ID allocation map: <object ID> <path>\n");
+	for (size_t i = 0; i < map->num_entries; i++) {
+		fprintf(stream, "0x%08x %s\n", map->entries[i].id, map->entries[i].path);
+	}
+
+	int ret = ferror(stream) ? -1 : 0;
+	if (fclose(stream)) {
+		ret = -1;
+	}
+	if (ret) {
+		fprintf(stderr, "Could not write '%s'\n", filename);
+	}
+	return ret;
+}
+
+/*
+ * Blob rewriting
+ */
+
+struct id_walker {
+	char *blob;
+	struct cfr_id_map *map;
+	char *path;
+	size_t len;
+	size_t max_len;
+};
+
+static struct lb_record *record_at(const struct id_walker *w, uint32_t offset)
+{
+	return (struct lb_record *)(w->blob + offset);
+}
+
+/* Records with an object ID, the root and enum values are the exception */
+static bool is_object(uint32_t tag)
+{
+	return tag != LB_TAG_CFR && tag != LB_TAG_CFR_ENUM_VALUE && tag != LB_TAG_CFR_ENUM_RANGE &&
+	       cfr_record_header_size(tag);
+}
+
+/* Appends the name of the object to the path. Returns -1 if it has none. */
+static int push_name(struct id_walker *w, uint32_t offset)
+{
+	const struct lb_record *rec = record_at(w, offset);
+	const uint32_t tag = cfr_le32_to_cpu(rec->tag);
+	const uint32_t name_tag = tag == LB_TAG_CFR_OPTION_FORM || tag == LB_TAG_CFR_OPTION_COMMENT ?
+				  LB_TAG_CFR_VARCHAR_UI_NAME : LB_TAG_CFR_VARCHAR_OPT_NAME;
+	const uint32_t end = offset + cfr_le32_to_cpu(rec->size);
+
+	for (uint32_t off = offset + cfr_record_header_size(tag); off < end;) {
+		const struct lb_cfr_varbinary *str = (const struct lb_cfr_varbinary *)record_at(w, off);
+		const uint32_t size = cfr_le32_to_cpu(str->size);
+		if (end - off < sizeof(struct lb_record) || size < sizeof(struct lb_record) ||
+		    size > end - off) {
+			break;
+		}
+		const uint32_t data_length = cfr_le32_to_cpu(str->data_length);
+		if (cfr_le32_to_cpu(str->tag) != name_tag || size < sizeof(*str) ||
+		    data_length < 1 || data_length > size - sizeof(*str)) {
+			off += size;
+			continue;
+		}
+
+		/* The NUL is not part of the name, and newlines would break the map file */
+		const size_t name_len = strnlen((const char *)str->data, data_length);
+		if (memchr(str->data, '\n', name_len)) {
+			break;
+		}
+		const size_t needed = w->len + 1 + name_len + 1;
+		if (needed > w->max_len) {
+			const size_t max_len = needed * 2;
+			char *path = realloc(w->path, max_len);
+			if (!path) {
+				fprintf(stderr, "Could not allocate %zu bytes for a path\n", max_len);
+				return -1;
+			}
+			w->path = path;
+			w->max_len = max_len;
+		}
+		if (w->len) {
+			w->path[w->len++] = '/';
+		}
+		memcpy(w->path + w->len, str->data, name_len);
+		w->len += name_len;
+		w->path[w->len] = '\0';
+		return 0;
+	}
+
+	fprintf(stderr, "Object %u at offset 0x%x has no usable name\n",
+		cfr_le32_to_cpu(((const struct lb_cfr_option_form *)rec)->object_id), offset);
+	return -1;
+}
+
+static int assign_id(struct id_walker *w, uint32_t offset)
+{
+	struct lb_cfr_option_form *object = (struct lb_cfr_option_form *)record_at(w, offset);
+	const uint32_t hash = path_hash(w->path, w->len);
+
+	struct id_entry *entry = find_path(w->map, w->path, w->len, hash);
+	if (entry && entry->assigned) {
+		fprintf(stderr, "Object at offset 0x%x has the same path '%s' as another one\n",
+			offset, w->path);
+		return -1;
+	}
+	if (!entry) {
+		uint32_t salt = 0;
+		while (find_id(w->map, stable_id(hash, salt))) {
+			salt++;
+		}
+		if (salt) {
+			fprintf(stderr, "Object ID of '%s' reassigned to 0x%08x after a collision\n",
+				w->path, stable_id(hash, salt));
+		}
+		entry = add_entry(w->map, w->path, w->len, hash, stable_id(hash, salt));
+		if (!entry) {
+			return -1;
+		}
+	}
+
+	entry->assigned = true;
+	object->object_id = cfr_cpu_to_le32(entry->id);
+	return 0;
+}
+
+static int assign_ids(struct id_walker *w, uint32_t parent, unsigned int depth)
+{
+	const struct lb_record *rec = record_at(w, parent);
+	const uint32_t end = parent + cfr_le32_to_cpu(rec->size);
+
+	if (depth > CFR_IDS_MAX_DEPTH) {
+		fprintf(stderr, "Records nested too deep at offset 0x%x\n", parent);
+		return -1;
+	}
+	for (uint32_t off = parent + cfr_record_header_size(cfr_le32_to_cpu(rec->tag)); off < end;) {
+		const struct lb_record *child = record_at(w, off);
+		const uint32_t tag = cfr_le32_to_cpu(child->tag);
+		const uint32_t size = cfr_le32_to_cpu(child->size);
+		if (end - off < sizeof(*child) || size < sizeof(*child) || size > end - off ||
+		    size < cfr_record_header_size(tag)) {
+			fprintf(stderr, "Bad size %u of record at offset 0x%x\n", size, off);
+			return -1;
+		}
+		if (!is_object(tag)) {
+			off += size;
+			continue;
+		}
+
+		const size_t parent_len = w->len;
+		if (push_name(w, off) || assign_id(w, off)) {
+			return -1;
+		}
+		if (tag == LB_TAG_CFR_OPTION_FORM) {
+			if (assign_ids(w, off, depth + 1)) {
+				return -1;
+			}
+			/* Forms inside this one are done, so their CRCs are already final */
+			struct lb_cfr_option_form *form = (struct lb_cfr_option_form *)child;
+			struct lb_cfr_form_checksum *crc =
+				(struct lb_cfr_form_checksum *)cfr_form_checksum(form);
+			if (crc) {
+				crc->checksum = 0;
+				crc->checksum = cfr_cpu_to_le32(cfr_crc32(form, size));
+			}
+		}
+		w->len = parent_len;
+		off += size;
+	}
+	return 0;
+}
+
+int cfr_assign_stable_ids(char *blob, struct cfr_id_map *map)
+{
+	struct lb_cfr *root = (struct lb_cfr *)blob;
+	if (cfr_le32_to_cpu(root->tag) != LB_TAG_CFR || cfr_le32_to_cpu(root->size) < sizeof(*root)) {
+		fprintf(stderr, "Not a CFR blob\n");
+		return -1;
+	}
+
+	struct cfr_id_map *own_map = NULL;
+	if (!map) {
+		map = own_map = cfr_id_map_new();
+		if (!map) {
+			return -1;
+		}
+	}
+	for (size_t i = 0; i < map->num_entries; i++) {
+		map->entries[i].assigned = false;
+	}
+
+	struct id_walker w = {
+		.blob	= blob,
+		.map	= map,
+	};
+	const int ret = assign_ids(&w, 0, 0);
+	free(w.path);
+	cfr_id_map_free(own_map);
+	if (ret) {
+		return -1;
+	}
+
+	/* The directory lists forms by ID, and they are all where they were */
+	struct lb_cfr_form_directory *directory =
+		(struct lb_cfr_form_directory *)cfr_form_directory(blob);
+	if (directory) {
+		struct lb_cfr_form_directory_entry *entries =
+			(struct lb_cfr_form_directory_entry *)(directory + 1);
+		const uint32_t size = cfr_le32_to_cpu(root->size);
+		for (uint32_t i = 0; i < cfr_le32_to_cpu(directory->num_entries); i++) {
+			const uint32_t offset = cfr_le32_to_cpu(entries[i].offset);
+			if (offset > size - sizeof(struct lb_cfr_option_form)) {
+				fprintf(stderr, "Form directory entry %u is out of bounds\n", i);
+				return -1;
+			}
+			const struct lb_cfr_option_form *form =
+				(const struct lb_cfr_option_form *)(blob + offset);
+			entries[i].object_id = form->object_id;
+		}
+	}
+
+	root->checksum = 0;
+	root->checksum = cfr_cpu_to_le32(cfr_crc32(blob, cfr_le32_to_cpu(root->size)));
+	return 0;
+}
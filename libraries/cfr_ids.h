@@ -0,0 +1,46 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+
+#ifndef CFR_IDS_H
+#define CFR_IDS_H
+
+#include <stdint.h>
+
+/*
+ * Stable object IDs. Handing out IDs from a counter renumbers every
+ * object after an inserted one, which invalidates everything keyed by
+ * object ID downstream. These IDs are derived from the path of every
+ * object instead: the UI names of the forms it is in, followed by its
+ * option name, or its UI name for forms and comments. For example:
+ *
+ *   Main/Power/power_on_after_fail
+ *
+ * An ID is the FNV-1a hash of the path, so it only changes with it.
+ * When a path hashes to an ID that is already taken, it is rehashed
+ * with a salt until it gets a free one.
+ *
+ * Which of two colliding paths keeps the plain hash would depend on the
+ * order of the objects, so an allocation map can record the ID of every
+ * path ever assigned. Paths in the map always get the same ID back, and
+ * the IDs of removed objects are never reused for other paths. The map
+ * is a text file of "<ID> <path>" lines in allocation order, meant to be
+ * kept under version control next to the menu.
+ */
+
+struct cfr_id_map;
+
+struct cfr_id_map *cfr_id_map_new(void);
+void cfr_id_map_free(struct cfr_id_map *map);
+
+/* Adds the entries of the map file to `map`. A missing file is an empty map. */
+int cfr_id_map_load(struct cfr_id_map *map, const char *filename);
+int cfr_id_map_save(const struct cfr_id_map *map, const char *filename);
+
+/*
+ * Replaces the ID of every object in the v1 blob with its stable one,
+ * and updates the form directory, the form CRCs and the root checksum
+ * to match. New paths are added to `map`, which may be NULL. Fails if
+ * two objects have the same path, as they cannot be told apart.
+ */
+int cfr_assign_stable_ids(char *blob, struct cfr_id_map *map);
+
+#endif	/* CFR_IDS_H */
@@ -0,0 +1,370 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cfr.h"
+#include "cfr_lint.h"
+
+#define CFR_LINT_MAX_DEPTH	32
+
+#define CFR_OPTFLAGS_ALL	(CFR_OPTFLAG_READONLY | CFR_OPTFLAG_GRAYOUT | \
+				 CFR_OPTFLAG_SUPPRESS | CFR_OPTFLAG_VOLATILE)
+
+struct lint;
+
+/*
+ * Open addressing set of record offsets. Offset 0 is the root, so it
+ * marks free slots. The hash of every entry is kept next to it, so that
+ * growing the set never has to look at the records again.
+ */
+struct offset_set {
+	uint32_t *offsets;
+	uint32_t *hashes;
+	size_t capacity;	/* Power of two */
+	size_t count;
+	bool (*same)(const struct lint *lint, uint32_t a, uint32_t b);
+};
+
+struct lint {
+	FILE *out;
+	const char *blob;
+	unsigned int violations;
+	bool out_of_memory;
+	struct offset_set ids;		/* Objects, by object ID */
+	struct offset_set names;	/* Options, by name */
+};
+
+__attribute__((format(printf, 3, 4)))
+static void report(struct lint *lint, uint32_t offset, const char *fmt, ...)
+{
+	va_list args;
+	va_start(args, fmt);
+	fprintf(lint->out, "0x%x: ", offset);
+	vfprintf(lint->out, fmt, args);
+	fputc('\n', lint->out);
+	va_end(args);
+	lint->violations++;
+}
+
+static const struct lb_record *record_at(const struct lint *lint, uint32_t offset)
+{
+	return (const struct lb_record *)(lint->blob + offset);
+}
+
+static uint32_t record_tag(const struct lint *lint, uint32_t offset)
+{
+	return cfr_le32_to_cpu(record_at(lint, offset)->tag);
+}
+
+static uint32_t record_size(const struct lint *lint, uint32_t offset)
+{
+	return cfr_le32_to_cpu(record_at(lint, offset)->size);
+}
+
+/* Records with an object ID, the root and enum values are the exception */
+static bool is_object(uint32_t tag)
+{
+	return tag != LB_TAG_CFR && tag != LB_TAG_CFR_ENUM_VALUE && tag != LB_TAG_CFR_ENUM_RANGE &&
+	       cfr_record_header_size(tag);
+}
+
+static bool is_string(uint32_t tag)
+{
+	switch (tag) {
+	case LB_TAG_CFR_VARCHAR_OPT_NAME:
+	case LB_TAG_CFR_VARCHAR_UI_NAME:
+	case LB_TAG_CFR_VARCHAR_UI_HELPTEXT:
+	case LB_TAG_CFR_VARCHAR_DEF_VALUE:
+		return true;
+	default:
+		return false;
+	}
+}
+
+static uint32_t object_id(const struct lint *lint, uint32_t offset)
+{
+	/* All object records start with the same fields as a form */
+	return cfr_le32_to_cpu(((const struct lb_cfr_option_form *)record_at(lint, offset))->object_id);
+}
+
+static const struct lb_cfr_varbinary *string_at(const struct lint *lint, uint32_t offset)
+{
+	return (const struct lb_cfr_varbinary *)record_at(lint, offset);
+}
+
+static bool same_id(const struct lint *lint, uint32_t a, uint32_t b)
+{
+	return object_id(lint, a) == object_id(lint, b);
+}
+
+static uint32_t hash_id(uint32_t id)
+{
+	return id * 0x9e3779b1u;
+}
+
+/* FNV-1a */
+static uint32_t hash_string(const uint8_t *data, uint32_t len)
+{
+	uint32_t hash = 0x811c9dc5;
+	for (uint32_t i = 0; i < len; i++) {
+		hash = (hash ^ data[i]) * 0x01000193;
+	}
+	return hash;
+}
+
+static uint32_t set_lookup_or_insert(struct lint *lint, struct offset_set *set, uint32_t hash,
+				     uint32_t offset);
+
+static bool set_grow(struct lint *lint, struct offset_set *set)
+{
+	uint32_t *old_offsets = set->offsets;
+	uint32_t *old_hashes = set->hashes;
+	const size_t old_capacity = set->capacity;
+
+	set->capacity = old_capacity ? old_capacity * 2 : 1024;
+	set->offsets = calloc(set->capacity, sizeof(*set->offsets));
+	set->hashes = malloc(set->capacity * sizeof(*set->hashes));
+	if (!set->offsets || !set->hashes) {
+		fprintf(stderr, "Could not allocate %zu set entries\n", set->capacity);
+		free(set->offsets);
+		free(set->hashes);
+		set->offsets = old_offsets;
+		set->hashes = old_hashes;
+		set->capacity = old_capacity;
+		lint->out_of_memory = true;
+		return false;
+	}
+
+	/* All entries are unique, so they can go straight into free slots */
+	set->count = 0;
+	for (size_t i = 0; i < old_capacity; i++) {
+		if (!old_offsets[i]) {
+			continue;
+		}
+		size_t j = old_hashes[i] & (set->capacity - 1);
+		while (set->offsets[j]) {
+			j = (j + 1) & (set->capacity - 1);
+		}
+		set->offsets[j] = old_offsets[i];
+		set->hashes[j] = old_hashes[i];
+		set->count++;
+	}
+	free(old_offsets);
+	free(old_hashes);
+	return true;
+}
+
+/* Returns the offset of an equal entry, or 0 after adding this one */
+static uint32_t set_lookup_or_insert(struct lint *lint, struct offset_set *set, uint32_t hash,
+				     uint32_t offset)
+{
+	if (2 * (set->count + 1) > set->capacity && !set_grow(lint, set)) {
+		return 0;
+	}
+
+	size_t i = hash & (set->capacity - 1);
+	for (; set->offsets[i]; i = (i + 1) & (set->capacity - 1)) {
+		if (set->hashes[i] == hash && set->same(lint, set->offsets[i], offset)) {
+			return set->offsets[i];
+		}
+	}
+	set->offsets[i] = offset;
+	set->hashes[i] = hash;
+	set->count++;
+	return 0;
+}
+
+static void set_free(struct offset_set *set)
+{
+	free(set->offsets);
+	free(set->hashes);
+}
+
+/* The string record with `tag` among the children of the object, or 0 */
+static uint32_t find_string(const struct lint *lint, uint32_t offset, uint32_t tag)
+{
+	const uint32_t end = offset + record_size(lint, offset);
+
+	for (uint32_t off = offset + cfr_record_header_size(record_tag(lint, offset)); off < end;
+	     off += record_size(lint, off)) {
+		if (record_tag(lint, off) == tag) {
+			return off;
+		}
+	}
+	return 0;
+}
+
+static bool same_name(const struct lint *lint, uint32_t a, uint32_t b)
+{
+	const struct lb_cfr_varbinary *name_a =
+		string_at(lint, find_string(lint, a, LB_TAG_CFR_VARCHAR_OPT_NAME));
+	const struct lb_cfr_varbinary *name_b =
+		string_at(lint, find_string(lint, b, LB_TAG_CFR_VARCHAR_OPT_NAME));
+	return name_a->data_length == name_b->data_length &&
+	       !memcmp(name_a->data, name_b->data, cfr_le32_to_cpu(name_a->data_length));
+}
+
+static void lint_object(struct lint *lint, uint32_t offset)
+{
+	const uint32_t tag = record_tag(lint, offset);
+	const uint32_t id = object_id(lint, offset);
+	/* Flags come right after the ID in every object record */
+	const uint32_t flags =
+		cfr_le32_to_cpu(((const struct lb_cfr_option_form *)record_at(lint, offset))->flags);
+
+	if (!id) {
+		report(lint, offset, "object ID is 0");
+	} else {
+		const uint32_t other = set_lookup_or_insert(lint, &lint->ids, hash_id(id), offset);
+		if (other) {
+			report(lint, offset, "object ID %u is also used at 0x%x", id, other);
+		}
+	}
+
+	if (flags & ~CFR_OPTFLAGS_ALL) {
+		report(lint, offset, "unknown flags 0x%x", flags & ~CFR_OPTFLAGS_ALL);
+	}
+
+	if (tag == LB_TAG_CFR_OPTION_FORM || tag == LB_TAG_CFR_OPTION_COMMENT) {
+		return;
+	}
+
+	const uint32_t opt_name = find_string(lint, offset, LB_TAG_CFR_VARCHAR_OPT_NAME);
+	const struct lb_cfr_varbinary *str = string_at(lint, opt_name);
+	if (!opt_name || cfr_le32_to_cpu(str->data_length) <= 1) {
+		report(lint, offset, "option %u has no name", id);
+	} else {
+		const uint32_t len = cfr_le32_to_cpu(str->data_length);
+		const uint32_t other = set_lookup_or_insert(lint, &lint->names,
+							    hash_string(str->data, len), offset);
+		if (other) {
+			report(lint, offset, "option name '%s' is also used at 0x%x",
+			       (const char *)str->data, other);
+		}
+	}
+
+	if (tag != LB_TAG_CFR_OPTION_ENUM && tag != LB_TAG_CFR_OPTION_BOOL) {
+		return;
+	}
+	const struct lb_cfr_numeric_option *option =
+		(const struct lb_cfr_numeric_option *)record_at(lint, offset);
+	const uint32_t default_value = cfr_le32_to_cpu(option->default_value);
+	if (tag == LB_TAG_CFR_OPTION_BOOL && default_value > 1) {
+		report(lint, offset, "bool default %u is not 0 or 1", default_value);
+	}
+	if (tag == LB_TAG_CFR_OPTION_ENUM && !cfr_enum_has_value(option, default_value)) {
+		report(lint, offset, "enum default %u is not one of its values", default_value);
+	}
+}
+
+static void lint_enum_range(struct lint *lint, uint32_t offset)
+{
+	const struct lb_cfr_enum_range *range =
+		(const struct lb_cfr_enum_range *)record_at(lint, offset);
+	const uint32_t start = cfr_le32_to_cpu(range->start);
+	const uint32_t count = cfr_le32_to_cpu(range->count);
+	const uint32_t step = cfr_le32_to_cpu(range->step);
+
+	if (count > CFR_ENUM_RANGE_MAX) {
+		report(lint, offset, "enum range has %u values, more than %u", count,
+		       CFR_ENUM_RANGE_MAX);
+	} else if (!cfr_enum_range_fits(start, count, step)) {
+		report(lint, offset, "enum range of %u values from %u every %u wraps around",
+		       count, start, step);
+	}
+}
+
+/* Strings must fit their record, with the padding after them */
+static bool lint_string(struct lint *lint, uint32_t offset)
+{
+	const struct lb_cfr_varbinary *str = string_at(lint, offset);
+	const uint32_t size = record_size(lint, offset);
+	const uint32_t data_length = cfr_le32_to_cpu(str->data_length);
+
+	if (size < sizeof(*str) || data_length > size - sizeof(*str)) {
+		report(lint, offset, "string of %u bytes does not fit its record of %u",
+		       data_length, size);
+		return false;
+	}
+	if (!data_length || str->data[data_length - 1]) {
+		report(lint, offset, "string is not NUL-terminated");
+		return false;
+	}
+	return true;
+}
+
+/* Returns whether all records in `parent` could be checked, or the rest of it had to be skipped */
+static bool lint_records(struct lint *lint, uint32_t parent, unsigned int depth)
+{
+	const uint32_t end = parent + record_size(lint, parent);
+	bool all_sound = true;
+
+	if (depth > CFR_LINT_MAX_DEPTH) {
+		report(lint, parent, "records nested too deep");
+		return false;
+	}
+	for (uint32_t off = parent + cfr_record_header_size(record_tag(lint, parent)); off < end;) {
+		const uint32_t remaining = end - off;
+		if (remaining < sizeof(struct lb_record)) {
+			report(lint, off, "truncated record");
+			return false;
+		}
+
+		/* Past a bad size, the rest of the parent cannot be found */
+		const uint32_t tag = record_tag(lint, off);
+		const uint32_t size = record_size(lint, off);
+		const size_t header_size = cfr_record_header_size(tag);
+		if (size < sizeof(struct lb_record) || size > remaining || size % LB_ENTRY_ALIGN ||
+		    size < header_size) {
+			report(lint, off, "bad size %u of record 0x%x", size, tag);
+			return false;
+		}
+
+		/* Forms only need their own fields, options also read their children */
+		if (tag == LB_TAG_CFR_OPTION_FORM) {
+			lint_object(lint, off);
+		}
+		const bool sound = header_size ? lint_records(lint, off, depth + 1) :
+						 !is_string(tag) || lint_string(lint, off);
+		if (is_object(tag) && tag != LB_TAG_CFR_OPTION_FORM && sound) {
+			lint_object(lint, off);
+		}
+		if (tag == LB_TAG_CFR_ENUM_RANGE) {
+			lint_enum_range(lint, off);
+		}
+		all_sound = all_sound && sound;
+		off += size;
+	}
+	return all_sound;
+}
+
+unsigned int cfr_lint(FILE *out, const char *blob, size_t len)
+{
+	struct lint lint = {
+		.out	= out,
+		.blob	= blob,
+		.ids	= { .same = same_id },
+		.names	= { .same = same_name },
+	};
+	const struct lb_cfr *root = (const struct lb_cfr *)blob;
+
+	if (len < sizeof(*root) || cfr_le32_to_cpu(root->tag) != LB_TAG_CFR ||
+	    cfr_le32_to_cpu(root->size) < sizeof(*root) || cfr_le32_to_cpu(root->size) > len) {
+		report(&lint, 0, "not a CFR blob");
+		return lint.violations;
+	}
+
+	lint_records(&lint, 0, 0);
+	if (lint.out_of_memory) {
+		report(&lint, 0, "ran out of memory, uniqueness was not fully checked");
+	}
+
+	set_free(&lint.ids);
+	set_free(&lint.names);
+	return lint.violations;
+}
@@ -0,0 +1,27 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+
+#ifndef CFR_LINT_H
+#define CFR_LINT_H
+
+#include <stddef.h>
+#include <stdio.h>
+
+/*
+ * Checks the invariants that the format does not enforce by itself:
+ *
+ *   - record sizes fit their parent, and strings their record
+ *   - object IDs are not 0 and unique across the whole blob
+ *   - option names are present and unique across the whole blob
+ *   - flags only use the bits of enum cfr_option_flags
+ *   - enum defaults are one of the values, listed or in a range
+ *   - enum ranges have at most CFR_ENUM_RANGE_MAX values, and do not wrap
+ *   - bool defaults are 0 or 1
+ *
+ * Uniqueness is checked with hash sets, so the whole blob is a single
+ * pass that stays cheap enough to run on every build. Every violation
+ * is printed to `out` with the offset of the record it is about, and
+ * the number of violations is returned.
+ */
+unsigned int cfr_lint(FILE *out, const char *blob, size_t len);
+
+#endif	/* CFR_LINT_H */
@@ -0,0 +1,323 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cfr.h"
+#include "cfr_lz.h"
+
+#define ALIGN_UP(x, a)		(((x) + ((a) - 1)) & ~((__typeof__(x))(a) - 1))
+
+#define HASH_BITS		16
+#define WINDOW_MASK		CFR_LZ_MAX_OFFSET
+
+/* Levels from here on also try a match one byte later before taking one */
+#define LAZY_LEVEL		4
+
+struct lz_encoder {
+	const uint8_t *src;
+	size_t len;
+	int32_t *head;		/* Latest position for every hash */
+	int32_t *prev;		/* Previous position with the same hash, by position */
+	size_t next_insert;
+	unsigned int max_attempts;
+	bool lazy;
+
+	uint8_t *out;
+	size_t out_pos;
+};
+
+static uint32_t read32(const uint8_t *p)
+{
+	uint32_t v;
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+static uint32_t hash4(const uint8_t *p)
+{
+	return (read32(p) * 2654435761u) >> (32 - HASH_BITS);
+}
+
+/* Adds all positions before `pos` to the hash chains */
+static void insert_upto(struct lz_encoder *e, size_t pos)
+{
+	for (; e->next_insert < pos && e->next_insert + 4 <= e->len; e->next_insert++) {
+		const uint32_t h = hash4(e->src + e->next_insert);
+		e->prev[e->next_insert & WINDOW_MASK] = e->head[h];
+		e->head[h] = e->next_insert;
+	}
+}
+
+/* Returns the length of the longest match for `pos` not going past `end` */
+static size_t find_match(struct lz_encoder *e, size_t pos, size_t end, size_t *offset)
+{
+	if (pos + CFR_LZ_MIN_MATCH > end) {
+		return 0;
+	}
+	insert_upto(e, pos);
+
+	const uint8_t *s = e->src + pos;
+	const uint32_t first = read32(s);
+	size_t best = 0;
+
+	int32_t cand = e->head[hash4(s)];
+	for (unsigned int i = 0; i < e->max_attempts && cand >= 0; i++) {
+		if (pos - cand > CFR_LZ_MAX_OFFSET) {
+			break;
+		}
+		const uint8_t *c = e->src + cand;
+		if (read32(c) == first) {
+			size_t len = CFR_LZ_MIN_MATCH;
+			while (pos + len < end && c[len] == s[len]) {
+				len++;
+			}
+			if (len > best) {
+				best = len;
+				*offset = pos - cand;
+				if (pos + len == end) {
+					break;
+				}
+			}
+		}
+		const int32_t next = e->prev[cand & WINDOW_MASK];
+		if (next >= cand) {
+			break;
+		}
+		cand = next;
+	}
+	return best;
+}
+
+static void put_length(struct lz_encoder *e, size_t len)
+{
+	while (len >= 255) {
+		e->out[e->out_pos++] = 255;
+		len -= 255;
+	}
+	e->out[e->out_pos++] = len;
+}
+
+static void emit_sequence(struct lz_encoder *e, size_t anchor, size_t pos,
+			  size_t match_len, size_t offset)
+{
+	const size_t lit = pos - anchor;
+	const size_t mlen = match_len ? match_len - CFR_LZ_MIN_MATCH : 0;
+
+	e->out[e->out_pos++] = (lit < 15 ? lit : 15) << 4 | (mlen < 15 ? mlen : 15);
+	if (lit >= 15) {
+		put_length(e, lit - 15);
+	}
+	memcpy(e->out + e->out_pos, e->src + anchor, lit);
+	e->out_pos += lit;
+
+	if (!match_len) {
+		return;
+	}
+	e->out[e->out_pos++] = offset & 0xff;
+	e->out[e->out_pos++] = offset >> 8;
+	if (mlen >= 15) {
+		put_length(e, mlen - 15);
+	}
+}
+
+/* Compresses [start, end) into e->out, which must be CFR_LZ_CHUNK_BOUND() */
+static void compress_chunk(struct lz_encoder *e, size_t start, size_t end)
+{
+	size_t anchor = start;
+	size_t pos = start;
+
+	e->out_pos = 0;
+	while (pos + CFR_LZ_MIN_MATCH <= end) {
+		size_t offset = 0;
+		const size_t len = find_match(e, pos, end, &offset);
+		if (len < CFR_LZ_MIN_MATCH) {
+			pos++;
+			continue;
+		}
+		if (e->lazy) {
+			size_t next_offset;
+			if (find_match(e, pos + 1, end, &next_offset) > len) {
+				pos++;
+				continue;
+			}
+		}
+		emit_sequence(e, anchor, pos, len, offset);
+		pos += len;
+		anchor = pos;
+	}
+	emit_sequence(e, anchor, end, 0, 0);
+}
+
+int cfr_lz_compress(const char *data, size_t len, const struct lb_cfr *root,
+		    int level, char **out, size_t *out_len)
+{
+	if (level < CFR_LZ_LEVEL_FAST || level > CFR_LZ_LEVEL_MAX) {
+		fprintf(stderr, "Compression level must be between %d and %d\n",
+			CFR_LZ_LEVEL_FAST, CFR_LZ_LEVEL_MAX);
+		return -1;
+	}
+	if (len > UINT32_MAX / 2) {
+		fprintf(stderr, "Cannot compress %zu bytes\n", len);
+		return -1;
+	}
+
+	const size_t num_chunks = (len + CFR_LZ_CHUNK_SIZE - 1) / CFR_LZ_CHUNK_SIZE;
+	const size_t max_len = ALIGN_UP(sizeof(struct lb_cfr_compressed) + len +
+					num_chunks * sizeof(struct lb_cfr_compressed_chunk),
+					LB_ENTRY_ALIGN);
+
+	struct lz_encoder e = {
+		.src		= (const uint8_t *)data,
+		.len		= len,
+		.head		= malloc(sizeof(*e.head) << HASH_BITS),
+		.prev		= malloc(sizeof(*e.prev) * (WINDOW_MASK + 1)),
+		.max_attempts	= 1u << (level - 1),
+		.lazy		= level >= LAZY_LEVEL,
+		.out		= malloc(CFR_LZ_CHUNK_BOUND(CFR_LZ_CHUNK_SIZE)),
+	};
+	char *record = calloc(1, max_len);
+
+	int ret = -1;
+	if (!e.head || !e.prev || !e.out || !record) {
+		fprintf(stderr, "Could not allocate compression buffers\n");
+		goto out;
+	}
+	memset(e.head, 0xff, sizeof(*e.head) << HASH_BITS);
+
+	size_t pos = sizeof(struct lb_cfr_compressed);
+	for (size_t start = 0; start < len; start += CFR_LZ_CHUNK_SIZE) {
+		const size_t end = len - start > CFR_LZ_CHUNK_SIZE ? start + CFR_LZ_CHUNK_SIZE : len;
+		compress_chunk(&e, start, end);
+
+		/* Keep the data as is if it does not compress */
+		const bool stored = e.out_pos >= end - start;
+		const size_t compressed_size = stored ? end - start : e.out_pos;
+		const struct lb_cfr_compressed_chunk chunk = {
+			.compressed_size	= cfr_cpu_to_le32(compressed_size),
+			.data_size		= cfr_cpu_to_le32(end - start),
+		};
+		memcpy(record + pos, &chunk, sizeof(chunk));
+		pos += sizeof(chunk);
+		memcpy(record + pos, stored ? (const uint8_t *)data + start : e.out,
+		       compressed_size);
+		pos += compressed_size;
+	}
+
+	const size_t size = ALIGN_UP(pos, LB_ENTRY_ALIGN);
+	const struct lb_cfr_compressed header = {
+		.tag		= cfr_cpu_to_le32(LB_TAG_CFR_COMPRESSED),
+		.size		= cfr_cpu_to_le32(size),
+		.algorithm	= cfr_cpu_to_le32(CFR_COMPRESSION_LZ),
+		.data_size	= cfr_cpu_to_le32(len),
+		.root_size	= root->size,
+		.root_checksum	= root->checksum,
+	};
+	memcpy(record, &header, sizeof(header));
+
+	*out = record;
+	*out_len = size;
+	record = NULL;
+	ret = 0;
+
+out:
+	free(record);
+	free(e.out);
+	free(e.prev);
+	free(e.head);
+	return ret;
+}
+
+static bool get_length(const uint8_t **p, const uint8_t *end, size_t *len)
+{
+	uint8_t b;
+	do {
+		if (*p >= end) {
+			return false;
+		}
+		b = *(*p)++;
+		*len += b;
+	} while (b == 255);
+	return true;
+}
+
+int cfr_lz_decompress_chunk(const struct lb_cfr_compressed_chunk *chunk,
+			    char *out, size_t pos, size_t out_size)
+{
+	const uint32_t compressed_size = cfr_le32_to_cpu(chunk->compressed_size);
+	const uint32_t data_size = cfr_le32_to_cpu(chunk->data_size);
+
+	if (data_size > out_size - pos) {
+		fprintf(stderr, "Compressed chunk does not fit in the output\n");
+		return -1;
+	}
+	if (compressed_size == data_size) {
+		memcpy(out + pos, chunk->data, data_size);
+		return 0;
+	}
+
+	const uint8_t *p = chunk->data;
+	const uint8_t *const end = p + compressed_size;
+	uint8_t *o = (uint8_t *)out + pos;
+	uint8_t *const o_end = o + data_size;
+
+	for (;;) {
+		if (p >= end) {
+			goto corrupt;
+		}
+		const uint8_t token = *p++;
+
+		size_t lit = token >> 4;
+		if (lit == 15 && !get_length(&p, end, &lit)) {
+			goto corrupt;
+		}
+		if (lit > (size_t)(end - p) || lit > (size_t)(o_end - o)) {
+			goto corrupt;
+		}
+		memcpy(o, p, lit);
+		o += lit;
+		p += lit;
+
+		if (p == end) {
+			break;
+		}
+
+		if (end - p < 2) {
+			goto corrupt;
+		}
+		const size_t offset = p[0] | p[1] << 8;
+		p += 2;
+
+		size_t len = token & 15;
+		if (len == 15 && !get_length(&p, end, &len)) {
+			goto corrupt;
+		}
+		len += CFR_LZ_MIN_MATCH;
+
+		if (!offset || offset > (size_t)(o - (uint8_t *)out) || len > (size_t)(o_end - o)) {
+			goto corrupt;
+		}
+		const uint8_t *m = o - offset;
+		if (offset >= len) {
+			memcpy(o, m, len);
+			o += len;
+		} else {
+			/* Overlapping matches repeat the last `offset` bytes */
+			for (size_t i = 0; i < len; i++) {
+				*o++ = *m++;
+			}
+		}
+	}
+
+	if (o == o_end) {
+		return 0;
+	}
+
+corrupt:
+	fprintf(stderr, "Compressed chunk is corrupt\n");
+	return -1;
+}
@@ -0,0 +1,55 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+
+#ifndef CFR_LZ_H
+#define CFR_LZ_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "cfr.h"
+
+/*
+ * A small LZ77 codec for `lb_cfr_compressed` chunks. Every chunk is a
+ * list of sequences:
+ *
+ *   token  [literal length bytes]  literals  offset  [match length bytes]
+ *
+ * The high nibble of the token is the number of literals, and the low
+ * nibble is the match length minus CFR_LZ_MIN_MATCH. A nibble of 15
+ * means more length bytes follow, each added to it until one below 255.
+ * The offset is 16-bit little-endian, and counts back from the current
+ * position in the output. Matches can reach into previous chunks. The
+ * last sequence of a chunk only has literals.
+ *
+ * Level 1 compresses fast with a single hash probe. Higher levels search
+ * hash chains for longer matches and are meant for release builds.
+ */
+
+#define CFR_LZ_CHUNK_SIZE	(64 * 1024)
+#define CFR_LZ_MIN_MATCH	4
+#define CFR_LZ_MAX_OFFSET	0xffff
+
+#define CFR_LZ_LEVEL_FAST	1
+#define CFR_LZ_LEVEL_DEFAULT	6
+#define CFR_LZ_LEVEL_MAX	9
+
+/* Worst case size of a compressed chunk, before falling back to storing it */
+#define CFR_LZ_CHUNK_BOUND(n)	((n) + (n) / 255 + 16)
+
+/*
+ * Wraps `len` bytes of `data`, a v1 or v2 blob whose root record is
+ * `root`, in a newly allocated compressed record. Like every record,
+ * it is written little-endian.
+ */
+int cfr_lz_compress(const char *data, size_t len, const struct lb_cfr *root,
+		    int level, char **out, size_t *out_len);
+
+/*
+ * Decompresses one chunk into `out + pos`, where `out` holds the output
+ * of all previous chunks. Returns 0 if exactly `chunk->data_size` bytes
+ * came out, which must fit in `out_size`.
+ */
+int cfr_lz_decompress_chunk(const struct lb_cfr_compressed_chunk *chunk,
+			    char *out, size_t pos, size_t out_size);
+
+#endif	/* CFR_LZ_H */
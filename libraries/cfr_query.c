@@ -0,0 +1,645 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cfr.h"
+#include "cfr_query.h"
+#include "cfr_view.h"
+
+enum query_field {
+	FIELD_ID,
+	FIELD_FLAGS,
+	FIELD_DEFAULT,
+	FIELD_VALUE,
+	FIELD_OPT_NAME,
+	FIELD_UI_NAME,
+	FIELD_HELP,
+};
+
+enum query_op {
+	OP_SET,		/* No operator, just the field */
+	OP_EQ,
+	OP_NE,
+	OP_LT,
+	OP_LE,
+	OP_GT,
+	OP_GE,
+	OP_CONTAINS,
+	OP_ANY_BITS,
+};
+
+struct query_pred {
+	enum query_field field;
+	enum query_op op;
+	bool negate;
+	bool string;		/* Compares `text`, rather than `number` */
+	uint32_t number;
+	char *text;
+};
+
+struct query_step {
+	bool descendant;	/* Any depth below the previous step, not just children */
+	bool values;		/* Enum values instead of objects */
+	uint32_t kinds;		/* Bit (tag - LB_TAG_CFR) per object tag, 0 for any */
+	struct query_pred *preds;
+	size_t num_preds;
+};
+
+struct cfr_query {
+	struct query_step *steps;
+	size_t num_steps;
+};
+
+/*
+ * Compiler
+ */
+
+struct parser {
+	const char *expr;
+	const char *pos;
+	bool failed;
+};
+
+#define KIND(tag)	(1u << ((tag) - LB_TAG_CFR))
+
+static const struct {
+	const char *name;
+	uint32_t kinds;
+} kind_names[] = {
+	{ "form",	KIND(LB_TAG_CFR_OPTION_FORM) },
+	{ "enum",	KIND(LB_TAG_CFR_OPTION_ENUM) },
+	{ "number",	KIND(LB_TAG_CFR_OPTION_NUMBER) },
+	{ "bool",	KIND(LB_TAG_CFR_OPTION_BOOL) },
+	{ "varchar",	KIND(LB_TAG_CFR_OPTION_VARCHAR) },
+	{ "comment",	KIND(LB_TAG_CFR_OPTION_COMMENT) },
+	{ "option",	KIND(LB_TAG_CFR_OPTION_ENUM) | KIND(LB_TAG_CFR_OPTION_NUMBER) |
+			KIND(LB_TAG_CFR_OPTION_BOOL) | KIND(LB_TAG_CFR_OPTION_VARCHAR) },
+};
+
+static const struct {
+	const char *name;
+	enum query_field field;
+} field_names[] = {
+	{ "id",		FIELD_ID },
+	{ "flags",	FIELD_FLAGS },
+	{ "default",	FIELD_DEFAULT },
+	{ "value",	FIELD_VALUE },
+	{ "opt_name",	FIELD_OPT_NAME },
+	{ "ui_name",	FIELD_UI_NAME },
+	{ "help",	FIELD_HELP },
+};
+
+static const struct {
+	const char *name;
+	uint32_t flag;
+} flag_names[] = {
+	{ "READONLY",	CFR_OPTFLAG_READONLY },
+	{ "GRAYOUT",	CFR_OPTFLAG_GRAYOUT },
+	{ "SUPPRESS",	CFR_OPTFLAG_SUPPRESS },
+	{ "VOLATILE",	CFR_OPTFLAG_VOLATILE },
+};
+
+__attribute__((format(printf, 2, 3)))
+static void parse_error(struct parser *p, const char *fmt, ...)
+{
+	if (p->failed) {
+		return;
+	}
+	p->failed = true;
+
+	va_list args;
+	va_start(args, fmt);
+	fprintf(stderr, "Query error at column %zu: ", (size_t)(p->pos - p->expr) + 1);
+	vfprintf(stderr, fmt, args);
+	fprintf(stderr, "\n  %s\n  %*s^\n", p->expr, (int)(p->pos - p->expr), "");
+	va_end(args);
+}
+
+static void skip_spaces(struct parser *p)
+{
+	while (*p->pos == ' ' || *p->pos == '\t') {
+		p->pos++;
+	}
+}
+
+static bool accept(struct parser *p, const char *token)
+{
+	skip_spaces(p);
+	const size_t len = strlen(token);
+	if (strncmp(p->pos, token, len)) {
+		return false;
+	}
+	p->pos += len;
+	return true;
+}
+
+static bool is_word_char(char c)
+{
+	return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') ||
+	       c == '_';
+}
+
+/* Returns the length of the word at the current position, without consuming it */
+static size_t peek_word(struct parser *p)
+{
+	skip_spaces(p);
+	size_t len = 0;
+	while (is_word_char(p->pos[len])) {
+		len++;
+	}
+	return len;
+}
+
+static bool word_is(const char *word, size_t len, const char *name)
+{
+	return strlen(name) == len && !strncmp(word, name, len);
+}
+
+static uint32_t parse_flags(struct parser *p)
+{
+	uint32_t flags = 0;
+
+	do {
+		const size_t len = peek_word(p);
+		size_t i = 0;
+		while (i < ARRAY_SIZE(flag_names) && !word_is(p->pos, len, flag_names[i].name)) {
+			i++;
+		}
+		if (i == ARRAY_SIZE(flag_names)) {
+			parse_error(p, "unknown flag '%.*s'", (int)len, p->pos);
+			return 0;
+		}
+		flags |= flag_names[i].flag;
+		p->pos += len;
+	} while (accept(p, "|"));
+
+	return flags;
+}
+
+static void parse_literal(struct parser *p, struct query_pred *pred)
+{
+	skip_spaces(p);
+
+	if (*p->pos == '"') {
+		const char *start = ++p->pos;
+		size_t len = 0;
+		for (; *p->pos && *p->pos != '"'; p->pos++, len++) {
+			if (*p->pos == '\\' && p->pos[1]) {
+				p->pos++;
+			}
+		}
+		if (*p->pos != '"') {
+			parse_error(p, "unterminated string");
+			return;
+		}
+		p->pos++;
+
+		pred->string = true;
+		pred->text = malloc(len + 1);
+		if (!pred->text) {
+			parse_error(p, "could not allocate %zu bytes", len + 1);
+			return;
+		}
+		for (size_t i = 0; i < len; i++, start++) {
+			if (*start == '\\') {
+				start++;
+			}
+			pred->text[i] = *start;
+		}
+		pred->text[len] = '\0';
+		return;
+	}
+
+	if (*p->pos >= '0' && *p->pos <= '9') {
+		char *end;
+		const unsigned long long number = strtoull(p->pos, &end, 0);
+		if (number > UINT32_MAX) {
+			parse_error(p, "number does not fit in 32 bits");
+			return;
+		}
+		pred->number = number;
+		p->pos = end;
+		return;
+	}
+
+	if (pred->field == FIELD_FLAGS && peek_word(p)) {
+		pred->number = parse_flags(p);
+		return;
+	}
+	parse_error(p, "expected a number or a string");
+}
+
+static bool field_allowed(const struct query_step *step, const struct query_pred *pred)
+{
+	switch (pred->field) {
+	case FIELD_VALUE:
+		return step->values;
+	case FIELD_UI_NAME:
+		return true;
+	default:
+		return !step->values;
+	}
+}
+
+static void parse_pred(struct parser *p, struct query_step *step, struct query_pred *pred)
+{
+	pred->negate = accept(p, "!");
+
+	const size_t len = peek_word(p);
+	size_t i = 0;
+	while (i < ARRAY_SIZE(field_names) && !word_is(p->pos, len, field_names[i].name)) {
+		i++;
+	}
+	if (i == ARRAY_SIZE(field_names)) {
+		parse_error(p, "unknown field '%.*s'", (int)len, p->pos);
+		return;
+	}
+	pred->field = field_names[i].field;
+	if (!field_allowed(step, pred)) {
+		parse_error(p, "'%s' does not apply to this step", field_names[i].name);
+		return;
+	}
+	p->pos += len;
+
+	/* Longer operators first */
+	static const struct {
+		const char *token;
+		enum query_op op;
+	} ops[] = {
+		{ "!=", OP_NE }, { "<=", OP_LE }, { ">=", OP_GE }, { "=", OP_EQ },
+		{ "<", OP_LT }, { ">", OP_GT }, { "~", OP_CONTAINS }, { "&", OP_ANY_BITS },
+	};
+	pred->op = OP_SET;
+	for (i = 0; i < ARRAY_SIZE(ops); i++) {
+		if (accept(p, ops[i].token)) {
+			pred->op = ops[i].op;
+			break;
+		}
+	}
+	if (pred->op == OP_SET) {
+		pred->string = pred->field >= FIELD_OPT_NAME;
+		return;
+	}
+
+	parse_literal(p, pred);
+	if (p->failed) {
+		return;
+	}
+
+	const bool string_field = pred->field >= FIELD_OPT_NAME ||
+				  (pred->field == FIELD_DEFAULT && pred->string);
+	if (pred->string != string_field) {
+		parse_error(p, "'%s' takes a %s", field_names[pred->field].name,
+			    string_field ? "string" : "number");
+	} else if (pred->string && pred->op != OP_EQ && pred->op != OP_NE &&
+		   pred->op != OP_CONTAINS) {
+		parse_error(p, "strings can only be compared with =, != and ~");
+	} else if (!pred->string && pred->op == OP_CONTAINS) {
+		parse_error(p, "~ only applies to strings");
+	}
+}
+
+static void parse_step(struct parser *p, struct query_step *step)
+{
+	const bool any = accept(p, "*");
+	const size_t len = any ? 0 : peek_word(p);
+
+	if (any) {
+		step->kinds = 0;
+	} else if (word_is(p->pos, len, "value")) {
+		step->values = true;
+	} else {
+		size_t i = 0;
+		while (i < ARRAY_SIZE(kind_names) && !word_is(p->pos, len, kind_names[i].name)) {
+			i++;
+		}
+		if (i == ARRAY_SIZE(kind_names)) {
+			if (len) {
+				parse_error(p, "unknown kind '%.*s'", (int)len, p->pos);
+			} else {
+				parse_error(p, "expected a kind");
+			}
+			return;
+		}
+		step->kinds = kind_names[i].kinds;
+	}
+	p->pos += len;
+
+	while (accept(p, "[")) {
+		struct query_pred *preds = realloc(step->preds,
+						   (step->num_preds + 1) * sizeof(*preds));
+		if (!preds) {
+			parse_error(p, "could not allocate predicate");
+			return;
+		}
+		step->preds = preds;
+		struct query_pred *pred = &preds[step->num_preds++];
+		*pred = (struct query_pred) { 0 };
+
+		parse_pred(p, step, pred);
+		if (p->failed) {
+			return;
+		}
+		if (!accept(p, "]")) {
+			parse_error(p, "expected ']'");
+			return;
+		}
+	}
+}
+
+struct cfr_query *cfr_query_compile(const char *expr)
+{
+	struct cfr_query *query = calloc(1, sizeof(*query));
+	if (!query) {
+		fprintf(stderr, "Could not allocate query\n");
+		return NULL;
+	}
+
+	struct parser p = { .expr = expr, .pos = expr };
+	bool descendant = accept(&p, "//");
+	if (!descendant) {
+		accept(&p, "/");
+	}
+
+	do {
+		if (query->num_steps && query->steps[query->num_steps - 1].values) {
+			parse_error(&p, "enum values have no children");
+			break;
+		}
+		struct query_step *steps = realloc(query->steps,
+						   (query->num_steps + 1) * sizeof(*steps));
+		if (!steps) {
+			parse_error(&p, "could not allocate step");
+			break;
+		}
+		query->steps = steps;
+		struct query_step *step = &steps[query->num_steps++];
+		*step = (struct query_step) { .descendant = descendant };
+
+		parse_step(&p, step);
+		if (p.failed) {
+			break;
+		}
+		descendant = accept(&p, "//");
+	} while (descendant || accept(&p, "/"));
+
+	skip_spaces(&p);
+	if (*p.pos) {
+		parse_error(&p, "unexpected '%c'", *p.pos);
+	}
+	if (p.failed) {
+		cfr_query_free(query);
+		return NULL;
+	}
+	return query;
+}
+
+void cfr_query_free(struct cfr_query *query)
+{
+	if (!query) {
+		return;
+	}
+	for (size_t i = 0; i < query->num_steps; i++) {
+		for (size_t j = 0; j < query->steps[i].num_preds; j++) {
+			free(query->steps[i].preds[j].text);
+		}
+		free(query->steps[i].preds);
+	}
+	free(query->steps);
+	free(query);
+}
+
+/*
+ * Evaluation
+ */
+
+static bool test_bit(const uint64_t *bitmap, size_t i)
+{
+	return bitmap[i / 64] >> (i % 64) & 1;
+}
+
+static void set_bit(uint64_t *bitmap, size_t i)
+{
+	bitmap[i / 64] |= UINT64_C(1) << (i % 64);
+}
+
+static void clear_bit(uint64_t *bitmap, size_t i)
+{
+	bitmap[i / 64] &= ~(UINT64_C(1) << (i % 64));
+}
+
+static void bitmap_fill(uint64_t *bitmap, size_t count)
+{
+	const size_t words = cfr_view_bitmap_words(count);
+
+	memset(bitmap, 0xff, words * sizeof(*bitmap));
+	if (count % 64) {
+		bitmap[words - 1] = (UINT64_C(1) << (count % 64)) - 1;
+	}
+}
+
+static void bitmap_invert(uint64_t *bitmap, size_t count)
+{
+	const size_t words = cfr_view_bitmap_words(count);
+
+	for (size_t w = 0; w < words; w++) {
+		bitmap[w] = ~bitmap[w];
+	}
+	if (count % 64) {
+		bitmap[words - 1] &= (UINT64_C(1) << (count % 64)) - 1;
+	}
+}
+
+static const uint32_t *numeric_column(const struct cfr_view *view, enum query_field field)
+{
+	switch (field) {
+	case FIELD_ID:		return view->object_id;
+	case FIELD_FLAGS:	return view->flags;
+	case FIELD_DEFAULT:	return view->default_value;
+	case FIELD_VALUE:	return view->value;
+	default:		return NULL;
+	}
+}
+
+static const uint32_t *string_column(const struct cfr_view *view, const struct query_step *step,
+				     enum query_field field)
+{
+	switch (field) {
+	case FIELD_DEFAULT:	return view->def_string;
+	case FIELD_OPT_NAME:	return view->opt_name;
+	case FIELD_UI_NAME:	return step->values ? view->value_ui_name : view->ui_name;
+	case FIELD_HELP:	return view->ui_helptext;
+	default:		return NULL;
+	}
+}
+
+/* Numeric predicates map onto the view filters, <= and >= as inverted > and < */
+static void filter_numeric(const struct cfr_view *view, const struct query_pred *pred,
+			   size_t count, uint64_t *bitmap)
+{
+	static const struct {
+		enum cfr_view_op op;
+		bool invert;
+	} ops[] = {
+		[OP_SET]	= { CFR_VIEW_NE, false },
+		[OP_EQ]		= { CFR_VIEW_EQ, false },
+		[OP_NE]		= { CFR_VIEW_NE, false },
+		[OP_LT]		= { CFR_VIEW_LT, false },
+		[OP_LE]		= { CFR_VIEW_GT, true },
+		[OP_GT]		= { CFR_VIEW_GT, false },
+		[OP_GE]		= { CFR_VIEW_LT, true },
+		[OP_ANY_BITS]	= { CFR_VIEW_ANY_BITS, false },
+	};
+	const uint32_t operand = pred->op == OP_SET ? 0 : pred->number;
+
+	cfr_view_filter(numeric_column(view, pred->field), count, ops[pred->op].op, operand, bitmap);
+	if (ops[pred->op].invert != pred->negate) {
+		bitmap_invert(bitmap, count);
+	}
+}
+
+static bool match_string(const char *str, const struct query_pred *pred)
+{
+	switch (pred->op) {
+	case OP_SET:		return *str != '\0';
+	case OP_EQ:		return !strcmp(str, pred->text);
+	case OP_NE:		return strcmp(str, pred->text) != 0;
+	case OP_CONTAINS:	return strstr(str, pred->text) != NULL;
+	default:		return false;
+	}
+}
+
+/* Strings are only looked at for the rows every other predicate left */
+static void filter_string(const struct cfr_view *view, const struct query_step *step,
+			  const struct query_pred *pred, size_t count, uint64_t *bitmap)
+{
+	const uint32_t *column = string_column(view, step, pred->field);
+
+	for (size_t w = 0; w < cfr_view_bitmap_words(count); w++) {
+		for (uint64_t bits = bitmap[w]; bits; bits &= bits - 1) {
+			const size_t row = w * 64 + __builtin_ctzll(bits);
+			const char *str = cfr_view_string(view, column[row]);
+			if (match_string(str, pred) == pred->negate) {
+				clear_bit(bitmap, row);
+			}
+		}
+	}
+}
+
+/* Rows of the step's kind that satisfy all of its predicates, regardless of position */
+static void filter_step(const struct cfr_view *view, const struct query_step *step,
+			uint64_t *bitmap, uint64_t *tmp)
+{
+	const size_t count = step->values ? view->num_values : view->num_rows;
+
+	if (step->kinds) {
+		memset(bitmap, 0, cfr_view_bitmap_words(count) * sizeof(*bitmap));
+		for (uint32_t tag = LB_TAG_CFR; tag < LB_TAG_CFR + 32; tag++) {
+			if (step->kinds & KIND(tag)) {
+				cfr_view_filter(view->tag, count, CFR_VIEW_EQ, tag, tmp);
+				cfr_view_bitmap_or(bitmap, tmp, count);
+			}
+		}
+	} else {
+		bitmap_fill(bitmap, count);
+	}
+
+	for (size_t i = 0; i < step->num_preds; i++) {
+		if (!step->preds[i].string) {
+			filter_numeric(view, &step->preds[i], count, tmp);
+			cfr_view_bitmap_and(bitmap, tmp, count);
+		}
+	}
+	for (size_t i = 0; i < step->num_preds; i++) {
+		if (step->preds[i].string) {
+			filter_string(view, step, &step->preds[i], count, bitmap);
+		}
+	}
+}
+
+/*
+ * Rows are in pre-order, so a parent always comes before its children
+ * and one pass is enough to find the rows below a matched one.
+ */
+static void find_below(const struct cfr_view *view, const uint64_t *matched, bool descendant,
+		       uint64_t *below)
+{
+	memset(below, 0, cfr_view_bitmap_words(view->num_rows) * sizeof(*below));
+	for (size_t row = 0; row < view->num_rows; row++) {
+		if (test_bit(matched, row) || (descendant && view->parent[row] != CFR_VIEW_NO_PARENT &&
+					       test_bit(below, view->parent[row]))) {
+			set_bit(below, row);
+		}
+	}
+}
+
+int cfr_query_run(const struct cfr_query *query, const struct cfr_view *view,
+		  struct cfr_query_result *result)
+{
+	const size_t count = view->num_rows > view->num_values ? view->num_rows : view->num_values;
+	const size_t words = cfr_view_bitmap_words(count) + 1;
+	uint64_t *matched = calloc(words, sizeof(*matched));
+	uint64_t *below = calloc(words, sizeof(*below));
+	uint64_t *tmp = calloc(words, sizeof(*tmp));
+	*result = (struct cfr_query_result) { 0 };
+
+	if (!matched || !below || !tmp) {
+		fprintf(stderr, "Could not allocate query bitmaps for %zu rows\n", count);
+		free(matched);
+		free(below);
+		free(tmp);
+		return -1;
+	}
+
+	for (size_t i = 0; i < query->num_steps; i++) {
+		const struct query_step *step = &query->steps[i];
+
+		/* `below` holds the rows of the previous step, or of its subtrees */
+		if (i > 0) {
+			find_below(view, matched, step->descendant, below);
+		}
+
+		filter_step(view, step, matched, tmp);
+
+		const size_t num = step->values ? view->num_values : view->num_rows;
+		for (size_t row = 0; row < num; row++) {
+			if (!test_bit(matched, row)) {
+				continue;
+			}
+			const uint32_t parent = step->values ? view->value_option[row] : view->parent[row];
+			bool ok;
+			if (parent == CFR_VIEW_NO_PARENT) {
+				ok = i == 0;
+			} else if (i == 0) {
+				/* Everything is below the root */
+				ok = step->descendant;
+			} else {
+				ok = test_bit(below, parent);
+			}
+			if (!ok) {
+				clear_bit(matched, row);
+			}
+		}
+		result->values = step->values;
+	}
+
+	const size_t num = result->values ? view->num_values : view->num_rows;
+	result->num_rows = cfr_view_bitmap_count(matched, num);
+	result->rows = malloc((result->num_rows + 1) * sizeof(*result->rows));
+	if (result->rows) {
+		cfr_view_bitmap_rows(matched, num, result->rows);
+	} else {
+		fprintf(stderr, "Could not allocate %zu query results\n", result->num_rows);
+	}
+
+	free(matched);
+	free(below);
+	free(tmp);
+	return result->rows ? 0 : -1;
+}
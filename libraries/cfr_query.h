@@ -0,0 +1,58 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+
+#ifndef CFR_QUERY_H
+#define CFR_QUERY_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "cfr_view.h"
+
+/*
+ * Path queries over the objects of a blob, for example:
+ *
+ *   form[ui_name="Main"]/enum[flags&SUPPRESS]/value
+ *
+ * A query is a list of steps separated by '/' for children or '//' for
+ * descendants at any depth. The first step is relative to the root, so
+ * a leading '//' searches the whole blob. Every step names a kind:
+ *
+ *   form, enum, number, bool, varchar, comment, option (any of the four
+ *   option kinds), value (enum values, last step only), or * (anything
+ *   but enum values)
+ *
+ * followed by any number of predicates in brackets, which must all hold:
+ *
+ *   [field]		the number is not 0, or the string is not empty
+ *   [field <op> x]	with op one of = != < <= > >= for numbers,
+ *			= != ~ (contains) for strings, and & (any bit)
+ *   [!...]		negates the predicate
+ *
+ * The fields are id, flags, default, value (enum values only), opt_name,
+ * ui_name and help. Numbers are decimal or hex, strings are in double
+ * quotes, and flags can also be given by name, like READONLY|GRAYOUT.
+ * default is the numeric default, or the string one of varchar options
+ * when compared to a string.
+ *
+ * Queries are compiled once and run against a cfr_view, where every step
+ * is a few passes of column filters plus one pass over the parent links.
+ */
+
+struct cfr_query;
+
+/* Returns NULL and prints where the query is wrong if it does not compile */
+struct cfr_query *cfr_query_compile(const char *expr);
+void cfr_query_free(struct cfr_query *query);
+
+struct cfr_query_result {
+	bool values;		/* Rows are enum values rather than objects */
+	uint32_t *rows;		/* In blob order */
+	size_t num_rows;
+};
+
+/* Fills `result`, whose rows must be freed afterwards. Returns -1 on error. */
+int cfr_query_run(const struct cfr_query *query, const struct cfr_view *view,
+		  struct cfr_query_result *result);
+
+#endif	/* CFR_QUERY_H */
@@ -0,0 +1,759 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+
+/* For pread(), ftruncate(), fdatasync(), fsync() and strndup() */
+#define _POSIX_C_SOURCE 200809L
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "cfr.h"
+#include "cfr_file.h"
+#include "cfr_store.h"
+
+#define ALIGN_UP(x, a)		(((x) + ((a) - 1)) & ~((__typeof__(x))(a) - 1))
+
+#define CFR_STORE_MAGIC		0x53524643	/* "CFRS" */
+#define CFR_STORE_VERSION	1
+#define CFR_STORE_ALIGN		4
+
+#define WRITE_BUFFER_SIZE	(64 * 1024)
+#define COPY_BUFFER_SIZE	(1024 * 1024)
+
+struct store_file_header {
+	uint32_t magic;
+	uint32_t version;
+};
+
+struct store_record {
+	uint32_t crc;		/* Of everything after this field, padding included */
+	uint32_t object_id;
+	uint16_t type;		/* enum cfr_value_type */
+	uint16_t reserved;
+	uint32_t length;	/* Of the value, strings are not NULL-terminated */
+	uint8_t value[];
+};
+
+static uint32_t record_size(uint32_t length)
+{
+	return ALIGN_UP(sizeof(struct store_record) + length, CFR_STORE_ALIGN);
+}
+
+static uint32_t record_crc(const struct store_record *rec, uint32_t size)
+{
+	return cfr_crc32(&rec->object_id, size - sizeof(rec->crc));
+}
+
+/*
+ * Open addressing hash table keyed by object ID. Object ID 0 is never
+ * handed out (it means someone messed up), so it marks free slots.
+ */
+struct store_entry {
+	uint32_t object_id;
+	uint16_t type;
+	uint32_t record_size;
+	uint32_t len;
+	union {
+		uint32_t u32;
+		char *str;
+	};
+};
+
+struct store_index {
+	struct store_entry *slots;
+	size_t mask;
+	size_t used;
+};
+
+static size_t slot_hash(uint32_t object_id, size_t mask)
+{
+	uint32_t h = object_id * 0x9e3779b1u;
+	return (h ^ (h >> 16)) & mask;
+}
+
+static void index_init(struct store_index *index, size_t num_slots)
+{
+	index->slots = calloc(num_slots, sizeof(*index->slots));
+	if (!index->slots) {
+		fprintf(stderr, "Could not allocate %zu index slots\n", num_slots);
+		exit(-1);
+	}
+	index->mask = num_slots - 1;
+	index->used = 0;
+}
+
+static struct store_entry *index_slot(struct store_index *index, uint32_t object_id)
+{
+	size_t i = slot_hash(object_id, index->mask);
+	while (index->slots[i].object_id && index->slots[i].object_id != object_id) {
+		i = (i + 1) & index->mask;
+	}
+	return &index->slots[i];
+}
+
+static struct store_entry *index_insert(struct store_index *index, uint32_t object_id)
+{
+	/* Keep the load factor below 3/4 */
+	if ((index->used + 1) * 4 > (index->mask + 1) * 3) {
+		struct store_index bigger;
+		index_init(&bigger, (index->mask + 1) * 2);
+		for (size_t i = 0; i <= index->mask; i++) {
+			if (index->slots[i].object_id) {
+				*index_slot(&bigger, index->slots[i].object_id) = index->slots[i];
+				bigger.used++;
+			}
+		}
+		free(index->slots);
+		*index = bigger;
+	}
+
+	struct store_entry *entry = index_slot(index, object_id);
+	if (!entry->object_id) {
+		entry->object_id = object_id;
+		entry->type = CFR_VALUE_NONE;
+		index->used++;
+	}
+	return entry;
+}
+
+struct cfr_store {
+	char *path;
+	char *compact_path;
+	int fd;
+	struct cfr_store_config config;
+	struct store_index index;
+
+	char *wbuf;
+	size_t wbuf_len;
+	size_t wbuf_cap;
+
+	uint64_t log_bytes;		/* Including buffered updates */
+	uint64_t live_bytes;
+	uint64_t num_values;
+	uint64_t appended_bytes;
+	uint64_t compacted_bytes;
+	uint64_t compactions;
+
+	/* Background compaction state */
+	bool compacting;
+	pthread_t thread;
+	atomic_bool compact_done;
+	int compact_result;
+	int compact_fd;
+	uint64_t compact_end;		/* Records past this offset are copied afterwards */
+	uint64_t compact_size;
+};
+
+static void entry_set(struct cfr_store *store, struct store_entry *entry,
+		      uint16_t type, uint32_t u32, const char *str, uint32_t len, uint32_t size)
+{
+	if (entry->type != CFR_VALUE_NONE) {
+		store->live_bytes -= entry->record_size;
+		store->num_values--;
+	}
+	if (entry->type == CFR_VALUE_STRING) {
+		free(entry->str);
+	}
+
+	entry->type = type;
+	entry->record_size = size;
+	entry->len = 0;
+
+	switch (type) {
+	case CFR_VALUE_U32:
+		entry->u32 = u32;
+		break;
+	case CFR_VALUE_STRING:
+		entry->str = malloc(len + 1);
+		if (!entry->str) {
+			fprintf(stderr, "Could not allocate %u bytes for value\n", len + 1);
+			exit(-1);
+		}
+		memcpy(entry->str, str, len);
+		entry->str[len] = '\0';
+		entry->len = len;
+		break;
+	}
+
+	if (type != CFR_VALUE_NONE) {
+		store->live_bytes += size;
+		store->num_values++;
+	}
+}
+
+/* Returns the size of the record at `data`, or 0 if it is truncated or corrupt */
+static uint32_t check_record(const char *data, uint64_t avail)
+{
+	const struct store_record *rec = (const struct store_record *)data;
+
+	if (avail < sizeof(*rec) || !rec->object_id) {
+		return 0;
+	}
+	if (rec->length > avail - sizeof(*rec)) {
+		return 0;
+	}
+	const uint32_t size = record_size(rec->length);
+	if (size > avail || record_crc(rec, size) != rec->crc) {
+		return 0;
+	}
+	switch (rec->type) {
+	case CFR_VALUE_NONE:
+		return size;
+	case CFR_VALUE_U32:
+		return rec->length == sizeof(uint32_t) ? size : 0;
+	case CFR_VALUE_STRING:
+		return size;
+	default:
+		return 0;
+	}
+}
+
+static void apply_record(struct cfr_store *store, const struct store_record *rec, uint32_t size)
+{
+	struct store_entry *entry = index_insert(&store->index, rec->object_id);
+	uint32_t u32 = 0;
+
+	if (rec->type == CFR_VALUE_U32) {
+		memcpy(&u32, rec->value, sizeof(u32));
+	}
+	entry_set(store, entry, rec->type, u32, (const char *)rec->value, rec->length, size);
+}
+
+static int load_log(struct cfr_store *store)
+{
+	struct stat st;
+	if (fstat(store->fd, &st)) {
+		perror("Could not stat value store");
+		return -1;
+	}
+
+	const struct store_file_header header = {
+		.magic		= CFR_STORE_MAGIC,
+		.version	= CFR_STORE_VERSION,
+	};
+
+	if (st.st_size == 0) {
+		store->log_bytes = sizeof(header);
+		return store->config.read_only ? 0 : cfr_write_all(store->fd, &header, sizeof(header));
+	}
+
+	if ((uint64_t)st.st_size < sizeof(header)) {
+		fprintf(stderr, "Value store '%s' is too small\n", store->path);
+		return -1;
+	}
+
+	char *data = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, store->fd, 0);
+	if (data == MAP_FAILED) {
+		perror("Could not map value store");
+		return -1;
+	}
+
+	const struct store_file_header *file_header = (const struct store_file_header *)data;
+	if (file_header->magic != header.magic || file_header->version != header.version) {
+		fprintf(stderr, "'%s' is not a version %u value store\n",
+			store->path, CFR_STORE_VERSION);
+		munmap(data, st.st_size);
+		return -1;
+	}
+
+	uint64_t offset = sizeof(header);
+	while (offset < (uint64_t)st.st_size) {
+		const uint32_t size = check_record(data + offset, st.st_size - offset);
+		if (!size) {
+			break;
+		}
+		apply_record(store, (const struct store_record *)(data + offset), size);
+		offset += size;
+	}
+
+	munmap(data, st.st_size);
+
+	if (offset != (uint64_t)st.st_size) {
+		fprintf(stderr, "Value store '%s': %s %" PRIu64 " bytes of "
+			"corrupt or incomplete records at offset %" PRIu64 "\n",
+			store->path, store->config.read_only ? "ignoring" : "dropping",
+			(uint64_t)st.st_size - offset, offset);
+		if (!store->config.read_only && ftruncate(store->fd, offset)) {
+			perror("Could not truncate value store");
+			return -1;
+		}
+	}
+
+	store->log_bytes = offset;
+	return lseek(store->fd, offset, SEEK_SET) < 0 ? -1 : 0;
+}
+
+static char *path_with_suffix(const char *path, const char *suffix)
+{
+	const size_t size = strlen(path) + strlen(suffix) + 1;
+	char *result = malloc(size);
+	if (result) {
+		snprintf(result, size, "%s%s", path, suffix);
+	}
+	return result;
+}
+
+struct cfr_store *cfr_store_open(const char *path, const struct cfr_store_config *config)
+{
+	struct cfr_store *store = calloc(1, sizeof(*store));
+	if (!store) {
+		fprintf(stderr, "Could not allocate value store\n");
+		return NULL;
+	}
+
+	store->config = config ? *config : CFR_STORE_DEFAULT_CONFIG;
+	store->path = path_with_suffix(path, "");
+	store->compact_path = path_with_suffix(path, ".compact");
+	store->compact_fd = -1;
+	index_init(&store->index, 1024);
+
+	store->fd = store->config.read_only ? open(path, O_RDONLY) :
+					      open(path, O_RDWR | O_CREAT, 0644);
+	if (!store->path || !store->compact_path || store->fd < 0) {
+		fprintf(stderr, "Could not open value store '%s': %s\n", path, strerror(errno));
+		goto fail;
+	}
+
+	/* Left behind by an interrupted compaction, the log is still complete */
+	if (!store->config.read_only) {
+		unlink(store->compact_path);
+	}
+
+	if (load_log(store)) {
+		goto fail;
+	}
+	return store;
+
+fail:
+	if (store->fd >= 0) {
+		close(store->fd);
+	}
+	free(store->index.slots);
+	free(store->compact_path);
+	free(store->path);
+	free(store);
+	return NULL;
+}
+
+static int flush_wbuf(struct cfr_store *store)
+{
+	if (!store->wbuf_len) {
+		return 0;
+	}
+	const int ret = cfr_write_all(store->fd, store->wbuf, store->wbuf_len);
+	store->wbuf_len = 0;
+	return ret;
+}
+
+/*
+ * Compaction rewrites the log up to `compact_end` with only the latest
+ * record of every option, dropping deleted ones. It works on the file
+ * and not on the index, so that it can run while updates keep coming.
+ */
+struct offset_slot {
+	uint32_t object_id;
+	uint64_t offset;
+};
+
+static void *compact_worker(void *arg)
+{
+	struct cfr_store *store = arg;
+	const uint64_t end = store->compact_end;
+	int ret = -1;
+
+	char *data = mmap(NULL, end, PROT_READ, MAP_SHARED, store->fd, 0);
+	char *out = malloc(COPY_BUFFER_SIZE);
+	struct offset_slot *latest = NULL;
+	size_t mask = 1023;
+
+	if (data == MAP_FAILED || !out) {
+		fprintf(stderr, "Could not set up compaction of '%s'\n", store->path);
+		goto done;
+	}
+
+	/* At most one slot per record, keep the table at most half full */
+	const size_t max_records = (end - sizeof(struct store_file_header)) / sizeof(struct store_record);
+	while (mask + 1 < max_records * 2) {
+		mask = mask * 2 + 1;
+	}
+	latest = calloc(mask + 1, sizeof(*latest));
+	if (!latest) {
+		fprintf(stderr, "Could not allocate compaction index\n");
+		goto done;
+	}
+
+	for (uint64_t off = sizeof(struct store_file_header); off < end;) {
+		const struct store_record *rec = (const struct store_record *)(data + off);
+		size_t i = slot_hash(rec->object_id, mask);
+		while (latest[i].object_id && latest[i].object_id != rec->object_id) {
+			i = (i + 1) & mask;
+		}
+		latest[i] = (struct offset_slot) { .object_id = rec->object_id, .offset = off };
+		off += record_size(rec->length);
+	}
+
+	const struct store_file_header header = {
+		.magic		= CFR_STORE_MAGIC,
+		.version	= CFR_STORE_VERSION,
+	};
+	memcpy(out, &header, sizeof(header));
+	size_t out_len = sizeof(header);
+	uint64_t written = 0;
+
+	for (uint64_t off = sizeof(struct store_file_header); off < end;) {
+		const struct store_record *rec = (const struct store_record *)(data + off);
+		const uint32_t size = record_size(rec->length);
+
+		size_t i = slot_hash(rec->object_id, mask);
+		while (latest[i].object_id != rec->object_id) {
+			i = (i + 1) & mask;
+		}
+		if (latest[i].offset == off && rec->type != CFR_VALUE_NONE) {
+			if (out_len + size > COPY_BUFFER_SIZE) {
+				if (cfr_write_all(store->compact_fd, out, out_len)) {
+					goto done;
+				}
+				written += out_len;
+				out_len = 0;
+			}
+			if (size > COPY_BUFFER_SIZE) {
+				if (cfr_write_all(store->compact_fd, rec, size)) {
+					goto done;
+				}
+				written += size;
+			} else {
+				memcpy(out + out_len, rec, size);
+				out_len += size;
+			}
+		}
+		off += size;
+	}
+
+	if (cfr_write_all(store->compact_fd, out, out_len)) {
+		goto done;
+	}
+	store->compact_size = written + out_len;
+	ret = 0;
+
+done:
+	if (data != MAP_FAILED) {
+		munmap(data, end);
+	}
+	free(latest);
+	free(out);
+	store->compact_result = ret;
+	atomic_store(&store->compact_done, true);
+	return NULL;
+}
+
+/* Makes a rename in the directory of `path` reach the disk */
+static int sync_dir(const char *path)
+{
+	const char *slash = strrchr(path, '/');
+	char *dir = slash ? strndup(path, slash == path ? 1 : slash - path) : strdup(".");
+	const int fd = dir ? open(dir, O_RDONLY | O_DIRECTORY) : -1;
+	int ret = fd < 0 ? -1 : 0;
+
+	if (fd >= 0) {
+		ret = fsync(fd);
+		close(fd);
+	}
+	free(dir);
+	return ret;
+}
+
+static int start_compaction(struct cfr_store *store)
+{
+	assert(!store->compacting);
+
+	if (store->config.read_only) {
+		fprintf(stderr, "Value store '%s' is read-only\n", store->path);
+		return -1;
+	}
+
+	if (flush_wbuf(store)) {
+		return -1;
+	}
+
+	store->compact_fd = open(store->compact_path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (store->compact_fd < 0) {
+		fprintf(stderr, "Could not create '%s': %s\n", store->compact_path, strerror(errno));
+		return -1;
+	}
+
+	store->compact_end = store->log_bytes;
+	store->compact_size = 0;
+	atomic_store(&store->compact_done, false);
+	store->compacting = true;
+
+	if (!store->config.background ||
+	    pthread_create(&store->thread, NULL, compact_worker, store)) {
+		store->config.background = false;
+		compact_worker(store);
+	}
+	return 0;
+}
+
+/* Copies the records appended while compacting, then swaps the logs */
+static int finish_compaction(struct cfr_store *store, bool wait)
+{
+	if (!store->compacting) {
+		return 0;
+	}
+	if (!wait && !atomic_load(&store->compact_done)) {
+		return 0;
+	}
+	if (store->config.background) {
+		pthread_join(store->thread, NULL);
+	}
+	store->compacting = false;
+
+	int ret = store->compact_result;
+	if (!ret) {
+		ret = flush_wbuf(store);
+	}
+
+	uint64_t new_size = store->compact_size;
+	char *buf = ret ? NULL : malloc(COPY_BUFFER_SIZE);
+	if (!ret && !buf) {
+		ret = -1;
+	}
+	for (uint64_t off = store->compact_end; !ret && off < store->log_bytes;) {
+		const size_t chunk = store->log_bytes - off < COPY_BUFFER_SIZE ?
+				     store->log_bytes - off : COPY_BUFFER_SIZE;
+		if (pread(store->fd, buf, chunk, off) != (ssize_t)chunk ||
+		    cfr_write_all(store->compact_fd, buf, chunk)) {
+			ret = -1;
+			break;
+		}
+		off += chunk;
+		new_size += chunk;
+	}
+	free(buf);
+
+	if (!ret && fdatasync(store->compact_fd)) {
+		ret = -1;
+	}
+	if (!ret && rename(store->compact_path, store->path)) {
+		ret = -1;
+	}
+
+	if (ret) {
+		fprintf(stderr, "Compaction of '%s' failed, keeping the old log\n", store->path);
+		close(store->compact_fd);
+		unlink(store->compact_path);
+		store->compact_fd = -1;
+		return -1;
+	}
+
+	close(store->fd);
+	store->fd = store->compact_fd;
+	store->compact_fd = -1;
+	store->compacted_bytes += new_size;
+	store->compactions++;
+	store->log_bytes = new_size;
+
+	/* Until then, the old log may come back after a crash */
+	if (sync_dir(store->path)) {
+		fprintf(stderr, "Could not sync the directory of '%s': %s\n",
+			store->path, strerror(errno));
+		return -1;
+	}
+	return 0;
+}
+
+static void maybe_compact(struct cfr_store *store)
+{
+	finish_compaction(store, false);
+
+	if (store->compacting || store->log_bytes < store->config.compact_min_size) {
+		return;
+	}
+	const uint64_t useful = store->live_bytes + sizeof(struct store_file_header);
+	if (store->log_bytes <= useful * store->config.compact_ratio) {
+		return;
+	}
+	if (start_compaction(store) == 0 && !store->config.background) {
+		finish_compaction(store, true);
+	}
+}
+
+static int append_record(struct cfr_store *store, uint32_t object_id, uint16_t type,
+			 const void *value, uint32_t length)
+{
+	if (!object_id) {
+		fprintf(stderr, "Object ID 0 is not valid\n");
+		return -1;
+	}
+	if (store->config.read_only) {
+		fprintf(stderr, "Value store '%s' is read-only\n", store->path);
+		return -1;
+	}
+
+	const uint32_t size = record_size(length);
+	if (store->wbuf_cap - store->wbuf_len < size) {
+		if (flush_wbuf(store)) {
+			return -1;
+		}
+		if (store->wbuf_cap < size || !store->wbuf) {
+			const size_t cap = size > WRITE_BUFFER_SIZE ? size : WRITE_BUFFER_SIZE;
+			char *wbuf = realloc(store->wbuf, cap);
+			if (!wbuf) {
+				fprintf(stderr, "Could not allocate %zu bytes write buffer\n", cap);
+				return -1;
+			}
+			store->wbuf = wbuf;
+			store->wbuf_cap = cap;
+		}
+	}
+
+	struct store_record *rec = (struct store_record *)(store->wbuf + store->wbuf_len);
+	memset(rec, 0, size);
+	rec->object_id = object_id;
+	rec->type = type;
+	rec->length = length;
+	/* Deletes have no value at all */
+	if (length) {
+		memcpy(rec->value, value, length);
+	}
+	rec->crc = record_crc(rec, size);
+
+	store->wbuf_len += size;
+	store->log_bytes += size;
+	store->appended_bytes += size;
+
+	apply_record(store, rec, size);
+	maybe_compact(store);
+	return 0;
+}
+
+int cfr_store_set_u32(struct cfr_store *store, uint32_t object_id, uint32_t value)
+{
+	return append_record(store, object_id, CFR_VALUE_U32, &value, sizeof(value));
+}
+
+int cfr_store_set_string(struct cfr_store *store, uint32_t object_id,
+			 const char *str, uint32_t len)
+{
+	return append_record(store, object_id, CFR_VALUE_STRING, str, len);
+}
+
+int cfr_store_delete(struct cfr_store *store, uint32_t object_id)
+{
+	struct cfr_value value;
+	if (cfr_store_get(store, object_id, &value)) {
+		return 0;
+	}
+	return append_record(store, object_id, CFR_VALUE_NONE, NULL, 0);
+}
+
+static void entry_to_value(const struct store_entry *entry, struct cfr_value *value)
+{
+	*value = (struct cfr_value) {
+		.type	= entry->type,
+		.u32	= entry->type == CFR_VALUE_U32 ? entry->u32 : 0,
+		.str	= entry->type == CFR_VALUE_STRING ? entry->str : NULL,
+		.len	= entry->len,
+	};
+}
+
+int cfr_store_get(struct cfr_store *store, uint32_t object_id, struct cfr_value *value)
+{
+	if (!object_id) {
+		return 1;
+	}
+	const struct store_entry *entry = index_slot(&store->index, object_id);
+	if (!entry->object_id || entry->type == CFR_VALUE_NONE) {
+		return 1;
+	}
+	entry_to_value(entry, value);
+	return 0;
+}
+
+int cfr_store_sync(struct cfr_store *store)
+{
+	if (store->config.read_only) {
+		return 0;
+	}
+	if (flush_wbuf(store)) {
+		return -1;
+	}
+	if (fdatasync(store->fd)) {
+		perror("Could not sync value store");
+		return -1;
+	}
+	return 0;
+}
+
+int cfr_store_compact(struct cfr_store *store)
+{
+	if (finish_compaction(store, true)) {
+		return -1;
+	}
+	if (start_compaction(store)) {
+		return -1;
+	}
+	return finish_compaction(store, true);
+}
+
+void cfr_store_foreach(struct cfr_store *store,
+		       void (*fn)(uint32_t object_id, const struct cfr_value *value, void *arg),
+		       void *arg)
+{
+	for (size_t i = 0; i <= store->index.mask; i++) {
+		const struct store_entry *entry = &store->index.slots[i];
+		if (!entry->object_id || entry->type == CFR_VALUE_NONE) {
+			continue;
+		}
+		struct cfr_value value;
+		entry_to_value(entry, &value);
+		fn(entry->object_id, &value, arg);
+	}
+}
+
+void cfr_store_get_stats(struct cfr_store *store, struct cfr_store_stats *stats)
+{
+	*stats = (struct cfr_store_stats) {
+		.num_values		= store->num_values,
+		.live_bytes		= store->live_bytes,
+		.log_bytes		= store->log_bytes,
+		.appended_bytes		= store->appended_bytes,
+		.compacted_bytes	= store->compacted_bytes,
+		.compactions		= store->compactions,
+	};
+}
+
+int cfr_store_close(struct cfr_store *store)
+{
+	int ret = finish_compaction(store, true);
+	if (flush_wbuf(store)) {
+		ret = -1;
+	}
+	if (close(store->fd)) {
+		ret = -1;
+	}
+
+	for (size_t i = 0; i <= store->index.mask; i++) {
+		if (store->index.slots[i].object_id &&
+		    store->index.slots[i].type == CFR_VALUE_STRING) {
+			free(store->index.slots[i].str);
+		}
+	}
+	free(store->index.slots);
+	free(store->wbuf);
+	free(store->compact_path);
+	free(store->path);
+	free(store);
+	return ret;
+}
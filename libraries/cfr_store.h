@@ -0,0 +1,90 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+
+#ifndef CFR_STORE_H
+#define CFR_STORE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * A log-structured store for the values users pick for CFR options, in
+ * the spirit of an SMMSTORE backend. Every update appends a record with
+ * the object ID, the value type and the value to the log, and an index
+ * in memory keeps the latest value of each option. Once enough of the
+ * log is made up of stale records, it gets compacted in the background.
+ *
+ * Every record carries a CRC32 of its contents. When opening a store,
+ * the log is truncated before the first record failing its check: this
+ * is what a torn write at the end of the log looks like.
+ *
+ * Updates are buffered in memory until `cfr_store_sync()` is called, the
+ * buffer fills up, or the store is closed.
+ *
+ * A store opened read-only is never created or written to, and records
+ * failing their check are skipped but left in the log. Updates and
+ * compactions fail on it.
+ */
+
+enum cfr_value_type {
+	CFR_VALUE_NONE		= 0,	/* Deleted */
+	CFR_VALUE_U32		= 1,	/* Enum, number and bool options */
+	CFR_VALUE_STRING	= 2,	/* Varchar options */
+};
+
+struct cfr_value {
+	enum cfr_value_type type;
+	uint32_t u32;
+	const char *str;	/* Valid until the option is updated again */
+	uint32_t len;		/* Of `str`, which is also NULL-terminated */
+};
+
+struct cfr_store_config {
+	size_t compact_min_size;	/* Never compact logs smaller than this */
+	unsigned int compact_ratio;	/* Compact once log size > ratio * live size */
+	bool background;		/* Compact on a separate thread */
+	bool read_only;			/* Only look up values */
+};
+
+#define CFR_STORE_DEFAULT_CONFIG ((struct cfr_store_config) {	\
+		.compact_min_size	= 1024 * 1024,		\
+		.compact_ratio		= 4,			\
+		.background		= true,			\
+	})
+
+struct cfr_store_stats {
+	uint64_t num_values;		/* Live values in the index */
+	uint64_t live_bytes;		/* Size of the records holding them */
+	uint64_t log_bytes;		/* Size of the log */
+	uint64_t appended_bytes;	/* Written by updates */
+	uint64_t compacted_bytes;	/* Written by compactions */
+	uint64_t compactions;
+};
+
+struct cfr_store;
+
+struct cfr_store *cfr_store_open(const char *path, const struct cfr_store_config *config);
+int cfr_store_close(struct cfr_store *store);
+
+/* Returns 0 if found, 1 if there is no value for `object_id` */
+int cfr_store_get(struct cfr_store *store, uint32_t object_id, struct cfr_value *value);
+
+int cfr_store_set_u32(struct cfr_store *store, uint32_t object_id, uint32_t value);
+int cfr_store_set_string(struct cfr_store *store, uint32_t object_id,
+			 const char *str, uint32_t len);
+int cfr_store_delete(struct cfr_store *store, uint32_t object_id);
+
+/* Writes out buffered updates and waits for them to reach the disk */
+int cfr_store_sync(struct cfr_store *store);
+
+/* Rewrites the log with only the latest values, and waits for it to finish */
+int cfr_store_compact(struct cfr_store *store);
+
+/* Calls `fn` for every live value, in no particular order */
+void cfr_store_foreach(struct cfr_store *store,
+		       void (*fn)(uint32_t object_id, const struct cfr_value *value, void *arg),
+		       void *arg);
+
+void cfr_store_get_stats(struct cfr_store *store, struct cfr_store_stats *stats);
+
+#endif	/* CFR_STORE_H */
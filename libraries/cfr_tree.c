@@ -0,0 +1,175 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "cfr.h"
+#include "cfr_tree.h"
+
+uint32_t cfr_tree_tag(const char *blob, uint32_t offset)
+{
+	return cfr_le32_to_cpu(((const struct lb_record *)(blob + offset))->tag);
+}
+
+/* Records that get their own row */
+static bool is_row_tag(uint32_t tag)
+{
+	switch (tag) {
+	case LB_TAG_CFR_OPTION_FORM:
+	case LB_TAG_CFR_ENUM_VALUE:
+	case LB_TAG_CFR_ENUM_RANGE:
+	case LB_TAG_CFR_OPTION_ENUM:
+	case LB_TAG_CFR_OPTION_NUMBER:
+	case LB_TAG_CFR_OPTION_BOOL:
+	case LB_TAG_CFR_OPTION_VARCHAR:
+	case LB_TAG_CFR_OPTION_COMMENT:
+		return true;
+	default:
+		return false;
+	}
+}
+
+static uint32_t child_rows(const char *blob, uint32_t offset)
+{
+	const uint32_t tag = cfr_tree_tag(blob, offset);
+
+	if (tag == LB_TAG_CFR_ENUM_RANGE) {
+		const struct lb_cfr_enum_range *range =
+			(const struct lb_cfr_enum_range *)(blob + offset);
+		if (cfr_le32_to_cpu(range->size) < sizeof(*range) ||
+		    cfr_le32_to_cpu(range->count) > CFR_ENUM_RANGE_MAX) {
+			return 0;
+		}
+		return cfr_le32_to_cpu(range->count);
+	}
+	return is_row_tag(tag);
+}
+
+int cfr_tree_init(struct cfr_tree *tree, const char *blob)
+{
+	*tree = (struct cfr_tree) { .blob = blob };
+
+	size_t count = 0;
+	cfr_for_each_child(blob, 0, off) {
+		count += cfr_tree_tag(blob, off) == LB_TAG_CFR_OPTION_FORM;
+	}
+
+	tree->forms = count ? calloc(count, sizeof(*tree->forms)) : NULL;
+	if (count && !tree->forms) {
+		fprintf(stderr, "Could not allocate %zu forms\n", count);
+		return -1;
+	}
+	cfr_for_each_child(blob, 0, off) {
+		if (cfr_tree_tag(blob, off) == LB_TAG_CFR_OPTION_FORM) {
+			tree->forms[tree->num_forms++] = (struct cfr_tree_node) { .offset = off };
+		}
+	}
+
+	size_t row;
+	if (cfr_tree_build_rows(tree, 0, &row)) {
+		cfr_tree_free(tree);
+		return -1;
+	}
+	return 0;
+}
+
+void cfr_tree_free(struct cfr_tree *tree)
+{
+	for (size_t i = 0; i < tree->num_forms; i++) {
+		cfr_tree_collapse(&tree->forms[i]);
+	}
+	free(tree->forms);
+	free(tree->rows);
+	*tree = (struct cfr_tree) { .blob = tree->blob };
+}
+
+bool cfr_tree_is_expandable(const char *blob, const struct cfr_tree_node *node)
+{
+	const uint32_t tag = cfr_tree_tag(blob, node->offset);
+	return tag == LB_TAG_CFR_OPTION_FORM || tag == LB_TAG_CFR_OPTION_ENUM;
+}
+
+int cfr_tree_expand(const char *blob, struct cfr_tree_node *node)
+{
+	if (node->expanded) {
+		return 0;
+	}
+
+	/* Enum ranges get one row per value */
+	size_t count = 0;
+	cfr_for_each_child(blob, node->offset, off) {
+		count += child_rows(blob, off);
+	}
+
+	struct cfr_tree_node *children = count ? calloc(count, sizeof(*children)) : NULL;
+	if (count && !children) {
+		fprintf(stderr, "Could not allocate %zu rows\n", count);
+		return -1;
+	}
+	node->children = children;
+	node->num_children = 0;
+	cfr_for_each_child(blob, node->offset, off) {
+		const uint32_t rows = child_rows(blob, off);
+		for (uint32_t i = 0; i < rows; i++) {
+			node->children[node->num_children++] = (struct cfr_tree_node) {
+				.offset	= off,
+				.parent	= node->offset,
+				.index	= i,
+				.depth	= node->depth + 1,
+			};
+		}
+	}
+	node->expanded = true;
+	return 0;
+}
+
+void cfr_tree_collapse(struct cfr_tree_node *node)
+{
+	for (size_t i = 0; i < node->num_children; i++) {
+		cfr_tree_collapse(&node->children[i]);
+	}
+	free(node->children);
+	node->children = NULL;
+	node->num_children = 0;
+	node->expanded = false;
+}
+
+static int add_rows(struct cfr_tree *tree, struct cfr_tree_node *nodes, size_t num_nodes)
+{
+	for (size_t i = 0; i < num_nodes; i++) {
+		if (tree->num_rows == tree->max_rows) {
+			const size_t max = tree->max_rows ? tree->max_rows * 2 : 256;
+			struct cfr_tree_node **rows = realloc(tree->rows, max * sizeof(*rows));
+			if (!rows) {
+				fprintf(stderr, "Could not allocate %zu rows\n", max);
+				return -1;
+			}
+			tree->rows = rows;
+			tree->max_rows = max;
+		}
+		tree->rows[tree->num_rows++] = &nodes[i];
+		if (nodes[i].expanded &&
+		    add_rows(tree, nodes[i].children, nodes[i].num_children)) {
+			return -1;
+		}
+	}
+	return 0;
+}
+
+int cfr_tree_build_rows(struct cfr_tree *tree, uint32_t offset, size_t *row)
+{
+	tree->num_rows = 0;
+	const int ret = add_rows(tree, tree->forms, tree->num_forms);
+
+	*row = 0;
+	for (size_t i = 0; i < tree->num_rows; i++) {
+		if (tree->rows[i]->offset == offset) {
+			*row = i;
+			break;
+		}
+	}
+	return ret;
+}
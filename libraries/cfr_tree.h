@@ -0,0 +1,77 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+
+#ifndef CFR_TREE_H
+#define CFR_TREE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "cfr.h"
+
+/*
+ * The objects of a CFR blob as a tree of rows, for browsing it. Only the
+ * top-level forms are read up front. Forms and enum options get children
+ * when they are expanded, and lose them again when they are collapsed,
+ * so that opening a large blob costs as little as possible. Enum values
+ * are rows too, with one row per value of a range.
+ *
+ * Records with a bad size end the list of children of their parent, and
+ * ranges with more than CFR_ENUM_RANGE_MAX values have no rows at all.
+ */
+
+struct cfr_tree_node {
+	uint32_t offset;	/* Of the record */
+	uint32_t parent;	/* Offset of the parent record, 0 for top-level forms */
+	uint32_t index;		/* Of the value, for rows of an enum range */
+	unsigned int depth;
+	bool expanded;
+	struct cfr_tree_node *children;
+	size_t num_children;
+};
+
+struct cfr_tree {
+	const char *blob;
+	struct cfr_tree_node *forms;
+	size_t num_forms;
+
+	struct cfr_tree_node **rows;	/* Visible nodes in display order */
+	size_t num_rows;
+	size_t max_rows;
+};
+
+/* Iterates over the child records of `parent`, stopping at the first bad size */
+#define cfr_for_each_child(blob, parent, off)						\
+	for (uint32_t off = (parent) + cfr_record_header_size(cfr_tree_tag(blob, parent)),	\
+	     _end = (parent) + cfr_le32_to_cpu(((const struct lb_record *)((blob) + (parent)))->size); \
+	     off < _end &&									\
+	     cfr_le32_to_cpu(((const struct lb_record *)((blob) + off))->size) >= sizeof(struct lb_record) && \
+	     cfr_le32_to_cpu(((const struct lb_record *)((blob) + off))->size) <= _end - off;	\
+	     off += cfr_le32_to_cpu(((const struct lb_record *)((blob) + off))->size))
+
+/* The tag of the record at `offset` */
+uint32_t cfr_tree_tag(const char *blob, uint32_t offset);
+
+/* Reads the top-level forms, and makes them the rows. Returns -1 on error. */
+int cfr_tree_init(struct cfr_tree *tree, const char *blob);
+void cfr_tree_free(struct cfr_tree *tree);
+
+/* Forms and enum options */
+bool cfr_tree_is_expandable(const char *blob, const struct cfr_tree_node *node);
+
+/*
+ * Reads the children of the node. The rows are not updated until
+ * cfr_tree_build_rows() is called. Returns -1 on error, with the node
+ * left collapsed.
+ */
+int cfr_tree_expand(const char *blob, struct cfr_tree_node *node);
+void cfr_tree_collapse(struct cfr_tree_node *node);
+
+/*
+ * Rebuilds the visible rows, and stores the row of the node at `offset`
+ * in `row`, or 0 if it is not visible. Returns -1 on error, with only the
+ * rows that fit.
+ */
+int cfr_tree_build_rows(struct cfr_tree *tree, uint32_t offset, size_t *row);
+
+#endif	/* CFR_TREE_H */
@@ -0,0 +1,389 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cfr.h"
+#include "cfr_v2.h"
+
+#define ALIGN_UP(x, a)		(((x) + ((a) - 1)) & ~((__typeof__(x))(a) - 1))
+
+/* Nothing legitimate nests this deep, it only guards the recursion */
+#define CFR_V2_MAX_DEPTH	64
+
+static bool is_string_tag(uint32_t tag)
+{
+	switch (tag) {
+	case LB_TAG_CFR_VARCHAR_OPT_NAME:
+	case LB_TAG_CFR_VARCHAR_UI_NAME:
+	case LB_TAG_CFR_VARCHAR_UI_HELPTEXT:
+	case LB_TAG_CFR_VARCHAR_DEF_VALUE:
+		return true;
+	default:
+		return false;
+	}
+}
+
+bool cfr_is_v2(const void *data, size_t len)
+{
+	return len >= CFR_V2_MAGIC_LEN && !memcmp(data, CFR_V2_MAGIC, CFR_V2_MAGIC_LEN);
+}
+
+/*
+ * Encoder
+ */
+
+static size_t put_varint(uint8_t *dst, uint32_t value)
+{
+	size_t n = 0;
+	while (value >= 0x80) {
+		dst[n++] = (value & 0x7f) | 0x80;
+		value >>= 7;
+	}
+	dst[n++] = value;
+	return n;
+}
+
+struct v2_encoder {
+	const char *blob;
+	uint8_t *out;
+	size_t pos;
+};
+
+static int encode_records(struct v2_encoder *e, uint32_t offset, uint32_t end, unsigned int depth);
+
+/* Encodes the record at `offset`, which is known to fit in its parent */
+static int encode_record(struct v2_encoder *e, uint32_t offset, unsigned int depth)
+{
+	const struct lb_record *rec = (const struct lb_record *)(e->blob + offset);
+	const uint32_t tag = cfr_le32_to_cpu(rec->tag);
+	const uint32_t size = cfr_le32_to_cpu(rec->size);
+	const uint32_t end = offset + size;
+	const size_t header_size = cfr_record_header_size(tag);
+
+	e->pos += put_varint(e->out + e->pos, tag - LB_TAG_CFR);
+
+	/* The body is encoded after room for the largest length varint */
+	const size_t len_pos = e->pos;
+	const size_t body_pos = len_pos + 5;
+	e->pos = body_pos;
+
+	if (header_size) {
+		if (tag == LB_TAG_CFR || size < header_size) {
+			fprintf(stderr, "Record at offset 0x%x cannot be encoded\n", offset);
+			return -1;
+		}
+		const uint8_t *fields = (const uint8_t *)rec + sizeof(*rec);
+		for (size_t i = 0; i < header_size - sizeof(*rec); i += sizeof(uint32_t)) {
+			uint32_t field;
+			memcpy(&field, fields + i, sizeof(field));
+			e->pos += put_varint(e->out + e->pos, cfr_le32_to_cpu(field));
+		}
+		if (encode_records(e, offset + header_size, end, depth + 1)) {
+			return -1;
+		}
+	} else if (is_string_tag(tag)) {
+		const struct lb_cfr_varbinary *str = (const struct lb_cfr_varbinary *)rec;
+		const uint32_t data_length = cfr_le32_to_cpu(str->data_length);
+		if (size < sizeof(*str) || data_length > size - sizeof(*str) ||
+		    size != ALIGN_UP(sizeof(*str) + data_length, LB_ENTRY_ALIGN)) {
+			fprintf(stderr, "String at offset 0x%x has bad size %u\n", offset, size);
+			return -1;
+		}
+		for (uint32_t i = sizeof(*str) + data_length; i < size; i++) {
+			if (((const uint8_t *)rec)[i]) {
+				fprintf(stderr, "String at offset 0x%x has non-zero padding\n", offset);
+				return -1;
+			}
+		}
+		e->pos += put_varint(e->out + e->pos, data_length);
+		memcpy(e->out + e->pos, str->data, data_length);
+		e->pos += data_length;
+	} else {
+		memcpy(e->out + e->pos, rec + 1, size - sizeof(*rec));
+		e->pos += size - sizeof(*rec);
+	}
+
+	const size_t body_len = e->pos - body_pos;
+	const size_t len_size = put_varint(e->out + len_pos, body_len);
+	memmove(e->out + len_pos + len_size, e->out + body_pos, body_len);
+	e->pos = len_pos + len_size + body_len;
+	return 0;
+}
+
+static int encode_records(struct v2_encoder *e, uint32_t offset, uint32_t end, unsigned int depth)
+{
+	if (depth > CFR_V2_MAX_DEPTH) {
+		fprintf(stderr, "Records nested too deep at offset 0x%x\n", offset);
+		return -1;
+	}
+	while (offset < end) {
+		const struct lb_record *rec = (const struct lb_record *)(e->blob + offset);
+		if (end - offset < sizeof(*rec)) {
+			fprintf(stderr, "Record at offset 0x%x is truncated\n", offset);
+			return -1;
+		}
+		const uint32_t size = cfr_le32_to_cpu(rec->size);
+		if (size < sizeof(*rec) || size > end - offset) {
+			fprintf(stderr, "Record at offset 0x%x has bad size\n", offset);
+			return -1;
+		}
+		if (size % LB_ENTRY_ALIGN) {
+			fprintf(stderr, "Record at offset 0x%x is not aligned\n", offset);
+			return -1;
+		}
+		if (encode_record(e, offset, depth)) {
+			return -1;
+		}
+		offset += size;
+	}
+	return 0;
+}
+
+int cfr_v2_encode(const char *blob, char **out, size_t *out_len)
+{
+	const struct lb_cfr *root = (const struct lb_cfr *)blob;
+	const uint32_t size = cfr_le32_to_cpu(root->size);
+	if (cfr_le32_to_cpu(root->tag) != LB_TAG_CFR || size < sizeof(*root)) {
+		fprintf(stderr, "Not a CFR blob\n");
+		return -1;
+	}
+
+	/*
+	 * Varints take at most 5 bytes, so fields and headers can grow by a
+	 * byte each, and the length varint needs up to 5 bytes of slack.
+	 */
+	const size_t max_len = CFR_V2_HEADER_MAX + (size_t)size * 2 + 5;
+	struct v2_encoder e = {
+		.blob	= blob,
+		.out	= malloc(max_len),
+	};
+	if (!e.out) {
+		fprintf(stderr, "Could not allocate %zu bytes\n", max_len);
+		return -1;
+	}
+
+	memcpy(e.out, CFR_V2_MAGIC, CFR_V2_MAGIC_LEN);
+	e.pos = CFR_V2_MAGIC_LEN;
+	e.pos += put_varint(e.out + e.pos, size);
+	memcpy(e.out + e.pos, &root->checksum, sizeof(root->checksum));
+	e.pos += sizeof(root->checksum);
+
+	if (encode_records(&e, sizeof(*root), size, 0)) {
+		free(e.out);
+		return -1;
+	}
+
+	*out = (char *)e.out;
+	*out_len = e.pos;
+	return 0;
+}
+
+/*
+ * Decoder
+ */
+
+struct v2_decoder {
+	const uint8_t *in;
+	const uint8_t *in_end;
+	char *out;
+	size_t pos;
+	size_t size;
+};
+
+static bool get_varint(const uint8_t **p, const uint8_t *end, uint32_t *value)
+{
+	const uint8_t *s = *p;
+
+	/* Single-byte varints are by far the most common */
+	if (s < end && *s < 0x80) {
+		*value = *s;
+		*p = s + 1;
+		return true;
+	}
+
+	uint32_t result = 0;
+	for (unsigned int shift = 0; shift < 35 && s < end; shift += 7) {
+		const uint8_t b = *s++;
+		if (shift == 28 && b > 0x0f) {
+			return false;
+		}
+		result |= (uint32_t)(b & 0x7f) << shift;
+		if (!(b & 0x80)) {
+			*value = result;
+			*p = s;
+			return true;
+		}
+	}
+	return false;
+}
+
+static bool reserve_out(struct v2_decoder *d, size_t len)
+{
+	if (d->size - d->pos < len) {
+		fprintf(stderr, "CFR v2 data decodes to more than the %zu bytes it claims\n",
+			d->size);
+		return false;
+	}
+	return true;
+}
+
+static int decode_records(struct v2_decoder *d, const uint8_t *p, const uint8_t *end,
+			  unsigned int depth);
+
+static int decode_record(struct v2_decoder *d, uint32_t tag, const uint8_t *p,
+			 const uint8_t *end, unsigned int depth)
+{
+	const size_t header_size = cfr_record_header_size(tag);
+	const size_t start = d->pos;
+
+	if (!reserve_out(d, sizeof(struct lb_record))) {
+		return -1;
+	}
+	d->pos += sizeof(struct lb_record);
+
+	if (header_size) {
+		if (tag == LB_TAG_CFR || !reserve_out(d, header_size - sizeof(struct lb_record))) {
+			return -1;
+		}
+		for (size_t i = sizeof(struct lb_record); i < header_size; i += sizeof(uint32_t)) {
+			uint32_t field;
+			if (!get_varint(&p, end, &field)) {
+				fprintf(stderr, "Truncated CFR v2 record fields\n");
+				return -1;
+			}
+			field = cfr_cpu_to_le32(field);
+			memcpy(d->out + d->pos, &field, sizeof(field));
+			d->pos += sizeof(field);
+		}
+		if (decode_records(d, p, end, depth + 1)) {
+			return -1;
+		}
+	} else if (is_string_tag(tag)) {
+		uint32_t data_length;
+		if (!get_varint(&p, end, &data_length) || data_length != (size_t)(end - p)) {
+			fprintf(stderr, "Bad CFR v2 string length\n");
+			return -1;
+		}
+		const size_t padded = ALIGN_UP(sizeof(uint32_t) + (size_t)data_length, LB_ENTRY_ALIGN);
+		if (!reserve_out(d, padded)) {
+			return -1;
+		}
+		const uint32_t le_length = cfr_cpu_to_le32(data_length);
+		memcpy(d->out + d->pos, &le_length, sizeof(le_length));
+		memcpy(d->out + d->pos + sizeof(data_length), p, data_length);
+		memset(d->out + d->pos + sizeof(data_length) + data_length, 0,
+		       padded - sizeof(data_length) - data_length);
+		d->pos += padded;
+	} else {
+		if (!reserve_out(d, end - p)) {
+			return -1;
+		}
+		memcpy(d->out + d->pos, p, end - p);
+		d->pos += end - p;
+	}
+
+	const struct lb_record rec = {
+		.tag	= cfr_cpu_to_le32(tag),
+		.size	= cfr_cpu_to_le32(d->pos - start),
+	};
+	memcpy(d->out + start, &rec, sizeof(rec));
+	return 0;
+}
+
+static int decode_records(struct v2_decoder *d, const uint8_t *p, const uint8_t *end,
+			  unsigned int depth)
+{
+	if (depth > CFR_V2_MAX_DEPTH) {
+		fprintf(stderr, "CFR v2 records nested too deep\n");
+		return -1;
+	}
+	while (p < end) {
+		uint32_t tag, len;
+		if (!get_varint(&p, end, &tag) || !get_varint(&p, end, &len) ||
+		    len > (size_t)(end - p)) {
+			fprintf(stderr, "Truncated CFR v2 record at offset 0x%zx\n",
+				(size_t)(p - d->in));
+			return -1;
+		}
+		if (decode_record(d, tag + LB_TAG_CFR, p, p + len, depth)) {
+			return -1;
+		}
+		p += len;
+	}
+	return 0;
+}
+
+static const uint8_t *parse_header(const char *data, size_t len, struct lb_cfr *root)
+{
+	const uint8_t *p = (const uint8_t *)data + CFR_V2_MAGIC_LEN;
+	const uint8_t *end = (const uint8_t *)data + len;
+	uint32_t size;
+
+	if (!cfr_is_v2(data, len) || !get_varint(&p, end, &size) ||
+	    (size_t)(end - p) < sizeof(root->checksum)) {
+		fprintf(stderr, "Bad CFR v2 header\n");
+		return NULL;
+	}
+	root->tag = cfr_cpu_to_le32(LB_TAG_CFR);
+	root->size = cfr_cpu_to_le32(size);
+	memcpy(&root->checksum, p, sizeof(root->checksum));
+	return p + sizeof(root->checksum);
+}
+
+int cfr_v2_read_header(const char *data, size_t len, struct lb_cfr *root)
+{
+	return parse_header(data, len, root) ? 0 : -1;
+}
+
+int cfr_v2_decode(const char *data, size_t len, char **blob)
+{
+	struct lb_cfr root;
+	const uint8_t *p = parse_header(data, len, &root);
+	if (!p) {
+		return -1;
+	}
+
+	/* v2 records are at most 4 times smaller, reject sizes nothing decodes to */
+	const size_t body_len = (const uint8_t *)data + len - p;
+	const uint32_t size = cfr_le32_to_cpu(root.size);
+	if (size < sizeof(root) || size - sizeof(root) > body_len * 4) {
+		fprintf(stderr, "Bad CFR v2 blob size %u\n", size);
+		return -1;
+	}
+
+	struct v2_decoder d = {
+		.in	= (const uint8_t *)data,
+		.in_end	= (const uint8_t *)data + len,
+		.out	= malloc(size),
+		.pos	= sizeof(root),
+		.size	= size,
+	};
+	if (!d.out) {
+		fprintf(stderr, "Could not allocate %u bytes\n", size);
+		return -1;
+	}
+	memcpy(d.out, &root, sizeof(root));
+
+	if (decode_records(&d, p, d.in_end, 0)) {
+		free(d.out);
+		return -1;
+	}
+	if (d.pos != d.size) {
+		fprintf(stderr, "CFR v2 data decodes to %zu bytes instead of %zu\n", d.pos, d.size);
+		free(d.out);
+		return -1;
+	}
+	if (!cfr_root_checksum_ok(d.out)) {
+		fprintf(stderr, "CFR v2 data does not match the checksum in its header\n");
+		free(d.out);
+		return -1;
+	}
+
+	*blob = d.out;
+	return 0;
+}
@@ -0,0 +1,56 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+
+#ifndef CFR_V2_H
+#define CFR_V2_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "cfr.h"
+
+/*
+ * CFR v2 is a compact encoding of the same record tree, meant for storage
+ * and transport. It drops the fixed-size headers and the padding:
+ *
+ *   "CFR2"  varint(v1 blob size)  u32 v1 checksum  records...
+ *
+ * and every record is
+ *
+ *   varint(tag - LB_TAG_CFR)  varint(body length)  body
+ *
+ * where the body holds the fixed-length fields of the v1 record (after
+ * tag and size) as varints, followed by the children. String records
+ * hold varint(data_length) and the data, without padding. Records with
+ * unknown tags keep their v1 payload as is.
+ *
+ * Varints are unsigned LEB128, and the checksum is little-endian. The
+ * checksum is the one of the v1 blob, which v2 decodes back to byte for
+ * byte. Consumers keep working on v1, so v2 only exists on disk.
+ */
+
+#define CFR_V2_MAGIC		"CFR2"
+#define CFR_V2_MAGIC_LEN	4
+
+/* Size of the v2 header fields that cfr_v2_read_header() needs at most */
+#define CFR_V2_HEADER_MAX	(CFR_V2_MAGIC_LEN + 5 + 4)
+
+bool cfr_is_v2(const void *data, size_t len);
+
+/*
+ * Encodes the v1 blob into a newly allocated `*out`. Fails for blobs that
+ * would not decode back to the same bytes, such as ones with non-zero
+ * padding.
+ */
+int cfr_v2_encode(const char *blob, char **out, size_t *out_len);
+
+/*
+ * Decodes the v2 data into a newly allocated v1 blob, and fails if that
+ * does not match the v1 checksum in the header
+ */
+int cfr_v2_decode(const char *data, size_t len, char **blob);
+
+/* Fills in the root record of the v1 blob from the v2 header */
+int cfr_v2_read_header(const char *data, size_t len, struct lb_cfr *root);
+
+#endif	/* CFR_V2_H */
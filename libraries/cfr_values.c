@@ -0,0 +1,292 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cfr.h"
+#include "cfr_store.h"
+#include "cfr_values.h"
+
+struct resolver {
+	const char *blob;
+	struct cfr_store *store;
+	struct cfr_values *values;
+	size_t max_options;
+};
+
+static const struct lb_record *record_at(const char *blob, uint32_t offset)
+{
+	return (const struct lb_record *)(blob + offset);
+}
+
+/* The string with `tag` among the children of the option, NULL if there is none that fits */
+static const struct lb_cfr_varbinary *find_string(const char *blob, uint32_t option,
+						  uint32_t tag)
+{
+	const struct lb_record *rec = record_at(blob, option);
+	const uint32_t end = option + cfr_le32_to_cpu(rec->size);
+
+	const size_t header_size = cfr_record_header_size(cfr_le32_to_cpu(rec->tag));
+
+	for (uint32_t off = option + header_size; off < end;) {
+		const struct lb_record *child = record_at(blob, off);
+		const uint32_t size = cfr_le32_to_cpu(child->size);
+		if (end - off < sizeof(*child) || size < sizeof(*child) || size > end - off) {
+			return NULL;
+		}
+		if (cfr_le32_to_cpu(child->tag) == tag) {
+			const struct lb_cfr_varbinary *str = (const struct lb_cfr_varbinary *)child;
+			if (size < sizeof(*str) ||
+			    cfr_le32_to_cpu(str->data_length) > size - sizeof(*str)) {
+				return NULL;
+			}
+			return str;
+		}
+		off += size;
+	}
+	return NULL;
+}
+
+static struct cfr_value string_value(const struct lb_cfr_varbinary *str)
+{
+	if (!str || !cfr_le32_to_cpu(str->data_length)) {
+		return (struct cfr_value) { .type = CFR_VALUE_STRING, .str = "" };
+	}
+	return (struct cfr_value) {
+		.type	= CFR_VALUE_STRING,
+		.str	= (const char *)str->data,
+		.len	= cfr_le32_to_cpu(str->data_length) - 1,
+	};
+}
+
+/* Checks that the stored value is one the option could have been set to */
+static bool stored_value_legal(const char *blob, const struct cfr_effective_value *option,
+			       const struct cfr_value *stored)
+{
+	switch (option->tag) {
+	case LB_TAG_CFR_OPTION_ENUM:
+		return stored->type == CFR_VALUE_U32 &&
+		       cfr_enum_has_value((const struct lb_cfr_numeric_option *)
+					  record_at(blob, option->offset), stored->u32);
+	case LB_TAG_CFR_OPTION_NUMBER:
+		return stored->type == CFR_VALUE_U32;
+	case LB_TAG_CFR_OPTION_BOOL:
+		return stored->type == CFR_VALUE_U32 && stored->u32 <= 1;
+	case LB_TAG_CFR_OPTION_VARCHAR:
+		return stored->type == CFR_VALUE_STRING;
+	default:
+		return false;
+	}
+}
+
+static void add_option(struct resolver *r, uint32_t offset)
+{
+	const struct lb_cfr_numeric_option *rec =
+		(const struct lb_cfr_numeric_option *)record_at(r->blob, offset);
+	const uint32_t object_id = cfr_le32_to_cpu(rec->object_id);
+	const uint32_t tag = cfr_le32_to_cpu(rec->tag);
+	struct cfr_values *values = r->values;
+
+	if (values->num_options == r->max_options) {
+		r->max_options = r->max_options ? r->max_options * 2 : 256;
+		values->options = realloc(values->options,
+					  r->max_options * sizeof(*values->options));
+		if (!values->options) {
+			fprintf(stderr, "Could not allocate %zu resolved options\n", r->max_options);
+			exit(-1);
+		}
+	}
+
+	struct cfr_effective_value *option = &values->options[values->num_options++];
+	const struct lb_cfr_varbinary *opt_name =
+		find_string(r->blob, offset, LB_TAG_CFR_VARCHAR_OPT_NAME);
+
+	*option = (struct cfr_effective_value) {
+		.object_id	= object_id,
+		.tag		= tag,
+		.flags		= cfr_le32_to_cpu(rec->flags),
+		.opt_name	= string_value(opt_name).str,
+		.opt_name_len	= string_value(opt_name).len,
+		.offset		= offset,
+		.source		= CFR_SOURCE_DEFAULT,
+	};
+
+	if (tag == LB_TAG_CFR_OPTION_VARCHAR) {
+		option->default_value = string_value(
+			find_string(r->blob, offset, LB_TAG_CFR_VARCHAR_DEF_VALUE));
+	} else {
+		option->default_value = (struct cfr_value) {
+			.type	= CFR_VALUE_U32,
+			.u32	= cfr_le32_to_cpu(rec->default_value),
+		};
+	}
+	option->value = option->default_value;
+
+	struct cfr_value stored;
+	if (!r->store || cfr_store_get(r->store, object_id, &stored)) {
+		return;
+	}
+	if (stored_value_legal(r->blob, option, &stored)) {
+		option->value = stored;
+		option->source = CFR_SOURCE_STORE;
+	} else {
+		option->source = CFR_SOURCE_REJECTED;
+		values->num_rejected++;
+	}
+}
+
+static int walk_records(struct resolver *r, uint32_t parent)
+{
+	const struct lb_record *rec = record_at(r->blob, parent);
+	const uint32_t end = parent + cfr_le32_to_cpu(rec->size);
+
+	const size_t header_size = cfr_record_header_size(cfr_le32_to_cpu(rec->tag));
+
+	for (uint32_t off = parent + header_size; off < end;) {
+		const struct lb_record *child = record_at(r->blob, off);
+		const uint32_t size = cfr_le32_to_cpu(child->size);
+		if (end - off < sizeof(*child) || size < sizeof(*child) || size > end - off ||
+		    size < cfr_record_header_size(cfr_le32_to_cpu(child->tag))) {
+			fprintf(stderr, "Record at offset 0x%x has bad size %u\n", off, size);
+			return -1;
+		}
+		switch (cfr_le32_to_cpu(child->tag)) {
+		case LB_TAG_CFR_OPTION_FORM:
+			if (walk_records(r, off)) {
+				return -1;
+			}
+			break;
+		case LB_TAG_CFR_OPTION_ENUM:
+		case LB_TAG_CFR_OPTION_NUMBER:
+		case LB_TAG_CFR_OPTION_BOOL:
+		case LB_TAG_CFR_OPTION_VARCHAR:
+			add_option(r, off);
+			break;
+		}
+		off += size;
+	}
+	return 0;
+}
+
+static int by_id_cmp(const void *a, const void *b)
+{
+	const struct cfr_effective_value *x = *(const struct cfr_effective_value *const *)a;
+	const struct cfr_effective_value *y = *(const struct cfr_effective_value *const *)b;
+	return (x->object_id > y->object_id) - (x->object_id < y->object_id);
+}
+
+static int name_cmp(const char *x, size_t x_len, const char *y, size_t y_len)
+{
+	const int ret = memcmp(x, y, x_len < y_len ? x_len : y_len);
+	if (ret) {
+		return ret;
+	}
+	return (x_len > y_len) - (x_len < y_len);
+}
+
+static int by_name_cmp(const void *a, const void *b)
+{
+	const struct cfr_effective_value *x = *(const struct cfr_effective_value *const *)a;
+	const struct cfr_effective_value *y = *(const struct cfr_effective_value *const *)b;
+	return name_cmp(x->opt_name, x->opt_name_len, y->opt_name, y->opt_name_len);
+}
+
+struct cfr_values *cfr_values_resolve(const char *blob, struct cfr_store *store)
+{
+	struct cfr_values *values = calloc(1, sizeof(*values));
+	if (!values) {
+		fprintf(stderr, "Could not allocate resolved values\n");
+		return NULL;
+	}
+
+	struct resolver r = {
+		.blob	= blob,
+		.store	= store,
+		.values	= values,
+	};
+	if (walk_records(&r, 0)) {
+		cfr_values_free(values);
+		return NULL;
+	}
+
+	const size_t n = values->num_options;
+	values->by_id = malloc(n * sizeof(*values->by_id) + 1);
+	values->by_name = malloc(n * sizeof(*values->by_name) + 1);
+	if (!values->by_id || !values->by_name) {
+		fprintf(stderr, "Could not allocate lookup tables for %zu options\n", n);
+		cfr_values_free(values);
+		return NULL;
+	}
+	for (size_t i = 0; i < n; i++) {
+		values->by_id[i] = &values->options[i];
+		values->by_name[i] = &values->options[i];
+	}
+	qsort(values->by_id, n, sizeof(*values->by_id), by_id_cmp);
+	qsort(values->by_name, n, sizeof(*values->by_name), by_name_cmp);
+
+	return values;
+}
+
+void cfr_values_free(struct cfr_values *values)
+{
+	if (!values) {
+		return;
+	}
+	free(values->by_name);
+	free(values->by_id);
+	free(values->options);
+	free(values);
+}
+
+const struct cfr_effective_value *cfr_values_by_id(const struct cfr_values *values,
+						   uint32_t object_id)
+{
+	size_t lo = 0, hi = values->num_options;
+	while (lo < hi) {
+		const size_t mid = lo + (hi - lo) / 2;
+		const uint32_t id = values->by_id[mid]->object_id;
+		if (id == object_id) {
+			return values->by_id[mid];
+		}
+		if (id < object_id) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+	return NULL;
+}
+
+const struct cfr_effective_value *cfr_values_by_name(const struct cfr_values *values,
+						     const char *name, size_t len)
+{
+	size_t lo = 0, hi = values->num_options;
+	while (lo < hi) {
+		const size_t mid = lo + (hi - lo) / 2;
+		const struct cfr_effective_value *option = values->by_name[mid];
+		const int ret = name_cmp(option->opt_name, option->opt_name_len, name, len);
+		if (!ret) {
+			return option;
+		}
+		if (ret < 0) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+	return NULL;
+}
+
+bool cfr_value_is_default(const struct cfr_effective_value *option)
+{
+	const struct cfr_value *a = &option->value;
+	const struct cfr_value *b = &option->default_value;
+
+	if (a->type == CFR_VALUE_STRING) {
+		return a->len == b->len && !memcmp(a->str, b->str, a->len);
+	}
+	return a->u32 == b->u32;
+}
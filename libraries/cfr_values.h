@@ -0,0 +1,62 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+
+#ifndef CFR_VALUES_H
+#define CFR_VALUES_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "cfr_store.h"
+
+/*
+ * Resolves the effective value of every option in a CFR blob: the value
+ * in the store if there is a legal one, otherwise the default value the
+ * blob provides. The result is a flat table in blob order, which can be
+ * scanned sequentially for bulk queries or looked up by object ID and by
+ * option name.
+ *
+ * Strings point into the blob or into the store, so the table is only
+ * valid while both are unchanged.
+ */
+
+enum cfr_value_source {
+	CFR_SOURCE_DEFAULT	= 0,	/* Nothing in the store */
+	CFR_SOURCE_STORE	= 1,	/* Value from the store */
+	CFR_SOURCE_REJECTED	= 2,	/* Stored value is not legal, using the default */
+};
+
+struct cfr_effective_value {
+	uint32_t object_id;
+	uint32_t tag;			/* LB_TAG_CFR_OPTION_* */
+	uint32_t flags;			/* enum cfr_option_flags */
+	const char *opt_name;
+	uint32_t opt_name_len;
+	uint32_t offset;		/* Of the option record in the blob */
+	enum cfr_value_source source;
+	struct cfr_value value;
+	struct cfr_value default_value;
+};
+
+struct cfr_values {
+	struct cfr_effective_value *options;
+	size_t num_options;
+	size_t num_rejected;
+
+	/* Point into `options`, sorted for lookups */
+	const struct cfr_effective_value **by_id;
+	const struct cfr_effective_value **by_name;
+};
+
+/* `store` may be NULL, in which case every option has its default value */
+struct cfr_values *cfr_values_resolve(const char *blob, struct cfr_store *store);
+void cfr_values_free(struct cfr_values *values);
+
+const struct cfr_effective_value *cfr_values_by_id(const struct cfr_values *values,
+						   uint32_t object_id);
+const struct cfr_effective_value *cfr_values_by_name(const struct cfr_values *values,
+						     const char *name, size_t len);
+
+bool cfr_value_is_default(const struct cfr_effective_value *option);
+
+#endif	/* CFR_VALUES_H */
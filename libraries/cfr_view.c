@@ -0,0 +1,493 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "cfr.h"
+#include "cfr_view.h"
+
+static bool grow_column(uint32_t **column, size_t count)
+{
+	uint32_t *grown = realloc(*column, count * sizeof(**column));
+	if (!grown) {
+		return false;
+	}
+	*column = grown;
+	return true;
+}
+
+static int reserve_row(struct cfr_view *view)
+{
+	if (view->num_rows < view->max_rows) {
+		return 0;
+	}
+	const size_t max = view->max_rows ? view->max_rows * 2 : 256;
+	uint32_t **const columns[] = {
+		&view->object_id, &view->tag, &view->flags, &view->default_value,
+		&view->parent, &view->offset, &view->opt_name, &view->ui_name,
+		&view->ui_helptext, &view->def_string, &view->first_value,
+		&view->value_count,
+	};
+	for (size_t i = 0; i < ARRAY_SIZE(columns); i++) {
+		if (!grow_column(columns[i], max)) {
+			fprintf(stderr, "Could not allocate view for %zu objects\n", max);
+			return -1;
+		}
+	}
+	view->max_rows = max;
+	return 0;
+}
+
+static int reserve_value(struct cfr_view *view)
+{
+	if (view->num_values < view->max_values) {
+		return 0;
+	}
+	const size_t max = view->max_values ? view->max_values * 2 : 256;
+	uint32_t **const columns[] = {
+		&view->value, &view->value_ui_name, &view->value_option,
+	};
+	for (size_t i = 0; i < ARRAY_SIZE(columns); i++) {
+		if (!grow_column(columns[i], max)) {
+			fprintf(stderr, "Could not allocate view for %zu enum values\n", max);
+			return -1;
+		}
+	}
+	view->max_values = max;
+	return 0;
+}
+
+static const struct lb_record *record_at(const char *blob, uint32_t offset)
+{
+	return (const struct lb_record *)(blob + offset);
+}
+
+static uint32_t string_offset(uint32_t offset)
+{
+	return offset + offsetof(struct lb_cfr_varbinary, data);
+}
+
+static int add_children(struct cfr_view *view, uint32_t parent_off, uint32_t row);
+
+/* The fields of a record are only read if its size covers them */
+static bool check_header_size(const struct lb_record *rec, uint32_t offset)
+{
+	const uint32_t size = cfr_le32_to_cpu(rec->size);
+	if (size < cfr_record_header_size(cfr_le32_to_cpu(rec->tag))) {
+		fprintf(stderr, "Record at offset 0x%x has bad size %u\n", offset, size);
+		return false;
+	}
+	return true;
+}
+
+static int add_enum_value(struct cfr_view *view, uint32_t offset, uint32_t row)
+{
+	if (!check_header_size(record_at(view->blob, offset), offset) || reserve_value(view)) {
+		return -1;
+	}
+	const struct lb_cfr_enum_value *rec =
+		(const struct lb_cfr_enum_value *)record_at(view->blob, offset);
+	const size_t i = view->num_values++;
+
+	view->value[i] = cfr_le32_to_cpu(rec->value);
+	view->value_option[i] = row;
+	view->value_ui_name[i] = 0;
+
+	const uint32_t end = offset + cfr_le32_to_cpu(rec->size);
+	for (uint32_t off = offset + sizeof(*rec); off < end;) {
+		const struct lb_record *child = record_at(view->blob, off);
+		const uint32_t size = cfr_le32_to_cpu(child->size);
+		if (size < sizeof(*child) || size > end - off) {
+			fprintf(stderr, "Record at offset 0x%x has bad size %u\n", off, size);
+			return -1;
+		}
+		if (cfr_le32_to_cpu(child->tag) == LB_TAG_CFR_VARCHAR_UI_NAME) {
+			view->value_ui_name[i] = string_offset(off);
+		}
+		off += size;
+	}
+	view->value_count[row]++;
+	return 0;
+}
+
+/* Returns the string offset of the label, or 0 if it does not fit */
+static uint32_t add_label(struct cfr_view *view, const char *label)
+{
+	const size_t len = strlen(label) + 1;
+	if (view->max_labels - view->labels_len < len) {
+		size_t max = view->max_labels ? view->max_labels * 2 : 4096;
+		while (max - view->labels_len < len) {
+			max *= 2;
+		}
+		char *grown = realloc(view->labels, max);
+		if (!grown) {
+			fprintf(stderr, "Could not allocate %zu bytes of enum labels\n", max);
+			return 0;
+		}
+		view->labels = grown;
+		view->max_labels = max;
+	}
+	if (view->labels_len + len > CFR_VIEW_LABEL) {
+		fprintf(stderr, "Too many enum labels for the view\n");
+		return 0;
+	}
+
+	const uint32_t offset = view->labels_len;
+	memcpy(view->labels + offset, label, len);
+	view->labels_len += len;
+	return offset | CFR_VIEW_LABEL;
+}
+
+static int add_enum_range(struct cfr_view *view, uint32_t offset, uint32_t row)
+{
+	const struct lb_cfr_enum_range *range =
+		(const struct lb_cfr_enum_range *)record_at(view->blob, offset);
+	if (!check_header_size((const struct lb_record *)range, offset)) {
+		return -1;
+	}
+	if (cfr_le32_to_cpu(range->count) > CFR_ENUM_RANGE_MAX) {
+		fprintf(stderr, "Enum range at offset 0x%x has %u values, more than %u\n",
+			offset, cfr_le32_to_cpu(range->count), CFR_ENUM_RANGE_MAX);
+		return -1;
+	}
+
+	char label[CFR_ENUM_LABEL_MAX];
+	for (uint32_t n = 0; n < cfr_le32_to_cpu(range->count); n++) {
+		if (reserve_value(view)) {
+			return -1;
+		}
+		cfr_enum_range_label(range, n, label);
+		const size_t i = view->num_values++;
+		view->value[i] = cfr_enum_range_value(range, n);
+		view->value_option[i] = row;
+		view->value_ui_name[i] = add_label(view, label);
+		if (!view->value_ui_name[i]) {
+			return -1;
+		}
+		view->value_count[row]++;
+	}
+	return 0;
+}
+
+static int add_object(struct cfr_view *view, uint32_t offset, uint32_t parent)
+{
+	if (!check_header_size(record_at(view->blob, offset), offset) || reserve_row(view)) {
+		return -1;
+	}
+	const struct lb_cfr_option_comment *rec =
+		(const struct lb_cfr_option_comment *)record_at(view->blob, offset);
+	const uint32_t row = view->num_rows++;
+
+	view->object_id[row] = cfr_le32_to_cpu(rec->object_id);
+	view->tag[row] = cfr_le32_to_cpu(rec->tag);
+	view->flags[row] = cfr_le32_to_cpu(rec->flags);
+	view->parent[row] = parent;
+	view->offset[row] = offset;
+	view->opt_name[row] = 0;
+	view->ui_name[row] = 0;
+	view->ui_helptext[row] = 0;
+	view->def_string[row] = 0;
+	view->first_value[row] = view->num_values;
+	view->value_count[row] = 0;
+
+	switch (view->tag[row]) {
+	case LB_TAG_CFR_OPTION_ENUM:
+	case LB_TAG_CFR_OPTION_NUMBER:
+	case LB_TAG_CFR_OPTION_BOOL:
+		view->default_value[row] =
+			cfr_le32_to_cpu(((const struct lb_cfr_numeric_option *)rec)->default_value);
+		break;
+	default:
+		view->default_value[row] = 0;
+		break;
+	}
+
+	return add_children(view, offset, row);
+}
+
+static int add_children(struct cfr_view *view, uint32_t parent_off, uint32_t row)
+{
+	const struct lb_record *rec = record_at(view->blob, parent_off);
+	const uint32_t end = parent_off + cfr_le32_to_cpu(rec->size);
+
+	const size_t header_size = cfr_record_header_size(cfr_le32_to_cpu(rec->tag));
+
+	for (uint32_t off = parent_off + header_size; off < end;) {
+		const struct lb_record *child = record_at(view->blob, off);
+		const uint32_t size = cfr_le32_to_cpu(child->size);
+		if (size < sizeof(*child) || size > end - off) {
+			fprintf(stderr, "Record at offset 0x%x has bad size %u\n", off, size);
+			return -1;
+		}
+
+		int ret = 0;
+		switch (cfr_le32_to_cpu(child->tag)) {
+		case LB_TAG_CFR_OPTION_FORM:
+		case LB_TAG_CFR_OPTION_ENUM:
+		case LB_TAG_CFR_OPTION_NUMBER:
+		case LB_TAG_CFR_OPTION_BOOL:
+		case LB_TAG_CFR_OPTION_VARCHAR:
+		case LB_TAG_CFR_OPTION_COMMENT:
+			ret = add_object(view, off, row);
+			break;
+		case LB_TAG_CFR_ENUM_VALUE:
+			ret = add_enum_value(view, off, row);
+			break;
+		case LB_TAG_CFR_ENUM_RANGE:
+			ret = add_enum_range(view, off, row);
+			break;
+		case LB_TAG_CFR_VARCHAR_OPT_NAME:
+			view->opt_name[row] = string_offset(off);
+			break;
+		case LB_TAG_CFR_VARCHAR_UI_NAME:
+			view->ui_name[row] = string_offset(off);
+			break;
+		case LB_TAG_CFR_VARCHAR_UI_HELPTEXT:
+			view->ui_helptext[row] = string_offset(off);
+			break;
+		case LB_TAG_CFR_VARCHAR_DEF_VALUE:
+			view->def_string[row] = string_offset(off);
+			break;
+		}
+		if (ret) {
+			return ret;
+		}
+		off += size;
+	}
+	return 0;
+}
+
+struct cfr_view *cfr_view_build(const char *blob)
+{
+	struct cfr_view *view = calloc(1, sizeof(*view));
+	if (!view) {
+		fprintf(stderr, "Could not allocate view\n");
+		return NULL;
+	}
+	view->blob = blob;
+
+	/* Top-level forms have no parent row, so the root is handled here */
+	const uint32_t end = cfr_le32_to_cpu(((const struct lb_cfr *)blob)->size);
+	for (uint32_t off = cfr_first_form(blob); off < end;) {
+		const struct lb_record *child = record_at(blob, off);
+		const uint32_t size = cfr_le32_to_cpu(child->size);
+		if (size < sizeof(*child) || size > end - off) {
+			fprintf(stderr, "Record at offset 0x%x has bad size %u\n", off, size);
+			cfr_view_free(view);
+			return NULL;
+		}
+		if (cfr_le32_to_cpu(child->tag) == LB_TAG_CFR_OPTION_FORM &&
+		    add_object(view, off, CFR_VIEW_NO_PARENT)) {
+			cfr_view_free(view);
+			return NULL;
+		}
+		off += size;
+	}
+	return view;
+}
+
+void cfr_view_free(struct cfr_view *view)
+{
+	if (!view) {
+		return;
+	}
+	free(view->object_id);
+	free(view->tag);
+	free(view->flags);
+	free(view->default_value);
+	free(view->parent);
+	free(view->offset);
+	free(view->opt_name);
+	free(view->ui_name);
+	free(view->ui_helptext);
+	free(view->def_string);
+	free(view->first_value);
+	free(view->value_count);
+	free(view->value);
+	free(view->value_ui_name);
+	free(view->value_option);
+	free(view->labels);
+	free(view);
+}
+
+const char *cfr_view_string(const struct cfr_view *view, uint32_t offset)
+{
+	if (offset & CFR_VIEW_LABEL) {
+		return view->labels + (offset & ~CFR_VIEW_LABEL);
+	}
+	return offset ? view->blob + offset : "";
+}
+
+/*
+ * NE and NO_BITS are computed as the inverse of EQ and ANY_BITS, so
+ * that the vector code only needs the comparisons SSE2 provides.
+ */
+static enum cfr_view_op base_op(enum cfr_view_op op)
+{
+	switch (op) {
+	case CFR_VIEW_NE:
+		return CFR_VIEW_EQ;
+	case CFR_VIEW_NO_BITS:
+		return CFR_VIEW_ANY_BITS;
+	default:
+		return op;
+	}
+}
+
+static bool match_scalar(uint32_t x, enum cfr_view_op op, uint32_t operand)
+{
+	switch (op) {
+	case CFR_VIEW_EQ:
+		return x == operand;
+	case CFR_VIEW_GT:
+		return x > operand;
+	case CFR_VIEW_LT:
+		return x < operand;
+	case CFR_VIEW_ANY_BITS:
+		return (x & operand) != 0;
+	default:
+		return false;
+	}
+}
+
+#if defined(__AVX2__)
+#define VEC_ROWS	8
+
+static uint32_t match_vector(const uint32_t *src, enum cfr_view_op op, uint32_t operand)
+{
+	/* There are only signed comparisons, flip the sign bits first */
+	const __m256i sign = _mm256_set1_epi32(INT32_MIN);
+	const __m256i x = _mm256_loadu_si256((const __m256i *)src);
+	const __m256i y = _mm256_set1_epi32(operand);
+	__m256i hit;
+
+	switch (op) {
+	case CFR_VIEW_EQ:
+		hit = _mm256_cmpeq_epi32(x, y);
+		break;
+	case CFR_VIEW_GT:
+		hit = _mm256_cmpgt_epi32(_mm256_xor_si256(x, sign), _mm256_xor_si256(y, sign));
+		break;
+	case CFR_VIEW_LT:
+		hit = _mm256_cmpgt_epi32(_mm256_xor_si256(y, sign), _mm256_xor_si256(x, sign));
+		break;
+	case CFR_VIEW_ANY_BITS:
+		hit = _mm256_cmpeq_epi32(_mm256_and_si256(x, y), _mm256_setzero_si256());
+		return ~(uint32_t)_mm256_movemask_ps(_mm256_castsi256_ps(hit)) & 0xff;
+	default:
+		return 0;
+	}
+	return (uint32_t)_mm256_movemask_ps(_mm256_castsi256_ps(hit));
+}
+#elif defined(__SSE2__)
+#define VEC_ROWS	4
+
+static uint32_t match_vector(const uint32_t *src, enum cfr_view_op op, uint32_t operand)
+{
+	/* There are only signed comparisons, flip the sign bits first */
+	const __m128i sign = _mm_set1_epi32(INT32_MIN);
+	const __m128i x = _mm_loadu_si128((const __m128i *)src);
+	const __m128i y = _mm_set1_epi32(operand);
+	__m128i hit;
+
+	switch (op) {
+	case CFR_VIEW_EQ:
+		hit = _mm_cmpeq_epi32(x, y);
+		break;
+	case CFR_VIEW_GT:
+		hit = _mm_cmpgt_epi32(_mm_xor_si128(x, sign), _mm_xor_si128(y, sign));
+		break;
+	case CFR_VIEW_LT:
+		hit = _mm_cmplt_epi32(_mm_xor_si128(x, sign), _mm_xor_si128(y, sign));
+		break;
+	case CFR_VIEW_ANY_BITS:
+		hit = _mm_cmpeq_epi32(_mm_and_si128(x, y), _mm_setzero_si128());
+		return ~(uint32_t)_mm_movemask_ps(_mm_castsi128_ps(hit)) & 0xf;
+	default:
+		return 0;
+	}
+	return (uint32_t)_mm_movemask_ps(_mm_castsi128_ps(hit));
+}
+#endif
+
+static uint64_t filter_word(const uint32_t *src, size_t count, enum cfr_view_op op,
+			    uint32_t operand)
+{
+	uint64_t bits = 0;
+	size_t i = 0;
+
+#ifdef VEC_ROWS
+	for (; i + VEC_ROWS <= count; i += VEC_ROWS) {
+		bits |= (uint64_t)match_vector(src + i, op, operand) << i;
+	}
+#endif
+	for (; i < count; i++) {
+		bits |= (uint64_t)match_scalar(src[i], op, operand) << i;
+	}
+	return bits;
+}
+
+static uint64_t tail_mask(size_t count)
+{
+	return count % 64 ? (UINT64_C(1) << (count % 64)) - 1 : UINT64_MAX;
+}
+
+void cfr_view_filter(const uint32_t *column, size_t count, enum cfr_view_op op,
+		     uint32_t operand, uint64_t *bitmap)
+{
+	const enum cfr_view_op base = base_op(op);
+	const uint64_t invert = base != op ? UINT64_MAX : 0;
+	const size_t words = cfr_view_bitmap_words(count);
+
+	for (size_t w = 0; w < words; w++) {
+		const size_t rows = w + 1 < words ? 64 : count - w * 64;
+		bitmap[w] = filter_word(column + w * 64, rows, base, operand) ^ invert;
+	}
+	if (words) {
+		bitmap[words - 1] &= tail_mask(count);
+	}
+}
+
+void cfr_view_bitmap_and(uint64_t *dst, const uint64_t *src, size_t count)
+{
+	for (size_t w = 0; w < cfr_view_bitmap_words(count); w++) {
+		dst[w] &= src[w];
+	}
+}
+
+void cfr_view_bitmap_or(uint64_t *dst, const uint64_t *src, size_t count)
+{
+	for (size_t w = 0; w < cfr_view_bitmap_words(count); w++) {
+		dst[w] |= src[w];
+	}
+}
+
+size_t cfr_view_bitmap_count(const uint64_t *bitmap, size_t count)
+{
+	size_t total = 0;
+	for (size_t w = 0; w < cfr_view_bitmap_words(count); w++) {
+		total += __builtin_popcountll(bitmap[w]);
+	}
+	return total;
+}
+
+size_t cfr_view_bitmap_rows(const uint64_t *bitmap, size_t count, uint32_t *rows)
+{
+	size_t n = 0;
+	for (size_t w = 0; w < cfr_view_bitmap_words(count); w++) {
+		for (uint64_t bits = bitmap[w]; bits; bits &= bits - 1) {
+			rows[n++] = w * 64 + __builtin_ctzll(bits);
+		}
+	}
+	return n;
+}
@@ -0,0 +1,99 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+
+#ifndef CFR_VIEW_H
+#define CFR_VIEW_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * A columnar view of the objects in a CFR blob: forms, options and
+ * comments. Every object is a row, in the same pre-order as the blob,
+ * and every field is an array with one element per row. Bulk queries
+ * then scan a few dense arrays instead of chasing variable-length
+ * records, and the filter helpers below can compare several rows at
+ * once.
+ *
+ * Enum values are rows of a second table, stored contiguously for each
+ * enum option.
+ *
+ * String columns hold the offset of the NULL-terminated string in the
+ * blob, or 0 when the object does not have that string. The blob must
+ * stay around for as long as the view is used. Enum ranges have no
+ * strings in the blob for their values, so their labels are generated
+ * into `labels` instead, and their offsets have CFR_VIEW_LABEL set.
+ */
+
+#define CFR_VIEW_NO_PARENT	UINT32_MAX
+#define CFR_VIEW_LABEL		(1u << 31)
+
+struct cfr_view {
+	const char *blob;
+	size_t num_rows;
+	size_t num_values;
+
+	/* Object rows */
+	uint32_t *object_id;
+	uint32_t *tag;
+	uint32_t *flags;
+	uint32_t *default_value;	/* 0 for objects without a numeric default */
+	uint32_t *parent;		/* Row of the containing form */
+	uint32_t *offset;		/* Of the object record in the blob */
+	uint32_t *opt_name;
+	uint32_t *ui_name;
+	uint32_t *ui_helptext;
+	uint32_t *def_string;		/* Default of varchar options */
+	uint32_t *first_value;		/* Index of the first enum value row */
+	uint32_t *value_count;		/* Number of enum value rows */
+
+	/* Enum value rows */
+	uint32_t *value;
+	uint32_t *value_ui_name;
+	uint32_t *value_option;		/* Row of the enum option */
+
+	char *labels;			/* Generated UI names of enum range values */
+	size_t labels_len;
+
+	size_t max_rows;
+	size_t max_values;
+	size_t max_labels;
+};
+
+/* Builds the view in one pass over the blob. Returns NULL on error. */
+struct cfr_view *cfr_view_build(const char *blob);
+void cfr_view_free(struct cfr_view *view);
+
+/* Returns the string at `offset` in the view's blob, or "" for 0 */
+const char *cfr_view_string(const struct cfr_view *view, uint32_t offset);
+
+/*
+ * Filters produce bitmaps with one bit per row, bit `i % 64` of word
+ * `i / 64` being row `i`. Bits past the last row are always zero.
+ */
+enum cfr_view_op {
+	CFR_VIEW_EQ,		/* column == operand */
+	CFR_VIEW_NE,		/* column != operand */
+	CFR_VIEW_GT,		/* column > operand */
+	CFR_VIEW_LT,		/* column < operand */
+	CFR_VIEW_ANY_BITS,	/* (column & operand) != 0 */
+	CFR_VIEW_NO_BITS,	/* (column & operand) == 0 */
+};
+
+static inline size_t cfr_view_bitmap_words(size_t count)
+{
+	return (count + 63) / 64;
+}
+
+void cfr_view_filter(const uint32_t *column, size_t count, enum cfr_view_op op,
+		     uint32_t operand, uint64_t *bitmap);
+
+/* Combine two bitmaps of `count` rows into `dst` */
+void cfr_view_bitmap_and(uint64_t *dst, const uint64_t *src, size_t count);
+void cfr_view_bitmap_or(uint64_t *dst, const uint64_t *src, size_t count);
+
+size_t cfr_view_bitmap_count(const uint64_t *bitmap, size_t count);
+
+/* Writes the rows set in `bitmap` to `rows`, returns how many there are */
+size_t cfr_view_bitmap_rows(const uint64_t *bitmap, size_t count, uint32_t *rows);
+
+#endif	/* CFR_VIEW_H */
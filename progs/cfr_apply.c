@@ -0,0 +1,100 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "cfr.h"
+#include "cfr_delta.h"
+#include "cfr_file.h"
+
+/* Deltas are not blobs, so they are read as they are */
+static int read_delta(char **data, size_t *length, const char *filename)
+{
+	FILE *stream = fopen(filename, "rb");
+	if (!stream) {
+		perror("Could not open delta file");
+		return -1;
+	}
+
+	int ret = -1;
+	long size;
+	if (fseek(stream, 0, SEEK_END) || (size = ftell(stream)) < 0) {
+		perror("Could not seek in delta file");
+		goto out;
+	}
+	rewind(stream);
+
+	*data = malloc(size ? size : 1);
+	if (!*data) {
+		fprintf(stderr, "Could not allocate %ld bytes\n", size);
+		goto out;
+	}
+	if (fread(*data, 1, size, stream) != (size_t)size) {
+		fprintf(stderr, "Could not read delta file\n");
+		free(*data);
+		goto out;
+	}
+	*length = size;
+	ret = 0;
+out:
+	fclose(stream);
+	return ret;
+}
+
+static int write_file(const char *filename, const void *data, size_t length)
+{
+	const int fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0) {
+		perror("Could not open output file");
+		return -1;
+	}
+	int ret = cfr_write_all(fd, data, length);
+	if (close(fd)) {
+		ret = -1;
+	}
+	return ret;
+}
+
+static void usage(void)
+{
+	fprintf(stderr, "Usage: cfr_apply <source file> <delta file> <output file>\n");
+	fprintf(stderr, "Rebuilds the target blob of a delta made by cfr_delta, as v1.\n");
+}
+
+int main(int argc, char **argv)
+{
+	if (argc != 4) {
+		usage();
+		return -1;
+	}
+
+	char *source;
+	if (cfr_read_file(&source, argv[1])) {
+		return -1;
+	}
+	char *delta;
+	size_t length;
+	if (read_delta(&delta, &length, argv[2])) {
+		free(source);
+		return -1;
+	}
+
+	char *target = NULL;
+	int ret = cfr_delta_apply(source, delta, length, &target);
+	if (!ret) {
+		const struct lb_cfr *root = (const struct lb_cfr *)target;
+		ret = write_file(argv[3], target, cfr_le32_to_cpu(root->size));
+		if (!ret) {
+			printf("Rebuilt %u bytes with CRC32 0x%08x\n", cfr_le32_to_cpu(root->size),
+			       cfr_le32_to_cpu(root->checksum));
+		}
+	}
+
+	free(target);
+	free(delta);
+	free(source);
+	return ret;
+}
@@ -0,0 +1,917 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+
+/* For termios, poll() and sigaction() */
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+
+#include "cfr.h"
+#include "cfr_file.h"
+#include "cfr_tree.h"
+
+#define NO_PARENT		UINT32_MAX
+#define MAX_QUERY		128
+#define MAX_LINE		1024
+
+/* Redraw interval while the search index is still being built */
+#define INDEX_POLL_MS		100
+
+struct name {
+	const char *data;
+	uint32_t len;
+};
+
+struct index_entry {
+	uint32_t offset;
+	uint32_t parent;	/* Entry of the enclosing form, or NO_PARENT */
+	struct name opt_name;
+	struct name ui_name;
+};
+
+/*
+ * Every form and option in blob order, so searches can start from any
+ * offset. Built by a background thread, entries are only looked at once
+ * `ready` is set.
+ */
+struct search_index {
+	const char *blob;
+	struct index_entry *entries;
+	size_t num_entries;
+	size_t max_entries;
+	atomic_uint progress;	/* Offset of the last top-level form indexed */
+	atomic_bool ready;
+	bool failed;
+};
+
+struct browser {
+	const char *filename;
+	const char *blob;
+	uint32_t blob_size;
+
+	struct cfr_tree tree;
+	size_t cursor;
+	size_t top;		/* First row on screen */
+
+	unsigned int width;
+	unsigned int height;
+
+	struct search_index index;
+
+	bool searching;
+	bool search_pending;	/* Waiting for the index */
+	char query[MAX_QUERY];
+	size_t query_len;
+	uint32_t search_start;	/* Offset of the row the search started on */
+	const char *message;
+
+	char *screen;
+	size_t screen_len;
+	size_t screen_cap;
+};
+
+/*
+ * Blob helpers
+ */
+
+static const struct lb_record *record_at(const char *blob, uint32_t offset)
+{
+	return (const struct lb_record *)(blob + offset);
+}
+
+static struct name find_string(const char *blob, uint32_t offset, uint32_t tag)
+{
+	cfr_for_each_child(blob, offset, off) {
+		const struct lb_cfr_varbinary *str = (const struct lb_cfr_varbinary *)(blob + off);
+		const uint32_t size = cfr_le32_to_cpu(str->size);
+		const uint32_t data_length = cfr_le32_to_cpu(str->data_length);
+		if (cfr_le32_to_cpu(str->tag) != tag) {
+			continue;
+		}
+		if (size < sizeof(*str) || !data_length || data_length > size - sizeof(*str)) {
+			break;
+		}
+		return (struct name) { (const char *)str->data, data_length - 1 };
+	}
+	return (struct name) { "", 0 };
+}
+
+/* Records that can be searched for */
+static bool is_object_tag(uint32_t tag)
+{
+	switch (tag) {
+	case LB_TAG_CFR_OPTION_FORM:
+	case LB_TAG_CFR_OPTION_ENUM:
+	case LB_TAG_CFR_OPTION_NUMBER:
+	case LB_TAG_CFR_OPTION_BOOL:
+	case LB_TAG_CFR_OPTION_VARCHAR:
+	case LB_TAG_CFR_OPTION_COMMENT:
+		return true;
+	default:
+		return false;
+	}
+}
+
+/*
+ * Tree
+ */
+
+static void term_restore(void);
+
+/* Running out of memory while drawing is fatal, but leaves the terminal usable */
+static void *xrealloc(void *ptr, size_t size)
+{
+	void *ret = realloc(ptr, size);
+	if (!ret) {
+		term_restore();
+		fprintf(stderr, "Could not allocate %zu bytes\n", size);
+		exit(-1);
+	}
+	return ret;
+}
+
+/* Rebuilds the visible rows, keeping the cursor on the node at `offset` */
+static void build_rows(struct browser *b, uint32_t offset)
+{
+	if (cfr_tree_build_rows(&b->tree, offset, &b->cursor)) {
+		b->message = "Out of memory, not every row is shown";
+	}
+}
+
+static uint32_t cursor_offset(const struct browser *b)
+{
+	return b->tree.num_rows ? b->tree.rows[b->cursor]->offset : 0;
+}
+
+/*
+ * Search index
+ */
+
+static void index_records(struct search_index *index, uint32_t parent, uint32_t parent_entry)
+{
+	cfr_for_each_child(index->blob, parent, off) {
+		const uint32_t tag = cfr_tree_tag(index->blob, off);
+		if (!is_object_tag(tag)) {
+			continue;
+		}
+		if (index->num_entries == index->max_entries) {
+			index->max_entries = index->max_entries ? index->max_entries * 2 : 1024;
+			index->entries = realloc(index->entries,
+						 index->max_entries * sizeof(*index->entries));
+			if (!index->entries) {
+				index->failed = true;
+				return;
+			}
+		}
+		const uint32_t entry = index->num_entries++;
+		index->entries[entry] = (struct index_entry) {
+			.offset		= off,
+			.parent		= parent_entry,
+			.opt_name	= find_string(index->blob, off, LB_TAG_CFR_VARCHAR_OPT_NAME),
+			.ui_name	= find_string(index->blob, off, LB_TAG_CFR_VARCHAR_UI_NAME),
+		};
+		if (tag == LB_TAG_CFR_OPTION_FORM) {
+			index_records(index, off, entry);
+		}
+		if (index->failed) {
+			return;
+		}
+		if (parent_entry == NO_PARENT) {
+			atomic_store_explicit(&index->progress, off, memory_order_relaxed);
+		}
+	}
+}
+
+static void *index_worker(void *arg)
+{
+	struct search_index *index = arg;
+
+	index_records(index, 0, NO_PARENT);
+	atomic_store_explicit(&index->ready, true, memory_order_release);
+	return NULL;
+}
+
+static bool index_ready(struct search_index *index)
+{
+	return atomic_load_explicit(&index->ready, memory_order_acquire);
+}
+
+static char tolower_ascii(char c)
+{
+	return c >= 'A' && c <= 'Z' ? c + 'a' - 'A' : c;
+}
+
+static bool contains(const struct name *name, const char *query, size_t query_len)
+{
+	for (size_t i = 0; i + query_len <= name->len; i++) {
+		size_t j = 0;
+		while (j < query_len && tolower_ascii(name->data[i + j]) == tolower_ascii(query[j])) {
+			j++;
+		}
+		if (j == query_len) {
+			return true;
+		}
+	}
+	return false;
+}
+
+static bool entry_matches(const struct index_entry *entry, const char *query, size_t query_len)
+{
+	return contains(&entry->opt_name, query, query_len) ||
+	       contains(&entry->ui_name, query, query_len);
+}
+
+/* Expands everything above the entry, returns its node */
+static struct cfr_tree_node *reveal(struct browser *b, uint32_t entry)
+{
+	const struct index_entry *e = &b->index.entries[entry];
+	struct cfr_tree_node *siblings = b->tree.forms;
+	size_t num_siblings = b->tree.num_forms;
+
+	if (e->parent != NO_PARENT) {
+		struct cfr_tree_node *parent = reveal(b, e->parent);
+		if (!parent || cfr_tree_expand(b->blob, parent)) {
+			return NULL;
+		}
+		siblings = parent->children;
+		num_siblings = parent->num_children;
+	}
+
+	for (size_t i = 0; i < num_siblings; i++) {
+		if (siblings[i].offset == e->offset) {
+			return &siblings[i];
+		}
+	}
+	return NULL;
+}
+
+/* Moves to the next match after `offset`, or the previous one before it */
+static void search(struct browser *b, uint32_t offset, bool forward, bool inclusive)
+{
+	if (!b->query_len) {
+		return;
+	}
+	if (!index_ready(&b->index)) {
+		b->search_pending = true;
+		return;
+	}
+	b->search_pending = false;
+	if (b->index.failed) {
+		b->message = "Could not build the search index";
+		return;
+	}
+
+	const struct index_entry *entries = b->index.entries;
+	const size_t n = b->index.num_entries;
+
+	/*
+	 * Entries are in blob order, find the first one to look at going
+	 * forward. Going backward starts right before it instead.
+	 */
+	const bool skip_offset = forward && !inclusive;
+	size_t lo = 0, hi = n;
+	while (lo < hi) {
+		const size_t mid = lo + (hi - lo) / 2;
+		if (entries[mid].offset < offset || (skip_offset && entries[mid].offset == offset)) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+
+	for (size_t i = 0; i < n; i++) {
+		const size_t entry = forward ? (lo + i) % n : (lo + n - 1 - i) % n;
+		if (!entry_matches(&entries[entry], b->query, b->query_len)) {
+			continue;
+		}
+		const struct cfr_tree_node *node = reveal(b, entry);
+		if (node) {
+			b->message = NULL;
+			build_rows(b, node->offset);
+			return;
+		}
+	}
+	b->message = "No match";
+}
+
+/*
+ * Drawing
+ */
+
+struct line {
+	char data[MAX_LINE];
+	size_t len;
+};
+
+static void line_add(struct line *line, const char *str, size_t len)
+{
+	for (size_t i = 0; i < len && line->len < sizeof(line->data); i++) {
+		const unsigned char c = str[i];
+		line->data[line->len++] = c < 0x20 || c == 0x7f ? '?' : c;
+	}
+}
+
+static void line_name(struct line *line, const struct name *name)
+{
+	line_add(line, name->data, name->len);
+}
+
+__attribute__((format(printf, 2, 3)))
+static void line_printf(struct line *line, const char *fmt, ...)
+{
+	char buffer[MAX_LINE];
+	va_list args;
+	va_start(args, fmt);
+	const int len = vsnprintf(buffer, sizeof(buffer), fmt, args);
+	va_end(args);
+	if (len > 0) {
+		line_add(line, buffer, (size_t)len < sizeof(buffer) ? (size_t)len : sizeof(buffer) - 1);
+	}
+}
+
+static void screen_add(struct browser *b, const char *data, size_t len)
+{
+	if (b->screen_cap - b->screen_len < len) {
+		b->screen_cap = (b->screen_len + len) * 2;
+		b->screen = xrealloc(b->screen, b->screen_cap);
+	}
+	memcpy(b->screen + b->screen_len, data, len);
+	b->screen_len += len;
+}
+
+#define screen_lit(b, str) screen_add((b), (str), sizeof(str) - 1)
+
+/* Writes one line cut to the terminal width, counting UTF-8 sequences as one column */
+static void screen_line(struct browser *b, const struct line *line, bool highlight)
+{
+	size_t len = 0;
+	unsigned int columns = 0;
+	while (len < line->len) {
+		if (((unsigned char)line->data[len] & 0xc0) != 0x80) {
+			if (columns == b->width) {
+				break;
+			}
+			columns++;
+		}
+		len++;
+	}
+
+	if (highlight) {
+		screen_lit(b, "\033[7m");
+	}
+	screen_add(b, line->data, len);
+	for (; columns < b->width && highlight; columns++) {
+		screen_lit(b, " ");
+	}
+	if (highlight) {
+		screen_lit(b, "\033[0m");
+	}
+	screen_lit(b, "\033[K\r\n");
+}
+
+static void format_value(const char *blob, uint32_t offset, struct line *line)
+{
+	const struct lb_cfr_numeric_option *option =
+		(const struct lb_cfr_numeric_option *)record_at(blob, offset);
+	const uint32_t value = cfr_le32_to_cpu(option->default_value);
+
+	switch (cfr_le32_to_cpu(option->tag)) {
+	case LB_TAG_CFR_OPTION_ENUM: {
+		struct cfr_enum_iter it;
+		for (cfr_enum_iter_init(&it, option); cfr_enum_iter_next(&it);) {
+			if (it.value == value) {
+				const struct name ui_name = { it.ui_name, strlen(it.ui_name) };
+				line_name(line, &ui_name);
+				return;
+			}
+		}
+		line_printf(line, "%u", value);
+		return;
+	}
+	case LB_TAG_CFR_OPTION_NUMBER:
+		line_printf(line, "%u", value);
+		return;
+	case LB_TAG_CFR_OPTION_BOOL:
+		line_printf(line, "%s", value ? "Enabled" : "Disabled");
+		return;
+	case LB_TAG_CFR_OPTION_VARCHAR: {
+		const struct name str = find_string(blob, offset, LB_TAG_CFR_VARCHAR_DEF_VALUE);
+		line_printf(line, "\"");
+		line_name(line, &str);
+		line_printf(line, "\"");
+		return;
+	}
+	}
+}
+
+static void format_row(const struct browser *b, const struct cfr_tree_node *node,
+		       struct line *line)
+{
+	const uint32_t tag = cfr_tree_tag(b->blob, node->offset);
+	const struct name ui_name = find_string(b->blob, node->offset, LB_TAG_CFR_VARCHAR_UI_NAME);
+
+	line->len = 0;
+	for (unsigned int i = 0; i < node->depth; i++) {
+		line_printf(line, "  ");
+	}
+	if (cfr_tree_is_expandable(b->blob, node)) {
+		line_printf(line, "%s ", node->expanded ? "-" : "+");
+	} else {
+		line_printf(line, "  ");
+	}
+
+	switch (tag) {
+	case LB_TAG_CFR_OPTION_FORM:
+		line_printf(line, "[");
+		line_name(line, &ui_name);
+		line_printf(line, "]");
+		break;
+	case LB_TAG_CFR_OPTION_COMMENT:
+		line_printf(line, "# ");
+		line_name(line, &ui_name);
+		break;
+	case LB_TAG_CFR_ENUM_VALUE:
+	case LB_TAG_CFR_ENUM_RANGE: {
+		struct name value_name = ui_name;
+		uint32_t value;
+		char label[CFR_ENUM_LABEL_MAX];
+		if (tag == LB_TAG_CFR_ENUM_RANGE) {
+			const struct lb_cfr_enum_range *range =
+				(const struct lb_cfr_enum_range *)record_at(b->blob, node->offset);
+			value = cfr_enum_range_value(range, node->index);
+			cfr_enum_range_label(range, node->index, label);
+			value_name = (struct name) { label, strlen(label) };
+		} else {
+			value = cfr_le32_to_cpu(((const struct lb_cfr_enum_value *)
+						 record_at(b->blob, node->offset))->value);
+		}
+		const uint32_t current =
+			cfr_le32_to_cpu(((const struct lb_cfr_numeric_option *)
+					 record_at(b->blob, node->parent))->default_value);
+		line_printf(line, "%s ", value == current ? "*" : " ");
+		line_name(line, &value_name);
+		line_printf(line, " (%u)", value);
+		break;
+	}
+	default: {
+		const struct name opt_name =
+			find_string(b->blob, node->offset, LB_TAG_CFR_VARCHAR_OPT_NAME);
+		line_name(line, &ui_name);
+		line_printf(line, ": ");
+		format_value(b->blob, node->offset, line);
+		line_printf(line, "  (");
+		line_name(line, &opt_name);
+		line_printf(line, ")");
+		break;
+	}
+	}
+}
+
+static void format_status(const struct browser *b, struct line *line)
+{
+	line->len = 0;
+
+	if (b->searching || b->search_pending) {
+		line_printf(line, "/%.*s", (int)b->query_len, b->query);
+		if (b->search_pending) {
+			const uint32_t progress = atomic_load_explicit(&b->index.progress,
+								       memory_order_relaxed);
+			line_printf(line, "  (indexing, %u%%)",
+				    (unsigned int)((uint64_t)progress * 100 / b->blob_size));
+		} else if (b->message) {
+			line_printf(line, "  (%s)", b->message);
+		}
+		return;
+	}
+	if (b->message) {
+		line_printf(line, "%s", b->message);
+		return;
+	}
+	if (!b->tree.num_rows) {
+		line_printf(line, "No forms");
+		return;
+	}
+
+	const uint32_t offset = cursor_offset(b);
+	const uint32_t tag = cfr_tree_tag(b->blob, offset);
+	if (tag == LB_TAG_CFR_ENUM_VALUE || tag == LB_TAG_CFR_ENUM_RANGE) {
+		line_printf(line, "offset 0x%x", offset);
+		return;
+	}
+
+	const struct lb_cfr_option_form *object =
+		(const struct lb_cfr_option_form *)record_at(b->blob, offset);
+	const uint32_t flags = cfr_le32_to_cpu(object->flags);
+	line_printf(line, "object %u at 0x%x%s%s%s%s", cfr_le32_to_cpu(object->object_id), offset,
+		    flags & CFR_OPTFLAG_READONLY ? ", read-only" : "",
+		    flags & CFR_OPTFLAG_GRAYOUT ? ", grayed out" : "",
+		    flags & CFR_OPTFLAG_SUPPRESS ? ", suppressed" : "",
+		    flags & CFR_OPTFLAG_VOLATILE ? ", volatile" : "");
+
+	const struct name help = find_string(b->blob, offset, LB_TAG_CFR_VARCHAR_UI_HELPTEXT);
+	if (help.len) {
+		line_printf(line, " | ");
+		line_name(line, &help);
+	}
+}
+
+static void draw(struct browser *b)
+{
+	const size_t list_height = b->height > 2 ? b->height - 2 : 1;
+	if (b->cursor < b->top) {
+		b->top = b->cursor;
+	} else if (b->cursor >= b->top + list_height) {
+		b->top = b->cursor - list_height + 1;
+	}
+
+	struct line line = { .len = 0 };
+	b->screen_len = 0;
+	screen_lit(b, "\033[H");
+
+	line_printf(&line, "%s: %zu forms, %s", b->filename, b->tree.num_forms,
+		    index_ready(&b->index) ? "indexed" : "indexing");
+	line_printf(&line, "  |  arrows: move  enter: open/close  /: search  n/N: next/prev  q: quit");
+	screen_line(b, &line, true);
+
+	for (size_t i = 0; i < list_height; i++) {
+		const size_t row = b->top + i;
+		if (row < b->tree.num_rows) {
+			format_row(b, b->tree.rows[row], &line);
+		} else {
+			line.len = 0;
+		}
+		screen_line(b, &line, row == b->cursor && row < b->tree.num_rows);
+	}
+
+	format_status(b, &line);
+	screen_add(b, line.data, line.len < b->width ? line.len : b->width);
+	screen_lit(b, "\033[K");
+
+	cfr_write_all(STDOUT_FILENO, b->screen, b->screen_len);
+}
+
+/*
+ * Terminal
+ */
+
+static struct termios saved_termios;
+static volatile sig_atomic_t resized;
+
+static void on_resize(int sig)
+{
+	resized = 1;
+}
+
+static void update_size(struct browser *b)
+{
+	struct winsize ws;
+	if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) || !ws.ws_col || !ws.ws_row) {
+		ws.ws_col = 80;
+		ws.ws_row = 24;
+	}
+	b->width = ws.ws_col;
+	b->height = ws.ws_row;
+}
+
+static int term_init(void)
+{
+	if (!isatty(STDIN_FILENO) || !isatty(STDOUT_FILENO)) {
+		fprintf(stderr, "cfr_browse needs a terminal\n");
+		return -1;
+	}
+	if (tcgetattr(STDIN_FILENO, &saved_termios)) {
+		perror("Could not get terminal attributes");
+		return -1;
+	}
+
+	struct termios raw = saved_termios;
+	raw.c_iflag &= ~(IXON | ICRNL | BRKINT | ISTRIP);
+	raw.c_lflag &= ~(ECHO | ICANON | ISIG | IEXTEN);
+	raw.c_cc[VMIN] = 1;
+	raw.c_cc[VTIME] = 0;
+	if (tcsetattr(STDIN_FILENO, TCSAFLUSH, &raw)) {
+		perror("Could not set terminal attributes");
+		return -1;
+	}
+
+	/* Alternate screen, hidden cursor */
+	static const char enter[] = "\033[?1049h\033[?25l";
+	cfr_write_all(STDOUT_FILENO, enter, sizeof(enter) - 1);
+	return 0;
+}
+
+static void term_restore(void)
+{
+	static const char leave[] = "\033[?25h\033[?1049l";
+	cfr_write_all(STDOUT_FILENO, leave, sizeof(leave) - 1);
+	tcsetattr(STDIN_FILENO, TCSAFLUSH, &saved_termios);
+}
+
+/*
+ * Input
+ */
+
+enum key {
+	KEY_ESC = 0x1b,
+	KEY_BACKSPACE = 0x7f,
+	KEY_UP = 0x100,
+	KEY_DOWN,
+	KEY_LEFT,
+	KEY_RIGHT,
+	KEY_PAGE_UP,
+	KEY_PAGE_DOWN,
+	KEY_HOME,
+	KEY_END,
+	KEY_UNKNOWN,
+};
+
+#define KEY_CTRL(c)	((c) & 0x1f)
+
+/* Decodes one key from `buf`, returns the number of bytes it took */
+static size_t decode_key(const char *buf, size_t len, int *key)
+{
+	if (buf[0] != '\033' || len < 3 || (buf[1] != '[' && buf[1] != 'O')) {
+		*key = (unsigned char)buf[0];
+		return 1;
+	}
+
+	switch (buf[2]) {
+	case 'A': *key = KEY_UP;	return 3;
+	case 'B': *key = KEY_DOWN;	return 3;
+	case 'C': *key = KEY_RIGHT;	return 3;
+	case 'D': *key = KEY_LEFT;	return 3;
+	case 'H': *key = KEY_HOME;	return 3;
+	case 'F': *key = KEY_END;	return 3;
+	}
+
+	/* `ESC [ <number> ~` */
+	size_t i = 2;
+	unsigned int number = 0;
+	while (i < len && buf[i] >= '0' && buf[i] <= '9') {
+		number = number * 10 + buf[i++] - '0';
+	}
+	if (i == len || buf[i] != '~') {
+		*key = KEY_UNKNOWN;
+		return i;
+	}
+	switch (number) {
+	case 1: case 7:	*key = KEY_HOME;	break;
+	case 4: case 8:	*key = KEY_END;		break;
+	case 5:		*key = KEY_PAGE_UP;	break;
+	case 6:		*key = KEY_PAGE_DOWN;	break;
+	default:	*key = KEY_UNKNOWN;	break;
+	}
+	return i + 1;
+}
+
+static void move_cursor(struct browser *b, long delta)
+{
+	if (!b->tree.num_rows) {
+		return;
+	}
+	long cursor = (long)b->cursor + delta;
+	if (cursor < 0) {
+		cursor = 0;
+	} else if ((size_t)cursor >= b->tree.num_rows) {
+		cursor = b->tree.num_rows - 1;
+	}
+	b->cursor = cursor;
+}
+
+static void toggle(struct browser *b)
+{
+	if (!b->tree.num_rows) {
+		return;
+	}
+	struct cfr_tree_node *node = b->tree.rows[b->cursor];
+	if (!cfr_tree_is_expandable(b->blob, node)) {
+		return;
+	}
+	if (node->expanded) {
+		cfr_tree_collapse(node);
+	} else if (cfr_tree_expand(b->blob, node)) {
+		b->message = "Out of memory";
+		return;
+	}
+	build_rows(b, node->offset);
+}
+
+static void close_or_parent(struct browser *b)
+{
+	if (!b->tree.num_rows) {
+		return;
+	}
+	struct cfr_tree_node *node = b->tree.rows[b->cursor];
+	if (node->expanded) {
+		cfr_tree_collapse(node);
+		build_rows(b, node->offset);
+		return;
+	}
+	while (b->cursor > 0 && b->tree.rows[b->cursor]->depth >= node->depth) {
+		b->cursor--;
+	}
+}
+
+static void search_key(struct browser *b, int key)
+{
+	switch (key) {
+	case '\r':
+	case '\n':
+		b->searching = false;
+		return;
+	case KEY_ESC:
+	case KEY_CTRL('c'):
+		b->searching = false;
+		b->search_pending = false;
+		b->message = NULL;
+		build_rows(b, b->search_start);
+		return;
+	case KEY_BACKSPACE:
+	case KEY_CTRL('h'):
+		if (b->query_len) {
+			b->query_len--;
+		}
+		search(b, b->search_start, true, true);
+		return;
+	case KEY_DOWN:
+	case KEY_CTRL('n'):
+		search(b, cursor_offset(b), true, false);
+		return;
+	case KEY_UP:
+	case KEY_CTRL('p'):
+		search(b, cursor_offset(b), false, false);
+		return;
+	}
+	if (key >= 0x20 && key < 0x7f && b->query_len < sizeof(b->query)) {
+		b->query[b->query_len++] = key;
+		search(b, b->search_start, true, true);
+	}
+}
+
+/* Returns false once the user wants to quit */
+static bool handle_key(struct browser *b, int key)
+{
+	const long page = b->height > 3 ? b->height - 3 : 1;
+
+	if (b->searching) {
+		search_key(b, key);
+		return true;
+	}
+	b->message = NULL;
+
+	switch (key) {
+	case 'q':
+	case KEY_CTRL('c'):
+		return false;
+	case KEY_UP:
+	case 'k':
+		move_cursor(b, -1);
+		break;
+	case KEY_DOWN:
+	case 'j':
+		move_cursor(b, 1);
+		break;
+	case KEY_PAGE_UP:
+		move_cursor(b, -page);
+		break;
+	case KEY_PAGE_DOWN:
+	case ' ':
+		move_cursor(b, page);
+		break;
+	case KEY_HOME:
+	case 'g':
+		move_cursor(b, -(long)b->tree.num_rows);
+		break;
+	case KEY_END:
+	case 'G':
+		move_cursor(b, b->tree.num_rows);
+		break;
+	case '\r':
+	case '\n':
+		toggle(b);
+		break;
+	case KEY_RIGHT:
+	case 'l':
+		if (b->tree.num_rows && b->tree.rows[b->cursor]->expanded) {
+			move_cursor(b, 1);
+		} else {
+			toggle(b);
+		}
+		break;
+	case KEY_LEFT:
+	case 'h':
+		close_or_parent(b);
+		break;
+	case '/':
+		b->searching = true;
+		b->query_len = 0;
+		b->search_start = cursor_offset(b);
+		break;
+	case 'n':
+		search(b, cursor_offset(b), true, false);
+		break;
+	case 'N':
+		search(b, cursor_offset(b), false, false);
+		break;
+	}
+	return true;
+}
+
+static void run(struct browser *b)
+{
+	for (;;) {
+		if (resized) {
+			resized = 0;
+			update_size(b);
+		}
+		if (b->search_pending && index_ready(&b->index)) {
+			search(b, b->search_start, true, true);
+		}
+		draw(b);
+
+		struct pollfd pfd = { .fd = STDIN_FILENO, .events = POLLIN };
+		const int ret = poll(&pfd, 1, index_ready(&b->index) ? -1 : INDEX_POLL_MS);
+		if (ret < 0 && errno == EINTR) {
+			continue;
+		}
+		if (ret < 0) {
+			return;
+		}
+		if (!ret) {
+			continue;
+		}
+
+		char keys[64];
+		const ssize_t len = read(STDIN_FILENO, keys, sizeof(keys));
+		if (len <= 0) {
+			return;
+		}
+		for (size_t i = 0; i < (size_t)len;) {
+			int key;
+			i += decode_key(keys + i, len - i, &key);
+			if (!handle_key(b, key)) {
+				return;
+			}
+		}
+	}
+}
+
+int main(int argc, char **argv)
+{
+	if (argc != 2) {
+		fprintf(stderr, "Usage: cfr_browse <input file>\n");
+		return -1;
+	}
+
+	struct browser b = { .filename = argv[1] };
+
+	char *blob = NULL;
+	if (cfr_read_file(&blob, argv[1])) {
+		free(blob);
+		return -1;
+	}
+	b.blob = blob;
+	b.blob_size = cfr_le32_to_cpu(((const struct lb_cfr *)blob)->size);
+	b.index.blob = blob;
+
+	if (cfr_tree_init(&b.tree, blob)) {
+		free(blob);
+		return -1;
+	}
+	if (term_init()) {
+		cfr_tree_free(&b.tree);
+		free(blob);
+		return -1;
+	}
+
+	const struct sigaction sa = { .sa_handler = on_resize };
+	sigaction(SIGWINCH, &sa, NULL);
+	update_size(&b);
+
+	pthread_t index_thread;
+	if (pthread_create(&index_thread, NULL, index_worker, &b.index)) {
+		/* Searching just has to wait until the index is built here */
+		index_worker(&b.index);
+	} else {
+		pthread_detach(index_thread);
+	}
+
+	run(&b);
+	term_restore();
+	cfr_tree_free(&b.tree);
+
+	/* The index thread may still be reading the blob, let exit() reclaim it */
+	return 0;
+}
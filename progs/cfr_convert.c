@@ -0,0 +1,166 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+
+#include <fcntl.h>
+#include <getopt.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "cfr.h"
+#include "cfr_file.h"
+#include "cfr_lz.h"
+#include "cfr_v2.h"
+
+enum input_format {
+	INPUT_V1,
+	INPUT_V2,
+	INPUT_COMPRESSED,
+};
+
+static int input_format(const char *filename, enum input_format *format)
+{
+	FILE *stream = fopen(filename, "rb");
+	if (!stream) {
+		perror("Could not open input file");
+		return -1;
+	}
+	union {
+		char v2[CFR_V2_MAGIC_LEN];
+		uint32_t tag;
+	} magic;
+	const size_t len = fread(&magic, 1, sizeof(magic), stream);
+	fclose(stream);
+
+	if (cfr_is_v2(magic.v2, len)) {
+		*format = INPUT_V2;
+	} else if (len == sizeof(magic.tag) && cfr_le32_to_cpu(magic.tag) == LB_TAG_CFR_COMPRESSED) {
+		*format = INPUT_COMPRESSED;
+	} else {
+		*format = INPUT_V1;
+	}
+	return 0;
+}
+
+static int write_file(const char *filename, const void *data, size_t length)
+{
+	const int fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0) {
+		perror("Could not open output file");
+		return -1;
+	}
+	int ret = cfr_write_all(fd, data, length);
+	if (close(fd)) {
+		ret = -1;
+	}
+	return ret;
+}
+
+/* Makes sure the compact encoding decodes back to the very same blob */
+static int check_roundtrip(const char *blob, const char *data, size_t length)
+{
+	char *decoded;
+	if (cfr_v2_decode(data, length, &decoded)) {
+		return -1;
+	}
+	const uint32_t size = cfr_le32_to_cpu(((const struct lb_cfr *)blob)->size);
+	const int ret = memcmp(decoded, blob, size) ? -1 : 0;
+	if (ret) {
+		fprintf(stderr, "Compact encoding does not decode back to the input\n");
+	}
+	free(decoded);
+	return ret;
+}
+
+static void usage(void)
+{
+	fprintf(stderr, "Usage: cfr_convert [--to v1|v2] [--compress <level>] <input file> <output file>\n");
+	fprintf(stderr, "Converts v1 to v2 and anything else to v1 unless --to is given.\n");
+	fprintf(stderr, "Compression levels go from %d (fast) to %d (smallest).\n",
+		CFR_LZ_LEVEL_FAST, CFR_LZ_LEVEL_MAX);
+}
+
+int main(int argc, char **argv)
+{
+	static const struct option long_options[] = {
+		{ "to",       required_argument, NULL, 't' },
+		{ "compress", required_argument, NULL, 'z' },
+		{ 0 },
+	};
+
+	int to_version = 0;
+	int compress_level = 0;
+
+	int opt;
+	while ((opt = getopt_long(argc, argv, "t:z:", long_options, NULL)) != -1) {
+		switch (opt) {
+		case 't':
+			if (!strcmp(optarg, "v1")) {
+				to_version = 1;
+			} else if (!strcmp(optarg, "v2")) {
+				to_version = 2;
+			} else {
+				usage();
+				return -1;
+			}
+			break;
+		case 'z':
+			compress_level = atoi(optarg);
+			break;
+		default:
+			usage();
+			return -1;
+		}
+	}
+
+	if (argc - optind != 2) {
+		usage();
+		return -1;
+	}
+
+	enum input_format format;
+	if (input_format(argv[optind], &format)) {
+		return -1;
+	}
+	if (!to_version) {
+		to_version = format == INPUT_V1 ? 2 : 1;
+	}
+
+	/* The loader decodes compact and compressed blobs, so this is always v1 */
+	char *blob;
+	if (cfr_read_file(&blob, argv[optind])) {
+		return -1;
+	}
+
+	const struct lb_cfr *root = (const struct lb_cfr *)blob;
+	const char *data = blob;
+	size_t length = cfr_le32_to_cpu(root->size);
+	char *encoded = NULL;
+	char *compressed = NULL;
+
+	int ret = 0;
+	if (to_version == 2) {
+		ret = cfr_v2_encode(blob, &encoded, &length);
+		if (!ret) {
+			ret = check_roundtrip(blob, encoded, length);
+		}
+		data = encoded;
+	}
+	if (!ret && compress_level) {
+		ret = cfr_lz_compress(data, length, root, compress_level, &compressed, &length);
+		data = compressed;
+	}
+	if (!ret) {
+		ret = write_file(argv[optind + 1], data, length);
+	}
+	if (!ret) {
+		printf("%u -> %zu bytes\n", cfr_le32_to_cpu(root->size), length);
+	}
+
+	free(compressed);
+	free(encoded);
+	free(blob);
+	return ret;
+}
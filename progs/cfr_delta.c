@@ -0,0 +1,84 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "cfr.h"
+#include "cfr_delta.h"
+#include "cfr_file.h"
+
+static int write_file(const char *filename, const void *data, size_t length)
+{
+	const int fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0) {
+		perror("Could not open output file");
+		return -1;
+	}
+	int ret = cfr_write_all(fd, data, length);
+	if (close(fd)) {
+		ret = -1;
+	}
+	return ret;
+}
+
+/* Makes sure the delta rebuilds the very same target */
+static int check_roundtrip(const char *source, const char *target, const char *delta, size_t length)
+{
+	char *applied;
+	if (cfr_delta_apply(source, delta, length, &applied)) {
+		return -1;
+	}
+	const uint32_t size = cfr_le32_to_cpu(((const struct lb_cfr *)target)->size);
+	const int ret = memcmp(applied, target, size) ? -1 : 0;
+	if (ret) {
+		fprintf(stderr, "Delta does not rebuild the target\n");
+	}
+	free(applied);
+	return ret;
+}
+
+static void usage(void)
+{
+	fprintf(stderr, "Usage: cfr_delta <source file> <target file> <delta file>\n");
+	fprintf(stderr, "Writes a delta that cfr_apply turns the source into the target with.\n");
+}
+
+int main(int argc, char **argv)
+{
+	if (argc != 4) {
+		usage();
+		return -1;
+	}
+
+	char *source = NULL;
+	char *target = NULL;
+	if (cfr_read_file(&source, argv[1]) || cfr_read_file(&target, argv[2])) {
+		free(source);
+		free(target);
+		return -1;
+	}
+
+	char *delta = NULL;
+	size_t length;
+	int ret = cfr_delta_create(source, target, &delta, &length);
+	if (!ret) {
+		ret = check_roundtrip(source, target, delta, length);
+	}
+	if (!ret) {
+		ret = write_file(argv[3], delta, length);
+	}
+	if (!ret) {
+		const uint32_t size = cfr_le32_to_cpu(((const struct lb_cfr *)target)->size);
+		printf("%u -> %zu bytes (%.1f%% of the target)\n", size, length,
+		       100.0 * length / size);
+	}
+
+	free(delta);
+	free(target);
+	free(source);
+	return ret;
+}
@@ -0,0 +1,305 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+
+/* For pread() */
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "cfr.h"
+#include "cfr_file.h"
+
+/*
+ * Writes single forms out as standalone blobs. Plain blobs are mapped
+ * rather than read, and forms are looked up through the form directory
+ * when there is one, so only the pages of the extracted forms are ever
+ * touched. Forms with their own CRC record are checked against it, and
+ * the checksum of the new root is derived from it.
+ */
+
+struct input {
+	const char *blob;
+	uint32_t size;
+	size_t map_size;	/* 0 if `blob` was decoded into memory instead */
+};
+
+static int open_input(struct input *in, const char *filename)
+{
+	const int fd = open(filename, O_RDONLY);
+	if (fd < 0) {
+		perror("Could not open input file");
+		return -1;
+	}
+
+	struct stat st;
+	if (fstat(fd, &st)) {
+		perror("Could not stat input file");
+		close(fd);
+		return -1;
+	}
+
+	struct lb_cfr root;
+	const bool plain = st.st_size >= (off_t)sizeof(root) &&
+			   pread(fd, &root, sizeof(root), 0) == sizeof(root) &&
+			   cfr_le32_to_cpu(root.tag) == LB_TAG_CFR &&
+			   cfr_le32_to_cpu(root.size) >= sizeof(root) &&
+			   cfr_le32_to_cpu(root.size) <= (uint64_t)st.st_size;
+	if (plain) {
+		void *data = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+		close(fd);
+		if (data == MAP_FAILED) {
+			perror("Could not map input file");
+			return -1;
+		}
+		in->blob = data;
+		in->size = cfr_le32_to_cpu(root.size);
+		in->map_size = st.st_size;
+		return 0;
+	}
+	close(fd);
+
+	/* Compressed and compact blobs have to be decoded in full */
+	char *buffer = NULL;
+	if (cfr_read_file(&buffer, filename)) {
+		free(buffer);
+		return -1;
+	}
+	in->blob = buffer;
+	in->size = cfr_le32_to_cpu(((const struct lb_cfr *)buffer)->size);
+	in->map_size = 0;
+	return 0;
+}
+
+static void close_input(struct input *in)
+{
+	if (in->map_size) {
+		munmap((void *)in->blob, in->map_size);
+	} else {
+		free((void *)in->blob);
+	}
+}
+
+static const struct lb_cfr_option_form *form_at(const struct input *in, uint32_t offset)
+{
+	const struct lb_cfr_option_form *form = (const struct lb_cfr_option_form *)(in->blob + offset);
+
+	if (offset < sizeof(struct lb_cfr) || offset > in->size - sizeof(*form) ||
+	    cfr_le32_to_cpu(form->tag) != LB_TAG_CFR_OPTION_FORM ||
+	    cfr_le32_to_cpu(form->size) < sizeof(*form) ||
+	    cfr_le32_to_cpu(form->size) > in->size - offset) {
+		return NULL;
+	}
+	return form;
+}
+
+static bool has_ui_name(const struct input *in, uint32_t offset, const char *name)
+{
+	const struct lb_cfr_option_form *form = form_at(in, offset);
+	if (!form) {
+		return false;
+	}
+
+	const struct lb_cfr_varbinary *ui_name = (const struct lb_cfr_varbinary *)(form + 1);
+	const uint32_t available = cfr_le32_to_cpu(form->size) - sizeof(*form);
+	const size_t len = strlen(name) + 1;
+	return available >= sizeof(*ui_name) &&
+	       cfr_le32_to_cpu(ui_name->tag) == LB_TAG_CFR_VARCHAR_UI_NAME &&
+	       cfr_le32_to_cpu(ui_name->data_length) == len &&
+	       len <= available - sizeof(*ui_name) &&
+	       !memcmp(ui_name->data, name, len);
+}
+
+static uint32_t walk_find_name(const struct input *in, uint32_t parent, const char *name)
+{
+	const struct lb_record *rec = (const struct lb_record *)(in->blob + parent);
+	const uint32_t end = parent + cfr_le32_to_cpu(rec->size);
+
+	uint32_t off = parent + cfr_record_header_size(cfr_le32_to_cpu(rec->tag));
+	while (off < end && end - off >= sizeof(struct lb_record)) {
+		const struct lb_record *child = (const struct lb_record *)(in->blob + off);
+		const uint32_t size = cfr_le32_to_cpu(child->size);
+		if (size < sizeof(*child) || size > end - off) {
+			return 0;
+		}
+		if (cfr_le32_to_cpu(child->tag) == LB_TAG_CFR_OPTION_FORM && form_at(in, off)) {
+			if (has_ui_name(in, off, name)) {
+				return off;
+			}
+			const uint32_t found = walk_find_name(in, off, name);
+			if (found) {
+				return found;
+			}
+		}
+		off += size;
+	}
+	return 0;
+}
+
+/* Same as cfr_find_form(), but by UI name */
+static uint32_t find_form_by_name(const struct input *in, const char *name)
+{
+	const struct lb_cfr_form_directory *directory = cfr_form_directory(in->blob);
+
+	if (directory) {
+		const struct lb_cfr_form_directory_entry *entries =
+			(const struct lb_cfr_form_directory_entry *)(directory + 1);
+		const uint32_t num_entries = cfr_le32_to_cpu(directory->num_entries);
+		for (uint32_t i = 0; i < num_entries; i++) {
+			const uint32_t offset = cfr_le32_to_cpu(entries[i].offset);
+			if (has_ui_name(in, offset, name)) {
+				return offset;
+			}
+		}
+	}
+	return walk_find_name(in, 0, name);
+}
+
+/* Forms are given by object ID if the argument is a number, by UI name otherwise */
+static const struct lb_cfr_option_form *find_form(const struct input *in, const char *arg)
+{
+	char *end;
+	const unsigned long object_id = strtoul(arg, &end, 0);
+	uint32_t offset;
+
+	if (*arg && !*end && object_id <= UINT32_MAX) {
+		offset = cfr_find_form(in->blob, object_id);
+	} else {
+		offset = find_form_by_name(in, arg);
+	}
+	return offset ? form_at(in, offset) : NULL;
+}
+
+/*
+ * The new root is written in front of the form as it is in the input,
+ * so the form bytes never get copied in memory.
+ */
+static int extract(const struct lb_cfr_option_form *form, const char *filename)
+{
+	/* A corrupt form would get a root checksum that makes it look fine */
+	if (cfr_check_form(form)) {
+		fprintf(stderr, "Not extracting form %u\n", cfr_le32_to_cpu(form->object_id));
+		return -1;
+	}
+
+	const uint32_t form_size = cfr_le32_to_cpu(form->size);
+	struct lb_cfr root = {
+		.tag	= cfr_cpu_to_le32(LB_TAG_CFR),
+		.size	= cfr_cpu_to_le32(sizeof(root) + form_size),
+	};
+	const uint32_t checksum = cfr_crc32_combine(cfr_crc32(&root, sizeof(root)),
+						    cfr_form_crc32(form), form_size);
+	root.checksum = cfr_cpu_to_le32(checksum);
+
+	const int fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0) {
+		fprintf(stderr, "Could not open '%s': %s\n", filename, strerror(errno));
+		return -1;
+	}
+	int ret = cfr_write_all(fd, &root, sizeof(root));
+	if (!ret) {
+		ret = cfr_write_all(fd, form, form_size);
+	}
+	if (close(fd)) {
+		ret = -1;
+	}
+	if (!ret) {
+		printf("Extracted form %u into '%s', %zu bytes with CRC32 0x%08x\n",
+		       cfr_le32_to_cpu(form->object_id), filename, sizeof(root) + form_size,
+		       checksum);
+	}
+	return ret;
+}
+
+static void usage(void)
+{
+	fprintf(stderr, "Usage: cfr_extract --form <object ID|UI name> <input file> <output file>\n");
+	fprintf(stderr, "       cfr_extract --form <object ID|UI name>... <input file> <output dir>\n");
+	fprintf(stderr, "With several forms, each is written to 'form-<object ID>.bin' in the output dir.\n");
+}
+
+int main(int argc, char **argv)
+{
+	static const struct option long_options[] = {
+		{ "form", required_argument, NULL, 'f' },
+		{ 0 },
+	};
+
+	const char **forms = calloc(argc, sizeof(*forms));
+	size_t num_forms = 0;
+	if (!forms) {
+		fprintf(stderr, "Could not allocate %d form arguments\n", argc);
+		return -1;
+	}
+
+	int opt;
+	while ((opt = getopt_long(argc, argv, "f:", long_options, NULL)) != -1) {
+		switch (opt) {
+		case 'f':
+			forms[num_forms++] = optarg;
+			break;
+		default:
+			usage();
+			free(forms);
+			return -1;
+		}
+	}
+
+	if (argc - optind != 2 || !num_forms) {
+		usage();
+		free(forms);
+		return -1;
+	}
+	const char *output = argv[optind + 1];
+
+	if (num_forms > 1 && mkdir(output, 0755) && errno != EEXIST) {
+		perror("Could not create output directory");
+		free(forms);
+		return -1;
+	}
+
+	struct input in;
+	if (open_input(&in, argv[optind])) {
+		free(forms);
+		return -1;
+	}
+
+	int ret = 0;
+	for (size_t i = 0; i < num_forms; i++) {
+		const struct lb_cfr_option_form *form = find_form(&in, forms[i]);
+		if (!form) {
+			fprintf(stderr, "No form '%s' in '%s'\n", forms[i], argv[optind]);
+			ret = -1;
+			continue;
+		}
+		if (num_forms == 1) {
+			ret |= extract(form, output);
+			continue;
+		}
+
+		const char *fmt = "%s/form-%u.bin";
+		const uint32_t object_id = cfr_le32_to_cpu(form->object_id);
+		const int len = snprintf(NULL, 0, fmt, output, object_id);
+		char *path = malloc(len + 1);
+		if (!path) {
+			fprintf(stderr, "Could not allocate %d bytes for output path\n", len + 1);
+			ret = -1;
+			break;
+		}
+		snprintf(path, len + 1, fmt, output, object_id);
+		ret |= extract(form, path);
+		free(path);
+	}
+
+	close_input(&in);
+	free(forms);
+	return ret;
+}
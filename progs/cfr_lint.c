@@ -0,0 +1,46 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "cfr.h"
+#include "cfr_file.h"
+#include "cfr_lint.h"
+
+static void usage(void)
+{
+	fprintf(stderr, "Usage: cfr_lint <input file>...\n");
+	fprintf(stderr, "Prints every violation with its offset, and fails if there are any.\n");
+}
+
+int main(int argc, char **argv)
+{
+	if (argc < 2) {
+		usage();
+		return -1;
+	}
+
+	int ret = 0;
+	for (int i = 1; i < argc; i++) {
+		char *blob = NULL;
+		if (cfr_read_file(&blob, argv[i])) {
+			free(blob);
+			ret = -1;
+			continue;
+		}
+
+		if (argc > 2) {
+			printf("%s:\n", argv[i]);
+		}
+		const uint32_t size = cfr_le32_to_cpu(((const struct lb_cfr *)blob)->size);
+		const unsigned int violations = cfr_lint(stdout, blob, size);
+		if (violations) {
+			printf("%u violation%s in '%s'\n", violations, violations == 1 ? "" : "s",
+			       argv[i]);
+			ret = -1;
+		}
+		free(blob);
+	}
+	return ret;
+}
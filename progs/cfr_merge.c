@@ -0,0 +1,810 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "cfr.h"
+#include "cfr_file.h"
+
+#define CFR_MERGE_MAX_DEPTH	32
+
+/*
+ * Splices the forms of several blobs into a single root. Forms sharing an
+ * object ID or a UI name with a form of an earlier blob are merged into
+ * it, and an option replaces the one of an earlier blob with the same
+ * object ID and type in the same form. Everything else is copied byte
+ * for byte, and the checksum of the output is combined from the CRC32 of
+ * every copied piece.
+ */
+
+struct input {
+	const char *filename;
+	char *blob;
+	uint32_t size;
+};
+
+/*
+ * Open addressing index of the children of a merged node. Slots hold the
+ * index of the child plus one, so that 0 marks free ones, next to the
+ * hash of its key so that growing never has to look at the records.
+ */
+struct child_slot {
+	uint32_t child;
+	uint32_t hash;
+};
+
+struct child_index {
+	struct child_slot *slots;
+	size_t capacity;	/* Power of two */
+	size_t count;
+};
+
+struct mnode {
+	const struct input *input;
+	uint32_t offset;	/* Of the record in the input blob */
+	uint32_t size;		/* Of the record in the output */
+	bool merged;		/* Form rebuilt from `children`, instead of copied as is */
+	struct mnode *children;
+	size_t num_children;
+	size_t max_children;
+	struct child_index by_id;	/* Objects, by tag and object ID */
+	struct child_index by_name;	/* Forms, by UI name */
+};
+
+struct name {
+	const char *data;
+	uint32_t len;
+};
+
+static const struct lb_record *record_at(const struct input *in, uint32_t offset)
+{
+	return (const struct lb_record *)(in->blob + offset);
+}
+
+static uint32_t record_tag(const struct input *in, uint32_t offset)
+{
+	return cfr_le32_to_cpu(record_at(in, offset)->tag);
+}
+
+static uint32_t record_size(const struct input *in, uint32_t offset)
+{
+	return cfr_le32_to_cpu(record_at(in, offset)->size);
+}
+
+/* Records with an object ID, the root and enum values are the exception */
+static bool is_object(uint32_t tag)
+{
+	return tag != LB_TAG_CFR && tag != LB_TAG_CFR_ENUM_VALUE && tag != LB_TAG_CFR_ENUM_RANGE &&
+	       cfr_record_header_size(tag);
+}
+
+static uint32_t object_id(const struct input *in, uint32_t offset)
+{
+	/* All object records start with the same fields as a form */
+	return cfr_le32_to_cpu(((const struct lb_cfr_option_form *)record_at(in, offset))->object_id);
+}
+
+/* Offset of the first child record, after the fixed-length fields */
+static uint32_t first_child(const struct input *in, uint32_t offset)
+{
+	return offset + cfr_record_header_size(record_tag(in, offset));
+}
+
+static struct name find_string(const struct input *in, uint32_t offset, uint32_t tag)
+{
+	const uint32_t end = offset + record_size(in, offset);
+
+	for (uint32_t off = first_child(in, offset); off < end; off += record_size(in, off)) {
+		const struct lb_cfr_varbinary *str = (const struct lb_cfr_varbinary *)record_at(in, off);
+		const uint32_t data_length = cfr_le32_to_cpu(str->data_length);
+		if (cfr_le32_to_cpu(str->tag) == tag && data_length &&
+		    data_length <= record_size(in, off) - sizeof(*str)) {
+			return (struct name) { (const char *)str->data, data_length - 1 };
+		}
+	}
+	return (struct name) { "", 0 };
+}
+
+static struct name object_name(const struct input *in, uint32_t offset)
+{
+	const struct name opt_name = find_string(in, offset, LB_TAG_CFR_VARCHAR_OPT_NAME);
+	return opt_name.len ? opt_name : find_string(in, offset, LB_TAG_CFR_VARCHAR_UI_NAME);
+}
+
+/*
+ * Checks the size of every record once, so that nothing else needs to.
+ * Only the record headers are read, not the strings in them.
+ */
+static int check_records(const struct input *in, uint32_t parent, unsigned int depth)
+{
+	const uint32_t end = parent + record_size(in, parent);
+
+	if (depth > CFR_MERGE_MAX_DEPTH) {
+		fprintf(stderr, "%s: records nested too deep at offset 0x%x\n", in->filename, parent);
+		return -1;
+	}
+	for (uint32_t off = first_child(in, parent); off < end;) {
+		const uint32_t remaining = end - off;
+		if (remaining < sizeof(struct lb_record)) {
+			fprintf(stderr, "%s: truncated record at offset 0x%x\n", in->filename, off);
+			return -1;
+		}
+		const uint32_t size = record_size(in, off);
+		if (size < sizeof(struct lb_record) || size > remaining || size % LB_ENTRY_ALIGN ||
+		    size < cfr_record_header_size(record_tag(in, off))) {
+			fprintf(stderr, "%s: bad size %u of record at offset 0x%x\n",
+				in->filename, size, off);
+			return -1;
+		}
+		if (cfr_record_header_size(record_tag(in, off)) && check_records(in, off, depth + 1)) {
+			return -1;
+		}
+		off += size;
+	}
+	return 0;
+}
+
+static int read_input(struct input *in, const char *filename)
+{
+	in->filename = filename;
+	if (cfr_read_file(&in->blob, filename)) {
+		return -1;
+	}
+	in->size = record_size(in, 0);
+	if (in->size < sizeof(struct lb_cfr)) {
+		fprintf(stderr, "%s: bad root record size %u\n", filename, in->size);
+		return -1;
+	}
+	return check_records(in, 0, 0);
+}
+
+/*
+ * Merge tree
+ */
+
+static uint32_t id_hash(uint32_t tag, uint32_t id)
+{
+	return (id ^ tag * 0x85ebca6bu) * 0x9e3779b1u;
+}
+
+/* FNV-1a */
+static uint32_t name_hash(struct name name)
+{
+	uint32_t hash = 0x811c9dc5;
+	for (uint32_t i = 0; i < name.len; i++) {
+		hash = (hash ^ (uint8_t)name.data[i]) * 0x01000193;
+	}
+	return hash;
+}
+
+static struct name form_name(const struct input *in, uint32_t offset)
+{
+	return find_string(in, offset, LB_TAG_CFR_VARCHAR_UI_NAME);
+}
+
+static void index_add(struct child_index *index, uint32_t hash, size_t child);
+
+static void index_grow(struct child_index *index)
+{
+	const struct child_slot *old = index->slots;
+	const size_t old_capacity = index->capacity;
+
+	index->capacity = old_capacity ? old_capacity * 2 : 64;
+	index->slots = calloc(index->capacity, sizeof(*index->slots));
+	if (!index->slots) {
+		fprintf(stderr, "Could not allocate %zu index slots\n", index->capacity);
+		exit(-1);
+	}
+	index->count = 0;
+	for (size_t i = 0; i < old_capacity; i++) {
+		if (old[i].child) {
+			index_add(index, old[i].hash, old[i].child - 1);
+		}
+	}
+	free((void *)old);
+}
+
+/* The caller makes sure that the key is not in the index yet */
+static void index_add(struct child_index *index, uint32_t hash, size_t child)
+{
+	if (2 * (index->count + 1) > index->capacity) {
+		index_grow(index);
+	}
+
+	size_t i = hash & (index->capacity - 1);
+	while (index->slots[i].child) {
+		i = (i + 1) & (index->capacity - 1);
+	}
+	index->slots[i] = (struct child_slot) { .child = child + 1, .hash = hash };
+	index->count++;
+}
+
+/* The first child with the tag and object ID */
+static struct mnode *find_object(const struct mnode *parent, uint32_t tag, uint32_t id)
+{
+	const struct child_index *index = &parent->by_id;
+	const uint32_t hash = id_hash(tag, id);
+
+	if (!index->capacity) {
+		return NULL;
+	}
+	for (size_t i = hash & (index->capacity - 1); index->slots[i].child;
+	     i = (i + 1) & (index->capacity - 1)) {
+		struct mnode *node = &parent->children[index->slots[i].child - 1];
+		if (index->slots[i].hash == hash && record_tag(node->input, node->offset) == tag &&
+		    object_id(node->input, node->offset) == id) {
+			return node;
+		}
+	}
+	return NULL;
+}
+
+/* The first form child with the UI name */
+static struct mnode *find_form(const struct mnode *parent, struct name name)
+{
+	const struct child_index *index = &parent->by_name;
+	const uint32_t hash = name_hash(name);
+
+	if (!index->capacity || !name.len) {
+		return NULL;
+	}
+	for (size_t i = hash & (index->capacity - 1); index->slots[i].child;
+	     i = (i + 1) & (index->capacity - 1)) {
+		struct mnode *node = &parent->children[index->slots[i].child - 1];
+		if (index->slots[i].hash != hash) {
+			continue;
+		}
+		const struct name other = form_name(node->input, node->offset);
+		if (other.len == name.len && !memcmp(other.data, name.data, name.len)) {
+			return node;
+		}
+	}
+	return NULL;
+}
+
+static struct mnode *add_node(struct mnode *parent, const struct input *in, uint32_t offset)
+{
+	if (parent->num_children == parent->max_children) {
+		parent->max_children = parent->max_children ? parent->max_children * 2 : 16;
+		parent->children = realloc(parent->children,
+					   parent->max_children * sizeof(*parent->children));
+		if (!parent->children) {
+			fprintf(stderr, "Could not allocate %zu merge nodes\n", parent->max_children);
+			exit(-1);
+		}
+	}
+	const size_t child = parent->num_children++;
+	parent->children[child] = (struct mnode) { .input = in, .offset = offset };
+
+	/* Only the first of several children with the same key is found again */
+	const uint32_t tag = record_tag(in, offset);
+	if (is_object(tag) && !find_object(parent, tag, object_id(in, offset))) {
+		index_add(&parent->by_id, id_hash(tag, object_id(in, offset)), child);
+	}
+	if (tag == LB_TAG_CFR_OPTION_FORM) {
+		const struct name name = form_name(in, offset);
+		if (name.len && !find_form(parent, name)) {
+			index_add(&parent->by_name, name_hash(name), child);
+		}
+	}
+	return &parent->children[child];
+}
+
+static void free_node(struct mnode *node)
+{
+	for (size_t i = 0; i < node->num_children; i++) {
+		free_node(&node->children[i]);
+	}
+	free(node->children);
+	free(node->by_id.slots);
+	free(node->by_name.slots);
+	node->children = NULL;
+	node->num_children = 0;
+	node->max_children = 0;
+	node->by_id = (struct child_index) { 0 };
+	node->by_name = (struct child_index) { 0 };
+}
+
+/* The UI name and CRC of a form are rebuilt when merging, everything else is a child */
+static bool is_form_child(uint32_t tag)
+{
+	return tag != LB_TAG_CFR_VARCHAR_UI_NAME && tag != LB_TAG_CFR_FORM_CHECKSUM;
+}
+
+/* Turns a copied form into a merged one, listing its own children */
+static void expand_form(struct mnode *form)
+{
+	const struct input *in = form->input;
+	const uint32_t end = form->offset + record_size(in, form->offset);
+
+	form->merged = true;
+	for (uint32_t off = first_child(in, form->offset); off < end; off += record_size(in, off)) {
+		if (is_form_child(record_tag(in, off))) {
+			add_node(form, in, off);
+		}
+	}
+}
+
+static void merge_record(struct mnode *parent, const struct input *in, uint32_t offset);
+
+static void merge_form(struct mnode *form, const struct input *in, uint32_t offset)
+{
+	const uint32_t end = offset + record_size(in, offset);
+
+	if (!form->merged) {
+		expand_form(form);
+	}
+	for (uint32_t off = first_child(in, offset); off < end; off += record_size(in, off)) {
+		if (is_form_child(record_tag(in, off))) {
+			merge_record(form, in, off);
+		}
+	}
+}
+
+/*
+ * Looks the record up in the children by key instead of comparing it with
+ * all of them, which would make merging forms with many options quadratic.
+ */
+static void merge_record(struct mnode *parent, const struct input *in, uint32_t offset)
+{
+	const uint32_t tag = record_tag(in, offset);
+
+	if (!is_object(tag)) {
+		add_node(parent, in, offset);
+		return;
+	}
+
+	/* Duplicates within one input are left for the collision check */
+	struct mnode *node = find_object(parent, tag, object_id(in, offset));
+	if (node && node->input == in) {
+		node = NULL;
+	}
+
+	if (tag == LB_TAG_CFR_OPTION_FORM) {
+		/* Of the forms with the same ID or UI name, the first one is merged into */
+		struct mnode *named = find_form(parent, form_name(in, offset));
+		if (named && named->input != in && (!node || named < node)) {
+			node = named;
+		}
+		if (node) {
+			merge_form(node, in, offset);
+			return;
+		}
+	} else if (node) {
+		free_node(node);
+		*node = (struct mnode) { .input = in, .offset = offset };
+		return;
+	}
+	add_node(parent, in, offset);
+}
+
+/*
+ * Object ID collisions
+ */
+
+struct id_entry {
+	const struct input *input;
+	uint32_t offset;
+};
+
+struct id_set {
+	struct id_entry *entries;
+	size_t capacity;	/* Power of two */
+	size_t count;
+	bool collision;
+};
+
+static void id_set_insert(struct id_set *set, const struct input *in, uint32_t offset);
+
+static void id_set_grow(struct id_set *set)
+{
+	const struct id_entry *old = set->entries;
+	const size_t old_capacity = set->capacity;
+
+	set->capacity = old_capacity ? old_capacity * 2 : 1024;
+	set->entries = calloc(set->capacity, sizeof(*set->entries));
+	if (!set->entries) {
+		fprintf(stderr, "Could not allocate %zu object IDs\n", set->capacity);
+		exit(-1);
+	}
+	set->count = 0;
+	for (size_t i = 0; i < old_capacity; i++) {
+		if (old[i].input) {
+			id_set_insert(set, old[i].input, old[i].offset);
+		}
+	}
+	free((void *)old);
+}
+
+static void id_set_insert(struct id_set *set, const struct input *in, uint32_t offset)
+{
+	if (2 * (set->count + 1) > set->capacity) {
+		id_set_grow(set);
+	}
+
+	const uint32_t id = object_id(in, offset);
+	size_t i = (id * 0x9e3779b1u) & (set->capacity - 1);
+	for (; set->entries[i].input; i = (i + 1) & (set->capacity - 1)) {
+		const struct id_entry *other = &set->entries[i];
+		if (object_id(other->input, other->offset) != id) {
+			continue;
+		}
+		const struct name a = object_name(other->input, other->offset);
+		const struct name b = object_name(in, offset);
+		fprintf(stderr, "Object ID %u is used by '%.*s' in %s and '%.*s' in %s\n", id,
+			(int)a.len, a.data, other->input->filename, (int)b.len, b.data, in->filename);
+		set->collision = true;
+		return;
+	}
+	set->entries[i] = (struct id_entry) { .input = in, .offset = offset };
+	set->count++;
+}
+
+static void collect_ids(struct id_set *set, const struct input *in, uint32_t parent)
+{
+	const uint32_t end = parent + record_size(in, parent);
+
+	for (uint32_t off = first_child(in, parent); off < end; off += record_size(in, off)) {
+		const uint32_t tag = record_tag(in, off);
+		if (is_object(tag)) {
+			id_set_insert(set, in, off);
+		}
+		if (tag == LB_TAG_CFR_OPTION_FORM) {
+			collect_ids(set, in, off);
+		}
+	}
+}
+
+static void collect_merged_ids(struct id_set *set, const struct mnode *parent)
+{
+	for (size_t i = 0; i < parent->num_children; i++) {
+		const struct mnode *node = &parent->children[i];
+		if (is_object(record_tag(node->input, node->offset))) {
+			id_set_insert(set, node->input, node->offset);
+		}
+		if (node->merged) {
+			collect_merged_ids(set, node);
+		} else if (record_tag(node->input, node->offset) == LB_TAG_CFR_OPTION_FORM) {
+			collect_ids(set, node->input, node->offset);
+		}
+	}
+}
+
+/*
+ * Output
+ */
+
+struct output {
+	char *blob;
+	bool nested_directory;
+	struct lb_cfr_form_directory_entry *entries;
+	uint32_t num_entries;
+};
+
+/* Computes the output size of every node, returns -1 if it does not fit a record */
+static int layout(struct mnode *node)
+{
+	const struct input *in = node->input;
+
+	if (!node->merged) {
+		node->size = record_size(in, node->offset);
+		return 0;
+	}
+
+	uint64_t size = sizeof(struct lb_cfr_option_form);
+	const uint32_t ui_name = first_child(in, node->offset);
+	if (record_tag(in, ui_name) == LB_TAG_CFR_VARCHAR_UI_NAME) {
+		size += record_size(in, ui_name);
+	}
+	if (cfr_form_checksum((const struct lb_cfr_option_form *)record_at(in, node->offset))) {
+		size += sizeof(struct lb_cfr_form_checksum);
+	}
+	for (size_t i = 0; i < node->num_children; i++) {
+		if (layout(&node->children[i])) {
+			return -1;
+		}
+		size += node->children[i].size;
+	}
+	if (size > UINT32_MAX / 2) {
+		fprintf(stderr, "Merged form %u is too large\n", object_id(in, node->offset));
+		return -1;
+	}
+	node->size = size;
+	return 0;
+}
+
+static uint32_t count_forms(const struct input *in, uint32_t parent, bool nested)
+{
+	const uint32_t end = parent + record_size(in, parent);
+	uint32_t count = 0;
+
+	for (uint32_t off = first_child(in, parent); off < end; off += record_size(in, off)) {
+		if (record_tag(in, off) == LB_TAG_CFR_OPTION_FORM) {
+			count += 1 + (nested ? count_forms(in, off, nested) : 0);
+		}
+	}
+	return count;
+}
+
+static uint32_t count_merged_forms(const struct mnode *parent, bool nested)
+{
+	uint32_t count = 0;
+
+	for (size_t i = 0; i < parent->num_children; i++) {
+		const struct mnode *node = &parent->children[i];
+		if (record_tag(node->input, node->offset) != LB_TAG_CFR_OPTION_FORM) {
+			continue;
+		}
+		count++;
+		if (nested && node->merged) {
+			count += count_merged_forms(node, nested);
+		} else if (nested) {
+			count += count_forms(node->input, node->offset, nested);
+		}
+	}
+	return count;
+}
+
+static void add_directory_entry(struct output *out, uint32_t object_id, uint32_t offset,
+				uint32_t depth)
+{
+	if (out->entries && (!depth || out->nested_directory)) {
+		out->entries[out->num_entries++] = (struct lb_cfr_form_directory_entry) {
+			.object_id	= cfr_cpu_to_le32(object_id),
+			.offset		= cfr_cpu_to_le32(offset),
+			.depth		= cfr_cpu_to_le32(depth),
+		};
+	}
+}
+
+/* Lists the forms of a copied subtree, at their offsets in the output */
+static void add_directory_entries(struct output *out, const struct input *in, uint32_t parent,
+				  uint32_t out_parent, uint32_t depth)
+{
+	const uint32_t end = parent + record_size(in, parent);
+
+	for (uint32_t off = first_child(in, parent); off < end; off += record_size(in, off)) {
+		if (record_tag(in, off) == LB_TAG_CFR_OPTION_FORM) {
+			add_directory_entry(out, object_id(in, off), out_parent + off - parent, depth);
+			add_directory_entries(out, in, off, out_parent + off - parent, depth + 1);
+		}
+	}
+}
+
+static uint32_t copied_crc(const struct input *in, uint32_t offset)
+{
+	const struct lb_record *rec = record_at(in, offset);
+
+	if (cfr_le32_to_cpu(rec->tag) == LB_TAG_CFR_OPTION_FORM) {
+		return cfr_form_crc32((const struct lb_cfr_option_form *)rec);
+	}
+	return cfr_crc32(rec, cfr_le32_to_cpu(rec->size));
+}
+
+/* Writes the node at `pos` in the output and returns the CRC32 of what was written */
+static uint32_t emit(struct output *out, const struct mnode *node, uint32_t pos, uint32_t depth)
+{
+	const struct input *in = node->input;
+	const bool is_form = record_tag(in, node->offset) == LB_TAG_CFR_OPTION_FORM;
+
+	if (is_form) {
+		add_directory_entry(out, object_id(in, node->offset), pos, depth);
+	}
+	if (!node->merged) {
+		memcpy(out->blob + pos, record_at(in, node->offset), node->size);
+		if (is_form && out->nested_directory) {
+			add_directory_entries(out, in, node->offset, pos, depth + 1);
+		}
+		return copied_crc(in, node->offset);
+	}
+
+	struct lb_cfr_option_form *form = (struct lb_cfr_option_form *)(out->blob + pos);
+	*form = *(const struct lb_cfr_option_form *)record_at(in, node->offset);
+	form->size = cfr_cpu_to_le32(node->size);
+	uint32_t crc = cfr_crc32(form, sizeof(*form));
+	uint32_t end = pos + sizeof(*form);
+
+	const uint32_t ui_name = first_child(in, node->offset);
+	if (record_tag(in, ui_name) == LB_TAG_CFR_VARCHAR_UI_NAME) {
+		const uint32_t size = record_size(in, ui_name);
+		memcpy(out->blob + end, record_at(in, ui_name), size);
+		crc = cfr_crc32_combine(crc, cfr_crc32(out->blob + end, size), size);
+		end += size;
+	}
+
+	struct lb_cfr_form_checksum *form_crc = NULL;
+	if (cfr_form_checksum((const struct lb_cfr_option_form *)record_at(in, node->offset))) {
+		form_crc = (struct lb_cfr_form_checksum *)(out->blob + end);
+		*form_crc = (struct lb_cfr_form_checksum) {
+			.tag	= cfr_cpu_to_le32(LB_TAG_CFR_FORM_CHECKSUM),
+			.size	= cfr_cpu_to_le32(sizeof(*form_crc)),
+		};
+		crc = cfr_crc32_combine(crc, cfr_crc32(form_crc, sizeof(*form_crc)), sizeof(*form_crc));
+		end += sizeof(*form_crc);
+	}
+
+	for (size_t i = 0; i < node->num_children; i++) {
+		const struct mnode *child = &node->children[i];
+		crc = cfr_crc32_combine(crc, emit(out, child, end, depth + 1), child->size);
+		end += child->size;
+	}
+
+	if (form_crc) {
+		/* `crc` is exactly what the form CRC covers */
+		form_crc->checksum = cfr_cpu_to_le32(crc);
+		crc = cfr_form_crc32(form);
+	}
+	return crc;
+}
+
+static int write_file(const char *filename, const void *data, size_t length)
+{
+	const int fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0) {
+		perror("Could not open output file");
+		return -1;
+	}
+	int ret = cfr_write_all(fd, data, length);
+	if (close(fd)) {
+		ret = -1;
+	}
+	return ret;
+}
+
+/* The inputs decide: nested entries if any of them lists nested forms */
+static enum cfr_form_directory_mode directory_mode(const struct input *inputs, size_t num_inputs)
+{
+	enum cfr_form_directory_mode mode = CFR_FORM_DIRECTORY_NONE;
+
+	for (size_t i = 0; i < num_inputs; i++) {
+		const struct lb_cfr_form_directory *directory = cfr_form_directory(inputs[i].blob);
+		if (!directory) {
+			continue;
+		}
+		if (mode == CFR_FORM_DIRECTORY_NONE) {
+			mode = CFR_FORM_DIRECTORY_TOP_LEVEL;
+		}
+		const struct lb_cfr_form_directory_entry *entries =
+			(const struct lb_cfr_form_directory_entry *)(directory + 1);
+		for (uint32_t j = 0; j < cfr_le32_to_cpu(directory->num_entries); j++) {
+			if (cfr_le32_to_cpu(entries[j].depth)) {
+				mode = CFR_FORM_DIRECTORY_ALL;
+			}
+		}
+	}
+	return mode;
+}
+
+static int merge(const char *output, struct input *inputs, size_t num_inputs)
+{
+	struct mnode root = { .merged = true };
+
+	for (size_t i = 0; i < num_inputs; i++) {
+		const struct input *in = &inputs[i];
+		for (uint32_t off = cfr_first_form(in->blob); off < in->size; off += record_size(in, off)) {
+			merge_record(&root, in, off);
+		}
+	}
+
+	int ret = -1;
+	struct id_set ids = { 0 };
+	collect_merged_ids(&ids, &root);
+	free(ids.entries);
+	if (ids.collision) {
+		goto out;
+	}
+
+	uint64_t forms_size = 0;
+	for (size_t i = 0; i < root.num_children; i++) {
+		if (layout(&root.children[i])) {
+			goto out;
+		}
+		forms_size += root.children[i].size;
+	}
+
+	const enum cfr_form_directory_mode mode = directory_mode(inputs, num_inputs);
+	struct output out = { .nested_directory = mode == CFR_FORM_DIRECTORY_ALL };
+	uint32_t num_entries = 0;
+	uint32_t directory_size = 0;
+	if (mode != CFR_FORM_DIRECTORY_NONE) {
+		num_entries = count_merged_forms(&root, out.nested_directory);
+		directory_size = sizeof(struct lb_cfr_form_directory) +
+			num_entries * sizeof(struct lb_cfr_form_directory_entry);
+	}
+
+	const uint64_t size = sizeof(struct lb_cfr) + directory_size + forms_size;
+	if (size > UINT32_MAX / 2) {
+		fprintf(stderr, "Merged blob is too large\n");
+		goto out;
+	}
+
+	out.blob = malloc(size);
+	if (!out.blob) {
+		fprintf(stderr, "Could not allocate %" PRIu64 " bytes\n", size);
+		goto out;
+	}
+
+	struct lb_cfr *cfr_root = (struct lb_cfr *)out.blob;
+	*cfr_root = (struct lb_cfr) {
+		.tag	= cfr_cpu_to_le32(LB_TAG_CFR),
+		.size	= cfr_cpu_to_le32(size),
+	};
+	struct lb_cfr_form_directory *directory = (struct lb_cfr_form_directory *)(cfr_root + 1);
+	if (directory_size) {
+		*directory = (struct lb_cfr_form_directory) {
+			.tag		= cfr_cpu_to_le32(LB_TAG_CFR_FORM_DIRECTORY),
+			.size		= cfr_cpu_to_le32(directory_size),
+			.num_entries	= cfr_cpu_to_le32(num_entries),
+		};
+		out.entries = (struct lb_cfr_form_directory_entry *)(directory + 1);
+	}
+
+	uint32_t forms_crc = 0;
+	uint32_t pos = sizeof(*cfr_root) + directory_size;
+	for (size_t i = 0; i < root.num_children; i++) {
+		const struct mnode *node = &root.children[i];
+		forms_crc = cfr_crc32_combine(forms_crc, emit(&out, node, pos, 0), node->size);
+		pos += node->size;
+	}
+	if (out.num_entries != num_entries) {
+		fprintf(stderr, "Listed %u forms in the directory instead of %u\n",
+			out.num_entries, num_entries);
+		free(out.blob);
+		goto out;
+	}
+
+	uint32_t checksum = cfr_crc32(out.blob, sizeof(*cfr_root) + directory_size);
+	checksum = cfr_crc32_combine(checksum, forms_crc, forms_size);
+	cfr_root->checksum = cfr_cpu_to_le32(checksum);
+
+	ret = write_file(output, out.blob, size);
+	if (!ret) {
+		printf("Merged %zu forms from %zu files into %" PRIu64 " bytes, with CRC32 0x%08x\n",
+		       root.num_children, num_inputs, size, checksum);
+	}
+	free(out.blob);
+out:
+	free_node(&root);
+	return ret;
+}
+
+static void usage(void)
+{
+	fprintf(stderr, "Usage: cfr_merge <output file> <input file>...\n");
+	fprintf(stderr, "Forms are merged by object ID or UI name, later inputs override options.\n");
+}
+
+int main(int argc, char **argv)
+{
+	if (argc < 3) {
+		usage();
+		return -1;
+	}
+
+	const size_t num_inputs = argc - 2;
+	struct input *inputs = calloc(num_inputs, sizeof(*inputs));
+	if (!inputs) {
+		fprintf(stderr, "Could not allocate %zu inputs\n", num_inputs);
+		return -1;
+	}
+
+	int ret = 0;
+	for (size_t i = 0; i < num_inputs && !ret; i++) {
+		ret = read_input(&inputs[i], argv[2 + i]);
+	}
+	if (!ret) {
+		ret = merge(argv[1], inputs, num_inputs);
+	}
+
+	for (size_t i = 0; i < num_inputs; i++) {
+		free(inputs[i].blob);
+	}
+	free(inputs);
+	return ret;
+}
@@ -1,6 +1,7 @@
 /* SPDX-License-Identifier: GPL-2.0-only */
 
 #include <assert.h>
+#include <getopt.h>
 #include <inttypes.h>
 #include <stdbool.h>
 #include <stdint.h>
@@ -9,46 +10,57 @@
 #include <string.h>
 
 #include "cfr.h"
-
-static int depth = 0;
-
-static void print_tabs(void)
+#include "cfr_file.h"
+#include "cfr_query.h"
+#include "cfr_view.h"
+
+/*
+ * Everything a dump needs besides the blob, so that several blobs can be
+ * dumped at the same time, to different streams.
+ */
+struct text_out {
+	FILE *stream;
+	int depth;
+	bool corrupt;		/* Some form failed its CRC check */
+	char tag_name[32];	/* Scratch space for tag_to_string() */
+	char flags[80];		/* Scratch space for print_flags() */
+};
+
+static void print_tabs(struct text_out *out)
 {
-	for (int i = 0; i < depth; i++) {
-		printf("\t");
+	for (int i = 0; i < out->depth; i++) {
+		fprintf(out->stream, "\t");
 	}
 }
 
 #define cfr_log(fmt, ...) \
-	do { print_tabs(); printf(fmt, ##__VA_ARGS__); } while (0)
+	do { print_tabs(out); fprintf(out->stream, fmt, ##__VA_ARGS__); } while (0)
 
 #define cfr_log_prop(_prop) \
 	do { cfr_log("%s: ", _prop); } while (0)
 
 #define cfr_log_prop_val(_fmt, _prop, _val) \
-	do { cfr_log("%-12s ", _prop ":"); printf(_fmt "\n", _val); } while (0)
+	do { cfr_log("%-12s ", _prop ":"); fprintf(out->stream, _fmt "\n", _val); } while (0)
 
 #define LOG_HEX "0x%x"
 #define LOG_NUM "%u"
 #define LOG_STR "%s"
 #define LOG_SQU "\"%s\""
 
-static void inc_depth(void)
+static void inc_depth(struct text_out *out)
 {
 	cfr_log("%c\n", '{');
-	depth++;
+	out->depth++;
 }
 
-static void dec_depth(void)
+static void dec_depth(struct text_out *out)
 {
-	depth--;
-	cfr_log("}%c\n", depth > 0 ? ',' : ';');
+	out->depth--;
+	cfr_log("}%c\n", out->depth > 0 ? ',' : ';');
 }
 
-static const char *tag_to_string(uint32_t tag)
+static const char *tag_to_string(struct text_out *out, uint32_t tag)
 {
-	static char buffer[50] = {0};
-
 	switch (tag) {
 	case LB_TAG_CFR:			return "Root record";
 	case LB_TAG_CFR_OPTION_FORM:		return "Form";
@@ -62,13 +74,16 @@ static const char *tag_to_string(uint32_t tag)
 	case LB_TAG_CFR_VARCHAR_UI_HELPTEXT:	return "UI help text";
 	case LB_TAG_CFR_VARCHAR_DEF_VALUE:	return "Default value";
 	case LB_TAG_CFR_OPTION_COMMENT:		return "Option comment";
+	case LB_TAG_CFR_FORM_DIRECTORY:		return "Form directory";
+	case LB_TAG_CFR_FORM_CHECKSUM:		return "Form checksum";
+	case LB_TAG_CFR_ENUM_RANGE:		return "Enum range";
 	default:
-		snprintf(buffer, sizeof(buffer), "UNKNOWN (0x%x)", tag);
-		return buffer;
+		snprintf(out->tag_name, sizeof(out->tag_name), "UNKNOWN (0x%x)", tag);
+		return out->tag_name;
 	}
 }
 
-static void _print_record(const struct lb_record *rec, const char *f)
+static void _print_record(struct text_out *out, const struct lb_record *rec, const char *f)
 {
 	const uintptr_t addr = (uintptr_t)(char *)rec;
 	if (addr & 0x3) {
@@ -76,36 +91,36 @@ static void _print_record(const struct lb_record *rec, const char *f)
 		exit(-1);
 	}
 
-	cfr_log("CFR '%s':\n", tag_to_string(rec->tag));
-	cfr_log_prop_val(LOG_HEX, "tag", rec->tag);
-	cfr_log_prop_val(LOG_NUM, "size", rec->size);
+	cfr_log("CFR '%s':\n", tag_to_string(out, cfr_le32_to_cpu(rec->tag)));
+	cfr_log_prop_val(LOG_HEX, "tag", cfr_le32_to_cpu(rec->tag));
+	cfr_log_prop_val(LOG_NUM, "size", cfr_le32_to_cpu(rec->size));
 }
 
-#define print_record(_rec) _print_record((const struct lb_record *)(_rec), __func__)
+#define print_record(_rec) _print_record(out, (const struct lb_record *)(_rec), __func__)
 
-static bool _tag_neq(const struct lb_record *rec, uint32_t tag, const char *f)
+static bool _tag_neq(struct text_out *out, const struct lb_record *rec, uint32_t tag, const char *f)
 {
-	if (rec->tag != tag && tag != LB_TAG_CFR_VARCHAR_UI_HELPTEXT) {
-		fprintf(stdout, "%s: expected a '%s' but ", f, tag_to_string(tag));
-		fprintf(stdout, "got a '%s' instead\n", tag_to_string(rec->tag));
+	if (cfr_le32_to_cpu(rec->tag) != tag && tag != LB_TAG_CFR_VARCHAR_UI_HELPTEXT) {
+		fprintf(out->stream, "%s: expected a '%s' but ", f, tag_to_string(out, tag));
+		fprintf(out->stream, "got a '%s' instead\n", tag_to_string(out, cfr_le32_to_cpu(rec->tag)));
 	}
-	return rec->tag != tag;
+	return cfr_le32_to_cpu(rec->tag) != tag;
 }
 
-#define tag_mismatch(_rec, _tag) _tag_neq((const struct lb_record *)(_rec), (_tag), __func__)
+#define tag_mismatch(_rec, _tag) _tag_neq(out, (const struct lb_record *)(_rec), (_tag), __func__)
 
-static void _tag_ok(const struct lb_record *rec, uint32_t tag, const char *f)
+static void _tag_ok(struct text_out *out, const struct lb_record *rec, uint32_t tag, const char *f)
 {
-	if (rec->tag != tag) {
-		fprintf(stderr, "%s: expected a '%s' but ", f, tag_to_string(tag));
-		fprintf(stderr, "got a '%s' instead, bailing\n", tag_to_string(rec->tag));
+	if (cfr_le32_to_cpu(rec->tag) != tag) {
+		fprintf(stderr, "%s: expected a '%s' but ", f, tag_to_string(out, tag));
+		fprintf(stderr, "got a '%s' instead, bailing\n", tag_to_string(out, cfr_le32_to_cpu(rec->tag)));
 		exit(-1);
 	}
 }
 
-#define ensure_tag_ok(_rec, _tag) _tag_ok((const struct lb_record *)(_rec), (_tag), __func__)
+#define ensure_tag_ok(_rec, _tag) _tag_ok(out, (const struct lb_record *)(_rec), (_tag), __func__)
 
-static const char *print_flags(uint32_t flags)
+static const char *print_flags(struct text_out *out, uint32_t flags)
 {
 	const struct {
 		uint32_t flag;
@@ -117,9 +132,10 @@ static const char *print_flags(uint32_t flags)
 		{ CFR_OPTFLAG_VOLATILE, "volatile"   },
 	};
 
-	static char buffer[300] = {0};
+	/* Long enough for all flags at once */
+	char *buffer = out->flags;
 
-	snprintf(buffer, sizeof(buffer), "0x%x (", flags);
+	snprintf(buffer, sizeof(out->flags), "0x%x (", flags);
 
 	unsigned int num_flags = 0;
 	for (unsigned int i = 0; i < ARRAY_SIZE(flags_to_text); i++) {
@@ -140,325 +156,487 @@ static const char *print_flags(uint32_t flags)
 	return buffer;
 }
 
-static uint32_t read_cfr_varchar(char *current, uint32_t tag)
+static uint32_t read_cfr_varchar(struct text_out *out, char *current, uint32_t tag)
 {
 	struct lb_cfr_varbinary *cfr_str = (struct lb_cfr_varbinary *)current;
 
 	if (tag_mismatch(cfr_str, tag)) {
-		printf("<not found>\n");
+		fprintf(out->stream, "<not found>\n");
 		if (tag == LB_TAG_CFR_VARCHAR_UI_HELPTEXT) {
 			return 0;
 		}
-		printf("[HEXDUMP BEGIN]\n");
-		for (uint32_t i = 0; i < cfr_str->size; i++) {
-			printf("%02x ", ((uint8_t *)current)[i]);
+		fprintf(out->stream, "[HEXDUMP BEGIN]\n");
+		for (uint32_t i = 0; i < cfr_le32_to_cpu(cfr_str->size); i++) {
+			fprintf(out->stream, "%02x ", ((uint8_t *)current)[i]);
 			if ((i & 0xf) == 0xf) {
-				printf("\t");
+				fprintf(out->stream, "\t");
 				for (uint32_t j = (i & ~0xf); j <= i; j++) {
-					printf("%c", current[j]);
+					fprintf(out->stream, "%c", current[j]);
 				}
-				printf("\n");
+				fprintf(out->stream, "\n");
 			}
 		}
-		printf("[HEXDUMP END]\n");
+		fprintf(out->stream, "[HEXDUMP END]\n");
 		exit(-1);
 	}
 
-	printf("\n");
-	inc_depth();
+	fprintf(out->stream, "\n");
+	inc_depth(out);
 
 	print_record(cfr_str);
-	cfr_log_prop_val(LOG_NUM, "data length", cfr_str->data_length);
+	cfr_log_prop_val(LOG_NUM, "data length", cfr_le32_to_cpu(cfr_str->data_length));
 	cfr_log_prop_val(LOG_SQU, "data", cfr_str->data);
 
-	dec_depth();
+	dec_depth(out);
 
-	assert(cfr_str->size > cfr_str->data_length);
-	return cfr_str->size;
+	assert(cfr_le32_to_cpu(cfr_str->size) > cfr_le32_to_cpu(cfr_str->data_length));
+	return cfr_le32_to_cpu(cfr_str->size);
 }
 
-static uint32_t sm_read_string_default_value(char *current)
+static uint32_t sm_read_string_default_value(struct text_out *out, char *current)
 {
 	cfr_log_prop("defval");
-	return read_cfr_varchar(current, LB_TAG_CFR_VARCHAR_DEF_VALUE);
+	return read_cfr_varchar(out, current, LB_TAG_CFR_VARCHAR_DEF_VALUE);
 }
 
-static uint32_t sm_read_opt_name(char *current)
+static uint32_t sm_read_opt_name(struct text_out *out, char *current)
 {
 	cfr_log_prop("option name");
-	return read_cfr_varchar(current, LB_TAG_CFR_VARCHAR_OPT_NAME);
+	return read_cfr_varchar(out, current, LB_TAG_CFR_VARCHAR_OPT_NAME);
 }
 
-static uint32_t sm_read_ui_name(char *current)
+static uint32_t sm_read_ui_name(struct text_out *out, char *current)
 {
 	cfr_log_prop("UI name");
-	return read_cfr_varchar(current, LB_TAG_CFR_VARCHAR_UI_NAME);
+	return read_cfr_varchar(out, current, LB_TAG_CFR_VARCHAR_UI_NAME);
 }
 
-static uint32_t sm_read_ui_helptext(char *current)
+static uint32_t sm_read_ui_helptext(struct text_out *out, char *current)
 {
 	cfr_log_prop("UI help text");
-	return read_cfr_varchar(current, LB_TAG_CFR_VARCHAR_UI_HELPTEXT);
+	return read_cfr_varchar(out, current, LB_TAG_CFR_VARCHAR_UI_HELPTEXT);
 }
 
-static uint32_t sm_read_enum_value(char *current)
+static uint32_t sm_read_enum_value(struct text_out *out, char *current)
 {
 	struct lb_cfr_enum_value *enum_val = (struct lb_cfr_enum_value *)current;
-	char *const limit = current + enum_val->size;
+	char *const limit = current + cfr_le32_to_cpu(enum_val->size);
 
 	print_record(enum_val);
-	cfr_log_prop_val(LOG_NUM, "value", enum_val->value);
+	cfr_log_prop_val(LOG_NUM, "value", cfr_le32_to_cpu(enum_val->value));
 
 	current += sizeof(*enum_val);
-	current += sm_read_ui_name(current);
+	current += sm_read_ui_name(out, current);
+
+	assert(current == limit);
+	return cfr_le32_to_cpu(enum_val->size);
+}
+
+/* Ranges are shown as stored, with the label format as their UI name */
+static uint32_t sm_read_enum_range(struct text_out *out, char *current)
+{
+	struct lb_cfr_enum_range *range = (struct lb_cfr_enum_range *)current;
+	char *const limit = current + cfr_le32_to_cpu(range->size);
+
+	print_record(range);
+	cfr_log_prop_val(LOG_NUM, "start", cfr_le32_to_cpu(range->start));
+	cfr_log_prop_val(LOG_NUM, "count", cfr_le32_to_cpu(range->count));
+	cfr_log_prop_val(LOG_NUM, "step", cfr_le32_to_cpu(range->step));
+	cfr_log_prop_val(LOG_NUM, "decimals", cfr_le32_to_cpu(range->decimals));
+
+	current += sizeof(*range);
+	current += sm_read_ui_name(out, current);
 
 	assert(current == limit);
-	return enum_val->size;
+	return cfr_le32_to_cpu(range->size);
 }
 
-static uint32_t read_numeric_option(char *current, uint32_t tag)
+static uint32_t read_numeric_option(struct text_out *out, char *current, uint32_t tag)
 {
 	struct lb_cfr_numeric_option *option = (struct lb_cfr_numeric_option *)current;
-	char *const limit = current + option->size;
+	char *const limit = current + cfr_le32_to_cpu(option->size);
 
 	ensure_tag_ok(option, tag);
 
 	print_record(option);
-	cfr_log_prop_val(LOG_NUM, "object ID", option->object_id);
-	cfr_log_prop_val(LOG_STR, "flags", print_flags(option->flags));
-	cfr_log_prop_val(LOG_NUM, "defval", option->default_value);
+	cfr_log_prop_val(LOG_NUM, "object ID", cfr_le32_to_cpu(option->object_id));
+	cfr_log_prop_val(LOG_STR, "flags", print_flags(out, cfr_le32_to_cpu(option->flags)));
+	cfr_log_prop_val(LOG_NUM, "defval", cfr_le32_to_cpu(option->default_value));
 
 	current += sizeof(*option);
-	current += sm_read_opt_name(current);
-	current += sm_read_ui_name(current);
-	current += sm_read_ui_helptext(current);
+	current += sm_read_opt_name(out, current);
+	current += sm_read_ui_name(out, current);
+	current += sm_read_ui_helptext(out, current);
 
-	if (option->tag == LB_TAG_CFR_OPTION_ENUM) {
+	if (cfr_le32_to_cpu(option->tag) == LB_TAG_CFR_OPTION_ENUM) {
 		cfr_log_prop("enum values");
-		printf("\n");
+		fprintf(out->stream, "\n");
 		while (current < limit) {
-			inc_depth();
-			current += sm_read_enum_value(current);
-			dec_depth();
+			inc_depth(out);
+			if (cfr_le32_to_cpu(((struct lb_record *)current)->tag) == LB_TAG_CFR_ENUM_RANGE) {
+				current += sm_read_enum_range(out, current);
+			} else {
+				current += sm_read_enum_value(out, current);
+			}
+			dec_depth(out);
 		}
 	}
 
 	assert(current == limit);
-	return option->size;
+	return cfr_le32_to_cpu(option->size);
 }
 
-static uint32_t sm_read_opt_enum(char *current)
+static uint32_t sm_read_opt_enum(struct text_out *out, char *current)
 {
-	return read_numeric_option(current, LB_TAG_CFR_OPTION_ENUM);
+	return read_numeric_option(out, current, LB_TAG_CFR_OPTION_ENUM);
 }
 
-static uint32_t sm_read_opt_number(char *current)
+static uint32_t sm_read_opt_number(struct text_out *out, char *current)
 {
-	return read_numeric_option(current, LB_TAG_CFR_OPTION_NUMBER);
+	return read_numeric_option(out, current, LB_TAG_CFR_OPTION_NUMBER);
 }
 
-static uint32_t sm_read_opt_bool(char *current)
+static uint32_t sm_read_opt_bool(struct text_out *out, char *current)
 {
-	return read_numeric_option(current, LB_TAG_CFR_OPTION_BOOL);
+	return read_numeric_option(out, current, LB_TAG_CFR_OPTION_BOOL);
 }
 
-static uint32_t sm_read_opt_varchar(char *current)
+static uint32_t sm_read_opt_varchar(struct text_out *out, char *current)
 {
 	struct lb_cfr_varchar_option *option = (struct lb_cfr_varchar_option *)current;
-	char *const limit = current + option->size;
+	char *const limit = current + cfr_le32_to_cpu(option->size);
 
 	ensure_tag_ok(option, LB_TAG_CFR_OPTION_VARCHAR);
 
 	print_record(option);
-	cfr_log_prop_val(LOG_NUM, "object ID", option->object_id);
-	cfr_log_prop_val(LOG_STR, "flags", print_flags(option->flags));
+	cfr_log_prop_val(LOG_NUM, "object ID", cfr_le32_to_cpu(option->object_id));
+	cfr_log_prop_val(LOG_STR, "flags", print_flags(out, cfr_le32_to_cpu(option->flags)));
 
 	current += sizeof(*option);
-	current += sm_read_string_default_value(current);
-	current += sm_read_opt_name(current);
-	current += sm_read_ui_name(current);
-	current += sm_read_ui_helptext(current);
+	current += sm_read_string_default_value(out, current);
+	current += sm_read_opt_name(out, current);
+	current += sm_read_ui_name(out, current);
+	current += sm_read_ui_helptext(out, current);
 
 	assert(current == limit);
-	return option->size;
+	return cfr_le32_to_cpu(option->size);
 }
 
-static uint32_t sm_read_opt_comment(char *current)
+static uint32_t sm_read_opt_comment(struct text_out *out, char *current)
 {
 	struct lb_cfr_option_comment *comment = (struct lb_cfr_option_comment *)current;
-	char *const limit = current + comment->size;
+	char *const limit = current + cfr_le32_to_cpu(comment->size);
 
 	ensure_tag_ok(comment, LB_TAG_CFR_OPTION_COMMENT);
 
 	print_record(comment);
-	cfr_log_prop_val(LOG_NUM, "object ID", comment->object_id);
-	cfr_log_prop_val(LOG_STR, "flags", print_flags(comment->flags));
+	cfr_log_prop_val(LOG_NUM, "object ID", cfr_le32_to_cpu(comment->object_id));
+	cfr_log_prop_val(LOG_STR, "flags", print_flags(out, cfr_le32_to_cpu(comment->flags)));
 
 	current += sizeof(*comment);
-	current += sm_read_ui_name(current);
-	current += sm_read_ui_helptext(current);
+	current += sm_read_ui_name(out, current);
+	current += sm_read_ui_helptext(out, current);
 
 	assert(current == limit);
-	return comment->size;
+	return cfr_le32_to_cpu(comment->size);
 }
 
-static uint32_t sm_read_object(char *current);
+static uint32_t sm_read_form_directory(struct text_out *out, char *current)
+{
+	struct lb_cfr_form_directory *directory = (struct lb_cfr_form_directory *)current;
+	const struct lb_cfr_form_directory_entry *entries =
+		(const struct lb_cfr_form_directory_entry *)(directory + 1);
+
+	ensure_tag_ok(directory, LB_TAG_CFR_FORM_DIRECTORY);
+
+	print_record(directory);
+	cfr_log_prop_val(LOG_NUM, "entries", cfr_le32_to_cpu(directory->num_entries));
+
+	for (uint32_t i = 0; i < cfr_le32_to_cpu(directory->num_entries); i++) {
+		cfr_log("form %u at 0x%x, depth %u\n", cfr_le32_to_cpu(entries[i].object_id),
+			cfr_le32_to_cpu(entries[i].offset), cfr_le32_to_cpu(entries[i].depth));
+	}
+
+	return cfr_le32_to_cpu(directory->size);
+}
 
-static uint32_t sm_read_form(char *current)
+static uint32_t sm_read_form_checksum(struct text_out *out, const struct lb_cfr_option_form *form, char *current)
+{
+	const struct lb_cfr_form_checksum *crc = cfr_form_checksum(form);
+	if ((char *)crc != current) {
+		return 0;
+	}
+
+	const bool ok = !cfr_check_form(form);
+	out->corrupt |= !ok;
+
+	cfr_log("%-12s 0x%x (%s)\n", "checksum:", cfr_le32_to_cpu(crc->checksum),
+		ok ? "ok" : "MISMATCH");
+	return cfr_le32_to_cpu(crc->size);
+}
+
+static uint32_t sm_read_object(struct text_out *out, char *current);
+
+static uint32_t sm_read_form(struct text_out *out, char *current)
 {
 	struct lb_cfr_option_form *form = (struct lb_cfr_option_form *)current;
-	char *const limit = current + form->size;
+	char *const limit = current + cfr_le32_to_cpu(form->size);
 
 	ensure_tag_ok(form, LB_TAG_CFR_OPTION_FORM);
 
 	print_record(form);
-	cfr_log_prop_val(LOG_NUM, "object ID", form->object_id);
-	cfr_log_prop_val(LOG_STR, "flags", print_flags(form->flags));
+	cfr_log_prop_val(LOG_NUM, "object ID", cfr_le32_to_cpu(form->object_id));
+	cfr_log_prop_val(LOG_STR, "flags", print_flags(out, cfr_le32_to_cpu(form->flags)));
 
 	current += sizeof(*form);
-	current += sm_read_ui_name(current);
+	current += sm_read_ui_name(out, current);
+	current += sm_read_form_checksum(out, form, current);
 
 	cfr_log_prop("object list");
-	printf("\n");
+	fprintf(out->stream, "\n");
 	while (current < limit) {
-		current += sm_read_object(current);
+		current += sm_read_object(out, current);
 	}
 
 	assert(current == limit);
-	return form->size;
+	return cfr_le32_to_cpu(form->size);
 }
 
-static uint32_t _sm_read_object(char *current)
+static uint32_t _sm_read_object(struct text_out *out, char *current)
 {
 	struct lb_record *rec = (struct lb_record *)current;
 
-	switch (rec->tag) {
+	switch (cfr_le32_to_cpu(rec->tag)) {
 	case LB_TAG_CFR_OPTION_ENUM:
-		return sm_read_opt_enum(current);
+		return sm_read_opt_enum(out, current);
 	case LB_TAG_CFR_OPTION_NUMBER:
-		return sm_read_opt_number(current);
+		return sm_read_opt_number(out, current);
 	case LB_TAG_CFR_OPTION_BOOL:
-		return sm_read_opt_bool(current);
+		return sm_read_opt_bool(out, current);
 	case LB_TAG_CFR_OPTION_VARCHAR:
-		return sm_read_opt_varchar(current);
+		return sm_read_opt_varchar(out, current);
 	case LB_TAG_CFR_OPTION_COMMENT:
-		return sm_read_opt_comment(current);
+		return sm_read_opt_comment(out, current);
 	case LB_TAG_CFR_OPTION_FORM:
-		return sm_read_form(current);
+		return sm_read_form(out, current);
+	case LB_TAG_CFR_FORM_DIRECTORY:
+		return sm_read_form_directory(out, current);
 	default:
 		print_record(rec);
-		return rec->size;
+		return cfr_le32_to_cpu(rec->size);
 	}
 }
 
-static uint32_t sm_read_object(char *current)
+static uint32_t sm_read_object(struct text_out *out, char *current)
 {
-	inc_depth();
-	const uint32_t ret = _sm_read_object(current);
-	dec_depth();
+	inc_depth(out);
+	const uint32_t ret = _sm_read_object(out, current);
+	dec_depth(out);
 	return ret;
 }
 
-static void sm_read_cfr(char *current)
+static void sm_read_cfr(struct text_out *out, char *current)
 {
 	struct lb_cfr *cfr_root = (struct lb_cfr *)current;
-	char *const limit = current + cfr_root->size;
+	char *const limit = current + cfr_le32_to_cpu(cfr_root->size);
 
 	ensure_tag_ok(cfr_root, LB_TAG_CFR);
 
 	print_record(cfr_root);
-	cfr_log_prop_val(LOG_HEX, "checksum", cfr_root->checksum);
+	cfr_log_prop_val(LOG_HEX, "checksum", cfr_le32_to_cpu(cfr_root->checksum));
 
 	current += sizeof(*cfr_root);
 
 	cfr_log_prop("form list");
-	printf("\n");
+	fprintf(out->stream, "\n");
 	while (current < limit) {
-		current += sm_read_object(current);
+		current += sm_read_object(out, current);
 	}
 
 	assert(current == limit);
 
-	printf("length:  %ld\n", (long int)(current - (char *)cfr_root));
-	printf("size:    %u\n", cfr_root->size);
+	fprintf(out->stream, "length:  %ld\n", (long int)(current - (char *)cfr_root));
+	fprintf(out->stream, "size:    %u\n", cfr_le32_to_cpu(cfr_root->size));
 
-	printf("depth:   %d\n", depth);
+	fprintf(out->stream, "depth:   %d\n", out->depth);
 }
 
-static int alloc_and_read(char **buffer, uint32_t length, struct lb_record *rec, FILE *stream)
+static void print_json_string(const char *str)
 {
-	rewind(stream);
-
-	*buffer = malloc(length);
-	if (!*buffer) {
-		fprintf(stderr, "Could not allocate %u bytes\n", length);
-		return -1;
+	putchar('"');
+	for (; *str; str++) {
+		const unsigned char c = *str;
+		if (c == '"' || c == '\\') {
+			printf("\\%c", c);
+		} else if (c < 0x20) {
+			printf("\\u%04x", c);
+		} else {
+			putchar(c);
+		}
 	}
+	putchar('"');
+}
 
-	const size_t read_size = fread(*buffer, sizeof((*buffer)[0]), length, stream);
-
-	if (read_size == length) {
-		return 0;
+static void print_json_field(const char *name, const struct cfr_view *view, uint32_t offset)
+{
+	if (offset) {
+		printf(", \"%s\": ", name);
+		print_json_string(cfr_view_string(view, offset));
 	}
+}
 
-	if (feof(stream)) {
-		fprintf(stderr, "Unexpected end of file while reading data\n");
-	} else if (ferror(stream)) {
-		perror("Error reading data");
-	} else {
-		fprintf(stderr, "Unknown error reading data\n");
+static const char *kind_name(uint32_t tag)
+{
+	switch (tag) {
+	case LB_TAG_CFR_OPTION_FORM:		return "form";
+	case LB_TAG_CFR_OPTION_ENUM:		return "enum";
+	case LB_TAG_CFR_OPTION_NUMBER:		return "number";
+	case LB_TAG_CFR_OPTION_BOOL:		return "bool";
+	case LB_TAG_CFR_OPTION_VARCHAR:		return "varchar";
+	case LB_TAG_CFR_OPTION_COMMENT:		return "comment";
+	default:				return "unknown";
 	}
-
-	return -1;
 }
 
-static int read_from_file(char **buffer, const char *filename)
+static void print_json_object(const struct cfr_view *view, uint32_t row)
 {
-	FILE *stream = fopen(filename, "rb");
-	if (!stream) {
-		perror("Could not open file");
-		return -1;
+	const uint32_t tag = view->tag[row];
+
+	printf("{\"kind\": \"%s\", \"offset\": %u, \"id\": %u, \"flags\": %u",
+	       kind_name(tag), view->offset[row], view->object_id[row], view->flags[row]);
+	print_json_field("opt_name", view, view->opt_name[row]);
+	print_json_field("ui_name", view, view->ui_name[row]);
+	print_json_field("help", view, view->ui_helptext[row]);
+	if (tag == LB_TAG_CFR_OPTION_VARCHAR) {
+		print_json_field("default", view, view->def_string[row]);
+	} else if (tag != LB_TAG_CFR_OPTION_FORM && tag != LB_TAG_CFR_OPTION_COMMENT) {
+		printf(", \"default\": %u", view->default_value[row]);
 	}
+	printf("}");
+}
 
-	int ret = -1;
+static void print_json_value(const struct cfr_view *view, uint32_t row)
+{
+	const uint32_t option = view->value_option[row];
 
-	struct lb_record record = {0};
-	const size_t header_size = fread(&record, sizeof(record), 1, stream);
+	printf("{\"kind\": \"value\", \"option\": %u, \"value\": %u",
+	       view->object_id[option], view->value[row]);
+	print_json_field("ui_name", view, view->value_ui_name[row]);
+	printf("}");
+}
 
-	if (header_size == 1) {
-		if (record.tag == LB_TAG_CFR) {
-			ret = alloc_and_read(buffer, record.size, &record, stream);
-		} else {
-			fprintf(stderr, "Root record tag 0x%x is not a CFR root\n", record.tag);
-		}
-	} else {
-		if (feof(stream)) {
-			fprintf(stderr, "Unexpected end of file while reading record\n");
-		} else if (ferror(stream)) {
-			perror("Error reading record");
+/* Prints one JSON object per file, all of them in an array */
+static int run_query(const struct cfr_query *query, char **files, int num_files)
+{
+	int ret = 0;
+	bool printed = false;
+
+	printf("[");
+	for (int i = 0; i < num_files; i++) {
+		char *buffer = NULL;
+		struct cfr_view *view = NULL;
+		struct cfr_query_result result = { 0 };
+
+		if (cfr_read_file(&buffer, files[i]) || !(view = cfr_view_build(buffer)) ||
+		    cfr_query_run(query, view, &result)) {
+			fprintf(stderr, "Skipping '%s'\n", files[i]);
+			ret = -1;
 		} else {
-			fprintf(stderr, "Unknown error reading record\n");
+			/* Skipped files leave no trace, not even a separator */
+			printf("%s\n{\"file\": ", printed ? "," : "");
+			printed = true;
+			print_json_string(files[i]);
+			printf(", \"matches\": [");
+			for (size_t j = 0; j < result.num_rows; j++) {
+				printf("%s\n  ", j ? "," : "");
+				if (result.values) {
+					print_json_value(view, result.rows[j]);
+				} else {
+					print_json_object(view, result.rows[j]);
+				}
+			}
+			printf("%s]}", result.num_rows ? "\n" : "");
 		}
-	}
 
-	fclose(stream);
+		free(result.rows);
+		cfr_view_free(view);
+		free(buffer);
+	}
+	printf("\n]\n");
 	return ret;
 }
 
+static void usage(void)
+{
+	fprintf(stderr, "Usage: cfr_read <input file> [form object ID]\n");
+	fprintf(stderr, "       cfr_read --query <path> <input file>...\n");
+	fprintf(stderr, "Queries print JSON, see cfr_query.h for the syntax. For example:\n");
+	fprintf(stderr, "       cfr_read --query 'form[ui_name=\"Main\"]/enum[flags&SUPPRESS]/value' menu.bin\n");
+}
+
 int main(int argc, char **argv)
 {
-	if (argc != 2) {
-		fprintf(stderr, "Usage: cfr_read <input file>\n");
+	static const struct option long_options[] = {
+		{ "query", required_argument, NULL, 'q' },
+		{ 0 },
+	};
+
+	const char *expr = NULL;
+
+	int opt;
+	while ((opt = getopt_long(argc, argv, "q:", long_options, NULL)) != -1) {
+		switch (opt) {
+		case 'q':
+			expr = optarg;
+			break;
+		default:
+			usage();
+			return -1;
+		}
+	}
+
+	const int num_args = argc - optind;
+	if (expr) {
+		if (num_args < 1) {
+			usage();
+			return -1;
+		}
+		struct cfr_query *query = cfr_query_compile(expr);
+		if (!query) {
+			return -1;
+		}
+		const int ret = run_query(query, argv + optind, num_args);
+		cfr_query_free(query);
+		return ret;
+	}
+
+	if (num_args != 1 && num_args != 2) {
+		usage();
 		return -1;
 	}
 
 	char *buffer = NULL;
-	if (read_from_file(&buffer, argv[1])) {
+	if (cfr_read_file(&buffer, argv[optind])) {
 		free(buffer);
 		return -1;
 	}
 
-	sm_read_cfr(buffer);
+	struct text_out out = {
+		.stream = stdout,
+	};
+	int ret = 0;
+	if (num_args == 2) {
+		const uint32_t object_id = strtoul(argv[optind + 1], NULL, 0);
+		const uint32_t offset = cfr_find_form(buffer, object_id);
+		if (offset) {
+			sm_read_object(&out, buffer + offset);
+		} else {
+			fprintf(stderr, "No form with object ID %u\n", object_id);
+			ret = -1;
+		}
+	} else {
+		sm_read_cfr(&out, buffer);
+	}
 	free(buffer);
-	return 0;
+	return out.corrupt ? -1 : ret;
 }
@@ -0,0 +1,200 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+
+#include <getopt.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cfr.h"
+#include "cfr_file.h"
+#include "cfr_view.h"
+
+struct scan_filter {
+	enum cfr_view_op op;
+	size_t column;		/* Offset of the column pointer in struct cfr_view */
+	uint32_t operand;
+};
+
+#define MAX_FILTERS	8
+
+static const struct {
+	const char *name;
+	uint32_t tag;
+} tag_names[] = {
+	{ "form",    LB_TAG_CFR_OPTION_FORM },
+	{ "enum",    LB_TAG_CFR_OPTION_ENUM },
+	{ "number",  LB_TAG_CFR_OPTION_NUMBER },
+	{ "bool",    LB_TAG_CFR_OPTION_BOOL },
+	{ "varchar", LB_TAG_CFR_OPTION_VARCHAR },
+	{ "comment", LB_TAG_CFR_OPTION_COMMENT },
+};
+
+static bool parse_tag(const char *name, uint32_t *tag)
+{
+	for (size_t i = 0; i < ARRAY_SIZE(tag_names); i++) {
+		if (!strcmp(name, tag_names[i].name)) {
+			*tag = tag_names[i].tag;
+			return true;
+		}
+	}
+	fprintf(stderr, "Unknown object type '%s'\n", name);
+	return false;
+}
+
+static const uint32_t *filter_column(const struct cfr_view *view, const struct scan_filter *f)
+{
+	return *(uint32_t *const *)((const char *)view + f->column);
+}
+
+/* Returns the number of matching objects, or -1 on error */
+static long scan_file(const char *filename, const struct scan_filter *filters,
+		      size_t num_filters, bool count_only)
+{
+	char *blob;
+	if (cfr_read_file(&blob, filename)) {
+		return -1;
+	}
+
+	struct cfr_view *view = cfr_view_build(blob);
+	if (!view) {
+		free(blob);
+		return -1;
+	}
+
+	const size_t words = cfr_view_bitmap_words(view->num_rows);
+	uint64_t *match = malloc((words + 1) * sizeof(*match));
+	uint64_t *tmp = malloc((words + 1) * sizeof(*tmp));
+	uint32_t *rows = malloc((view->num_rows + 1) * sizeof(*rows));
+	if (!match || !tmp || !rows) {
+		fprintf(stderr, "Could not allocate scan buffers\n");
+		exit(-1);
+	}
+
+	/* Start with every row, and narrow it down one column at a time */
+	cfr_view_filter(view->object_id, view->num_rows, CFR_VIEW_NO_BITS, 0, match);
+	for (size_t i = 0; i < num_filters; i++) {
+		cfr_view_filter(filter_column(view, &filters[i]), view->num_rows,
+				filters[i].op, filters[i].operand, tmp);
+		cfr_view_bitmap_and(match, tmp, view->num_rows);
+	}
+
+	const size_t num_matches = cfr_view_bitmap_rows(match, view->num_rows, rows);
+	if (!count_only) {
+		for (size_t i = 0; i < num_matches; i++) {
+			const uint32_t row = rows[i];
+			const uint32_t name = view->opt_name[row] ? view->opt_name[row]
+								  : view->ui_name[row];
+			printf("%s: %u %s\n", filename, view->object_id[row],
+			       cfr_view_string(view, name));
+		}
+	}
+
+	free(rows);
+	free(tmp);
+	free(match);
+	cfr_view_free(view);
+	free(blob);
+	return num_matches;
+}
+
+static void usage(void)
+{
+	fprintf(stderr, "Usage: cfr_scan [filters] [--count] <input file>...\n");
+	fprintf(stderr, "Filters, which must all match:\n");
+	fprintf(stderr, "    --type <form|enum|number|bool|varchar|comment>\n");
+	fprintf(stderr, "    --flags <mask>          any of the flags in mask are set\n");
+	fprintf(stderr, "    --min-values <n>        enums with at least n values\n");
+	fprintf(stderr, "    --non-zero-default      numeric default is not 0\n");
+}
+
+int main(int argc, char **argv)
+{
+	static const struct option long_options[] = {
+		{ "type",             required_argument, NULL, 't' },
+		{ "flags",            required_argument, NULL, 'f' },
+		{ "min-values",       required_argument, NULL, 'v' },
+		{ "non-zero-default", no_argument,       NULL, 'z' },
+		{ "count",            no_argument,       NULL, 'c' },
+		{ 0 },
+	};
+
+	struct scan_filter filters[MAX_FILTERS];
+	size_t num_filters = 0;
+	bool count_only = false;
+
+	int opt;
+	while ((opt = getopt_long(argc, argv, "t:f:v:zc", long_options, NULL)) != -1) {
+		if (num_filters == MAX_FILTERS && opt != 'c') {
+			fprintf(stderr, "Too many filters\n");
+			return -1;
+		}
+		struct scan_filter *f = &filters[num_filters];
+		switch (opt) {
+		case 't':
+			*f = (struct scan_filter) {
+				.op	= CFR_VIEW_EQ,
+				.column	= offsetof(struct cfr_view, tag),
+			};
+			if (!parse_tag(optarg, &f->operand)) {
+				return -1;
+			}
+			num_filters++;
+			break;
+		case 'f':
+			*f = (struct scan_filter) {
+				.op		= CFR_VIEW_ANY_BITS,
+				.column		= offsetof(struct cfr_view, flags),
+				.operand	= strtoul(optarg, NULL, 0),
+			};
+			num_filters++;
+			break;
+		case 'v': {
+			/* value_count >= n is value_count > n - 1, and always true for 0 */
+			const uint32_t min = strtoul(optarg, NULL, 0);
+			*f = (struct scan_filter) {
+				.op		= min ? CFR_VIEW_GT : CFR_VIEW_NO_BITS,
+				.column		= offsetof(struct cfr_view, value_count),
+				.operand	= min ? min - 1 : 0,
+			};
+			num_filters++;
+			break;
+		}
+		case 'z':
+			*f = (struct scan_filter) {
+				.op	= CFR_VIEW_NE,
+				.column	= offsetof(struct cfr_view, default_value),
+			};
+			num_filters++;
+			break;
+		case 'c':
+			count_only = true;
+			break;
+		default:
+			usage();
+			return -1;
+		}
+	}
+
+	if (optind >= argc) {
+		usage();
+		return -1;
+	}
+
+	int ret = 0;
+	unsigned long total = 0;
+	for (int i = optind; i < argc; i++) {
+		const long matches = scan_file(argv[i], filters, num_filters, count_only);
+		if (matches < 0) {
+			ret = -1;
+			continue;
+		}
+		total += matches;
+	}
+
+	if (count_only) {
+		printf("%lu\n", total);
+	}
+	return ret;
+}
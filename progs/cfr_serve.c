@@ -0,0 +1,1013 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+
+/* For strncasecmp() */
+#define _POSIX_C_SOURCE 200809L
+
+#include <arpa/inet.h>
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <netinet/in.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+
+#include "cfr.h"
+#include "cfr_file.h"
+#include "cfr_html.h"
+
+#define ALIGN_UP(x, a)		(((x) + ((a) - 1)) & ~((__typeof__(x))(a) - 1))
+
+#define MAX_EVENTS		64
+#define MAX_REQUEST_SIZE	(64 * 1024)
+#define MAX_BODY_SIZE		(1024 * 1024)
+#define MAX_INPUT_SIZE		(MAX_REQUEST_SIZE + MAX_BODY_SIZE)
+
+/*
+ * The in-memory copy of the blob which POSTs get applied to. Records can
+ * grow or shrink when a string changes, so the buffer is reallocated as
+ * needed and all offsets into it are only valid until the next change.
+ */
+struct blob {
+	char *data;
+	size_t len;
+};
+
+struct option_ref {
+	const char *name;	/* Points into the blob */
+	size_t name_len;
+	uint32_t offset;	/* Of the option record */
+};
+
+struct server {
+	struct blob blob;
+	struct option_ref *options;
+	size_t num_options;
+	size_t max_options;
+
+	struct html_out page;	/* Rendered lazily after every change */
+	bool page_valid;
+
+	char *style;
+	size_t style_len;
+};
+
+struct conn {
+	int fd;
+	char *in;
+	size_t in_len;
+	size_t in_cap;
+	char *out;
+	size_t out_len;
+	size_t out_off;
+	size_t out_cap;
+	bool close_after_write;
+};
+
+/*
+ * Blob structure helpers
+ */
+
+static struct lb_record *record_at(const struct blob *blob, uint32_t offset)
+{
+	return (struct lb_record *)(blob->data + offset);
+}
+
+/* Returns the offset of the first child of `parent` with `tag`, or 0 if none */
+static uint32_t find_child(const struct blob *blob, uint32_t parent, uint32_t tag)
+{
+	const struct lb_record *rec = record_at(blob, parent);
+	const uint32_t end = parent + cfr_le32_to_cpu(rec->size);
+
+	const size_t header_size = cfr_record_header_size(cfr_le32_to_cpu(rec->tag));
+
+	for (uint32_t off = parent + header_size; off < end;) {
+		const struct lb_record *child = record_at(blob, off);
+		if (cfr_le32_to_cpu(child->tag) == tag) {
+			return off;
+		}
+		off += cfr_le32_to_cpu(child->size);
+	}
+	return 0;
+}
+
+static void add_option(struct server *srv, uint32_t offset)
+{
+	const uint32_t name_off = find_child(&srv->blob, offset, LB_TAG_CFR_VARCHAR_OPT_NAME);
+	if (!name_off) {
+		return;
+	}
+	const struct lb_cfr_varbinary *name =
+		(const struct lb_cfr_varbinary *)record_at(&srv->blob, name_off);
+	const uint32_t name_len = cfr_le32_to_cpu(name->data_length);
+
+	if (srv->num_options == srv->max_options) {
+		srv->max_options = srv->max_options ? srv->max_options * 2 : 64;
+		srv->options = realloc(srv->options, srv->max_options * sizeof(*srv->options));
+		if (!srv->options) {
+			fprintf(stderr, "Could not allocate option index\n");
+			exit(-1);
+		}
+	}
+	srv->options[srv->num_options++] = (struct option_ref) {
+		.name		= (const char *)name->data,
+		.name_len	= name_len ? name_len - 1 : 0,
+		.offset		= offset,
+	};
+}
+
+static void index_options(struct server *srv, uint32_t parent)
+{
+	const struct lb_record *rec = record_at(&srv->blob, parent);
+	const uint32_t end = parent + cfr_le32_to_cpu(rec->size);
+
+	const size_t header_size = cfr_record_header_size(cfr_le32_to_cpu(rec->tag));
+
+	for (uint32_t off = parent + header_size; off < end;) {
+		const struct lb_record *child = record_at(&srv->blob, off);
+		switch (cfr_le32_to_cpu(child->tag)) {
+		case LB_TAG_CFR_OPTION_FORM:
+			index_options(srv, off);
+			break;
+		case LB_TAG_CFR_OPTION_ENUM:
+		case LB_TAG_CFR_OPTION_NUMBER:
+		case LB_TAG_CFR_OPTION_BOOL:
+		case LB_TAG_CFR_OPTION_VARCHAR:
+			add_option(srv, off);
+			break;
+		}
+		off += cfr_le32_to_cpu(child->size);
+	}
+}
+
+static int option_ref_cmp(const void *a, const void *b)
+{
+	const struct option_ref *x = a;
+	const struct option_ref *y = b;
+	const size_t len = x->name_len < y->name_len ? x->name_len : y->name_len;
+
+	const int ret = memcmp(x->name, y->name, len);
+	if (ret) {
+		return ret;
+	}
+	return (x->name_len > y->name_len) - (x->name_len < y->name_len);
+}
+
+static void rebuild_index(struct server *srv)
+{
+	srv->num_options = 0;
+	index_options(srv, 0);
+	qsort(srv->options, srv->num_options, sizeof(*srv->options), option_ref_cmp);
+}
+
+static const struct option_ref *lookup_option(const struct server *srv,
+					      const char *name, size_t name_len)
+{
+	const struct option_ref key = { .name = name, .name_len = name_len };
+	return bsearch(&key, srv->options, srv->num_options, sizeof(*srv->options),
+		       option_ref_cmp);
+}
+
+/*
+ * Replaces the string at `offset` and fixes up the size of every record
+ * containing it. Everything after the string moves if its size changes.
+ */
+static void replace_varchar(struct blob *blob, uint32_t offset, const char *str, size_t len)
+{
+	const struct lb_cfr_varbinary *old = (const struct lb_cfr_varbinary *)(blob->data + offset);
+	const uint32_t old_size = cfr_le32_to_cpu(old->size);
+	const uint32_t tag = cfr_le32_to_cpu(old->tag);
+	const uint32_t new_size = ALIGN_UP(sizeof(*old) + len + 1, LB_ENTRY_ALIGN);
+	const int64_t delta = (int64_t)new_size - old_size;
+
+	if (delta > 0) {
+		char *data = realloc(blob->data, blob->len + delta);
+		if (!data) {
+			fprintf(stderr, "Could not grow blob to %zu bytes\n", blob->len + delta);
+			exit(-1);
+		}
+		blob->data = data;
+	}
+
+	const size_t tail = offset + old_size;
+	memmove(blob->data + tail + delta, blob->data + tail, blob->len - tail);
+	cfr_form_directory_move(blob->data, offset, delta);
+
+	struct lb_cfr_varbinary *str_rec = (struct lb_cfr_varbinary *)(blob->data + offset);
+	memset(str_rec, 0, new_size);
+	str_rec->tag = cfr_cpu_to_le32(tag);
+	str_rec->size = cfr_cpu_to_le32(new_size);
+	str_rec->data_length = cfr_cpu_to_le32(len + 1);
+	memcpy(str_rec->data, str, len);
+
+	/* Records containing the string have not moved, and neither have their sizes */
+	uint32_t parent = 0;
+	while (parent != offset) {
+		struct lb_record *rec = record_at(blob, parent);
+		uint32_t child = parent + cfr_record_header_size(cfr_le32_to_cpu(rec->tag));
+		while (child + cfr_le32_to_cpu(record_at(blob, child)->size) <= offset) {
+			child += cfr_le32_to_cpu(record_at(blob, child)->size);
+		}
+		rec->size = cfr_cpu_to_le32(cfr_le32_to_cpu(rec->size) + delta);
+		parent = child;
+	}
+
+	blob->len += delta;
+}
+
+static void update_checksum(struct blob *blob)
+{
+	struct lb_cfr *root = (struct lb_cfr *)blob->data;
+	root->checksum = 0;
+	root->checksum = cfr_cpu_to_le32(cfr_crc32(root, cfr_le32_to_cpu(root->size)));
+}
+
+/*
+ * Form handling
+ */
+
+static int hex_value(char c)
+{
+	if (c >= '0' && c <= '9')
+		return c - '0';
+	if (c >= 'a' && c <= 'f')
+		return c - 'a' + 10;
+	if (c >= 'A' && c <= 'F')
+		return c - 'A' + 10;
+	return -1;
+}
+
+/* Decodes `application/x-www-form-urlencoded` data in place */
+static size_t url_decode(char *str, size_t len)
+{
+	size_t out = 0;
+	for (size_t i = 0; i < len; i++) {
+		if (str[i] == '+') {
+			str[out++] = ' ';
+		} else if (str[i] == '%' && i + 2 < len &&
+			   hex_value(str[i + 1]) >= 0 && hex_value(str[i + 2]) >= 0) {
+			str[out++] = hex_value(str[i + 1]) << 4 | hex_value(str[i + 2]);
+			i += 2;
+		} else {
+			str[out++] = str[i];
+		}
+	}
+	return out;
+}
+
+static bool parse_u32(const char *str, size_t len, uint32_t *out)
+{
+	if (!len || len > 10) {
+		return false;
+	}
+	uint64_t val = 0;
+	for (size_t i = 0; i < len; i++) {
+		if (str[i] < '0' || str[i] > '9') {
+			return false;
+		}
+		val = val * 10 + (str[i] - '0');
+	}
+	if (val > UINT32_MAX) {
+		return false;
+	}
+	*out = val;
+	return true;
+}
+
+static bool parse_bool(const char *str, size_t len, uint32_t *out)
+{
+	if ((len == 2 && !memcmp(str, "on", 2)) || (len == 1 && str[0] == '1')) {
+		*out = 1;
+		return true;
+	}
+	if ((len == 3 && !memcmp(str, "off", 3)) || (len == 1 && str[0] == '0')) {
+		*out = 0;
+		return true;
+	}
+	return false;
+}
+
+struct form_pair {
+	const char *name;
+	size_t name_len;
+	const char *val;
+	size_t val_len;
+};
+
+/* The option the pair sets, NULL for unknown names and read-only options */
+static struct lb_cfr_numeric_option *pair_option(const struct server *srv,
+						 const struct form_pair *pair, uint32_t *offset)
+{
+	const struct option_ref *ref = lookup_option(srv, pair->name, pair->name_len);
+	if (!ref) {
+		return NULL;
+	}
+
+	struct lb_cfr_numeric_option *opt =
+		(struct lb_cfr_numeric_option *)record_at(&srv->blob, ref->offset);
+	if (cfr_le32_to_cpu(opt->flags) & CFR_OPTFLAG_READONLY) {
+		return NULL;
+	}
+	*offset = ref->offset;
+	return opt;
+}
+
+/*
+ * Checks a single `name=value` pair without changing anything. Unknown
+ * names and read-only options are skipped. Returns an error message for
+ * values the option can't take, and the numeric value in `value`.
+ */
+static const char *check_value(const struct server *srv, const struct form_pair *pair,
+			       uint32_t *value)
+{
+	uint32_t offset;
+	const struct lb_cfr_numeric_option *opt = pair_option(srv, pair, &offset);
+	if (!opt) {
+		return NULL;
+	}
+
+	switch (cfr_le32_to_cpu(opt->tag)) {
+	case LB_TAG_CFR_OPTION_ENUM:
+		if (!parse_u32(pair->val, pair->val_len, value) ||
+		    !cfr_enum_has_value(opt, *value)) {
+			return "Invalid enum value";
+		}
+		return NULL;
+	case LB_TAG_CFR_OPTION_NUMBER:
+		if (!parse_u32(pair->val, pair->val_len, value)) {
+			return "Invalid number";
+		}
+		return NULL;
+	case LB_TAG_CFR_OPTION_BOOL:
+		if (!parse_bool(pair->val, pair->val_len, value)) {
+			return "Invalid boolean";
+		}
+		return NULL;
+	case LB_TAG_CFR_OPTION_VARCHAR:
+		if (memchr(pair->val, '\0', pair->val_len)) {
+			return "Invalid string";
+		}
+		if (!find_child(&srv->blob, offset, LB_TAG_CFR_VARCHAR_DEF_VALUE)) {
+			return "String option has no default value";
+		}
+		return NULL;
+	default:
+		return NULL;
+	}
+}
+
+/* Applies a pair that passed check_value() */
+static void apply_value(struct server *srv, const struct form_pair *pair)
+{
+	uint32_t offset;
+	uint32_t value;
+	struct lb_cfr_numeric_option *opt = pair_option(srv, pair, &offset);
+	if (!opt || check_value(srv, pair, &value)) {
+		return;
+	}
+
+	switch (cfr_le32_to_cpu(opt->tag)) {
+	case LB_TAG_CFR_OPTION_ENUM:
+	case LB_TAG_CFR_OPTION_NUMBER:
+	case LB_TAG_CFR_OPTION_BOOL:
+		opt->default_value = cfr_cpu_to_le32(value);
+		cfr_update_form_checksums(srv->blob.data, offset);
+		break;
+	case LB_TAG_CFR_OPTION_VARCHAR: {
+		const uint32_t str = find_child(&srv->blob, offset, LB_TAG_CFR_VARCHAR_DEF_VALUE);
+		replace_varchar(&srv->blob, str, pair->val, pair->val_len);
+		cfr_update_form_checksums(srv->blob.data, str);
+		rebuild_index(srv);
+		break;
+	}
+	default:
+		break;
+	}
+}
+
+/*
+ * Applies all pairs of the form, or none of them: every pair is checked
+ * before the first one changes the blob, so that a rejected request
+ * leaves the blob as it was.
+ */
+static const char *apply_form(struct server *srv, char *body, size_t len)
+{
+	char *const end = body + len;
+	size_t num_pairs = 1;
+	for (const char *amp = body; (amp = memchr(amp, '&', end - amp)); amp++) {
+		num_pairs++;
+	}
+
+	struct form_pair *pairs = malloc(num_pairs * sizeof(*pairs));
+	if (!pairs) {
+		fprintf(stderr, "Could not allocate %zu form pairs\n", num_pairs);
+		exit(-1);
+	}
+
+	size_t count = 0;
+	while (body < end) {
+		char *pair_end = memchr(body, '&', end - body);
+		if (!pair_end) {
+			pair_end = end;
+		}
+		char *eq = memchr(body, '=', pair_end - body);
+		if (eq) {
+			pairs[count++] = (struct form_pair) {
+				.name		= body,
+				.name_len	= url_decode(body, eq - body),
+				.val		= eq + 1,
+				.val_len	= url_decode(eq + 1, pair_end - eq - 1),
+			};
+		}
+		body = pair_end + 1;
+	}
+
+	const char *error = NULL;
+	for (size_t i = 0; i < count && !error; i++) {
+		uint32_t value;
+		error = check_value(srv, &pairs[i], &value);
+	}
+	if (!error && count) {
+		for (size_t i = 0; i < count; i++) {
+			apply_value(srv, &pairs[i]);
+		}
+		update_checksum(&srv->blob);
+		srv->page_valid = false;
+	}
+
+	free(pairs);
+	return error;
+}
+
+/* Pages that fail to render are not kept, so the next request tries again */
+static int render_page(struct server *srv)
+{
+	if (srv->page_valid) {
+		return 0;
+	}
+	srv->page.len = 0;
+	srv->page.depth = 0;
+	srv->page.error = false;
+	if (cfr_html_render(&srv->page, srv->blob.data)) {
+		return -1;
+	}
+	srv->page_valid = true;
+	return 0;
+}
+
+/*
+ * HTTP
+ */
+
+/* Like find_bytes(), which is not available in strict ISO C mode */
+static char *find_bytes(const char *haystack, size_t len, const char *needle, size_t needle_len)
+{
+	while (len >= needle_len) {
+		const char *p = memchr(haystack, needle[0], len - needle_len + 1);
+		if (!p) {
+			return NULL;
+		}
+		if (!memcmp(p, needle, needle_len)) {
+			return (char *)p;
+		}
+		len -= p + 1 - haystack;
+		haystack = p + 1;
+	}
+	return NULL;
+}
+
+static void conn_append(struct conn *c, const void *data, size_t len)
+{
+	if (c->out_cap - c->out_len < len) {
+		size_t cap = c->out_cap ? c->out_cap : 4096;
+		while (cap - c->out_len < len) {
+			cap *= 2;
+		}
+		c->out = realloc(c->out, cap);
+		if (!c->out) {
+			fprintf(stderr, "Could not allocate %zu bytes of output\n", cap);
+			exit(-1);
+		}
+		c->out_cap = cap;
+	}
+	memcpy(c->out + c->out_len, data, len);
+	c->out_len += len;
+}
+
+static void respond(struct conn *c, const char *status, const char *type,
+		    const char *extra_headers, const void *body, size_t len)
+{
+	char header[512];
+	const int header_len = snprintf(header, sizeof(header),
+		"HTTP/1.1 %s\r\n"
+		"Content-Type: %s\r\n"
+		"Content-Length: %zu\r\n"
+		"%s"
+		"%s"
+		"\r\n",
+		status, type, len, extra_headers,
+		c->close_after_write ? "Connection: close\r\n" : "");
+
+	assert(header_len > 0 && (size_t)header_len < sizeof(header));
+	conn_append(c, header, header_len);
+	conn_append(c, body, len);
+}
+
+static void respond_text(struct conn *c, const char *status, const char *text)
+{
+	respond(c, status, "text/plain", "", text, strlen(text));
+}
+
+static void respond_blob(struct conn *c, const struct server *srv)
+{
+	respond(c, "200 OK", "application/octet-stream",
+		"Content-Disposition: attachment; filename=\"cfr.bin\"\r\n",
+		srv->blob.data, srv->blob.len);
+}
+
+static bool header_name_eq(const char *line, size_t len, const char *name)
+{
+	const size_t name_len = strlen(name);
+	if (len < name_len + 1 || line[name_len] != ':') {
+		return false;
+	}
+	for (size_t i = 0; i < name_len; i++) {
+		char ch = line[i];
+		if (ch >= 'A' && ch <= 'Z') {
+			ch += 'a' - 'A';
+		}
+		if (ch != name[i]) {
+			return false;
+		}
+	}
+	return true;
+}
+
+static const char *header_value(const char *line, size_t len, size_t *value_len)
+{
+	const char *value = (const char *)memchr(line, ':', len) + 1;
+	const char *end = line + len;
+	while (value < end && (*value == ' ' || *value == '\t')) {
+		value++;
+	}
+	*value_len = end - value;
+	return value;
+}
+
+/* Serves `form-<object ID>.html`, as fetched by pages rendered with fragments */
+static void respond_form(struct conn *c, struct server *srv, const char *name)
+{
+	const char *suffix = strchr(name, '.');
+	uint32_t object_id;
+	if (!suffix || strcmp(suffix, ".html") || !parse_u32(name, suffix - name, &object_id)) {
+		respond_text(c, "404 Not Found", "Not found\n");
+		return;
+	}
+
+	struct html_out frag = { .fd = -1 };
+	if (!cfr_find_form(srv->blob.data, object_id)) {
+		respond_text(c, "404 Not Found", "No such form\n");
+	} else if (cfr_html_render_form(&frag, srv->blob.data, object_id)) {
+		respond_text(c, "500 Internal Server Error", "Form is corrupt\n");
+	} else {
+		respond(c, "200 OK", "text/html; charset=utf-8", "", frag.data, frag.len);
+	}
+	free(frag.data);
+}
+
+static void handle_request(struct server *srv, struct conn *c, const char *method,
+			   const char *path, char *body, size_t body_len)
+{
+	if (!strcmp(method, "GET") || !strcmp(method, "HEAD")) {
+		/* Earlier pipelined responses may still be waiting in the buffer */
+		const size_t start = c->out_len;
+		if (!strcmp(path, "/") || !strcmp(path, "/index.html")) {
+			if (render_page(srv)) {
+				respond_text(c, "500 Internal Server Error", "Could not render page\n");
+			} else {
+				respond(c, "200 OK", "text/html; charset=utf-8", "",
+					srv->page.data, srv->page.len);
+			}
+		} else if (!strcmp(path, "/cfr.bin")) {
+			respond_blob(c, srv);
+		} else if (!strncmp(path, "/form-", 6)) {
+			respond_form(c, srv, path + 6);
+		} else if (!strcmp(path, "/style.css") && srv->style) {
+			respond(c, "200 OK", "text/css", "", srv->style, srv->style_len);
+		} else {
+			respond_text(c, "404 Not Found", "Not found\n");
+		}
+		if (!strcmp(method, "HEAD")) {
+			/* Drop the body, keep the headers */
+			char *hdr_end = find_bytes(c->out + start, c->out_len - start,
+					       "\r\n\r\n", 4);
+			c->out_len = hdr_end + 4 - c->out;
+		}
+		return;
+	}
+
+	if (!strcmp(method, "POST")) {
+		if (strcmp(path, "/apply")) {
+			respond_text(c, "404 Not Found", "Not found\n");
+			return;
+		}
+		const char *error = apply_form(srv, body, body_len);
+		if (error) {
+			respond_text(c, "400 Bad Request", error);
+			return;
+		}
+		respond_blob(c, srv);
+		return;
+	}
+
+	respond_text(c, "405 Method Not Allowed", "Method not allowed\n");
+}
+
+/* Returns the number of bytes consumed, 0 if the request is incomplete, -1 on errors */
+static ssize_t parse_request(struct server *srv, struct conn *c)
+{
+	char *const start = c->in;
+	char *const hdr_end = find_bytes(start, c->in_len, "\r\n\r\n", 4);
+	if (hdr_end ? hdr_end + 4 - start > MAX_REQUEST_SIZE : c->in_len >= MAX_REQUEST_SIZE) {
+		c->close_after_write = true;
+		respond_text(c, "431 Request Header Fields Too Large", "Request too large\n");
+		return -1;
+	}
+	if (!hdr_end) {
+		return 0;
+	}
+
+	/* Request line */
+	char *line_end = find_bytes(start, hdr_end + 2 - start, "\r\n", 2);
+	*line_end = '\0';
+	char *method = start;
+	char *path = strchr(method, ' ');
+	char *version = path ? strchr(path + 1, ' ') : NULL;
+	if (!version) {
+		c->close_after_write = true;
+		respond_text(c, "400 Bad Request", "Malformed request line\n");
+		return -1;
+	}
+	*path++ = '\0';
+	*version++ = '\0';
+	char *query = strchr(path, '?');
+	if (query) {
+		*query = '\0';
+	}
+
+	bool keep_alive = !strcmp(version, "HTTP/1.1");
+	size_t body_len = 0;
+
+	for (char *line = line_end + 2; line < hdr_end + 2;) {
+		char *next = find_bytes(line, hdr_end + 2 - line, "\r\n", 2);
+		const size_t len = next - line;
+		size_t value_len;
+
+		if (header_name_eq(line, len, "content-length")) {
+			const char *value = header_value(line, len, &value_len);
+			uint32_t parsed;
+			if (!parse_u32(value, value_len, &parsed) || parsed > MAX_BODY_SIZE) {
+				c->close_after_write = true;
+				respond_text(c, "413 Content Too Large", "Invalid body length\n");
+				return -1;
+			}
+			body_len = parsed;
+		} else if (header_name_eq(line, len, "connection")) {
+			const char *value = header_value(line, len, &value_len);
+			if (value_len == 5 && !strncasecmp(value, "close", 5)) {
+				keep_alive = false;
+			} else if (value_len == 10 && !strncasecmp(value, "keep-alive", 10)) {
+				keep_alive = true;
+			}
+		}
+		line = next + 2;
+	}
+
+	const size_t header_size = hdr_end + 4 - start;
+	if (c->in_len - header_size < body_len) {
+		/* Wait for the rest of the body, the request line gets parsed again */
+		*line_end = '\r';
+		path[-1] = ' ';
+		version[-1] = ' ';
+		if (query) {
+			*query = '?';
+		}
+		return 0;
+	}
+
+	c->close_after_write = !keep_alive;
+	handle_request(srv, c, method, path, hdr_end + 4, body_len);
+	return header_size + body_len;
+}
+
+static void conn_free(int epfd, struct conn *c)
+{
+	epoll_ctl(epfd, EPOLL_CTL_DEL, c->fd, NULL);
+	close(c->fd);
+	free(c->in);
+	free(c->out);
+	free(c);
+}
+
+/* Returns false if the connection was closed */
+static bool conn_flush(int epfd, struct conn *c)
+{
+	while (c->out_off < c->out_len) {
+		const ssize_t ret = send(c->fd, c->out + c->out_off, c->out_len - c->out_off,
+					 MSG_NOSIGNAL);
+		if (ret < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			if (errno == EAGAIN || errno == EWOULDBLOCK) {
+				struct epoll_event ev = {
+					.events = EPOLLIN | EPOLLOUT,
+					.data.ptr = c,
+				};
+				epoll_ctl(epfd, EPOLL_CTL_MOD, c->fd, &ev);
+				return true;
+			}
+			conn_free(epfd, c);
+			return false;
+		}
+		c->out_off += ret;
+	}
+
+	c->out_off = 0;
+	c->out_len = 0;
+	if (c->close_after_write) {
+		conn_free(epfd, c);
+		return false;
+	}
+
+	struct epoll_event ev = { .events = EPOLLIN, .data.ptr = c };
+	epoll_ctl(epfd, EPOLL_CTL_MOD, c->fd, &ev);
+	return true;
+}
+
+static void conn_readable(struct server *srv, int epfd, struct conn *c)
+{
+	/* At most one request of the largest size is buffered, the rest waits in the socket */
+	while (c->in_len < MAX_INPUT_SIZE) {
+		if (c->in_cap - c->in_len < 4096 && c->in_cap < MAX_INPUT_SIZE) {
+			c->in_cap = c->in_cap ? c->in_cap * 2 : 8192;
+			if (c->in_cap > MAX_INPUT_SIZE) {
+				c->in_cap = MAX_INPUT_SIZE;
+			}
+			c->in = realloc(c->in, c->in_cap);
+			if (!c->in) {
+				fprintf(stderr, "Could not allocate %zu bytes of input\n", c->in_cap);
+				exit(-1);
+			}
+		}
+		const ssize_t ret = recv(c->fd, c->in + c->in_len, c->in_cap - c->in_len, 0);
+		if (ret < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			if (errno == EAGAIN || errno == EWOULDBLOCK) {
+				break;
+			}
+			conn_free(epfd, c);
+			return;
+		}
+		if (ret == 0) {
+			conn_free(epfd, c);
+			return;
+		}
+		c->in_len += ret;
+	}
+
+	/* Handle every complete request, pipelined requests are answered in order */
+	while (!c->close_after_write) {
+		const ssize_t used = parse_request(srv, c);
+		if (used <= 0) {
+			break;
+		}
+		memmove(c->in, c->in + used, c->in_len - used);
+		c->in_len -= used;
+	}
+
+	if (c->out_len) {
+		conn_flush(epfd, c);
+	}
+}
+
+static int set_nonblocking(int fd)
+{
+	const int flags = fcntl(fd, F_GETFL);
+	return flags < 0 ? -1 : fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+}
+
+static void accept_all(int epfd, int listen_fd)
+{
+	for (;;) {
+		const int fd = accept(listen_fd, NULL, NULL);
+		if (fd < 0) {
+			if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+				perror("Could not accept connection");
+			}
+			return;
+		}
+		struct conn *c = calloc(1, sizeof(*c));
+		if (!c || set_nonblocking(fd)) {
+			close(fd);
+			free(c);
+			continue;
+		}
+		c->fd = fd;
+		struct epoll_event ev = { .events = EPOLLIN, .data.ptr = c };
+		if (epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev)) {
+			perror("Could not watch connection");
+			close(fd);
+			free(c);
+		}
+	}
+}
+
+static int listen_on(uint16_t port)
+{
+	const int fd = socket(AF_INET, SOCK_STREAM, 0);
+	if (fd < 0) {
+		perror("Could not create socket");
+		return -1;
+	}
+
+	const int one = 1;
+	setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+	const struct sockaddr_in addr = {
+		.sin_family	= AF_INET,
+		.sin_port	= htons(port),
+		.sin_addr	= { .s_addr = htonl(INADDR_LOOPBACK) },
+	};
+	if (bind(fd, (const struct sockaddr *)&addr, sizeof(addr))) {
+		perror("Could not bind to localhost");
+		close(fd);
+		return -1;
+	}
+	if (listen(fd, SOMAXCONN) || set_nonblocking(fd)) {
+		perror("Could not listen");
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+static int serve(struct server *srv, uint16_t port)
+{
+	const int listen_fd = listen_on(port);
+	if (listen_fd < 0) {
+		return -1;
+	}
+
+	const int epfd = epoll_create1(0);
+	if (epfd < 0) {
+		perror("Could not create epoll instance");
+		close(listen_fd);
+		return -1;
+	}
+
+	/* The listening socket is the only one without a connection */
+	struct epoll_event ev = { .events = EPOLLIN, .data.ptr = NULL };
+	epoll_ctl(epfd, EPOLL_CTL_ADD, listen_fd, &ev);
+
+	printf("Serving on http://127.0.0.1:%u/\n", port);
+	fflush(stdout);
+
+	struct epoll_event events[MAX_EVENTS];
+	for (;;) {
+		const int num = epoll_wait(epfd, events, MAX_EVENTS, -1);
+		if (num < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			perror("Could not wait for events");
+			break;
+		}
+		for (int i = 0; i < num; i++) {
+			struct conn *c = events[i].data.ptr;
+			if (!c) {
+				accept_all(epfd, listen_fd);
+			} else if (events[i].events & (EPOLLERR | EPOLLHUP)) {
+				conn_free(epfd, c);
+			} else if (events[i].events & EPOLLOUT) {
+				conn_flush(epfd, c);
+			} else {
+				conn_readable(srv, epfd, c);
+			}
+		}
+	}
+
+	close(epfd);
+	close(listen_fd);
+	return -1;
+}
+
+static int read_style(struct server *srv, const char *filename, bool required)
+{
+	FILE *stream = fopen(filename, "rb");
+	if (!stream) {
+		if (required) {
+			perror("Could not open style sheet");
+			return -1;
+		}
+		return 0;
+	}
+
+	char chunk[4096];
+	size_t len;
+	while ((len = fread(chunk, 1, sizeof(chunk), stream)) > 0) {
+		srv->style = realloc(srv->style, srv->style_len + len);
+		if (!srv->style) {
+			fprintf(stderr, "Could not allocate style sheet\n");
+			fclose(stream);
+			return -1;
+		}
+		memcpy(srv->style + srv->style_len, chunk, len);
+		srv->style_len += len;
+	}
+	fclose(stream);
+	return 0;
+}
+
+static void usage(void)
+{
+	fprintf(stderr, "Usage: cfr_serve [--port N] [--style <file>] <input file>\n");
+}
+
+int main(int argc, char **argv)
+{
+	static const struct option long_options[] = {
+		{ "port",  required_argument, NULL, 'p' },
+		{ "style", required_argument, NULL, 's' },
+		{ 0 },
+	};
+
+	unsigned long port = 8080;
+	const char *style = NULL;
+
+	int opt;
+	while ((opt = getopt_long(argc, argv, "p:s:", long_options, NULL)) != -1) {
+		switch (opt) {
+		case 'p':
+			port = strtoul(optarg, NULL, 0);
+			if (port == 0 || port > UINT16_MAX) {
+				usage();
+				return -1;
+			}
+			break;
+		case 's':
+			style = optarg;
+			break;
+		default:
+			usage();
+			return -1;
+		}
+	}
+
+	if (argc - optind != 1) {
+		usage();
+		return -1;
+	}
+
+	struct server srv = {
+		.page = {
+			.fd		= -1,
+			.form_action	= "/apply",
+		},
+	};
+
+	if (cfr_read_file(&srv.blob.data, argv[optind])) {
+		free(srv.blob.data);
+		return -1;
+	}
+	srv.blob.len = cfr_le32_to_cpu(((struct lb_cfr *)srv.blob.data)->size);
+	if (!cfr_html_blob_ok(srv.blob.data, srv.blob.len)) {
+		fprintf(stderr, "'%s' is not a valid CFR blob\n", argv[optind]);
+		free(srv.blob.data);
+		return -1;
+	}
+
+	if (read_style(&srv, style ? style : "style.css", style != NULL)) {
+		free(srv.blob.data);
+		return -1;
+	}
+
+	rebuild_index(&srv);
+
+	const int ret = serve(&srv, port);
+
+	free(srv.options);
+	free(srv.page.data);
+	free(srv.style);
+	free(srv.blob.data);
+	return ret;
+}
@@ -0,0 +1,269 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+
+/* For mkstemp() */
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "cfr_store.h"
+
+static void usage(void)
+{
+	fprintf(stderr, "Usage: cfr_store [--no-background] <store file> get <object id>\n");
+	fprintf(stderr, "       cfr_store [--no-background] <store file> set <object id> <value>\n");
+	fprintf(stderr, "       cfr_store [--no-background] <store file> set-string <object id> <string>\n");
+	fprintf(stderr, "       cfr_store [--no-background] <store file> delete <object id>\n");
+	fprintf(stderr, "       cfr_store [--no-background] <store file> dump\n");
+	fprintf(stderr, "       cfr_store [--no-background] <store file> compact\n");
+	fprintf(stderr, "       cfr_store [--no-background] <store file> bench [updates] [options]\n");
+}
+
+static void print_value(uint32_t object_id, const struct cfr_value *value, void *arg)
+{
+	if (value->type == CFR_VALUE_U32) {
+		printf("%u: %u (0x%08x)\n", object_id, value->u32, value->u32);
+	} else {
+		printf("%u: \"%s\"\n", object_id, value->str);
+	}
+}
+
+static bool parse_u32(const char *str, uint32_t *value)
+{
+	char *end;
+	const unsigned long parsed = strtoul(str, &end, 0);
+	if (!*str || *end || parsed > UINT32_MAX) {
+		fprintf(stderr, "'%s' is not a valid number\n", str);
+		return false;
+	}
+	*value = parsed;
+	return true;
+}
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+	timespec_get(&ts, TIME_UTC);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+	const uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+	return (x > y) - (x < y);
+}
+
+static void print_latency(const char *what, uint64_t *samples, size_t count)
+{
+	uint64_t total = 0;
+	for (size_t i = 0; i < count; i++) {
+		total += samples[i];
+	}
+	qsort(samples, count, sizeof(*samples), cmp_u64);
+
+	printf("%-4s avg %6" PRIu64 " ns  p50 %6" PRIu64 " ns  p99 %6" PRIu64 " ns  max %8" PRIu64 " ns\n",
+	       what, total / count, samples[count / 2], samples[count * 99 / 100], samples[count - 1]);
+}
+
+/*
+ * Updates random options the way a setup menu would, with one in eight
+ * of them being strings, and measures how long single gets and sets take.
+ */
+static int bench(struct cfr_store *store, size_t updates, uint32_t num_options)
+{
+	uint64_t *set_ns = malloc(updates * sizeof(*set_ns));
+	uint64_t *get_ns = malloc(updates * sizeof(*get_ns));
+	if (!set_ns || !get_ns) {
+		fprintf(stderr, "Could not allocate latency samples\n");
+		free(set_ns);
+		free(get_ns);
+		return -1;
+	}
+
+	uint32_t seed = 0x12345678;
+	char str[64];
+	int ret = 0;
+
+	for (size_t i = 0; i < updates && !ret; i++) {
+		seed = seed * 1103515245 + 12345;
+		const uint32_t object_id = 1 + (seed >> 8) % num_options;
+
+		const uint64_t start = now_ns();
+		if (object_id % 8 == 0) {
+			const int len = snprintf(str, sizeof(str), "Value number %zu", i);
+			ret = cfr_store_set_string(store, object_id, str, len);
+		} else {
+			ret = cfr_store_set_u32(store, object_id, seed);
+		}
+		set_ns[i] = now_ns() - start;
+	}
+
+	for (size_t i = 0; i < updates && !ret; i++) {
+		seed = seed * 1103515245 + 12345;
+		const uint32_t object_id = 1 + (seed >> 8) % num_options;
+
+		struct cfr_value value;
+		const uint64_t start = now_ns();
+		cfr_store_get(store, object_id, &value);
+		get_ns[i] = now_ns() - start;
+	}
+
+	if (!ret) {
+		ret = cfr_store_sync(store);
+	}
+
+	if (!ret) {
+		struct cfr_store_stats stats;
+		cfr_store_get_stats(store, &stats);
+
+		print_latency("set", set_ns, updates);
+		print_latency("get", get_ns, updates);
+		printf("values %" PRIu64 ", live %" PRIu64 " bytes, log %" PRIu64 " bytes\n",
+		       stats.num_values, stats.live_bytes, stats.log_bytes);
+		printf("appended %" PRIu64 " bytes, compacted %" PRIu64 " bytes in %" PRIu64 " compactions\n",
+		       stats.appended_bytes, stats.compacted_bytes, stats.compactions);
+		printf("write amplification %.2f\n",
+		       (double)(stats.appended_bytes + stats.compacted_bytes) / stats.appended_bytes);
+	}
+
+	free(set_ns);
+	free(get_ns);
+	return ret;
+}
+
+int main(int argc, char **argv)
+{
+	static const struct option long_options[] = {
+		{ "no-background", no_argument, NULL, 'n' },
+		{ 0 },
+	};
+
+	struct cfr_store_config config = CFR_STORE_DEFAULT_CONFIG;
+
+	int opt;
+	while ((opt = getopt_long(argc, argv, "n", long_options, NULL)) != -1) {
+		switch (opt) {
+		case 'n':
+			config.background = false;
+			break;
+		default:
+			usage();
+			return -1;
+		}
+	}
+
+	const int num_args = argc - optind;
+	if (num_args < 2) {
+		usage();
+		return -1;
+	}
+
+	const char *command = argv[optind + 1];
+	char **args = &argv[optind + 2];
+	const int num_cmd_args = num_args - 2;
+	uint32_t object_id = 0, value = 0;
+
+	if (!strcmp(command, "get") || !strcmp(command, "delete")) {
+		if (num_cmd_args != 1 || !parse_u32(args[0], &object_id)) {
+			usage();
+			return -1;
+		}
+	} else if (!strcmp(command, "set")) {
+		if (num_cmd_args != 2 || !parse_u32(args[0], &object_id) ||
+		    !parse_u32(args[1], &value)) {
+			usage();
+			return -1;
+		}
+	} else if (!strcmp(command, "set-string")) {
+		if (num_cmd_args != 2 || !parse_u32(args[0], &object_id)) {
+			usage();
+			return -1;
+		}
+	} else if (!strcmp(command, "bench")) {
+		if (num_cmd_args > 2) {
+			usage();
+			return -1;
+		}
+	} else if (strcmp(command, "dump") && strcmp(command, "compact")) {
+		usage();
+		return -1;
+	}
+	config.read_only = !strcmp(command, "get") || !strcmp(command, "dump");
+
+	/* The benchmark gets a store of its own next to the given one, which is left alone */
+	const char *path = argv[optind];
+	char *bench_path = NULL;
+	if (!strcmp(command, "bench")) {
+		const size_t size = strlen(path) + sizeof(".bench.XXXXXX");
+		bench_path = malloc(size);
+		if (!bench_path) {
+			fprintf(stderr, "Could not allocate the benchmark path\n");
+			return -1;
+		}
+		snprintf(bench_path, size, "%s.bench.XXXXXX", path);
+		const int fd = mkstemp(bench_path);
+		if (fd < 0) {
+			fprintf(stderr, "Could not create '%s': %s\n", bench_path, strerror(errno));
+			free(bench_path);
+			return -1;
+		}
+		close(fd);
+		path = bench_path;
+	}
+
+	struct cfr_store *store = cfr_store_open(path, &config);
+	if (!store) {
+		if (bench_path) {
+			unlink(bench_path);
+			free(bench_path);
+		}
+		return -1;
+	}
+
+	int ret = 0;
+	if (!strcmp(command, "get")) {
+		struct cfr_value result;
+		if (cfr_store_get(store, object_id, &result)) {
+			fprintf(stderr, "No value for object ID %u\n", object_id);
+			ret = 1;
+		} else {
+			print_value(object_id, &result, NULL);
+		}
+	} else if (!strcmp(command, "set")) {
+		ret = cfr_store_set_u32(store, object_id, value);
+	} else if (!strcmp(command, "set-string")) {
+		ret = cfr_store_set_string(store, object_id, args[1], strlen(args[1]));
+	} else if (!strcmp(command, "delete")) {
+		ret = cfr_store_delete(store, object_id);
+	} else if (!strcmp(command, "dump")) {
+		cfr_store_foreach(store, print_value, NULL);
+	} else if (!strcmp(command, "compact")) {
+		ret = cfr_store_compact(store);
+	} else {
+		const size_t updates = num_cmd_args > 0 ? strtoul(args[0], NULL, 0) : 1000000;
+		const uint32_t num_options = num_cmd_args > 1 ? strtoul(args[1], NULL, 0) : 2000;
+		if (!updates || !num_options) {
+			usage();
+			ret = -1;
+		} else {
+			ret = bench(store, updates, num_options);
+		}
+	}
+
+	if (cfr_store_close(store)) {
+		ret = -1;
+	}
+	if (bench_path) {
+		unlink(bench_path);
+		free(bench_path);
+	}
+	return ret;
+}
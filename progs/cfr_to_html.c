@@ -1,617 +1,440 @@
 /* SPDX-License-Identifier: GPL-2.0-only */
 
-#include <assert.h>
-#include <inttypes.h>
+/* For clock_gettime(), mkstemp(), fchmod() and strndup() */
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include "cfr.h"
+#include "cfr_file.h"
+#include "cfr_html.h"
 
-static FILE *ostream = NULL;
-
-static int depth = 0;
-
-static void print_tabs(FILE *stream)
-{
-	for (int i = 0; i < depth; i++) {
-		fprintf(stream, "\t");
-	}
-}
-
-#define LOG_HEX "0x%x"
-#define LOG_H32 "0x%08x"
-#define LOG_NUM "%u"
-#define LOG_STR "%s"
-#define LOG_SQU "'%s'"
-
-#define hprintf(stream, ...) \
-	do { print_tabs(stream); fprintf(stream, ##__VA_ARGS__); } while (0)
-
-#define hprintln(stream, ...) \
-	do { hprintf(stream, ##__VA_ARGS__); fprintf(stream, "\n"); } while (0)
-
-static void hpropval(FILE *stream, const char *fmt, const char *prop, uint32_t val)
-{
-	static char buf[200] = {0};
-
-	/* This can blow up if fmt does not have exactly one format specifier */
-	snprintf(buf, sizeof(buf),
-		"<input type='text' name='%%s' value='%s' readonly>", fmt);
+/*
+ * Rendered documents are cached under a name derived from the root record
+ * checksum, the blob size and the options affecting the output. Bump the
+ * version whenever the generated HTML changes, to invalidate old entries.
+ */
+#define HTML_CACHE_VERSION	1
 
-	hprintln(stream, "<label>%s", prop);
-	depth++;
-	hprintln(stream, buf, prop, val);
-	depth--;
-	hprintln(stream, "</label>");
-}
+#define HTML_CACHE_OPT_MINIFY	(1 << 0)
 
-static bool _tag_neq(const struct lb_record *rec, uint32_t tag, const char *f)
+/* Returns NULL if the path cannot be allocated */
+static char *cache_path(const char *cache_dir, const struct lb_cfr *root,
+			const struct html_out *out, const char *suffix)
 {
-	if (rec->tag != tag && tag != LB_TAG_CFR_VARCHAR_UI_HELPTEXT) {
-		fprintf(stderr, "%s: expected tag 0x%x but ", f, tag);
-		fprintf(stderr, "got tag 0x%x instead\n", rec->tag);
+	const uint32_t opts = out->minify ? HTML_CACHE_OPT_MINIFY : 0;
+	const uint32_t checksum = cfr_le32_to_cpu(root->checksum);
+	const uint32_t size = cfr_le32_to_cpu(root->size);
+
+	const char *fmt = "%s/cfr-v%u-%08x-%u-%x.html%s";
+	const int len = snprintf(NULL, 0, fmt, cache_dir, HTML_CACHE_VERSION,
+				 checksum, size, opts, suffix);
+	char *path = malloc(len + 1);
+	if (!path) {
+		fprintf(stderr, "Could not allocate %d bytes for cache path\n", len + 1);
+		return NULL;
 	}
-	return rec->tag != tag;
+	snprintf(path, len + 1, fmt, cache_dir, HTML_CACHE_VERSION,
+		 checksum, size, opts, suffix);
+	return path;
 }
 
-#define tag_mismatch(_rec, _tag) _tag_neq((const struct lb_record *)(_rec), (_tag), __func__)
-
-static void _tag_ok(const struct lb_record *rec, uint32_t tag, const char *f)
+/* Returns 1 if there is no cache entry at `path` */
+static int serve_cached(int fd, const char *path)
 {
-	if (rec->tag != tag) {
-		fprintf(stderr, "%s: expected tag 0x%x but ", f, tag);
-		fprintf(stderr, "got tag 0x%x instead, bailing\n", rec->tag);
-		exit(-1);
-	}
-}
-
-#define ensure_tag_ok(_rec, _tag) _tag_ok((const struct lb_record *)(_rec), (_tag), __func__)
-
-static const char *print_flags(uint32_t flags)
-{
-	/* This is only accurate from a visual standpoint. It won't work properly. */
-	const struct {
-		uint32_t flag;
-		const char *text;
-	} flags_to_text[] = {
-		{ CFR_OPTFLAG_READONLY, " readonly" },
-		{ CFR_OPTFLAG_GRAYOUT,  " disabled" },
-		{ CFR_OPTFLAG_SUPPRESS, " hidden"   },
-		{ CFR_OPTFLAG_VOLATILE, ""          },
-	};
-
-	static char buffer[300] = {0};
-	memset(buffer, 0, sizeof(buffer));
-
-	for (unsigned int i = 0; i < ARRAY_SIZE(flags_to_text); i++) {
-		if ((flags & flags_to_text[i].flag) == 0) {
-			continue;
+	const int cache_fd = open(path, O_RDONLY);
+	if (cache_fd < 0) {
+		if (errno == ENOENT) {
+			return 1;
 		}
-		strcat(buffer, flags_to_text[i].text);
+		fprintf(stderr, "Could not open '%s': %s\n", path, strerror(errno));
+		return -1;
 	}
-	return buffer;
-}
 
-static uint32_t read_cfr_varchar(char **out, char *current, uint32_t tag)
-{
-	struct lb_cfr_varbinary *cfr_str = (struct lb_cfr_varbinary *)current;
-
-	if (tag_mismatch(cfr_str, tag)) {
-		if (tag == LB_TAG_CFR_VARCHAR_UI_HELPTEXT) {
-			*out = strdup("");
-			if (!*out) {
-				fprintf(stderr, "Could not 'strdup(\"\")'\n");
-				exit(-1);
-			}
-			return 0;
+	int ret = -1;
+	struct stat st;
+	if (fstat(cache_fd, &st)) {
+		perror("Could not stat cache entry");
+	} else if (st.st_size == 0) {
+		ret = 0;
+	} else {
+		void *data = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, cache_fd, 0);
+		if (data == MAP_FAILED) {
+			perror("Could not map cache entry");
+		} else {
+			ret = cfr_write_all(fd, data, st.st_size);
+			munmap(data, st.st_size);
 		}
-		fprintf(stderr, "Could not find required varchar with tag 0x%x\n", tag);
-		exit(-1);
-	}
-
-	*out = malloc(cfr_str->data_length);
-	if (!*out) {
-		fprintf(stderr, "Could not allocate %u bytes for CFR string '%s'\n",
-			cfr_str->data_length, cfr_str->data);
-		exit(-1);
 	}
-	snprintf(*out, cfr_str->data_length, "%s", cfr_str->data);
-
-	assert(strlen(*out) + 1 == cfr_str->data_length);
-	assert(cfr_str->size > cfr_str->data_length);
-	return cfr_str->size;
-}
 
-char *fixme;
-
-static uint32_t sm_read_string_default_value(char **out, char *current)
-{
-	return read_cfr_varchar(out, current, LB_TAG_CFR_VARCHAR_DEF_VALUE);
+	close(cache_fd);
+	return ret;
 }
 
-static uint32_t sm_read_opt_name(char **out, char *current)
+/* The buffer holds exactly the root record */
+static int render_buffer(struct html_out *out, char *buffer)
 {
-	return read_cfr_varchar(out, current, LB_TAG_CFR_VARCHAR_OPT_NAME);
+	const int ret = cfr_html_render_blob(out, buffer,
+					     cfr_le32_to_cpu(((struct lb_cfr *)buffer)->size));
+	free(out->data);
+	out->data = NULL;
+	return ret;
 }
 
-static uint32_t sm_read_ui_name(char **out, char *current)
+static int render(struct html_out *out, const char *input)
 {
-	return read_cfr_varchar(out, current, LB_TAG_CFR_VARCHAR_UI_NAME);
-}
+	char *buffer = NULL;
+	if (cfr_read_file(&buffer, input)) {
+		free(buffer);
+		return -1;
+	}
 
-static uint32_t sm_read_ui_helptext(char **out, char *current)
-{
-	return read_cfr_varchar(out, current, LB_TAG_CFR_VARCHAR_UI_HELPTEXT);
+	const int ret = render_buffer(out, buffer);
+	free(buffer);
+	return ret;
 }
 
-static uint32_t sm_read_enum_value(char *current, uint32_t default_value)
+/*
+ * Cache entries are rendered into a temporary file which is then renamed
+ * into place, so concurrent invocations never see a partial document.
+ *
+ * The key is only as good as the root checksum, so the whole blob is read
+ * and checked against it first. A blob that does not match its checksum
+ * would share the entry of the blob it was changed from, so it is rendered
+ * without the cache.
+ */
+static int render_cached(struct html_out *out, const char *input, const char *cache_dir)
 {
-	struct lb_cfr_enum_value *enum_val = (struct lb_cfr_enum_value *)current;
-	char *const limit = current + enum_val->size;
-
-	ensure_tag_ok(enum_val, LB_TAG_CFR_ENUM_VALUE);
-
-	char *ui_name = NULL;
-
-	current += sizeof(*enum_val);
-	current += sm_read_ui_name(&ui_name, current);
-	assert(ui_name);
-
-	const char *selected = (enum_val->value == default_value) ? " selected" : "";
-
-	hprintln(ostream, "<option value='%u'%s>%s</option>",
-		enum_val->value, selected, ui_name);
+	char *buffer = NULL;
+	if (cfr_read_file(&buffer, input)) {
+		free(buffer);
+		return -1;
+	}
+	const struct lb_cfr *root = (const struct lb_cfr *)buffer;
+	if (!cfr_root_checksum_ok(buffer)) {
+		fprintf(stderr, "'%s' does not match its checksum, not caching it\n", input);
+		const int ret = render_buffer(out, buffer);
+		free(buffer);
+		return ret;
+	}
 
-	assert(current == limit);
-	return enum_val->size;
-}
+	char *path = cache_path(cache_dir, root, out, "");
+	if (!path) {
+		free(buffer);
+		return -1;
+	}
+	int ret = serve_cached(out->fd, path);
+	if (ret <= 0) {
+		free(path);
+		free(buffer);
+		return ret;
+	}
 
-static uint32_t sm_read_opt_enum(char *current)
-{
-	struct lb_cfr_numeric_option *option = (struct lb_cfr_numeric_option *)current;
-	char *const limit = current + option->size;
-
-	char *opt_name = NULL;
-	char *ui_name = NULL;
-	char *ui_helptext = NULL;
-
-	ensure_tag_ok(option, LB_TAG_CFR_OPTION_ENUM);
-
-	current += sizeof(*option);
-	current += sm_read_opt_name(&opt_name, current);
-	current += sm_read_ui_name(&ui_name, current);
-	current += sm_read_ui_helptext(&ui_helptext, current);
-	assert(opt_name);
-	assert(ui_name);
-	assert(ui_helptext);
-
-	hprintln(ostream, "<td class='ui-name'>");
-	depth++;
-	hprintln(ostream, "<label for='object-%u'>%s</label>", option->object_id, ui_name);
-	depth--;
-	hprintln(ostream, "</td>");
-	hprintln(ostream, "<td class='ui-input'>");
-	depth++;
-	hprintln(ostream, "<select id='object-%u' name='%s'%s>",
-		option->object_id, opt_name, print_flags(option->flags));
-	depth++;
-	while (current < limit) {
-		current += sm_read_enum_value(current, option->default_value);
-	}
-	depth--;
-	hprintln(ostream, "</select>");
-	depth--;
-	hprintln(ostream, "</td>");
-	hprintln(ostream, "<td>");
-	depth++;
-	hprintln(ostream, "<span>%s</span>", ui_helptext);
-	depth--;
-	hprintln(ostream, "</td>");
-
-	assert(current == limit);
-	return option->size;
-}
+	char *tmp_path = cache_path(cache_dir, root, out, ".XXXXXX");
+	if (!tmp_path) {
+		free(path);
+		free(buffer);
+		return -1;
+	}
+	struct html_out tmp_out = *out;
+	tmp_out.fd = mkstemp(tmp_path);
+	if (tmp_out.fd < 0) {
+		fprintf(stderr, "Could not create '%s': %s\n", tmp_path, strerror(errno));
+		free(tmp_path);
+		free(path);
+		free(buffer);
+		return -1;
+	}
 
-static uint32_t sm_read_opt_number(char *current)
-{
-	struct lb_cfr_numeric_option *option = (struct lb_cfr_numeric_option *)current;
-	char *const limit = current + option->size;
-
-	char *opt_name = NULL;
-	char *ui_name = NULL;
-	char *ui_helptext = NULL;
-
-	ensure_tag_ok(option, LB_TAG_CFR_OPTION_NUMBER);
-
-	current += sizeof(*option);
-	current += sm_read_opt_name(&opt_name, current);
-	current += sm_read_ui_name(&ui_name, current);
-	current += sm_read_ui_helptext(&ui_helptext, current);
-	assert(opt_name);
-	assert(ui_name);
-	assert(ui_helptext);
-
-	hprintln(ostream, "<td class='ui-name'>");
-	depth++;
-	hprintln(ostream, "<label for='object-%u'>%s</label>", option->object_id, ui_name);
-	depth--;
-	hprintln(ostream, "</td>");
-	hprintln(ostream, "<td class='ui-input'>");
-	depth++;
-	hprintln(ostream, "<input type='number' id='object-%u' name='%s' value='%u'%s>",
-		option->object_id, opt_name, option->default_value, print_flags(option->flags));
-	depth--;
-	hprintln(ostream, "</td>");
-	hprintln(ostream, "<td>");
-	depth++;
-	hprintln(ostream, "<span>%s</span>", ui_helptext);
-	depth--;
-	hprintln(ostream, "</td>");
-
-	assert(current == limit);
-	return option->size;
-}
+	/* mkstemp() only lets the owner read the file, entries are for everyone */
+	if (fchmod(tmp_out.fd, 0644)) {
+		perror("Could not make cache entry readable");
+		ret = -1;
+	} else {
+		ret = render_buffer(&tmp_out, buffer);
+	}
+	if (close(tmp_out.fd)) {
+		ret = -1;
+	}
+	free(buffer);
 
-static uint32_t sm_read_opt_bool(char *current)
-{
-	struct lb_cfr_numeric_option *option = (struct lb_cfr_numeric_option *)current;
-	char *const limit = current + option->size;
-
-	char *opt_name = NULL;
-	char *ui_name = NULL;
-	char *ui_helptext = NULL;
-
-	ensure_tag_ok(option, LB_TAG_CFR_OPTION_BOOL);
-
-	current += sizeof(*option);
-	current += sm_read_opt_name(&opt_name, current);
-	current += sm_read_ui_name(&ui_name, current);
-	current += sm_read_ui_helptext(&ui_helptext, current);
-	assert(opt_name);
-	assert(ui_name);
-	assert(ui_helptext);
-
-	const char *checked = option->default_value ? " checked" : "";
-
-	hprintln(ostream, "<td class='ui-name'>");
-	depth++;
-	hprintln(ostream, "<label for='object-%u'>%s</label>", option->object_id, ui_name);
-	depth--;
-	hprintln(ostream, "</td>");
-	hprintln(ostream, "<td class='ui-input'>");
-	depth++;
-	hprintln(ostream, "<input type='checkbox' id='object-%u' name='%s'%s%s>",
-		option->object_id, opt_name, checked, print_flags(option->flags));
-	depth--;
-	hprintln(ostream, "</td>");
-	hprintln(ostream, "<td>");
-	depth++;
-	hprintln(ostream, "<span>%s</span>", ui_helptext);
-	depth--;
-	hprintln(ostream, "</td>");
-
-	assert(current == limit);
-	return option->size;
-}
+	if (!ret && rename(tmp_path, path)) {
+		fprintf(stderr, "Could not rename '%s': %s\n", tmp_path, strerror(errno));
+		ret = -1;
+	}
+	if (ret) {
+		unlink(tmp_path);
+	} else {
+		ret = serve_cached(out->fd, path) ? -1 : 0;
+	}
 
-static uint32_t sm_read_opt_varchar(char *current)
-{
-	struct lb_cfr_varchar_option *option = (struct lb_cfr_varchar_option *)current;
-	char *const limit = current + option->size;
-
-	char *opt_name = NULL;
-	char *ui_name = NULL;
-	char *ui_helptext = NULL;
-	char *default_value = NULL;
-
-	ensure_tag_ok(option, LB_TAG_CFR_OPTION_VARCHAR);
-
-	current += sizeof(*option);
-	current += sm_read_string_default_value(&default_value, current);
-	current += sm_read_opt_name(&opt_name, current);
-	current += sm_read_ui_name(&ui_name, current);
-	current += sm_read_ui_helptext(&ui_helptext, current);
-	assert(opt_name);
-	assert(ui_name);
-	assert(ui_helptext);
-	assert(default_value);
-
-	hprintln(ostream, "<td class='ui-name'>");
-	depth++;
-	hprintln(ostream, "<label for='object-%u'>%s</label>", option->object_id, ui_name);
-	depth--;
-	hprintln(ostream, "</td>");
-	hprintln(ostream, "<td class='ui-input'>");
-	depth++;
-	hprintln(ostream, "<input type='text' id='object-%u' name='%s' value='%s'%s>",
-		option->object_id, opt_name, default_value, print_flags(option->flags));
-	depth--;
-	hprintln(ostream, "</td>");
-	hprintln(ostream, "<td>");
-	depth++;
-	hprintln(ostream, "<span>%s</span>", ui_helptext);
-	depth--;
-	hprintln(ostream, "</td>");
-
-	assert(current == limit);
-	return option->size;
+	free(tmp_path);
+	free(path);
+	return ret;
 }
 
-static uint32_t sm_read_opt_comment(char *current)
+static double now_ms(void)
 {
-	struct lb_cfr_option_comment *comment = (struct lb_cfr_option_comment *)current;
-	char *const limit = current + comment->size;
-
-	char *ui_name = NULL;
-	char *ui_helptext = NULL;
-
-	ensure_tag_ok(comment, LB_TAG_CFR_OPTION_COMMENT);
-
-	current += sizeof(*comment);
-	current += sm_read_ui_name(&ui_name, current);
-	current += sm_read_ui_helptext(&ui_helptext, current);
-	assert(ui_name);
-	assert(ui_helptext);
-
-	hprintln(ostream, "<td class='ui-name' colspan='2'>");
-	depth++;
-	hprintln(ostream, "<span id='object-%u'%s>%s</span>",
-		comment->object_id, print_flags(comment->flags), ui_name);
-	depth--;
-	hprintln(ostream, "</td>");
-	hprintln(ostream, "<td>");
-	depth++;
-	hprintln(ostream, "<span>%s</span>", ui_helptext);
-	depth--;
-	hprintln(ostream, "</td>");
-
-	assert(current == limit);
-	return comment->size;
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
 }
 
-static uint32_t sm_read_object(char *current);
-
-static uint32_t sm_read_form(char *current)
+/*
+ * Renders `input` into a temporary file next to `output`, which is then
+ * renamed over it. Only forms that changed since the last call are
+ * rendered again, the others are spliced in from `cache`.
+ */
+static int render_watched(struct html_out *out, const char *input, const char *output,
+			  struct cfr_html_cache *cache)
 {
-	struct lb_cfr_option_form *form = (struct lb_cfr_option_form *)current;
-	char *const limit = current + form->size;
-
-	char *ui_name = NULL;
+	const double start = now_ms();
 
-	ensure_tag_ok(form, LB_TAG_CFR_OPTION_FORM);
-
-	current += sizeof(*form);
-	current += sm_read_ui_name(&ui_name, current);
-	assert(ui_name);
-
-	/* TODO: Decide what to do here */
-	hprintln(ostream, "<div id='object-%u'%s>",
-		form->object_id, print_flags(form->flags));
-	depth++;
-	hprintln(ostream, "<table>");
-	depth++;
-
-	while (current < limit) {
-		current += sm_read_object(current);
+	char *buffer = NULL;
+	if (cfr_read_file(&buffer, input)) {
+		free(buffer);
+		return -1;
 	}
-
-	depth--;
-	hprintln(ostream, "</table>");
-	depth--;
-	hprintln(ostream, "</div>");
-
-	assert(current == limit);
-	return form->size;
-}
-
-static uint32_t sm_read_form_tab(char *current, unsigned int tab_idx)
-{
-	struct lb_cfr_option_form *form = (struct lb_cfr_option_form *)current;
-	char *const limit = current + form->size;
-
-	char *ui_name = NULL;
-
-	ensure_tag_ok(form, LB_TAG_CFR_OPTION_FORM);
-
-	current += sizeof(*form);
-	current += sm_read_ui_name(&ui_name, current);
-	assert(ui_name);
-
-	hprintln(ostream, "<div class='tab' id='object-%u'%s>",
-		form->object_id, print_flags(form->flags));
-	depth++;
-	hprintln(ostream, "<input type='radio' id='tab-%u' name='tab-group'%s>",
-		form->object_id, tab_idx == 1 ? " checked" : "");
-	hprintln(ostream, "<label class='tab-label' for='tab-%u'>%s</label>",
-		form->object_id, ui_name);
-	hprintln(ostream, "<div class='tab-content'>");
-	depth++;
-	hprintln(ostream, "<table>");
-	depth++;
-
-	while (current < limit) {
-		current += sm_read_object(current);
-	}
-
-	depth--;
-	hprintln(ostream, "</table>");
-	depth--;
-	hprintln(ostream, "</div>");
-	depth--;
-	hprintln(ostream, "</div>");
-
-	assert(current == limit);
-	return form->size;
-}
-
-static uint32_t _sm_read_object(char *current)
-{
-	struct lb_record *rec = (struct lb_record *)current;
-
-	switch (rec->tag) {
-	case LB_TAG_CFR_OPTION_ENUM:
-		return sm_read_opt_enum(current);
-	case LB_TAG_CFR_OPTION_NUMBER:
-		return sm_read_opt_number(current);
-	case LB_TAG_CFR_OPTION_BOOL:
-		return sm_read_opt_bool(current);
-	case LB_TAG_CFR_OPTION_VARCHAR:
-		return sm_read_opt_varchar(current);
-	case LB_TAG_CFR_OPTION_COMMENT:
-		return sm_read_opt_comment(current);
-	case LB_TAG_CFR_OPTION_FORM:
-		return sm_read_form(current);
-	default:
-		return rec->size;
+	if (!cfr_html_blob_ok(buffer, cfr_le32_to_cpu(((struct lb_cfr *)buffer)->size))) {
+		fprintf(stderr, "'%s' is not a valid CFR blob\n", input);
+		free(buffer);
+		return -1;
 	}
-}
-
-static uint32_t sm_read_object(char *current)
-{
-	hprintln(ostream, "<tr>");
-	depth++;
-	const uint32_t ret = _sm_read_object(current);
-	depth--;
-	hprintln(ostream, "</tr>");
-	return ret;
-}
 
-static void sm_read_cfr(char *current)
-{
-	assert(ostream);
-
-	struct lb_cfr *cfr_root = (struct lb_cfr *)current;
-	char *const limit = current + cfr_root->size;
-
-	ensure_tag_ok(cfr_root, LB_TAG_CFR);
-
-	hprintln(ostream, "<!DOCTYPE html>");
-	hprintln(ostream, "<html>");
-	depth++;
-	hprintln(ostream, "<head>");
-	depth++;
-	hprintln(ostream, "<link rel='stylesheet' href='style.css'>");
-	depth--;
-	hprintln(ostream, "</head>");
-	hprintln(ostream, "<body>");
-	depth++;
-	hpropval(ostream, LOG_H32, "checksum", cfr_root->checksum);
-
-	current += sizeof(*cfr_root);
-
-	hprintln(ostream, "<div class='tabs'>");
-	depth++;
-	unsigned int tab_idx = 0;
-	while (current < limit) {
-		current += sm_read_form_tab(current, ++tab_idx);
+	const char *fmt = "%s.tmp.%ld";
+	const int len = snprintf(NULL, 0, fmt, output, (long)getpid());
+	char *tmp_path = malloc(len + 1);
+	if (!tmp_path) {
+		fprintf(stderr, "Could not allocate %d bytes for output path\n", len + 1);
+		free(buffer);
+		return -1;
 	}
-	depth--;
-	hprintln(ostream, "</div>");
-
-	assert(current == limit);
-
-	depth--;
-	hprintln(ostream, "</body>");
-	depth--;
-	hprintln(ostream, "</html>");
-
-	//printf("length:  %ld\n", (long int)(current - (char *)cfr_root));
-	//printf("size:    %u\n", cfr_root->size);
+	snprintf(tmp_path, len + 1, fmt, output, (long)getpid());
 
-	//printf("depth:   %d\n", depth);
-}
-
-static int alloc_and_read(char **buffer, uint32_t length, struct lb_record *rec, FILE *stream)
-{
-	rewind(stream);
-
-	*buffer = malloc(length);
-	if (!*buffer) {
-		fprintf(stderr, "Could not allocate %u bytes\n", length);
+	struct html_out tmp_out = *out;
+	tmp_out.fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (tmp_out.fd < 0) {
+		fprintf(stderr, "Could not create '%s': %s\n", tmp_path, strerror(errno));
+		free(tmp_path);
+		free(buffer);
 		return -1;
 	}
 
-	const size_t read_size = fread(*buffer, sizeof((*buffer)[0]), length, stream);
+	const size_t num_rendered = cfr_html_render_cached(&tmp_out, buffer, cache);
+	html_flush(&tmp_out);
+	free(tmp_out.data);
+	free(buffer);
 
-	if (read_size == length) {
-		return 0;
+	int ret = tmp_out.error ? -1 : 0;
+	if (close(tmp_out.fd)) {
+		ret = -1;
 	}
-
-	if (feof(stream)) {
-		fprintf(stderr, "Unexpected end of file while reading data\n");
-	} else if (ferror(stream)) {
-		perror("Error reading data");
+	if (!ret && rename(tmp_path, output)) {
+		fprintf(stderr, "Could not rename '%s': %s\n", tmp_path, strerror(errno));
+		ret = -1;
+	}
+	if (ret) {
+		unlink(tmp_path);
 	} else {
-		fprintf(stderr, "Unknown error reading data\n");
+		fprintf(stderr, "Updated '%s': rendered %zu of %zu forms in %.1f ms\n", output,
+			num_rendered, cache->num_forms, now_ms() - start);
 	}
-
-	return -1;
+	free(tmp_path);
+	return ret;
 }
 
-static int read_from_file(char **buffer, const char *filename)
+/*
+ * The directory is watched rather than the input itself, so that inputs
+ * which get replaced by a rename are followed as well. Errors while
+ * rendering, for example of a blob that is still being written, are
+ * reported and the previous output is left in place. Watching ends when
+ * the input is deleted or moved away.
+ */
+static int watch(struct html_out *out, const char *input, const char *output)
 {
-	FILE *stream = fopen(filename, "rb");
-	if (!stream) {
-		perror("Could not open input file");
+	const char *slash = strrchr(input, '/');
+	const char *name = slash ? slash + 1 : input;
+	char *dir = slash ? strndup(input, slash - input + 1) : strdup(".");
+	if (!dir) {
+		fprintf(stderr, "Could not allocate input directory name\n");
 		return -1;
 	}
 
-	int ret = -1;
-
-	struct lb_record record = {0};
-	const size_t header_size = fread(&record, sizeof(record), 1, stream);
+	const int fd = inotify_init1(IN_CLOEXEC);
+	if (fd < 0) {
+		perror("Could not initialize inotify");
+		free(dir);
+		return -1;
+	}
+	if (inotify_add_watch(fd, dir, IN_CLOSE_WRITE | IN_MOVED_TO | IN_DELETE | IN_MOVED_FROM) < 0) {
+		fprintf(stderr, "Could not watch '%s': %s\n", dir, strerror(errno));
+		close(fd);
+		free(dir);
+		return -1;
+	}
+	free(dir);
+
+	struct cfr_html_cache cache = { 0 };
+	render_watched(out, input, output, &cache);
+
+	/* Large enough for at least one event with a name of NAME_MAX bytes */
+	_Alignas(struct inotify_event) char events[64 * 1024];
+	int ret = 1;
+	while (ret > 0) {
+		const ssize_t len = read(fd, events, sizeof(events));
+		if (len < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			perror("Could not read inotify events");
+			ret = -1;
+			break;
+		}
 
-	if (header_size == 1) {
-		if (record.tag == LB_TAG_CFR) {
-			ret = alloc_and_read(buffer, record.size, &record, stream);
-		} else {
-			fprintf(stderr, "Root record tag 0x%x is not a CFR root\n", record.tag);
+		/* Only the last event counts, the input may be replaced right after removing it */
+		bool changed = false;
+		for (const char *p = events; p < events + len;) {
+			const struct inotify_event *event = (const struct inotify_event *)p;
+			if (event->len && !strcmp(event->name, name)) {
+				changed = event->mask & (IN_CLOSE_WRITE | IN_MOVED_TO);
+				ret = changed || access(input, F_OK) == 0;
+			}
+			p += sizeof(*event) + event->len;
 		}
-	} else {
-		if (feof(stream)) {
-			fprintf(stderr, "Unexpected end of file while reading record\n");
-		} else if (ferror(stream)) {
-			perror("Error reading record");
-		} else {
-			fprintf(stderr, "Unknown error reading record\n");
+		if (changed) {
+			render_watched(out, input, output, &cache);
 		}
 	}
 
-	fclose(stream);
+	cfr_html_cache_free(&cache);
+	close(fd);
 	return ret;
 }
 
+static void usage(void)
+{
+	fprintf(stderr, "Usage: cfr_to_html [--minify] [--jobs N] [--cache <dir>] <input file> [output file]\n");
+	fprintf(stderr, "       cfr_to_html [--minify] [--jobs N] --split <output dir> <input file>\n");
+	fprintf(stderr, "       cfr_to_html [--minify] [--jobs N] --watch <input file> <output file>\n");
+	fprintf(stderr, "With --watch, the output is updated whenever the input changes, until\n");
+	fprintf(stderr, "the input is removed.\n");
+}
+
 int main(int argc, char **argv)
 {
-	if (argc != 2 && argc != 3) {
-		fprintf(stderr, "Usage: cfr_to_html <input file> [output file]\n");
-		return -1;
+	static const struct option long_options[] = {
+		{ "minify", no_argument,       NULL, 'm' },
+		{ "split",  required_argument, NULL, 's' },
+		{ "jobs",   required_argument, NULL, 'j' },
+		{ "cache",  required_argument, NULL, 'c' },
+		{ "watch",  no_argument,       NULL, 'w' },
+		{ 0 },
+	};
+
+	const long num_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+	struct html_out out = {
+		.fd	= STDOUT_FILENO,
+		.jobs	= num_cpus > 0 ? num_cpus : 1,
+	};
+	const char *cache_dir = NULL;
+	bool watch_input = false;
+
+	int opt;
+	while ((opt = getopt_long(argc, argv, "ms:j:c:w", long_options, NULL)) != -1) {
+		switch (opt) {
+		case 'm':
+			out.minify = true;
+			break;
+		case 's':
+			out.fragment_dir = optarg;
+			break;
+		case 'j':
+			out.jobs = strtoul(optarg, NULL, 0);
+			if (!out.jobs) {
+				usage();
+				return -1;
+			}
+			break;
+		case 'c':
+			cache_dir = optarg;
+			break;
+		case 'w':
+			watch_input = true;
+			break;
+		default:
+			usage();
+			return -1;
+		}
 	}
 
-	char *buffer = NULL;
-	if (read_from_file(&buffer, argv[1])) {
-		free(buffer);
+	const int num_args = argc - optind;
+	if (num_args != 1 && (num_args != 2 || out.fragment_dir)) {
+		usage();
+		return -1;
+	}
+	if (cache_dir && out.fragment_dir) {
+		fprintf(stderr, "Paginated output cannot be cached\n");
 		return -1;
 	}
 
-	if (argc == 3) {
-		ostream = fopen(argv[2], "w");
-		if (!ostream) {
+	if (watch_input) {
+		if (num_args != 2 || cache_dir || out.fragment_dir) {
+			usage();
+			return -1;
+		}
+		return watch(&out, argv[optind], argv[optind + 1]);
+	}
+
+	const char *output = num_args == 2 ? argv[optind + 1] : NULL;
+	char *index_path = NULL;
+
+	if (out.fragment_dir) {
+		if (mkdir(out.fragment_dir, 0755) && errno != EEXIST) {
+			perror("Could not create output directory");
+			return -1;
+		}
+		const size_t path_size = strlen(out.fragment_dir) + sizeof("/index.html");
+		index_path = malloc(path_size);
+		if (!index_path) {
+			fprintf(stderr, "Could not allocate %zu bytes\n", path_size);
+			return -1;
+		}
+		snprintf(index_path, path_size, "%s/index.html", out.fragment_dir);
+		output = index_path;
+	}
+
+	if (output) {
+		out.fd = open(output, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+		if (out.fd < 0) {
 			perror("Could not open output file");
-			free(buffer);
+			free(index_path);
 			return -1;
 		}
+	}
+
+	int ret;
+	if (cache_dir) {
+		ret = render_cached(&out, argv[optind], cache_dir);
 	} else {
-		ostream = stdout;
+		ret = render(&out, argv[optind]);
 	}
 
-	sm_read_cfr(buffer);
-	free(buffer);
-	if (argc == 3) {
-		fclose(ostream);
+	if (output) {
+		close(out.fd);
 	}
-	return 0;
+	free(index_path);
+	return ret;
 }
@@ -0,0 +1,149 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+
+#include <getopt.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cfr.h"
+#include "cfr_file.h"
+#include "cfr_store.h"
+#include "cfr_values.h"
+
+static const char *source_name(enum cfr_value_source source)
+{
+	switch (source) {
+	case CFR_SOURCE_DEFAULT:
+		return "default";
+	case CFR_SOURCE_STORE:
+		return "stored";
+	case CFR_SOURCE_REJECTED:
+		return "rejected";
+	default:
+		return "unknown";
+	}
+}
+
+static void print_value(const struct cfr_value *value)
+{
+	if (value->type == CFR_VALUE_STRING) {
+		printf("\"%.*s\"", (int)value->len, value->str);
+	} else {
+		printf("%u", value->u32);
+	}
+}
+
+static void print_option(const struct cfr_effective_value *option)
+{
+	printf("%u %.*s = ", option->object_id, (int)option->opt_name_len, option->opt_name);
+	print_value(&option->value);
+	printf(" (%s", source_name(option->source));
+	if (!cfr_value_is_default(option)) {
+		printf(", default ");
+		print_value(&option->default_value);
+	}
+	printf(")\n");
+}
+
+/* Options can be given by object ID or by name */
+static const struct cfr_effective_value *lookup(const struct cfr_values *values,
+						const char *key)
+{
+	char *end;
+	const unsigned long object_id = strtoul(key, &end, 0);
+	if (*key && !*end && object_id <= UINT32_MAX) {
+		return cfr_values_by_id(values, object_id);
+	}
+	return cfr_values_by_name(values, key, strlen(key));
+}
+
+static void usage(void)
+{
+	fprintf(stderr, "Usage: cfr_values [--store <store file>] [--non-default] <input file> [option...]\n");
+}
+
+int main(int argc, char **argv)
+{
+	static const struct option long_options[] = {
+		{ "store",       required_argument, NULL, 's' },
+		{ "non-default", no_argument,       NULL, 'n' },
+		{ 0 },
+	};
+
+	const char *store_path = NULL;
+	bool non_default = false;
+
+	int opt;
+	while ((opt = getopt_long(argc, argv, "s:n", long_options, NULL)) != -1) {
+		switch (opt) {
+		case 's':
+			store_path = optarg;
+			break;
+		case 'n':
+			non_default = true;
+			break;
+		default:
+			usage();
+			return -1;
+		}
+	}
+
+	if (optind >= argc) {
+		usage();
+		return -1;
+	}
+
+	char *blob;
+	if (cfr_read_file(&blob, argv[optind])) {
+		return -1;
+	}
+
+	/* Only looking, so a store that is in use is not disturbed */
+	struct cfr_store_config config = CFR_STORE_DEFAULT_CONFIG;
+	config.read_only = true;
+	struct cfr_store *store = NULL;
+	if (store_path) {
+		store = cfr_store_open(store_path, &config);
+		if (!store) {
+			free(blob);
+			return -1;
+		}
+	}
+
+	int ret = 0;
+	struct cfr_values *values = cfr_values_resolve(blob, store);
+	if (!values) {
+		ret = -1;
+	} else if (optind + 1 < argc) {
+		for (int i = optind + 1; i < argc; i++) {
+			const struct cfr_effective_value *option = lookup(values, argv[i]);
+			if (!option) {
+				fprintf(stderr, "No option '%s'\n", argv[i]);
+				ret = 1;
+				continue;
+			}
+			print_option(option);
+		}
+	} else {
+		for (size_t i = 0; i < values->num_options; i++) {
+			const struct cfr_effective_value *option = &values->options[i];
+			if (!non_default || !cfr_value_is_default(option)) {
+				print_option(option);
+			}
+		}
+	}
+
+	if (values && values->num_rejected) {
+		fprintf(stderr, "%zu stored values are not legal and were ignored\n",
+			values->num_rejected);
+	}
+
+	cfr_values_free(values);
+	if (store) {
+		cfr_store_close(store);
+	}
+	free(blob);
+	return ret;
+}
@@ -1,6 +1,7 @@
 /* SPDX-License-Identifier: GPL-2.0-only */
 
 #include <assert.h>
+#include <getopt.h>
 #include <inttypes.h>
 #include <stdbool.h>
 #include <stdint.h>
@@ -9,6 +10,10 @@
 #include <string.h>
 
 #include "cfr.h"
+#include "cfr_ids.h"
+#include "cfr_lint.h"
+#include "cfr_lz.h"
+#include "cfr_v2.h"
 
 /* TODO: This may need to be global, or removed if auto-generating the data */
 static uint32_t atlas_get_object_id(void)
@@ -25,7 +30,8 @@ static uint32_t atlas_get_object_id(void)
  * into code at build time may be the way to go. Maybe expand SCONFIG
  * so that these can be devicetree options?
  */
-static void lb_board(struct lb_header *header)
+static void lb_board(struct lb_header *header, enum cfr_form_directory_mode form_directory,
+		     bool form_checksums)
 {
 	const bool rt_perf = false;
 	const bool pf_ok = true;
@@ -119,22 +125,22 @@ static void lb_board(struct lb_header *header)
 	};
 
 #define NUM_PCIE_SSC_SETTINGS	20
-	struct sm_enum_value pch_pm_pcie_pll_ssc_values[] = {
-		[NUM_PCIE_SSC_SETTINGS] = { "Auto", 0xff },
+	/* 0.0% to 1.9% in steps of 0.1% */
+	const struct sm_enum_range pch_pm_pcie_pll_ssc_ranges[] = {
+		{ "%v%%", 0, NUM_PCIE_SSC_SETTINGS, 1, 1 },
+		SM_ENUM_RANGE_END,
+	};
+	const struct sm_enum_value pch_pm_pcie_pll_ssc_values[] = {
+		{ "Auto", 0xff },
 		SM_ENUM_VALUE_END,
 	};
-	for (unsigned int i = 0; i < NUM_PCIE_SSC_SETTINGS; i++) {
-		char buffer[16];
-		snprintf(buffer, sizeof(buffer), "%u.%u%%", i / 10, i % 10);
-		pch_pm_pcie_pll_ssc_values[i].ui_name = strdup(buffer);
-		pch_pm_pcie_pll_ssc_values[i].value = i;
-	}
 	const struct sm_obj_enum pch_pcie_pll_ssc = {
 		.object_id	= atlas_get_object_id(),
 		.opt_name	= "pch_pcie_pll_ssc",
 		.ui_name	= "PCH PCIe PLL Spread Spectrum Clocking",
 		/* No help text */
 		.default_value	= 0xff,
+		.ranges		= pch_pm_pcie_pll_ssc_ranges,
 		.values		= pch_pm_pcie_pll_ssc_values,
 	};
 
@@ -257,6 +263,8 @@ static void lb_board(struct lb_header *header)
 	const struct setup_menu_root sm_root = {
 		.form_list	= root_contents,
 		.num_forms	= ARRAY_SIZE(root_contents),
+		.form_directory	= form_directory,
+		.form_checksums	= form_checksums,
 	};
 
 	cfr_write_setup_menu(header, &sm_root);
@@ -298,25 +306,145 @@ static int dump_formatted(FILE *stream, const char *data, size_t length)
 static size_t cfr_size(const char *buffer)
 {
 	const struct lb_record *rec = (const struct lb_record *)buffer;
-	assert(rec->tag == LB_TAG_CFR);
-	return rec->size;
+	assert(cfr_le32_to_cpu(rec->tag) == LB_TAG_CFR);
+	return cfr_le32_to_cpu(rec->size);
+}
+
+/* The map is only read if there is one, and only written back once the blob is */
+static int assign_stable_ids(char *buffer, const char *id_map_file, struct cfr_id_map **map)
+{
+	if (id_map_file) {
+		*map = cfr_id_map_new();
+		if (!*map || cfr_id_map_load(*map, id_map_file)) {
+			return -1;
+		}
+	}
+	return cfr_assign_stable_ids(buffer, *map);
+}
+
+static void usage(void)
+{
+	fprintf(stderr, "Usage: cfr_write [--compact] [--compress[=level]] "
+			"[--form-directory[=all]] [--form-checksums] "
+			"[--stable-ids[=map file]] [output file]\n");
+	fprintf(stderr, "Stable IDs are derived from the names of options, see cfr_ids.h.\n");
 }
 
 int main(int argc, char **argv)
 {
 	static __attribute__((aligned(4))) char buffer[32 * 1024] = {0};
 
-	if (argc > 2) {
-		fprintf(stderr, "Usage: cfr_write [output file]\n");
+	static const struct option long_options[] = {
+		{ "compact",  no_argument,       NULL, 'c' },
+		{ "compress", optional_argument, NULL, 'z' },
+		{ "form-directory", optional_argument, NULL, 'd' },
+		{ "form-checksums", no_argument,       NULL, 's' },
+		{ "stable-ids",     optional_argument, NULL, 'i' },
+		{ 0 },
+	};
+
+	bool compact = false;
+	int compress_level = 0;
+	enum cfr_form_directory_mode form_directory = CFR_FORM_DIRECTORY_NONE;
+	bool form_checksums = false;
+	bool stable_ids = false;
+	const char *id_map_file = NULL;
+
+	int opt;
+	while ((opt = getopt_long(argc, argv, "cz::d::si::", long_options, NULL)) != -1) {
+		switch (opt) {
+		case 'c':
+			compact = true;
+			break;
+		case 'z':
+			compress_level = optarg ? atoi(optarg) : CFR_LZ_LEVEL_MAX;
+			break;
+		case 'd':
+			if (!optarg) {
+				form_directory = CFR_FORM_DIRECTORY_TOP_LEVEL;
+			} else if (!strcmp(optarg, "all")) {
+				form_directory = CFR_FORM_DIRECTORY_ALL;
+			} else {
+				usage();
+				return -1;
+			}
+			break;
+		case 's':
+			form_checksums = true;
+			break;
+		case 'i':
+			stable_ids = true;
+			id_map_file = optarg;
+			break;
+		default:
+			usage();
+			return -1;
+		}
+	}
+
+	if (argc - optind > 1) {
+		usage();
 		return -1;
 	}
 
 	struct lb_header header = { .buffer = buffer };
-	lb_board(&header);
+	lb_board(&header, form_directory, form_checksums);
 
-	if (argc == 2) {
-		return save_to_file(argv[1], buffer, cfr_size(buffer));
+	struct cfr_id_map *map = NULL;
+	if (stable_ids && assign_stable_ids(buffer, id_map_file, &map)) {
+		cfr_id_map_free(map);
+		return -1;
+	}
+
+	const unsigned int violations = cfr_lint(stderr, buffer, cfr_size(buffer));
+	if (violations) {
+		fprintf(stderr, "Not writing a blob with %u lint violations\n", violations);
+		cfr_id_map_free(map);
+		return -1;
+	}
+
+	/* Only now that all IDs are final, the checksum is too */
+	const struct lb_cfr *root = (const struct lb_cfr *)buffer;
+	printf("CFR: Written %u bytes of CFR structures at %p, with CRC32 0x%08x\n",
+	       cfr_le32_to_cpu(root->size), (void *)buffer, cfr_le32_to_cpu(root->checksum));
+
+	const char *data = buffer;
+	size_t length = cfr_size(buffer);
+	char *encoded = NULL;
+
+	if (compact) {
+		if (cfr_v2_encode(buffer, &encoded, &length)) {
+			cfr_id_map_free(map);
+			return -1;
+		}
+		data = encoded;
+	}
+
+	if (compress_level) {
+		char *compressed;
+		if (cfr_lz_compress(data, length, (const struct lb_cfr *)buffer,
+				    compress_level, &compressed, &length)) {
+			free(encoded);
+			cfr_id_map_free(map);
+			return -1;
+		}
+		free(encoded);
+		data = encoded = compressed;
+	}
+
+	int ret;
+	if (argc - optind == 1) {
+		ret = save_to_file(argv[optind], data, length);
 	} else {
-		return dump_formatted(stdout, buffer, cfr_size(buffer));
+		ret = dump_formatted(stdout, data, length);
 	}
+
+	/* The IDs in the map must never refer to a blob that was not written */
+	if (!ret && map) {
+		ret = cfr_id_map_save(map, id_map_file);
+	}
+
+	cfr_id_map_free(map);
+	free(encoded);
+	return ret;
 }
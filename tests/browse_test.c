@@ -0,0 +1,40 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cfr.h"
+#include "test.h"
+
+/* Without a terminal there is nothing to browse with, so blobs are only checked */
+int main(void)
+{
+	const char *path = test_tmp_path("browse.cfr");
+	const char *bad_path = test_tmp_path("bad.cfr");
+	char cmd[512];
+	size_t size;
+	int status;
+
+	char *blob = test_menu(CFR_FORM_DIRECTORY_NONE, false, 0, &size);
+	CHECK(test_write_file(path, blob, size) == 0);
+	snprintf(cmd, sizeof(cmd), "./cfr_browse %s </dev/null 2>&1", path);
+	char *output = test_run(cmd, &status);
+	CHECK(status != 0 && strstr(output, "needs a terminal"));
+	free(output);
+
+	/* Files that are not blobs are refused before the terminal is touched */
+	CHECK(test_write_file(bad_path, "not a blob", strlen("not a blob")) == 0);
+	snprintf(cmd, sizeof(cmd), "./cfr_browse %s </dev/null 2>&1", bad_path);
+	output = test_run(cmd, &status);
+	CHECK(status != 0 && strstr(output, "not a CFR root"));
+	CHECK(!strstr(output, "needs a terminal"));
+	free(output);
+
+	output = test_run("./cfr_browse 2>&1", &status);
+	CHECK(status != 0 && strstr(output, "Usage"));
+	free(output);
+
+	free(blob);
+	return test_done();
+}
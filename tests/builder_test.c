@@ -0,0 +1,205 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cfr.h"
+#include "cfr_builder.h"
+#include "cfr_lint.h"
+#include "test.h"
+
+/* The menu of test_menu(), built at runtime */
+static char *built_menu(enum cfr_form_directory_mode form_directory, bool form_checksums,
+			unsigned int extra, size_t *size)
+{
+	const struct sm_enum_range ranges[] = {
+		{ .label = "%v s", .start = 10, .count = 5, .step = 10, .decimals = 1 },
+		SM_ENUM_RANGE_END,
+	};
+	const struct sm_enum_value values[] = {
+		{ "Power off", 0 },
+		{ "Power on", 1 },
+		SM_ENUM_VALUE_END,
+	};
+	struct cfr_builder *b = cfr_builder_new();
+	uint32_t id = 0;
+	int ret = !b;
+
+	ret = ret || cfr_builder_form_begin(b, ++id, 0, "Main");
+	for (unsigned int i = 0; i < extra; i++) {
+		char name[32];
+		snprintf(name, sizeof(name), "extra_%u", i);
+		ret = ret || cfr_builder_add_bool(b, &(struct sm_obj_bool) {
+			.object_id	= ++id,
+			.opt_name	= name,
+			.ui_name	= name,
+		});
+	}
+	ret = ret || cfr_builder_add_enum(b, &(struct sm_obj_enum) {
+		.object_id	= ++id,
+		.opt_name	= "power_on_after_fail",
+		.ui_name	= "Restore AC power loss",
+		.ui_helptext	= "What to do when power is re-applied",
+		.default_value	= 1,
+		.ranges		= ranges,
+		.values		= values,
+	});
+	ret = ret || cfr_builder_add_enum_value(b, "Previous state", 2);
+	ret = ret || cfr_builder_add_number(b, &(struct sm_obj_number) {
+		.object_id	= ++id,
+		.opt_name	= "boot_delay",
+		.ui_name	= "Boot delay",
+		.default_value	= 3,
+	});
+	ret = ret || cfr_builder_add_bool(b, &(struct sm_obj_bool) {
+		.object_id	= ++id,
+		.opt_name	= "vmx",
+		.ui_name	= "VMX <virtualization>",
+	});
+	ret = ret || cfr_builder_add_varchar(b, &(struct sm_obj_varchar) {
+		.object_id	= ++id,
+		.opt_name	= "serial",
+		.ui_name	= "Serial number",
+		.default_value	= "abc",
+	});
+	ret = ret || cfr_builder_add_comment(b, &(struct sm_obj_comment) {
+		.object_id	= ++id,
+		.ui_name	= "Changes apply after a reboot",
+	});
+	ret = ret || cfr_builder_form_begin(b, ++id, 0, "Power");
+	ret = ret || cfr_builder_add_bool(b, &(struct sm_obj_bool) {
+		.object_id	= ++id,
+		.opt_name	= "s3",
+		.ui_name	= "Suspend to RAM",
+		.default_value	= true,
+	});
+	ret = ret || cfr_builder_form_begin(b, ++id, CFR_OPTFLAG_GRAYOUT, "Deep");
+	ret = ret || cfr_builder_add_number(b, &(struct sm_obj_number) {
+		.object_id	= ++id,
+		.flags		= CFR_OPTFLAG_READONLY,
+		.opt_name	= "deep_limit",
+		.ui_name	= "Limit",
+		.default_value	= 5,
+	});
+	ret = ret || cfr_builder_form_end(b);
+	ret = ret || cfr_builder_form_end(b);
+	ret = ret || cfr_builder_form_end(b);
+	ret = ret || cfr_builder_form_begin(b, ++id, 0, "Board");
+	ret = ret || cfr_builder_add_bool(b, &(struct sm_obj_bool) {
+		.object_id	= ++id,
+		.opt_name	= "led",
+		.ui_name	= "LED",
+	});
+	ret = ret || cfr_builder_form_end(b);
+
+	char *blob = NULL;
+	ret = ret || cfr_builder_finish(b, form_directory, form_checksums, &blob, size);
+	cfr_builder_free(b);
+	CHECK(ret == 0);
+	return blob;
+}
+
+/* The builder writes the same bytes as the const aggregates of test_menu() */
+static void test_same_as_static(void)
+{
+	for (int mode = CFR_FORM_DIRECTORY_NONE; mode <= CFR_FORM_DIRECTORY_ALL; mode++) {
+		for (int checksums = 0; checksums <= 1; checksums++) {
+			for (unsigned int extra = 0; extra <= 2000; extra += 1000) {
+				size_t built_size, static_size;
+				char *built = built_menu(mode, checksums, extra, &built_size);
+				char *expected = test_menu(mode, checksums, extra, &static_size);
+
+				CHECK(built && built_size == static_size);
+				CHECK(built && cfr_le32_to_cpu(((const struct lb_cfr *)built)->size) ==
+					       built_size);
+				CHECK(built && !memcmp(built, expected, static_size < built_size ?
+									static_size : built_size));
+				CHECK(built && cfr_lint(stderr, built, built_size) == 0);
+
+				free(expected);
+				free(built);
+			}
+		}
+	}
+}
+
+static void test_finish_twice(void)
+{
+	struct cfr_builder *b = cfr_builder_new();
+	CHECK(b);
+	CHECK(cfr_builder_form_begin(b, 1, 0, "Main") == 0);
+	CHECK(cfr_builder_add_bool(b, &(struct sm_obj_bool) {
+		.object_id	= 2,
+		.opt_name	= "a",
+		.ui_name	= "A",
+	}) == 0);
+	CHECK(cfr_builder_form_end(b) == 0);
+
+	char *first, *second;
+	size_t first_size, second_size;
+	CHECK(cfr_builder_finish(b, CFR_FORM_DIRECTORY_NONE, false, &first, &first_size) == 0);
+	CHECK(cfr_builder_finish(b, CFR_FORM_DIRECTORY_NONE, false, &second, &second_size) == 0);
+	CHECK(first_size == second_size && !memcmp(first, second, first_size));
+
+	free(second);
+	free(first);
+	cfr_builder_free(b);
+}
+
+static void test_errors(void)
+{
+	struct cfr_builder *b = cfr_builder_new();
+	char *blob;
+	size_t size;
+
+	CHECK(b);
+	const int saved = test_mute(stderr);
+	/* Options must be in a form */
+	CHECK(cfr_builder_add_bool(b, &(struct sm_obj_bool) {
+		.object_id	= 1,
+		.opt_name	= "a",
+		.ui_name	= "A",
+	}) == -1);
+	CHECK(cfr_builder_form_end(b) == -1);
+	CHECK(cfr_builder_add_enum_value(b, "A", 1) == -1);
+
+	/* Ranges must not be too large, or wrap around */
+	const struct sm_enum_range large[] = {
+		{ .label = "%v", .count = CFR_ENUM_RANGE_MAX + 1, .step = 1 },
+		SM_ENUM_RANGE_END,
+	};
+	const struct sm_enum_range wrapping[] = {
+		{ .label = "%v", .start = UINT32_MAX - 1, .count = 3, .step = 1 },
+		SM_ENUM_RANGE_END,
+	};
+	CHECK(cfr_builder_form_begin(b, 1, 0, "Main") == 0);
+	CHECK(cfr_builder_add_enum(b, &(struct sm_obj_enum) {
+		.object_id	= 2,
+		.opt_name	= "e",
+		.ui_name	= "E",
+		.ranges		= large,
+	}) == -1);
+	CHECK(cfr_builder_add_enum(b, &(struct sm_obj_enum) {
+		.object_id	= 2,
+		.opt_name	= "e",
+		.ui_name	= "E",
+		.ranges		= wrapping,
+	}) == -1);
+	CHECK(cfr_builder_form_end(b) == 0);
+
+	/* Forms must be ended before finishing */
+	CHECK(cfr_builder_form_begin(b, 1, 0, "Main") == 0);
+	CHECK(cfr_builder_finish(b, CFR_FORM_DIRECTORY_NONE, false, &blob, &size) == -1);
+	test_unmute(stderr, saved);
+
+	cfr_builder_free(b);
+}
+
+int main(void)
+{
+	test_same_as_static();
+	test_finish_twice();
+	test_errors();
+	return test_done();
+}
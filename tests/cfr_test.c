@@ -0,0 +1,284 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+
+/* For dup() and fileno() */
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "cfr.h"
+#include "cfr_html.h"
+#include "cfr_lint.h"
+#include "test.h"
+
+static uint32_t le32_at(const char *blob, size_t offset)
+{
+	const uint8_t *bytes = (const uint8_t *)blob + offset;
+	return bytes[0] | bytes[1] << 8 | bytes[2] << 16 | (uint32_t)bytes[3] << 24;
+}
+
+static void test_crc32_combine(void)
+{
+	static const char data[] = "The quick brown fox jumps over the lazy dog";
+	const size_t len = strlen(data);
+
+	for (size_t split = 0; split <= len; split++) {
+		const uint32_t crc_a = cfr_crc32(data, split);
+		const uint32_t crc_b = cfr_crc32(data + split, len - split);
+		CHECK(cfr_crc32_combine(crc_a, crc_b, len - split) == cfr_crc32(data, len));
+	}
+}
+
+static void test_enum_values(void)
+{
+	static const struct {
+		uint32_t value;
+		const char *ui_name;
+	} expected[] = {
+		{ 10, "1.0 s" }, { 20, "2.0 s" }, { 30, "3.0 s" }, { 40, "4.0 s" }, { 50, "5.0 s" },
+		{ 0, "Power off" }, { 1, "Power on" }, { 2, "Previous state" },
+	};
+	size_t size;
+	char *blob = test_menu(CFR_FORM_DIRECTORY_NONE, false, 0, &size);
+	const struct lb_cfr_numeric_option *option = (const struct lb_cfr_numeric_option *)
+		(blob + test_find_offset(blob, "power_on_after_fail"));
+	CHECK(cfr_le32_to_cpu(option->tag) == LB_TAG_CFR_OPTION_ENUM);
+
+	struct cfr_enum_iter it;
+	size_t count = 0;
+	for (cfr_enum_iter_init(&it, option); cfr_enum_iter_next(&it); count++) {
+		CHECK(count < ARRAY_SIZE(expected));
+		if (count < ARRAY_SIZE(expected)) {
+			CHECK(it.value == expected[count].value);
+			CHECK(!strcmp(it.ui_name, expected[count].ui_name));
+		}
+	}
+	CHECK(count == ARRAY_SIZE(expected));
+	CHECK(cfr_enum_has_value(option, 2));
+	CHECK(cfr_enum_has_value(option, 30));
+	CHECK(!cfr_enum_has_value(option, 35));
+	CHECK(!cfr_enum_has_value(option, 60));
+
+	free(blob);
+}
+
+/* Blobs are little-endian whatever the host is */
+static void test_little_endian(void)
+{
+	static const uint8_t bytes[] = { 0x78, 0x56, 0x34, 0x12 };
+	uint32_t value;
+	memcpy(&value, bytes, sizeof(value));
+	CHECK(cfr_le32_to_cpu(value) == 0x12345678);
+	CHECK(cfr_cpu_to_le32(cfr_le32_to_cpu(value)) == value);
+
+	size_t size;
+	char *blob = test_menu(CFR_FORM_DIRECTORY_NONE, false, 0, &size);
+	const uint32_t form = sizeof(struct lb_cfr);
+
+	CHECK(le32_at(blob, offsetof(struct lb_cfr, tag)) == LB_TAG_CFR);
+	CHECK(le32_at(blob, offsetof(struct lb_cfr, size)) == size);
+	CHECK(le32_at(blob, form + offsetof(struct lb_cfr_option_form, tag)) ==
+	      LB_TAG_CFR_OPTION_FORM);
+	CHECK(le32_at(blob, form + offsetof(struct lb_cfr_option_form, object_id)) == 1);
+	CHECK(test_checksum_ok(blob));
+
+	/* The checksum is of the bytes as they are stored */
+	struct lb_cfr *root = (struct lb_cfr *)blob;
+	const uint32_t checksum = le32_at(blob, offsetof(struct lb_cfr, checksum));
+	CHECK(cfr_root_checksum_ok(blob));
+	root->checksum = 0;
+	CHECK(cfr_crc32(blob, size) == checksum);
+	CHECK(!cfr_root_checksum_ok(blob));
+	root->checksum = cfr_cpu_to_le32(checksum);
+	blob[size - 1] ^= 1;
+	CHECK(!cfr_root_checksum_ok(blob));
+
+	free(blob);
+}
+
+/* Ranges as the writer stores them, and the labels they expand to */
+static void test_enum_ranges(void)
+{
+	char long_label[CFR_ENUM_LABEL_MAX + 64];
+	char number_label[CFR_ENUM_LABEL_MAX];
+	memset(long_label, 'x', sizeof(long_label) - 3);
+	strcpy(long_label + sizeof(long_label) - 3, "%v");
+	/* Leaves room for the integer part and two of the three decimals */
+	memset(number_label, 'y', CFR_ENUM_LABEL_MAX - 5);
+	strcpy(number_label + CFR_ENUM_LABEL_MAX - 5, "%v");
+
+	const struct sm_enum_range ranges[] = {
+		{ .label = "%v%%", .start = 5, .count = 3, .step = 25, .decimals = 2 },
+		{ .label = "100%% at %v %", .start = 7, .count = 1 },
+		{ .label = long_label, .start = 1, .count = 1 },
+		{ .label = number_label, .start = 1234, .count = 1, .decimals = 3 },
+		{ .label = "%v", .start = UINT32_MAX - 4, .count = 3, .step = 2 },
+		SM_ENUM_RANGE_END,
+	};
+	const struct sm_object object = { .kind = SM_OBJ_ENUM, .sm_enum = {
+		.object_id	= 2,
+		.opt_name	= "e",
+		.ui_name	= "E",
+		.default_value	= 7,
+		.ranges		= ranges,
+	} };
+	const struct sm_obj_form form = {
+		.object_id	= 1,
+		.ui_name	= "Main",
+		.obj_list	= &object,
+		.num_objects	= 1,
+	};
+	const struct setup_menu_root sm_root = { .form_list = &form, .num_forms = 1 };
+
+	char truncated[CFR_ENUM_LABEL_MAX], number[CFR_ENUM_LABEL_MAX];
+	memset(truncated, 'x', CFR_ENUM_LABEL_MAX - 1);
+	truncated[CFR_ENUM_LABEL_MAX - 1] = '\0';
+	memset(number, 'y', CFR_ENUM_LABEL_MAX - 5);
+	strcpy(number + CFR_ENUM_LABEL_MAX - 5, "1.23");
+	const struct {
+		uint32_t value;
+		const char *ui_name;
+	} expected[] = {
+		{ 5, "0.05%" }, { 30, "0.30%" }, { 55, "0.55%" },
+		{ 7, "100% at 7 %" },
+		{ 1, truncated },
+		{ 1234, number },
+		{ UINT32_MAX - 4, "4294967291" }, { UINT32_MAX - 2, "4294967293" },
+		{ UINT32_MAX, "4294967295" },
+	};
+
+	size_t size;
+	char *blob = test_blob(&sm_root, &size);
+	CHECK(cfr_lint(stderr, blob, size) == 0);
+	CHECK(cfr_html_blob_ok(blob, size));
+
+	const struct lb_cfr_numeric_option *option = (const struct lb_cfr_numeric_option *)
+		(blob + test_find_offset(blob, "e"));
+	struct cfr_enum_iter it;
+	size_t count = 0;
+	for (cfr_enum_iter_init(&it, option); cfr_enum_iter_next(&it); count++) {
+		CHECK(count < ARRAY_SIZE(expected));
+		if (count < ARRAY_SIZE(expected)) {
+			CHECK(it.value == expected[count].value);
+			CHECK(!strcmp(it.ui_name, expected[count].ui_name));
+		}
+	}
+	CHECK(count == ARRAY_SIZE(expected));
+	CHECK(strlen(number) == CFR_ENUM_LABEL_MAX - 1);
+
+	/* Ranges must not be too large, or wrap around */
+	CHECK(cfr_enum_range_fits(0, CFR_ENUM_RANGE_MAX, 1));
+	CHECK(!cfr_enum_range_fits(0, CFR_ENUM_RANGE_MAX + 1, 1));
+	CHECK(cfr_enum_range_fits(UINT32_MAX, 1, UINT32_MAX));
+	CHECK(!cfr_enum_range_fits(UINT32_MAX, 2, 1));
+	CHECK(!cfr_enum_range_fits(1, 2, UINT32_MAX));
+	CHECK(cfr_enum_range_fits(UINT32_MAX, CFR_ENUM_RANGE_MAX, 0));
+	CHECK(cfr_enum_range_fits(UINT32_MAX, 0, UINT32_MAX));
+
+	free(blob);
+}
+
+static void test_find_form(void)
+{
+	for (int mode = CFR_FORM_DIRECTORY_NONE; mode <= CFR_FORM_DIRECTORY_ALL; mode++) {
+		size_t size;
+		char *blob = test_menu(mode, true, 0, &size);
+		const uint32_t main_form = cfr_nth_form(blob, 0);
+		const uint32_t board = cfr_nth_form(blob, 1);
+
+		CHECK((cfr_form_directory(blob) != NULL) == (mode != CFR_FORM_DIRECTORY_NONE));
+		CHECK(main_form == cfr_first_form(blob));
+		CHECK(cfr_find_form(blob, test_find_id(blob, "Main")) == main_form);
+		CHECK(cfr_find_form(blob, test_find_id(blob, "Board")) == board);
+		CHECK(cfr_find_form(blob, test_find_id(blob, "Deep")) > main_form);
+		CHECK(cfr_find_form(blob, test_find_id(blob, "Deep")) < board);
+		CHECK(!cfr_find_form(blob, test_find_id(blob, "vmx")));
+		CHECK(!cfr_find_form(blob, 1000));
+		CHECK(!cfr_nth_form(blob, 2));
+		free(blob);
+	}
+}
+
+/* Runs cfr_check_form() with its message going to `message` */
+static int check_form(const struct lb_cfr_option_form *form, char *message, size_t size)
+{
+	const char *path = test_tmp_path("stderr.txt");
+	FILE *capture = fopen(path, "w+");
+	const int saved = dup(fileno(stderr));
+	CHECK(capture && saved >= 0);
+	if (!capture || saved < 0) {
+		exit(1);
+	}
+
+	fflush(stderr);
+	dup2(fileno(capture), fileno(stderr));
+	const int ret = cfr_check_form(form);
+	fflush(stderr);
+	dup2(saved, fileno(stderr));
+	close(saved);
+
+	rewind(capture);
+	message[fread(message, 1, size - 1, capture)] = '\0';
+	fclose(capture);
+	return ret;
+}
+
+static void test_check_form(void)
+{
+	size_t size;
+	char *blob = test_menu(CFR_FORM_DIRECTORY_NONE, true, 0, &size);
+	struct lb_cfr_option_form *form = (struct lb_cfr_option_form *)(blob + cfr_first_form(blob));
+	struct lb_cfr_varbinary *ui_name = (struct lb_cfr_varbinary *)(form + 1);
+	char message[256];
+
+	CHECK(cfr_form_checksum(form));
+	CHECK(check_form(form, message, sizeof(message)) == 0);
+	CHECK(!message[0]);
+
+	/* A change anywhere in the form names the form */
+	blob[cfr_first_form(blob) + cfr_le32_to_cpu(form->size) - 1] ^= 1;
+	CHECK(check_form(form, message, sizeof(message)) == -1);
+	CHECK(strstr(message, "'Main' is corrupt"));
+	cfr_update_form_checksums(blob, cfr_first_form(blob) + cfr_le32_to_cpu(form->size) - 1);
+	CHECK(check_form(form, message, sizeof(message)) == 0);
+
+	/* A name that claims more data than its record has must not be printed */
+	const uint32_t data_length = ui_name->data_length;
+	ui_name->data_length = cfr_cpu_to_le32(0x40000000);
+	CHECK(check_form(form, message, sizeof(message)) == -1);
+	CHECK(strstr(message, "'' is corrupt"));
+	ui_name->data_length = cfr_cpu_to_le32(cfr_le32_to_cpu(ui_name->size));
+	CHECK(check_form(form, message, sizeof(message)) == -1);
+	CHECK(strstr(message, "'' is corrupt"));
+	ui_name->data_length = data_length;
+
+	/* Or that is not terminated within it */
+	const char last = ui_name->data[cfr_le32_to_cpu(data_length) - 1];
+	ui_name->data[cfr_le32_to_cpu(data_length) - 1] = 'x';
+	CHECK(check_form(form, message, sizeof(message)) == -1);
+	CHECK(strstr(message, "'' is corrupt"));
+	ui_name->data[cfr_le32_to_cpu(data_length) - 1] = last;
+	CHECK(check_form(form, message, sizeof(message)) == 0);
+
+	/* Blobs written without them have none to check */
+	free(blob);
+	blob = test_menu(CFR_FORM_DIRECTORY_NONE, false, 0, &size);
+	form = (struct lb_cfr_option_form *)(blob + cfr_first_form(blob));
+	CHECK(!cfr_form_checksum(form));
+	CHECK(check_form(form, message, sizeof(message)) == 0);
+
+	free(blob);
+}
+
+int main(void)
+{
+	test_crc32_combine();
+	test_little_endian();
+	test_enum_values();
+	test_enum_ranges();
+	test_find_form();
+	test_check_form();
+	return test_done();
+}
@@ -0,0 +1,142 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cfr.h"
+#include "cfr_delta.h"
+#include "cfr_file.h"
+#include "test.h"
+
+/* Creates the delta from `source` to `target` and applies it again */
+static size_t check_round_trip(const char *source, const char *target, size_t target_size)
+{
+	char *delta = NULL, *applied = NULL;
+	size_t delta_len = 0;
+
+	CHECK(cfr_delta_create(source, target, &delta, &delta_len) == 0);
+	CHECK(delta && cfr_is_delta(delta, delta_len));
+	CHECK(delta && cfr_delta_apply(source, delta, delta_len, &applied) == 0);
+	CHECK(applied && !memcmp(applied, target, target_size));
+
+	free(applied);
+	free(delta);
+	return delta_len;
+}
+
+static void test_round_trip(void)
+{
+	size_t size, grown_size, directory_size;
+	char *source = test_menu(CFR_FORM_DIRECTORY_NONE, false, 0, &size);
+	char *grown = test_menu(CFR_FORM_DIRECTORY_NONE, false, 5, &grown_size);
+	char *directory = test_menu(CFR_FORM_DIRECTORY_ALL, true, 0, &directory_size);
+
+	/* Nothing changed, so everything is a copy */
+	CHECK(check_round_trip(source, source, size) < 64);
+
+	/* Options inserted, and the IDs of everything after them shifted */
+	check_round_trip(source, grown, grown_size);
+	check_round_trip(grown, source, size);
+
+	/* A form directory and form CRCs added */
+	CHECK(check_round_trip(source, directory, directory_size) < directory_size);
+	check_round_trip(directory, source, size);
+
+	free(directory);
+	free(grown);
+	free(source);
+}
+
+static void test_wrong_source(void)
+{
+	size_t size, other_size;
+	char *source = test_menu(CFR_FORM_DIRECTORY_NONE, false, 0, &size);
+	char *target = test_menu(CFR_FORM_DIRECTORY_NONE, false, 2, &other_size);
+	char *other = test_menu(CFR_FORM_DIRECTORY_TOP_LEVEL, false, 0, &other_size);
+	char *delta = NULL, *applied = NULL;
+	size_t delta_len;
+
+	CHECK(cfr_delta_create(source, target, &delta, &delta_len) == 0);
+	const int saved = test_mute(stderr);
+	CHECK(delta && cfr_delta_apply(other, delta, delta_len, &applied) != 0);
+	test_unmute(stderr, saved);
+	CHECK(!applied);
+
+	free(delta);
+	free(other);
+	free(target);
+	free(source);
+}
+
+static void test_damaged(void)
+{
+	size_t size, target_size;
+	char *source = test_menu(CFR_FORM_DIRECTORY_NONE, false, 0, &size);
+	char *target = test_menu(CFR_FORM_DIRECTORY_TOP_LEVEL, true, 3, &target_size);
+	char *delta = NULL;
+	size_t delta_len = 0;
+
+	CHECK(cfr_delta_create(source, target, &delta, &delta_len) == 0);
+	/* Every one of them is reported, which is not what this is about */
+	const int saved = test_mute(stderr);
+	for (size_t len = 0; delta && len < delta_len; len++) {
+		char *applied = NULL;
+		CHECK(cfr_delta_apply(source, delta, len, &applied) != 0);
+		free(applied);
+	}
+
+	/* A result is only ever the target itself */
+	for (size_t i = 0; delta && i < delta_len; i++) {
+		char *applied = NULL;
+		delta[i] ^= 0x01;
+		if (cfr_delta_apply(source, delta, delta_len, &applied) == 0) {
+			CHECK(!memcmp(applied, target, target_size));
+		}
+		delta[i] ^= 0x01;
+		free(applied);
+	}
+	test_unmute(stderr, saved);
+
+	free(delta);
+	free(target);
+	free(source);
+}
+
+/* cfr_delta and cfr_apply do the same through files */
+static void test_programs(void)
+{
+	const char *source_path = test_tmp_path("source.cfr");
+	const char *target_path = test_tmp_path("target.cfr");
+	const char *delta_path = test_tmp_path("delta.cfr");
+	const char *out_path = test_tmp_path("applied.cfr");
+	size_t size, target_size;
+	char *source = test_menu(CFR_FORM_DIRECTORY_NONE, false, 0, &size);
+	char *target = test_menu(CFR_FORM_DIRECTORY_ALL, true, 1, &target_size);
+	char *applied = NULL;
+	char cmd[512];
+
+	CHECK(test_write_file(source_path, source, size) == 0);
+	CHECK(test_write_file(target_path, target, target_size) == 0);
+	snprintf(cmd, sizeof(cmd), "./cfr_delta %s %s %s >/dev/null",
+		 source_path, target_path, delta_path);
+	CHECK(system(cmd) == 0);
+	snprintf(cmd, sizeof(cmd), "./cfr_apply %s %s %s >/dev/null",
+		 source_path, delta_path, out_path);
+	CHECK(system(cmd) == 0);
+	CHECK(cfr_read_file(&applied, out_path) == 0);
+	CHECK(applied && !memcmp(applied, target, target_size));
+
+	free(applied);
+	free(target);
+	free(source);
+}
+
+int main(void)
+{
+	test_round_trip();
+	test_wrong_source();
+	test_damaged();
+	test_programs();
+	return test_done();
+}
@@ -0,0 +1,146 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cfr.h"
+#include "cfr_file.h"
+#include "cfr_lint.h"
+#include "cfr_values.h"
+#include "test.h"
+
+static int extract(const char *forms, const char *in, const char *out)
+{
+	char cmd[512];
+	snprintf(cmd, sizeof(cmd), "./cfr_extract %s %s %s >/dev/null", forms, in, out);
+	return system(cmd);
+}
+
+/* Reads an extracted blob, which holds only the form with the ID */
+static char *read_extracted(const char *path, uint32_t object_id)
+{
+	char *blob = NULL;
+	CHECK(cfr_read_file(&blob, path) == 0);
+	if (!blob) {
+		return NULL;
+	}
+	CHECK(test_checksum_ok(blob));
+	CHECK(cfr_nth_form(blob, 0) == sizeof(struct lb_cfr));
+	CHECK(cfr_find_form(blob, object_id) == sizeof(struct lb_cfr));
+	CHECK(!cfr_nth_form(blob, 1));
+	CHECK(cfr_lint(stderr, blob, cfr_le32_to_cpu(((const struct lb_cfr *)blob)->size)) == 0);
+
+	/* And the tools take it */
+	char cmd[512];
+	int status;
+	snprintf(cmd, sizeof(cmd), "./cfr_read %s", path);
+	char *output = test_run(cmd, &status);
+	CHECK(status == 0 && *output);
+	free(output);
+	return blob;
+}
+
+/* The options an extracted blob resolves to, by name */
+static void check_options(const char *blob, const char *const *names, size_t num_names)
+{
+	struct cfr_values *values = cfr_values_resolve(blob, NULL);
+	CHECK(values && values->num_options == num_names);
+	for (size_t i = 0; values && i < num_names; i++) {
+		CHECK(cfr_values_by_name(values, names[i], strlen(names[i])));
+	}
+	cfr_values_free(values);
+}
+
+static void test_extract(void)
+{
+	static const char *const board_options[] = { "led" };
+	static const char *const deep_options[] = { "deep_limit" };
+	const char *out_path = test_tmp_path("board.cfr");
+	const char *in_path = test_tmp_path("menu.cfr");
+	char forms[64];
+	size_t size;
+
+	/* Through the directory and the form CRC records, or the hard way */
+	for (int checksums = 0; checksums <= 1; checksums++) {
+		char *blob = test_menu(checksums ? CFR_FORM_DIRECTORY_ALL : CFR_FORM_DIRECTORY_NONE,
+				       checksums, 0, &size);
+		CHECK(test_write_file(in_path, blob, size) == 0);
+
+		/* By UI name */
+		CHECK(extract("--form Board", in_path, out_path) == 0);
+		char *extracted = read_extracted(out_path, test_find_id(blob, "Board"));
+		if (extracted) {
+			check_options(extracted, board_options, ARRAY_SIZE(board_options));
+		}
+		free(extracted);
+
+		/* Nested forms by ID */
+		snprintf(forms, sizeof(forms), "--form %u", test_find_id(blob, "Deep"));
+		CHECK(extract(forms, in_path, out_path) == 0);
+		extracted = read_extracted(out_path, test_find_id(blob, "Deep"));
+		if (extracted) {
+			check_options(extracted, deep_options, ARRAY_SIZE(deep_options));
+		}
+		free(extracted);
+
+		const int saved = test_mute(stderr);
+		CHECK(extract("--form Nope", in_path, out_path) != 0);
+		test_unmute(stderr, saved);
+		free(blob);
+	}
+}
+
+/* With several forms, each goes to a file of its own */
+static void test_several(void)
+{
+	const char *in_path = test_tmp_path("several.cfr");
+	const char *main_path = test_tmp_path("forms/form-1.bin");
+	char board_name[32];
+	size_t size;
+	char *blob = test_menu(CFR_FORM_DIRECTORY_NONE, false, 0, &size);
+
+	snprintf(board_name, sizeof(board_name), "forms/form-%u.bin", test_find_id(blob, "Board"));
+	const char *board_path = test_tmp_path(board_name);
+	const char *dir = test_tmp_path("forms");
+
+	CHECK(test_write_file(in_path, blob, size) == 0);
+	CHECK(extract("--form Main --form Board", in_path, dir) == 0);
+	free(read_extracted(main_path, 1));
+	free(read_extracted(board_path, test_find_id(blob, "Board")));
+	free(blob);
+}
+
+/* Forms that do not match their CRC are not given a valid root checksum */
+static void test_corrupt(void)
+{
+	const char *in_path = test_tmp_path("corrupt.cfr");
+	const char *board_path = test_tmp_path("corrupt_board.cfr");
+	const char *main_path = test_tmp_path("corrupt_main.cfr");
+	size_t size;
+	char *blob = test_menu(CFR_FORM_DIRECTORY_ALL, true, 0, &size);
+	struct lb_cfr_numeric_option *led =
+		(struct lb_cfr_numeric_option *)(blob + test_find_offset(blob, "led"));
+	led->default_value = cfr_cpu_to_le32(1);
+	CHECK(test_write_file(in_path, blob, size) == 0);
+
+	const int saved = test_mute(stderr);
+	CHECK(extract("--form Board", in_path, board_path) != 0);
+	test_unmute(stderr, saved);
+	char *board = test_read_file(board_path, &size);
+	CHECK(!board);
+	free(board);
+
+	/* The other forms are fine */
+	CHECK(extract("--form Main", in_path, main_path) == 0);
+	free(read_extracted(main_path, 1));
+	free(blob);
+}
+
+int main(void)
+{
+	test_extract();
+	test_several();
+	test_corrupt();
+	return test_done();
+}
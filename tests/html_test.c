@@ -0,0 +1,312 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cfr.h"
+#include "cfr_html.h"
+#include "test.h"
+
+static bool contains(const struct html_out *out, const char *text)
+{
+	const size_t len = strlen(text);
+	for (size_t i = 0; i + len <= out->len; i++) {
+		if (!memcmp(out->data + i, text, len)) {
+			return true;
+		}
+	}
+	return false;
+}
+
+static bool same(const struct html_out *a, const struct html_out *b)
+{
+	return a->len == b->len && !memcmp(a->data, b->data, a->len);
+}
+
+static void test_render(void)
+{
+	for (int mode = CFR_FORM_DIRECTORY_NONE; mode <= CFR_FORM_DIRECTORY_ALL; mode++) {
+		for (int checksums = 0; checksums <= 1; checksums++) {
+			size_t size;
+			char *blob = test_menu(mode, checksums, 0, &size);
+			struct html_out out = { .fd = -1 };
+
+			CHECK(cfr_html_render_blob(&out, blob, size) == 0);
+			CHECK(contains(&out, "Restore AC power loss"));
+			CHECK(contains(&out, "5.0 s"));
+			CHECK(contains(&out, "VMX &lt;virtualization&gt;"));
+			CHECK(contains(&out, "deep_limit"));
+			CHECK(contains(&out, "</html>"));
+
+			free(out.data);
+			free(blob);
+		}
+	}
+}
+
+/* Blobs that do not fit into their length are refused before rendering */
+static void test_truncated(void)
+{
+	size_t size;
+	char *blob = test_menu(CFR_FORM_DIRECTORY_NONE, false, 0, &size);
+	struct html_out out = { .fd = -1 };
+
+	const int saved = test_mute(stderr);
+	CHECK(cfr_html_render_blob(&out, blob, size - 1) == -1);
+	CHECK(cfr_html_render_blob(&out, blob, sizeof(struct lb_cfr) - 1) == -1);
+	test_unmute(stderr, saved);
+	CHECK(out.len == 0);
+
+	free(out.data);
+	free(blob);
+}
+
+struct job {
+	char *blob;
+	size_t size;
+	struct html_out out;
+	int ret;
+};
+
+static void *render_job(void *arg)
+{
+	struct job *job = arg;
+	job->ret = cfr_html_render_blob(&job->out, job->blob, job->size);
+	return NULL;
+}
+
+/* Blobs rendered at the same time come out as when rendered one by one */
+static void test_concurrent(void)
+{
+	enum { NUM_JOBS = 4 };
+	struct job jobs[NUM_JOBS];
+	pthread_t threads[NUM_JOBS];
+
+	for (size_t i = 0; i < NUM_JOBS; i++) {
+		jobs[i] = (struct job) { .out = { .fd = -1, .minify = i % 2 } };
+		jobs[i].blob = test_menu(CFR_FORM_DIRECTORY_NONE, false, i * 500, &jobs[i].size);
+	}
+	for (size_t i = 0; i < NUM_JOBS; i++) {
+		CHECK(pthread_create(&threads[i], NULL, render_job, &jobs[i]) == 0);
+	}
+	for (size_t i = 0; i < NUM_JOBS; i++) {
+		pthread_join(threads[i], NULL);
+		struct html_out expected = { .fd = -1, .minify = i % 2 };
+		cfr_html_render(&expected, jobs[i].blob);
+		CHECK(jobs[i].ret == 0 && same(&jobs[i].out, &expected));
+		free(expected.data);
+		free(jobs[i].out.data);
+		free(jobs[i].blob);
+	}
+}
+
+/* Only forms that changed are rendered again, and the document is as if all were */
+static void test_cached(void)
+{
+	for (int checksums = 0; checksums <= 1; checksums++) {
+		size_t size;
+		char *blob = test_menu(CFR_FORM_DIRECTORY_TOP_LEVEL, checksums, 0, &size);
+		struct html_out full = { .fd = -1 }, first = { .fd = -1 }, second = { .fd = -1 };
+		struct cfr_html_cache cache = {0};
+
+		cfr_html_render(&full, blob);
+		CHECK(cfr_html_render_cached(&first, blob, &cache) == 2);
+		CHECK(cfr_html_render_cached(&second, blob, &cache) == 0);
+		CHECK(same(&first, &full));
+		CHECK(same(&second, &full));
+
+		/* Turn the LED on by default, which only changes Board */
+		const uint32_t led = test_find_offset(blob, "led");
+		struct lb_cfr_numeric_option *option = (struct lb_cfr_numeric_option *)(blob + led);
+		option->default_value = cfr_cpu_to_le32(1);
+		cfr_update_form_checksums(blob, led);
+
+		struct html_out changed = { .fd = -1 }, third = { .fd = -1 };
+		cfr_html_render(&changed, blob);
+		CHECK(cfr_html_render_cached(&third, blob, &cache) == 1);
+		CHECK(same(&third, &changed));
+		CHECK(!same(&third, &full));
+
+		cfr_html_cache_free(&cache);
+		free(third.data);
+		free(changed.data);
+		free(second.data);
+		free(first.data);
+		free(full.data);
+		free(blob);
+	}
+}
+
+static void test_form(void)
+{
+	size_t size;
+	char *blob = test_menu(CFR_FORM_DIRECTORY_ALL, true, 0, &size);
+	struct html_out out = { .fd = -1 };
+
+	CHECK(cfr_html_render_form(&out, blob, test_find_id(blob, "Board")) == 0);
+	CHECK(contains(&out, "LED"));
+	CHECK(!contains(&out, "Restore AC power loss"));
+	CHECK(cfr_html_render_form(&out, blob, 1000) == -1);
+
+	free(out.data);
+	free(blob);
+}
+
+/* Every record is checked, however deep it is nested */
+static void test_damaged(void)
+{
+	size_t size;
+	char *blob = test_menu(CFR_FORM_DIRECTORY_NONE, false, 0, &size);
+	const uint32_t offsets[] = {
+		test_find_offset(blob, "Main"),
+		test_find_offset(blob, "power_on_after_fail"),
+		test_find_offset(blob, "deep_limit"),
+		test_find_offset(blob, "Deep"),
+		test_find_offset(blob, "led"),
+	};
+
+	CHECK(!cfr_html_blob_ok(blob, size - 4));
+	CHECK(!cfr_html_blob_ok(blob, 4));
+
+	const int saved = test_mute(stderr);
+	for (size_t i = 0; i < ARRAY_SIZE(offsets); i++) {
+		struct lb_record *record = (struct lb_record *)(blob + offsets[i]);
+		const uint32_t record_size = cfr_le32_to_cpu(record->size);
+		const uint32_t bad_sizes[] = { 0, 4, record_size - 2, record_size + 4, size };
+
+		for (size_t j = 0; j < ARRAY_SIZE(bad_sizes); j++) {
+			struct html_out out = { .fd = -1 };
+			record->size = cfr_cpu_to_le32(bad_sizes[j]);
+			CHECK(!cfr_html_blob_ok(blob, size));
+			CHECK(cfr_html_render_blob(&out, blob, size) == -1);
+			CHECK(!out.len);
+			free(out.data);
+		}
+		record->size = cfr_cpu_to_le32(record_size);
+	}
+	test_unmute(stderr, saved);
+	CHECK(cfr_html_blob_ok(blob, size));
+
+	free(blob);
+}
+
+/* Ranges are refused if they are too large to render, or wrap around */
+static void test_enum_ranges(void)
+{
+	size_t size;
+	char *blob = test_menu(CFR_FORM_DIRECTORY_NONE, false, 0, &size);
+	const uint32_t offset = test_find_range(blob, "power_on_after_fail");
+	CHECK(offset);
+	if (!offset) {
+		free(blob);
+		return;
+	}
+	struct lb_cfr_enum_range *range = (struct lb_cfr_enum_range *)(blob + offset);
+
+	range->count = cfr_cpu_to_le32(CFR_ENUM_RANGE_MAX);
+	CHECK(cfr_html_blob_ok(blob, size));
+	range->count = cfr_cpu_to_le32(CFR_ENUM_RANGE_MAX + 1);
+	CHECK(!cfr_html_blob_ok(blob, size));
+	range->count = cfr_cpu_to_le32(5);
+	range->start = cfr_cpu_to_le32(UINT32_MAX - 30);
+	CHECK(!cfr_html_blob_ok(blob, size));
+	range->start = cfr_cpu_to_le32(UINT32_MAX - 40);
+	CHECK(cfr_html_blob_ok(blob, size));
+
+	/* The label is read like any other string */
+	struct lb_record *label = (struct lb_record *)(blob + offset + sizeof(*range));
+	label->tag = cfr_cpu_to_le32(LB_TAG_CFR_VARCHAR_OPT_NAME);
+	CHECK(!cfr_html_blob_ok(blob, size));
+
+	free(blob);
+}
+
+/* Forms that do not match their checksum are left out, and fail the rendering */
+static void test_corrupt_form(void)
+{
+	size_t size;
+	char *blob = test_menu(CFR_FORM_DIRECTORY_NONE, true, 0, &size);
+	struct lb_cfr_numeric_option *led =
+		(struct lb_cfr_numeric_option *)(blob + test_find_offset(blob, "led"));
+	led->default_value = cfr_cpu_to_le32(1);
+
+	struct html_out out = { .fd = -1 };
+	const int saved = test_mute(stderr);
+	cfr_html_render(&out, blob);
+	test_unmute(stderr, saved);
+	CHECK(out.error);
+	CHECK(contains(&out, "name='boot_delay'"));
+	CHECK(!contains(&out, "Board"));
+	CHECK(!contains(&out, "name='led'"));
+
+	free(out.data);
+	free(blob);
+}
+
+/* Records that are not where they belong fail the rendering, instead of the program */
+static void test_misplaced(void)
+{
+	size_t size;
+	char *blob = test_menu(CFR_FORM_DIRECTORY_NONE, false, 0, &size);
+	const uint32_t offset = test_find_offset(blob, "boot_delay");
+	struct lb_record *opt_name = (struct lb_record *)
+		(blob + offset + sizeof(struct lb_cfr_numeric_option));
+	CHECK(cfr_le32_to_cpu(opt_name->tag) == LB_TAG_CFR_VARCHAR_OPT_NAME);
+	opt_name->tag = cfr_cpu_to_le32(LB_TAG_CFR_VARCHAR_DEF_VALUE);
+
+	struct html_out out = { .fd = -1 };
+	const int saved = test_mute(stderr);
+	CHECK(cfr_html_render(&out, blob) == -1);
+	test_unmute(stderr, saved);
+	CHECK(out.error);
+	CHECK(contains(&out, "Boot delay"));
+	CHECK(!contains(&out, "name='boot_delay'"));
+	CHECK(contains(&out, "name='led'"));
+	free(out.data);
+
+	/* Not a CFR root at all */
+	struct lb_cfr *root = (struct lb_cfr *)blob;
+	root->tag = cfr_cpu_to_le32(LB_TAG_CFR_OPTION_FORM);
+	struct cfr_html_cache cache = { 0 };
+	for (int cached = 0; cached <= 1; cached++) {
+		out = (struct html_out) { .fd = -1 };
+		const int saved_root = test_mute(stderr);
+		if (cached) {
+			CHECK(cfr_html_render_cached(&out, blob, &cache) == 0);
+		} else {
+			CHECK(cfr_html_render(&out, blob) == -1);
+		}
+		test_unmute(stderr, saved_root);
+		CHECK(out.error && !out.len);
+		free(out.data);
+	}
+	cfr_html_cache_free(&cache);
+
+	free(blob);
+}
+
+static void test_depth(void)
+{
+	for (unsigned int depth = 30; depth <= 40; depth += 10) {
+		size_t size;
+		char *blob = test_nest_forms(depth, &size);
+		CHECK(cfr_html_blob_ok(blob, size) == (depth <= 32));
+		free(blob);
+	}
+}
+
+int main(void)
+{
+	test_render();
+	test_truncated();
+	test_concurrent();
+	test_cached();
+	test_form();
+	test_damaged();
+	test_enum_ranges();
+	test_corrupt_form();
+	test_misplaced();
+	test_depth();
+	return test_done();
+}
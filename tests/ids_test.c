@@ -0,0 +1,162 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cfr.h"
+#include "cfr_builder.h"
+#include "cfr_file.h"
+#include "cfr_ids.h"
+#include "cfr_lint.h"
+#include "test.h"
+
+static const char *const names[] = {
+	"Main", "power_on_after_fail", "boot_delay", "vmx", "serial",
+	"Power", "s3", "Deep", "deep_limit", "Board", "led",
+};
+
+/* The test menu with `extra` options inserted, with stable IDs from `map` */
+static char *stable_menu(unsigned int extra, struct cfr_id_map *map, size_t *size)
+{
+	char *blob = test_menu(CFR_FORM_DIRECTORY_ALL, true, extra, size);
+	CHECK(cfr_assign_stable_ids(blob, map) == 0);
+	CHECK(cfr_lint(stderr, blob, *size) == 0);
+	return blob;
+}
+
+static void check_same_ids(const char *a, const char *b)
+{
+	for (size_t i = 0; i < ARRAY_SIZE(names); i++) {
+		const uint32_t id = test_find_id(a, names[i]);
+		if (!id || id != test_find_id(b, names[i])) {
+			fprintf(stderr, "'%s' has ID %u and %u\n", names[i], id,
+				test_find_id(b, names[i]));
+			test_failures++;
+		}
+	}
+}
+
+static void test_insert(void)
+{
+	size_t size, grown_size;
+	char *blob = stable_menu(0, NULL, &size);
+	char *grown = stable_menu(5, NULL, &grown_size);
+
+	check_same_ids(blob, grown);
+
+	free(grown);
+	free(blob);
+}
+
+static char *read_text(const char *path)
+{
+	static char text[4096];
+	FILE *stream = fopen(path, "r");
+	if (!stream) {
+		return NULL;
+	}
+	text[fread(text, 1, sizeof(text) - 1, stream)] = '\0';
+	fclose(stream);
+	return text;
+}
+
+static void test_map(void)
+{
+	const char *path = test_tmp_path("ids.map");
+	struct cfr_id_map *map = cfr_id_map_new();
+	size_t size, grown_size;
+
+	/* A missing map is an empty one */
+	CHECK(map && cfr_id_map_load(map, path) == 0);
+	char *grown = stable_menu(5, map, &grown_size);
+	CHECK(cfr_id_map_save(map, path) == 0);
+	cfr_id_map_free(map);
+
+	const char *text = read_text(path);
+	CHECK(text && strstr(text, " Main/Power/Deep/deep_limit\n"));
+	CHECK(text && strstr(text, " Main/extra_4\n"));
+
+	/* Options removed since keep their IDs in the map, the others keep theirs */
+	map = cfr_id_map_new();
+	CHECK(map && cfr_id_map_load(map, path) == 0);
+	char *blob = stable_menu(0, map, &size);
+	check_same_ids(blob, grown);
+	CHECK(cfr_id_map_save(map, path) == 0);
+	cfr_id_map_free(map);
+	CHECK(text && !strcmp(read_text(path), text));
+
+	free(blob);
+	free(grown);
+}
+
+static void test_same_path(void)
+{
+	struct cfr_builder *b = cfr_builder_new();
+	char *blob = NULL;
+	size_t size;
+
+	CHECK(b);
+	CHECK(cfr_builder_form_begin(b, 1, 0, "Main") == 0);
+	CHECK(cfr_builder_add_bool(b, &(struct sm_obj_bool) {
+		.object_id	= 2,
+		.opt_name	= "a",
+		.ui_name	= "A",
+	}) == 0);
+	CHECK(cfr_builder_add_number(b, &(struct sm_obj_number) {
+		.object_id	= 3,
+		.opt_name	= "a",
+		.ui_name	= "Also A",
+	}) == 0);
+	CHECK(cfr_builder_form_end(b) == 0);
+	CHECK(cfr_builder_finish(b, CFR_FORM_DIRECTORY_NONE, false, &blob, &size) == 0);
+	const int saved = test_mute(stderr);
+	CHECK(blob && cfr_assign_stable_ids(blob, NULL) != 0);
+	test_unmute(stderr, saved);
+
+	free(blob);
+	cfr_builder_free(b);
+}
+
+/* The map of cfr_write may only change once the blob it describes is written */
+static void test_cfr_write(void)
+{
+	const char *map = test_tmp_path("write.map");
+	const char *out = test_tmp_path("write.cfr");
+	const char *log = test_tmp_path("write.log");
+	char cmd[512];
+
+	snprintf(cmd, sizeof(cmd), "./cfr_write --stable-ids=%s %s/missing/write.cfr >%s 2>&1",
+		 map, out, log);
+	CHECK(system(cmd) != 0);
+	CHECK(!read_text(map));
+
+	snprintf(cmd, sizeof(cmd), "./cfr_write --stable-ids=%s %s >%s", map, out, log);
+	CHECK(system(cmd) == 0);
+	const char *text = read_text(map);
+	CHECK(text && strstr(text, "\n"));
+
+	/* The CRC printed is the one of the blob written */
+	unsigned int crc = 0;
+	text = read_text(log);
+	CHECK(text && sscanf(text, "CFR: Written %*u bytes of CFR structures at %*p, "
+				   "with CRC32 0x%x", &crc) == 1);
+	char *blob = NULL;
+	CHECK(cfr_read_file(&blob, out) == 0);
+	CHECK(blob && cfr_le32_to_cpu(((const struct lb_cfr *)blob)->checksum) == crc);
+	if (blob) {
+		const uint32_t size = cfr_le32_to_cpu(((const struct lb_cfr *)blob)->size);
+		CHECK(test_checksum_ok(blob));
+		CHECK(cfr_lint(stderr, blob, size) == 0);
+	}
+	free(blob);
+}
+
+int main(void)
+{
+	test_insert();
+	test_map();
+	test_same_path();
+	test_cfr_write();
+	return test_done();
+}
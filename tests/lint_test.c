@@ -0,0 +1,243 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+
+/* For fmemopen() */
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cfr.h"
+#include "cfr_builder.h"
+#include "cfr_lint.h"
+#include "test.h"
+
+/* Lints the blob, and checks that the report has `count` violations and mentions `expected` */
+static void check_lint(const char *blob, size_t len, unsigned int count, const char *expected)
+{
+	char report[4096] = {0};
+	FILE *out = fmemopen(report, sizeof(report) - 1, "w");
+	CHECK(out);
+	if (!out) {
+		return;
+	}
+	const unsigned int violations = cfr_lint(out, blob, len);
+	fclose(out);
+
+	if (violations != count || (expected && !strstr(report, expected))) {
+		fprintf(stderr, "Expected %u violations with '%s', got %u:\n%s",
+			count, expected ? expected : "", violations, report);
+		test_failures++;
+	}
+}
+
+/* A form with two bools, which the caller makes clash */
+static char *two_bools(const struct sm_obj_bool *a, const struct sm_obj_bool *b, size_t *size)
+{
+	struct cfr_builder *builder = cfr_builder_new();
+	char *blob = NULL;
+	CHECK(builder);
+	CHECK(cfr_builder_form_begin(builder, 1, 0, "Main") == 0);
+	CHECK(cfr_builder_add_bool(builder, a) == 0);
+	CHECK(cfr_builder_add_bool(builder, b) == 0);
+	CHECK(cfr_builder_form_end(builder) == 0);
+	CHECK(cfr_builder_finish(builder, CFR_FORM_DIRECTORY_NONE, false, &blob, size) == 0);
+	cfr_builder_free(builder);
+	return blob;
+}
+
+static void test_clean(void)
+{
+	for (int mode = CFR_FORM_DIRECTORY_NONE; mode <= CFR_FORM_DIRECTORY_ALL; mode++) {
+		for (int checksums = 0; checksums <= 1; checksums++) {
+			size_t size;
+			char *blob = test_menu(mode, checksums, 10, &size);
+			check_lint(blob, size, 0, NULL);
+			free(blob);
+		}
+	}
+}
+
+static void test_objects(void)
+{
+	static const struct {
+		struct sm_obj_bool a, b;
+		const char *expected;
+	} cases[] = {
+		{
+			{ .object_id = 2, .opt_name = "a", .ui_name = "A" },
+			{ .object_id = 2, .opt_name = "b", .ui_name = "B" },
+			"object ID 2 is also used",
+		},
+		{
+			{ .object_id = 2, .opt_name = "a", .ui_name = "A" },
+			{ .object_id = 0, .opt_name = "b", .ui_name = "B" },
+			"object ID is 0",
+		},
+		{
+			{ .object_id = 2, .opt_name = "a", .ui_name = "A" },
+			{ .object_id = 3, .opt_name = "a", .ui_name = "B" },
+			"option name 'a' is also used",
+		},
+		{
+			{ .object_id = 2, .opt_name = "a", .ui_name = "A" },
+			{ .object_id = 3, .flags = 1 << 8, .opt_name = "b", .ui_name = "B" },
+			"unknown flags 0x100",
+		},
+	};
+
+	for (size_t i = 0; i < ARRAY_SIZE(cases); i++) {
+		size_t size;
+		char *blob = two_bools(&cases[i].a, &cases[i].b, &size);
+		if (blob) {
+			check_lint(blob, size, 1, cases[i].expected);
+		}
+		free(blob);
+	}
+}
+
+static void test_enum_defaults(void)
+{
+	const struct sm_enum_range ranges[] = {
+		{ .label = "%v", .start = 10, .count = 5, .step = 10 },
+		SM_ENUM_RANGE_END,
+	};
+	const struct sm_enum_value values[] = {
+		{ "Off", 0 },
+		{ "On", 1 },
+		SM_ENUM_VALUE_END,
+	};
+	static const struct {
+		uint32_t default_value;
+		unsigned int count;
+	} cases[] = {
+		{ 1, 0 },
+		{ 30, 0 },
+		{ 50, 0 },
+		{ 2, 1 },
+		{ 35, 1 },
+		{ 60, 1 },
+	};
+
+	for (size_t i = 0; i < ARRAY_SIZE(cases); i++) {
+		struct cfr_builder *b = cfr_builder_new();
+		char *blob = NULL;
+		size_t size;
+		CHECK(b);
+		CHECK(cfr_builder_form_begin(b, 1, 0, "Main") == 0);
+		CHECK(cfr_builder_add_enum(b, &(struct sm_obj_enum) {
+			.object_id	= 2,
+			.opt_name	= "e",
+			.ui_name	= "E",
+			.default_value	= cases[i].default_value,
+			.ranges		= ranges,
+			.values		= values,
+		}) == 0);
+		CHECK(cfr_builder_form_end(b) == 0);
+		CHECK(cfr_builder_finish(b, CFR_FORM_DIRECTORY_NONE, false, &blob, &size) == 0);
+		if (blob) {
+			check_lint(blob, size, cases[i].count, cases[i].count ? "enum default" : NULL);
+		}
+		free(blob);
+		cfr_builder_free(b);
+	}
+}
+
+static void test_enum_ranges(void)
+{
+	size_t size;
+	char *blob = test_menu(CFR_FORM_DIRECTORY_NONE, false, 0, &size);
+	const uint32_t offset = test_find_range(blob, "power_on_after_fail");
+	CHECK(offset);
+	if (!offset) {
+		free(blob);
+		return;
+	}
+	struct lb_cfr_enum_range *range = (struct lb_cfr_enum_range *)(blob + offset);
+
+	range->count = cfr_cpu_to_le32(CFR_ENUM_RANGE_MAX + 1);
+	check_lint(blob, size, 1, "more than");
+	range->count = cfr_cpu_to_le32(CFR_ENUM_RANGE_MAX);
+	check_lint(blob, size, 0, NULL);
+
+	/* 10 + 4 * step is past UINT32_MAX */
+	range->count = cfr_cpu_to_le32(5);
+	range->step = cfr_cpu_to_le32(UINT32_MAX / 4);
+	check_lint(blob, size, 1, "wraps around");
+	free(blob);
+}
+
+static void test_structure(void)
+{
+	size_t size;
+	char *blob = test_menu(CFR_FORM_DIRECTORY_NONE, false, 0, &size);
+
+	/* Blobs cut short */
+	check_lint(blob, size - 4, 1, NULL);
+	check_lint(blob, 8, 1, "not a CFR blob");
+
+	/* A record that claims to be empty must not stop or hang the walk */
+	const uint32_t offset = test_find_offset(blob, "boot_delay");
+	CHECK(offset);
+	if (offset) {
+		struct lb_record *record = (struct lb_record *)(blob + offset);
+		const uint32_t record_size = record->size;
+		record->size = 0;
+		check_lint(blob, size, 1, "bad size 0");
+		record->size = cfr_cpu_to_le32(size);
+		check_lint(blob, size, 1, "bad size");
+		record->size = record_size;
+	}
+	check_lint(blob, size, 0, NULL);
+	free(blob);
+}
+
+static void test_depth(void)
+{
+	for (unsigned int depth = 30; depth <= 40; depth += 10) {
+		size_t size;
+		char *blob = test_nest_forms(depth, &size);
+		check_lint(blob, size, depth > 32, depth > 32 ? "nested too deep" : NULL);
+		free(blob);
+	}
+}
+
+/* cfr_lint fails on any violation, in any of the files */
+static void test_program(void)
+{
+	const char *path = test_tmp_path("clean.cfr");
+	const char *bad_path = test_tmp_path("bad.cfr");
+	char cmd[512];
+	size_t size;
+	int status;
+	char *blob = test_menu(CFR_FORM_DIRECTORY_NONE, false, 0, &size);
+
+	CHECK(test_write_file(path, blob, size) == 0);
+	snprintf(cmd, sizeof(cmd), "./cfr_lint %s", path);
+	char *output = test_run(cmd, &status);
+	CHECK(status == 0 && !output[0]);
+	free(output);
+
+	/* Give boot_delay the ID of vmx */
+	struct lb_cfr_numeric_option *option = (struct lb_cfr_numeric_option *)
+		(blob + test_find_offset(blob, "boot_delay"));
+	option->object_id = cfr_cpu_to_le32(test_find_id(blob, "vmx"));
+	CHECK(test_write_file(bad_path, blob, size) == 0);
+	snprintf(cmd, sizeof(cmd), "./cfr_lint %s %s", path, bad_path);
+	output = test_run(cmd, &status);
+	CHECK(status != 0 && strstr(output, "is also used") && strstr(output, "1 violation in"));
+	free(output);
+	free(blob);
+}
+
+int main(void)
+{
+	test_clean();
+	test_objects();
+	test_enum_defaults();
+	test_enum_ranges();
+	test_structure();
+	test_depth();
+	test_program();
+	return test_done();
+}
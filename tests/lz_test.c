@@ -0,0 +1,169 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "cfr.h"
+#include "cfr_file.h"
+#include "cfr_lz.h"
+#include "cfr_v2.h"
+#include "test.h"
+
+/* Compresses `data` at `level`, and reads it back as a file */
+static void check_round_trip(const char *data, size_t len, const struct lb_cfr *root,
+			     int level, const char *expected, size_t expected_size)
+{
+	static const char *path;
+	char *compressed = NULL, *read = NULL;
+	size_t compressed_len;
+
+	if (!path) {
+		path = test_tmp_path("menu.lz");
+	}
+	CHECK(cfr_lz_compress(data, len, root, level, &compressed, &compressed_len) == 0);
+	CHECK(compressed && compressed_len < len);
+	CHECK(compressed && test_write_file(path, compressed, compressed_len) == 0);
+	CHECK(cfr_read_file(&read, path) == 0);
+	CHECK(read && !memcmp(read, expected, expected_size));
+
+	/* All of the data is needed, only the padding of the record is not */
+	const int saved = test_mute(stderr);
+	for (size_t cut = LB_ENTRY_ALIGN; compressed && cut < compressed_len; cut *= 2) {
+		char *truncated = NULL;
+		CHECK(test_write_file(path, compressed, compressed_len - cut) == 0);
+		CHECK(cfr_read_file(&truncated, path) != 0);
+		free(truncated);
+	}
+	test_unmute(stderr, saved);
+
+	free(read);
+	free(compressed);
+}
+
+static void test_v1(void)
+{
+	/* Enough options for several chunks */
+	size_t size;
+	char *blob = test_menu(CFR_FORM_DIRECTORY_NONE, false, 3000, &size);
+	CHECK(size > 2 * CFR_LZ_CHUNK_SIZE);
+
+	const int levels[] = { CFR_LZ_LEVEL_FAST, CFR_LZ_LEVEL_DEFAULT, CFR_LZ_LEVEL_MAX };
+	for (size_t i = 0; i < ARRAY_SIZE(levels); i++) {
+		check_round_trip(blob, size, (const struct lb_cfr *)blob, levels[i], blob, size);
+	}
+
+	free(blob);
+}
+
+static void test_v2(void)
+{
+	size_t size, v2_len;
+	char *blob = test_menu(CFR_FORM_DIRECTORY_NONE, false, 3000, &size);
+	char *v2 = NULL;
+	struct lb_cfr root;
+
+	CHECK(cfr_v2_encode(blob, &v2, &v2_len) == 0);
+	CHECK(v2 && cfr_v2_read_header(v2, v2_len, &root) == 0);
+	if (v2) {
+		check_round_trip(v2, v2_len, &root, CFR_LZ_LEVEL_DEFAULT, blob, size);
+	}
+
+	free(v2);
+	free(blob);
+}
+
+static void test_incompressible(void)
+{
+	/* Stored chunks must round trip too */
+	const size_t len = CFR_LZ_CHUNK_SIZE + 100;
+	char *data = malloc(len);
+	CHECK(data);
+	if (!data) {
+		return;
+	}
+
+	uint32_t state = 1;
+	for (size_t i = 0; i < len; i++) {
+		state = state * 1103515245 + 12345;
+		data[i] = state >> 24;
+	}
+	struct lb_cfr *root = (struct lb_cfr *)data;
+	root->tag = cfr_cpu_to_le32(LB_TAG_CFR);
+	root->size = cfr_cpu_to_le32(len);
+	root->checksum = 0;
+	root->checksum = cfr_cpu_to_le32(cfr_crc32(data, len));
+
+	const char *path = test_tmp_path("random.lz");
+	char *compressed = NULL, *read = NULL;
+	size_t compressed_len;
+	CHECK(cfr_lz_compress(data, len, root, CFR_LZ_LEVEL_MAX, &compressed, &compressed_len) == 0);
+	CHECK(compressed && test_write_file(path, compressed, compressed_len) == 0);
+	CHECK(cfr_read_file(&read, path) == 0);
+	CHECK(read && !memcmp(read, data, len));
+
+	free(read);
+	free(compressed);
+	free(data);
+}
+
+/* The data is refused unless it is the blob the wrapper says it is */
+static void test_root_mismatch(void)
+{
+	const char *path = test_tmp_path("mismatch.lz");
+	size_t size, v2_len;
+	char *blob = test_menu(CFR_FORM_DIRECTORY_NONE, false, 0, &size);
+	char *v2 = NULL;
+	CHECK(cfr_v2_encode(blob, &v2, &v2_len) == 0);
+
+	struct lb_cfr *root = (struct lb_cfr *)blob;
+	const struct lb_cfr good = *root;
+	struct lb_cfr wrong_size = good, wrong_checksum = good;
+	wrong_size.size = cfr_cpu_to_le32(size + 4);
+	wrong_checksum.checksum ^= 1;
+
+	const struct {
+		const char *data;
+		size_t len;
+		const struct lb_cfr *root;
+	} cases[] = {
+		{ blob, size, &wrong_size },
+		{ blob, size, &wrong_checksum },
+		{ v2, v2_len, &wrong_size },
+		{ v2, v2_len, &wrong_checksum },
+	};
+	const int saved = test_mute(stderr);
+	for (size_t i = 0; i < ARRAY_SIZE(cases) && v2; i++) {
+		char *compressed = NULL, *read = NULL;
+		size_t compressed_len;
+		CHECK(cfr_lz_compress(cases[i].data, cases[i].len, cases[i].root,
+				      CFR_LZ_LEVEL_FAST, &compressed, &compressed_len) == 0);
+		CHECK(compressed && test_write_file(path, compressed, compressed_len) == 0);
+		CHECK(cfr_read_file(&read, path) != 0);
+		free(read);
+		free(compressed);
+	}
+
+	/* Nor when the blob itself does not match its checksum */
+	root->checksum ^= 1;
+	char *compressed = NULL, *read = NULL;
+	size_t compressed_len;
+	CHECK(cfr_lz_compress(blob, size, root, CFR_LZ_LEVEL_FAST,
+			      &compressed, &compressed_len) == 0);
+	CHECK(compressed && test_write_file(path, compressed, compressed_len) == 0);
+	CHECK(cfr_read_file(&read, path) != 0);
+	test_unmute(stderr, saved);
+
+	free(read);
+	free(compressed);
+	free(v2);
+	free(blob);
+}
+
+int main(void)
+{
+	test_v1();
+	test_v2();
+	test_incompressible();
+	test_root_mismatch();
+	return test_done();
+}
@@ -0,0 +1,164 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cfr.h"
+#include "cfr_file.h"
+#include "cfr_values.h"
+#include "test.h"
+
+static int merge(const char *out, const char *a, const char *b)
+{
+	char cmd[512];
+	snprintf(cmd, sizeof(cmd), "./cfr_merge %s %s %s >/dev/null", out, a, b);
+	return system(cmd);
+}
+
+/* Overrides vmx of the test menu by its ID, and adds options to Main by its name */
+static char *overlay(uint32_t vmx_id, size_t *size)
+{
+	const struct sm_object main_contents[] = {
+		{ .kind = SM_OBJ_BOOL, .sm_bool = {
+			.object_id	= vmx_id,
+			.opt_name	= "vmx",
+			.ui_name	= "VMX",
+			.default_value	= true,
+		} },
+		{ .kind = SM_OBJ_BOOL, .sm_bool = {
+			.object_id	= 101,
+			.opt_name	= "added",
+			.ui_name	= "Added",
+		} },
+	};
+	const struct sm_object extra_contents[] = {
+		{ .kind = SM_OBJ_NUMBER, .sm_number = {
+			.object_id	= 103,
+			.opt_name	= "extra",
+			.ui_name	= "Extra",
+		} },
+	};
+	const struct sm_obj_form forms[] = {
+		{
+			.object_id	= 100,
+			.ui_name	= "Main",
+			.obj_list	= main_contents,
+			.num_objects	= ARRAY_SIZE(main_contents),
+		},
+		{
+			.object_id	= 102,
+			.ui_name	= "Extra",
+			.obj_list	= extra_contents,
+			.num_objects	= ARRAY_SIZE(extra_contents),
+		},
+	};
+	const struct setup_menu_root sm_root = { .form_list = forms, .num_forms = ARRAY_SIZE(forms) };
+	return test_blob(&sm_root, size);
+}
+
+static void test_merge(void)
+{
+	const char *base_path = test_tmp_path("base.cfr");
+	const char *overlay_path = test_tmp_path("overlay.cfr");
+	const char *out_path = test_tmp_path("merged.cfr");
+	size_t base_size, overlay_size;
+	char *base = test_menu(CFR_FORM_DIRECTORY_NONE, false, 0, &base_size);
+	char *extra = overlay(test_find_id(base, "vmx"), &overlay_size);
+	char *merged = NULL;
+
+	CHECK(test_write_file(base_path, base, base_size) == 0);
+	CHECK(test_write_file(overlay_path, extra, overlay_size) == 0);
+	CHECK(merge(out_path, base_path, overlay_path) == 0);
+	CHECK(cfr_read_file(&merged, out_path) == 0);
+	if (!merged) {
+		free(extra);
+		free(base);
+		return;
+	}
+	CHECK(test_checksum_ok(merged));
+
+	/* vmx replaced in place, and everything else in Main kept */
+	struct cfr_values *values = cfr_values_resolve(merged, NULL);
+	CHECK(values);
+	if (values) {
+		CHECK(values->num_options == 9);
+		const struct cfr_effective_value *vmx = cfr_values_by_name(values, "vmx", 3);
+		CHECK(vmx && vmx->value.u32 == 1);
+		CHECK(cfr_values_by_name(values, "added", 5));
+		CHECK(cfr_values_by_name(values, "deep_limit", 10));
+		CHECK(values->options[2].object_id == test_find_id(base, "vmx"));
+	}
+	cfr_values_free(values);
+
+	/* Merged forms keep their place and ID, new ones go last */
+	CHECK(cfr_find_form(merged, test_find_id(base, "Main")) == cfr_nth_form(merged, 0));
+	CHECK(cfr_find_form(merged, test_find_id(base, "Board")) == cfr_nth_form(merged, 1));
+	CHECK(cfr_find_form(merged, 102) == cfr_nth_form(merged, 2));
+	CHECK(!cfr_find_form(merged, 100));
+
+	free(merged);
+	free(extra);
+	free(base);
+}
+
+/* A blob merged with itself comes out unchanged */
+static void test_same(void)
+{
+	const char *path = test_tmp_path("same.cfr");
+	const char *out_path = test_tmp_path("same-merged.cfr");
+	size_t size;
+	char *blob = test_menu(CFR_FORM_DIRECTORY_ALL, true, 0, &size);
+	char *merged = NULL;
+
+	CHECK(test_write_file(path, blob, size) == 0);
+	CHECK(merge(out_path, path, path) == 0);
+	CHECK(cfr_read_file(&merged, out_path) == 0);
+	CHECK(merged && !memcmp(merged, blob, size));
+
+	free(merged);
+	free(blob);
+}
+
+/* Enough options in one form for the index of its children to grow a few times */
+static void test_large(void)
+{
+	const char *path = test_tmp_path("large.cfr");
+	const char *out_path = test_tmp_path("large-merged.cfr");
+	size_t size;
+	char *blob = test_menu(CFR_FORM_DIRECTORY_NONE, false, 5000, &size);
+	char *merged = NULL;
+
+	CHECK(test_write_file(path, blob, size) == 0);
+	CHECK(merge(out_path, path, path) == 0);
+	CHECK(cfr_read_file(&merged, out_path) == 0);
+	CHECK(merged && !memcmp(merged, blob, size));
+
+	free(merged);
+	free(blob);
+}
+
+/* Blobs nested deeper than the record walkers go are refused */
+static void test_depth(void)
+{
+	const char *path = test_tmp_path("deep.cfr");
+	const char *out_path = test_tmp_path("deep-merged.cfr");
+	size_t size;
+	char *blob = test_nest_forms(40, &size);
+
+	CHECK(test_write_file(path, blob, size) == 0);
+	const int saved = test_mute(stderr);
+	CHECK(merge(out_path, path, path) != 0);
+	test_unmute(stderr, saved);
+
+	free(blob);
+}
+
+int main(void)
+{
+	test_merge();
+	test_same();
+	test_large();
+	test_depth();
+	return test_done();
+}
@@ -0,0 +1,169 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cfr.h"
+#include "cfr_query.h"
+#include "cfr_view.h"
+#include "test.h"
+
+/* Runs the query, and lists the names of what it found separated by commas */
+static void run(const struct cfr_view *view, const char *expr, char *names, size_t size)
+{
+	struct cfr_query *query = cfr_query_compile(expr);
+	struct cfr_query_result result = {0};
+	size_t len = 0;
+
+	names[0] = '\0';
+	if (!query || cfr_query_run(query, view, &result)) {
+		snprintf(names, size, "<error>");
+		cfr_query_free(query);
+		return;
+	}
+	for (size_t i = 0; i < result.num_rows; i++) {
+		const uint32_t row = result.rows[i];
+		uint32_t name;
+		if (result.values) {
+			name = view->value_ui_name[row];
+		} else {
+			name = view->opt_name[row] ? view->opt_name[row] : view->ui_name[row];
+		}
+		len += snprintf(names + len, len < size ? size - len : 0, "%s%s",
+				i ? "," : "", cfr_view_string(view, name));
+	}
+	free(result.rows);
+	cfr_query_free(query);
+}
+
+static void test_queries(void)
+{
+	static const struct {
+		const char *expr;
+		const char *names;
+	} cases[] = {
+		{ "form",				"Main,Board" },
+		{ "//form",				"Main,Power,Deep,Board" },
+		{ "form/option",			"power_on_after_fail,boot_delay,vmx,serial,led" },
+		{ "form/*",				"power_on_after_fail,boot_delay,vmx,serial,"
+							"Changes apply after a reboot,Power,led" },
+		{ "//bool",				"vmx,s3,led" },
+		{ "//comment",				"Changes apply after a reboot" },
+		{ "//*[id=9]",				"Deep" },
+		{ "//*[id=0x9]",			"Deep" },
+		{ "//*[flags&READONLY]",		"deep_limit" },
+		{ "//form[flags&GRAYOUT|READONLY]//number", "deep_limit" },
+		{ "//form[!flags]/form",		"Power,Deep" },
+		{ "form[ui_name=\"Main\"]//bool",	"vmx,s3" },
+		{ "form[ui_name!=\"Main\"]/bool",	"led" },
+		{ "//option[ui_name~\"power\"]",	"power_on_after_fail" },
+		{ "//option[default=3]",		"boot_delay" },
+		{ "//number[default>=3][default<5]",	"boot_delay" },
+		{ "//bool[default]",			"s3" },
+		{ "//varchar[default=\"abc\"]",		"serial" },
+		{ "//option[help]",			"power_on_after_fail" },
+		{ "//option[!help]",			"boot_delay,vmx,serial,s3,deep_limit,led" },
+		{ "//enum/value[value<2]",		"Power off,Power on" },
+		{ "//enum/value[value=2]",		"Previous state" },
+		{ "//enum/value[value>40]",		"5.0 s" },
+		{ "//form[ui_name=\"Nope\"]",		"" },
+	};
+
+	size_t size;
+	char *blob = test_menu(CFR_FORM_DIRECTORY_ALL, true, 0, &size);
+	struct cfr_view *view = cfr_view_build(blob);
+	CHECK(view);
+
+	for (size_t i = 0; view && i < ARRAY_SIZE(cases); i++) {
+		char names[256];
+		run(view, cases[i].expr, names, sizeof(names));
+		if (strcmp(names, cases[i].names)) {
+			fprintf(stderr, "'%s' found '%s' instead of '%s'\n",
+				cases[i].expr, names, cases[i].names);
+			test_failures++;
+		}
+	}
+
+	cfr_view_free(view);
+	free(blob);
+}
+
+static void test_errors(void)
+{
+	static const char *const exprs[] = {
+		"",
+		"/",
+		"form/",
+		"forms",
+		"form[",
+		"form[]",
+		"form[ui_name",
+		"form[ui_name=]",
+		"form[ui_name=\"Main]",
+		"form[ui_name<\"Main\"]",
+		"form[id~3]",
+		"form[id=BOGUS]",
+		"form[nope=1]",
+		"form]",
+		"value/form",
+		"form[id=99999999999]",
+	};
+
+	for (size_t i = 0; i < ARRAY_SIZE(exprs); i++) {
+		const int saved = test_mute(stderr);
+		struct cfr_query *query = cfr_query_compile(exprs[i]);
+		test_unmute(stderr, saved);
+		if (query) {
+			fprintf(stderr, "'%s' compiled\n", exprs[i]);
+			test_failures++;
+		}
+		cfr_query_free(query);
+	}
+}
+
+/* cfr_read prints the matches of every file as one JSON array */
+static void test_cfr_read(void)
+{
+	const char *path = test_tmp_path("query.cfr");
+	char cmd[512];
+	size_t size;
+	int status;
+	char *blob = test_menu(CFR_FORM_DIRECTORY_NONE, false, 0, &size);
+
+	CHECK(test_write_file(path, blob, size) == 0);
+	snprintf(cmd, sizeof(cmd), "./cfr_read --query '//bool[default]' %s %s", path, path);
+	char *output = test_run(cmd, &status);
+	CHECK(status == 0);
+	CHECK(!strncmp(output, "[\n{\"file\": ", 11));
+	CHECK(strstr(output, "\"opt_name\": \"s3\", \"ui_name\": \"Suspend to RAM\""));
+	CHECK(strstr(output, "]},\n{\"file\": "));
+	CHECK(strlen(output) > 6 && !strcmp(output + strlen(output) - 6, "\n]}\n]\n"));
+	free(output);
+
+	/* Files that can't be read are left out, and the rest is still valid JSON */
+	snprintf(cmd, sizeof(cmd), "./cfr_read --query form /nonexistent %s /nonexistent %s "
+		 "2>/dev/null", path, path);
+	output = test_run(cmd, &status);
+	CHECK(status != 0);
+	CHECK(!strncmp(output, "[\n{\"file\": ", 11));
+	const char *second = strstr(output, "]},\n{\"file\": ");
+	CHECK(second && !strstr(second + 1, "]},\n{\"file\": "));
+	CHECK(!strstr(output, ",,") && !strstr(output, "[,"));
+	CHECK(strlen(output) > 6 && !strcmp(output + strlen(output) - 6, "\n]}\n]\n"));
+	free(output);
+
+	snprintf(cmd, sizeof(cmd), "./cfr_read --query form /nonexistent 2>/dev/null");
+	output = test_run(cmd, &status);
+	CHECK(status != 0 && !strcmp(output, "[\n]\n"));
+	free(output);
+	free(blob);
+}
+
+int main(void)
+{
+	test_queries();
+	test_errors();
+	test_cfr_read();
+	return test_done();
+}
@@ -0,0 +1,259 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+
+/* For kill() and nanosleep() */
+#define _POSIX_C_SOURCE 200809L
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+
+#include "cfr.h"
+#include "cfr_values.h"
+#include "test.h"
+
+#define RESPONSE_MAX	(256 * 1024)
+
+static uint16_t port;
+
+static int connect_server(void)
+{
+	const struct sockaddr_in addr = {
+		.sin_family	= AF_INET,
+		.sin_port	= htons(port),
+		.sin_addr	= { htonl(INADDR_LOOPBACK) },
+	};
+	/* A connection the server wrongly keeps open fails the test instead of hanging it */
+	const struct timeval timeout = { .tv_sec = 5 };
+	const int fd = socket(AF_INET, SOCK_STREAM, 0);
+	if (fd < 0) {
+		return -1;
+	}
+	setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+	if (connect(fd, (const struct sockaddr *)&addr, sizeof(addr))) {
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+/* Sends the request and reads the response until the server closes the connection */
+static size_t request(const char *req, size_t req_len, char *response)
+{
+	const int fd = connect_server();
+	size_t len = 0;
+	CHECK(fd >= 0);
+	if (fd < 0) {
+		return 0;
+	}
+
+	for (size_t sent = 0; sent < req_len;) {
+		const ssize_t n = write(fd, req + sent, req_len - sent);
+		if (n <= 0) {
+			break;
+		}
+		sent += n;
+	}
+	for (ssize_t n; len < RESPONSE_MAX - 1 &&
+	     (n = read(fd, response + len, RESPONSE_MAX - 1 - len)) > 0;) {
+		len += n;
+	}
+	response[len] = '\0';
+	close(fd);
+	return len;
+}
+
+static size_t get(const char *path, char *response)
+{
+	char req[256];
+	const int len = snprintf(req, sizeof(req),
+				 "GET %s HTTP/1.1\r\nConnection: close\r\n\r\n", path);
+	return request(req, len, response);
+}
+
+static size_t post(const char *body, char *response)
+{
+	char req[1024];
+	const int len = snprintf(req, sizeof(req),
+				 "POST /apply HTTP/1.1\r\nConnection: close\r\n"
+				 "Content-Length: %zu\r\n\r\n%s", strlen(body), body);
+	return request(req, len, response);
+}
+
+/* The blob the server currently has */
+static char *get_blob(char *response)
+{
+	const size_t len = get("/cfr.bin", response);
+	const char *body = strstr(response, "\r\n\r\n");
+	CHECK(!strncmp(response, "HTTP/1.1 200", 12) && body);
+	if (!body) {
+		return NULL;
+	}
+	body += 4;
+
+	char *blob = malloc(len - (body - response));
+	CHECK(blob);
+	if (blob) {
+		memcpy(blob, body, len - (body - response));
+	}
+	return blob;
+}
+
+static pid_t start_server(const char *path, const char *style)
+{
+	for (unsigned int attempt = 0; attempt < 10; attempt++) {
+		port = 20000 + (getpid() * 7 + attempt * 1013) % 40000;
+		char port_arg[8];
+		snprintf(port_arg, sizeof(port_arg), "%u", port);
+
+		const pid_t pid = fork();
+		if (pid == 0) {
+			freopen("/dev/null", "w", stdout);
+			freopen("/dev/null", "w", stderr);
+			execl("./cfr_serve", "cfr_serve", "--port", port_arg, "--style", style, path,
+			      (char *)NULL);
+			_exit(127);
+		}
+
+		/* Wait for it to listen, or to fail because the port is taken */
+		for (unsigned int i = 0; i < 200 && pid > 0; i++) {
+			const int fd = connect_server();
+			if (fd >= 0) {
+				close(fd);
+				return pid;
+			}
+			if (waitpid(pid, NULL, WNOHANG) == pid) {
+				break;
+			}
+			nanosleep(&(struct timespec) { .tv_nsec = 10 * 1000 * 1000 }, NULL);
+		}
+		if (pid > 0) {
+			kill(pid, SIGTERM);
+			waitpid(pid, NULL, 0);
+		}
+	}
+	fprintf(stderr, "Could not start cfr_serve\n");
+	exit(1);
+}
+
+static uint32_t u32_value(const char *blob, const char *name)
+{
+	struct cfr_values *values = cfr_values_resolve(blob, NULL);
+	const struct cfr_effective_value *option =
+		values ? cfr_values_by_name(values, name, strlen(name)) : NULL;
+	const uint32_t value = option ? option->value.u32 : UINT32_MAX;
+	cfr_values_free(values);
+	return value;
+}
+
+int main(void)
+{
+	const char *path = test_tmp_path("serve.cfr");
+	const char *style_path = test_tmp_path("style.css");
+	static const char style[] = "body { color: black; }\n";
+	size_t size;
+	char *blob = test_menu(CFR_FORM_DIRECTORY_NONE, true, 0, &size);
+	char *response = malloc(RESPONSE_MAX);
+	CHECK(response && test_write_file(path, blob, size) == 0);
+	CHECK(test_write_file(style_path, style, strlen(style)) == 0);
+	if (!response) {
+		return test_done();
+	}
+	/* The server may close the connection before a request is fully sent */
+	signal(SIGPIPE, SIG_IGN);
+	const pid_t pid = start_server(path, style_path);
+
+	char *served = get_blob(response);
+	CHECK(served && !memcmp(served, blob, size));
+	free(served);
+
+	get("/", response);
+	CHECK(!strncmp(response, "HTTP/1.1 200", 12));
+	CHECK(strstr(response, "name='boot_delay' value='3'"));
+	get("/nope", response);
+	CHECK(!strncmp(response, "HTTP/1.1 404", 12));
+
+	/* HEAD has the headers of GET, and no body */
+	static const char head[] = "HEAD / HTTP/1.1\r\nConnection: close\r\n\r\n";
+	const size_t head_len = request(head, strlen(head), response);
+	CHECK(!strncmp(response, "HTTP/1.1 200", 12));
+	CHECK(head_len >= 4 && !strcmp(response + head_len - 4, "\r\n\r\n"));
+
+	/*
+	 * A HEAD pipelined after a GET only drops its own body, and the
+	 * connection header is matched in any case
+	 */
+	static const char pipelined[] = "GET /style.css HTTP/1.1\r\n\r\n"
+					"HEAD / HTTP/1.1\r\nConnection: Close\r\n\r\n";
+	const size_t pipelined_len = request(pipelined, strlen(pipelined), response);
+	const char *css = strstr(response, "\r\n\r\n");
+	CHECK(!strncmp(response, "HTTP/1.1 200", 12));
+	CHECK(css && !strncmp(css + 4, style, strlen(style)));
+	CHECK(css && !strncmp(css + 4 + strlen(style), "HTTP/1.1 200", 12));
+	CHECK(pipelined_len >= 4 && !strcmp(response + pipelined_len - 4, "\r\n\r\n"));
+	CHECK(!strstr(response, "<html"));
+
+	/* Values that an option can't take are refused */
+	post("power_on_after_fail=35", response);
+	CHECK(!strncmp(response, "HTTP/1.1 400", 12));
+
+	/* One bad value fails the whole form, and nothing is applied */
+	post("boot_delay=7&power_on_after_fail=35", response);
+	CHECK(!strncmp(response, "HTTP/1.1 400", 12));
+	served = get_blob(response);
+	CHECK(served && !memcmp(served, blob, size));
+	free(served);
+
+	/* Strings can change their length, and the checksum follows */
+	post("boot_delay=7&serial=a%20longer%20serial", response);
+	CHECK(!strncmp(response, "HTTP/1.1 200", 12));
+	served = get_blob(response);
+	CHECK(served && test_checksum_ok(served));
+	CHECK(served && cfr_check_form((const struct lb_cfr_option_form *)
+				       (served + cfr_first_form(served))) == 0);
+	CHECK(served && cfr_le32_to_cpu(((const struct lb_cfr *)served)->size) > size);
+	free(served);
+	get("/", response);
+	CHECK(strstr(response, "name='boot_delay' value='7'"));
+	CHECK(strstr(response, "value='a longer serial'"));
+
+	/* Read-only options and unknown names are skipped */
+	post("power_on_after_fail=30&deep_limit=9&nope=1", response);
+	CHECK(!strncmp(response, "HTTP/1.1 200", 12));
+	served = get_blob(response);
+	CHECK(served && u32_value(served, "boot_delay") == 7);
+	CHECK(served && u32_value(served, "power_on_after_fail") == 30);
+	CHECK(served && u32_value(served, "deep_limit") == 5);
+	free(served);
+
+	/* Headers are capped even when their end arrives in the same read */
+	const size_t big_len = 80 * 1024;
+	char *big = malloc(big_len);
+	CHECK(big);
+	if (big) {
+		memset(big, 'a', big_len);
+		memcpy(big, "GET / HTTP/1.1\r\nX: ", 19);
+		memcpy(big + big_len - 4, "\r\n\r\n", 4);
+		request(big, big_len, response);
+		CHECK(!strncmp(response, "HTTP/1.1 431", 12));
+		free(big);
+	}
+
+	/* And the server is still there */
+	served = get_blob(response);
+	CHECK(served && u32_value(served, "boot_delay") == 7);
+	free(served);
+
+	kill(pid, SIGTERM);
+	waitpid(pid, NULL, 0);
+	free(response);
+	free(blob);
+	return test_done();
+}
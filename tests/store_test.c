@@ -0,0 +1,202 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+
+/* For truncate() and access() */
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "cfr_store.h"
+#include "test.h"
+
+static struct cfr_store_config config(void)
+{
+	struct cfr_store_config config = CFR_STORE_DEFAULT_CONFIG;
+	config.background = false;
+	return config;
+}
+
+static bool has_u32(struct cfr_store *store, uint32_t object_id, uint32_t expected)
+{
+	struct cfr_value value;
+	return cfr_store_get(store, object_id, &value) == 0 &&
+	       value.type == CFR_VALUE_U32 && value.u32 == expected;
+}
+
+static bool has_string(struct cfr_store *store, uint32_t object_id, const char *expected)
+{
+	struct cfr_value value;
+	return cfr_store_get(store, object_id, &value) == 0 &&
+	       value.type == CFR_VALUE_STRING && value.len == strlen(expected) &&
+	       !strcmp(value.str, expected);
+}
+
+static bool has_none(struct cfr_store *store, uint32_t object_id)
+{
+	struct cfr_value value;
+	return cfr_store_get(store, object_id, &value) == 1;
+}
+
+static void test_reopen(void)
+{
+	const char *path = test_tmp_path("reopen.log");
+	const struct cfr_store_config cfg = config();
+
+	struct cfr_store *store = cfr_store_open(path, &cfg);
+	CHECK(store);
+	CHECK(cfr_store_set_u32(store, 1, 10) == 0);
+	CHECK(cfr_store_set_string(store, 2, "hello", 5) == 0);
+	CHECK(cfr_store_set_u32(store, 3, 30) == 0);
+	CHECK(cfr_store_set_u32(store, 1, 11) == 0);
+	CHECK(cfr_store_delete(store, 3) == 0);
+	CHECK(has_u32(store, 1, 11));
+	CHECK(has_none(store, 3));
+	CHECK(cfr_store_close(store) == 0);
+
+	store = cfr_store_open(path, &cfg);
+	CHECK(store);
+	CHECK(has_u32(store, 1, 11));
+	CHECK(has_string(store, 2, "hello"));
+	CHECK(has_none(store, 3));
+	CHECK(has_none(store, 4));
+
+	struct cfr_store_stats stats;
+	cfr_store_get_stats(store, &stats);
+	CHECK(stats.num_values == 2);
+	CHECK(cfr_store_close(store) == 0);
+}
+
+static void test_compact(void)
+{
+	const char *path = test_tmp_path("compact.log");
+	const struct cfr_store_config cfg = config();
+
+	struct cfr_store *store = cfr_store_open(path, &cfg);
+	CHECK(store);
+	for (uint32_t i = 0; i < 1000; i++) {
+		CHECK(cfr_store_set_u32(store, 1 + i % 10, i) == 0);
+	}
+	CHECK(cfr_store_set_string(store, 20, "kept", 4) == 0);
+	CHECK(cfr_store_sync(store) == 0);
+
+	struct cfr_store_stats before, after;
+	cfr_store_get_stats(store, &before);
+	CHECK(cfr_store_compact(store) == 0);
+	cfr_store_get_stats(store, &after);
+	CHECK(after.log_bytes < before.log_bytes);
+	CHECK(after.num_values == 11);
+	CHECK(has_u32(store, 1, 990));
+	CHECK(has_u32(store, 10, 999));
+	CHECK(cfr_store_close(store) == 0);
+
+	store = cfr_store_open(path, &cfg);
+	CHECK(store);
+	CHECK(has_u32(store, 1, 990));
+	CHECK(has_u32(store, 10, 999));
+	CHECK(has_string(store, 20, "kept"));
+	CHECK(cfr_store_close(store) == 0);
+}
+
+static void test_torn_write(void)
+{
+	const char *path = test_tmp_path("torn.log");
+	const struct cfr_store_config cfg = config();
+
+	struct cfr_store *store = cfr_store_open(path, &cfg);
+	CHECK(store);
+	CHECK(cfr_store_set_u32(store, 1, 10) == 0);
+	CHECK(cfr_store_sync(store) == 0);
+	CHECK(cfr_store_set_string(store, 2, "torn", 4) == 0);
+	CHECK(cfr_store_close(store) == 0);
+
+	/* Cut the last record short, as if the power went out while writing it */
+	struct stat st;
+	CHECK(stat(path, &st) == 0);
+	CHECK(truncate(path, st.st_size - 1) == 0);
+
+	/* Dropping the record is reported */
+	const int saved = test_mute(stderr);
+	store = cfr_store_open(path, &cfg);
+	test_unmute(stderr, saved);
+	CHECK(store);
+	CHECK(has_u32(store, 1, 10));
+	CHECK(has_none(store, 2));
+
+	/* The log is usable again after the torn record */
+	CHECK(cfr_store_set_u32(store, 2, 20) == 0);
+	CHECK(cfr_store_close(store) == 0);
+	store = cfr_store_open(path, &cfg);
+	CHECK(store);
+	CHECK(has_u32(store, 1, 10));
+	CHECK(has_u32(store, 2, 20));
+	CHECK(cfr_store_close(store) == 0);
+}
+
+static void test_read_only(void)
+{
+	const char *path = test_tmp_path("read_only.log");
+	struct cfr_store_config cfg = config();
+	cfg.read_only = true;
+
+	/* Missing stores are not created */
+	const int saved = test_mute(stderr);
+	CHECK(!cfr_store_open(path, &cfg));
+	test_unmute(stderr, saved);
+	CHECK(access(path, F_OK) == -1);
+
+	cfg.read_only = false;
+	struct cfr_store *store = cfr_store_open(path, &cfg);
+	CHECK(store);
+	CHECK(cfr_store_set_u32(store, 1, 10) == 0);
+	CHECK(cfr_store_sync(store) == 0);
+	CHECK(cfr_store_set_string(store, 2, "torn", 4) == 0);
+	CHECK(cfr_store_close(store) == 0);
+
+	struct stat before, after;
+	CHECK(stat(path, &before) == 0);
+	CHECK(truncate(path, before.st_size - 1) == 0);
+
+	/* A torn record is skipped, but stays for the next writer to drop */
+	cfg.read_only = true;
+	const int saved_open = test_mute(stderr);
+	store = cfr_store_open(path, &cfg);
+	test_unmute(stderr, saved_open);
+	CHECK(store);
+	CHECK(stat(path, &after) == 0 && after.st_size == before.st_size - 1);
+	CHECK(store && has_u32(store, 1, 10));
+	CHECK(store && has_none(store, 2));
+
+	/* And nothing can be written */
+	const int saved_set = test_mute(stderr);
+	CHECK(store && cfr_store_set_u32(store, 1, 11) == -1);
+	CHECK(store && cfr_store_compact(store) == -1);
+	test_unmute(stderr, saved_set);
+	CHECK(store && has_u32(store, 1, 10));
+	CHECK(store && cfr_store_close(store) == 0);
+	CHECK(stat(path, &after) == 0 && after.st_size == before.st_size - 1);
+}
+
+/* The benchmark leaves the store it was given alone */
+static void test_bench(void)
+{
+	const char *path = test_tmp_path("bench.log");
+	char command[512];
+	int status;
+
+	snprintf(command, sizeof(command), "./cfr_store --no-background %s bench 1000 10", path);
+	free(test_run(command, &status));
+	CHECK(status == 0);
+	CHECK(access(path, F_OK) == -1);
+}
+
+int main(void)
+{
+	test_reopen();
+	test_compact();
+	test_torn_write();
+	test_read_only();
+	test_bench();
+	return test_done();
+}
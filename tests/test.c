@@ -0,0 +1,372 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+
+/* For mkdtemp(), fileno() and popen() */
+#define _POSIX_C_SOURCE 200809L
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "cfr.h"
+#include "cfr_builder.h"
+#include "cfr_view.h"
+#include "test.h"
+
+#define MAX_TMP_PATHS	32
+
+unsigned int test_failures;
+
+static char tmp_dir[] = "/tmp/cfr-test-XXXXXX";
+static bool tmp_dir_created;
+static char *tmp_paths[MAX_TMP_PATHS];
+static size_t num_tmp_paths;
+
+int test_done(void)
+{
+	/* Directories are asked for after the files in them, and removed after them */
+	for (size_t i = 0; i < num_tmp_paths; i++) {
+		remove(tmp_paths[i]);
+		free(tmp_paths[i]);
+	}
+	if (tmp_dir_created) {
+		rmdir(tmp_dir);
+	}
+	if (test_failures) {
+		fprintf(stderr, "%u checks failed\n", test_failures);
+		return 1;
+	}
+	return 0;
+}
+
+/* Setting up a test is not what is being tested, so failing to do it is fatal */
+static void test_setup(int ret, const char *what)
+{
+	if (ret) {
+		fprintf(stderr, "Could not %s\n", what);
+		exit(1);
+	}
+}
+
+int test_mute(FILE *stream)
+{
+	const int null = open("/dev/null", O_WRONLY);
+	const int saved = dup(fileno(stream));
+	test_setup(null < 0 || saved < 0, "mute a stream");
+
+	fflush(stream);
+	dup2(null, fileno(stream));
+	close(null);
+	return saved;
+}
+
+void test_unmute(FILE *stream, int saved)
+{
+	fflush(stream);
+	dup2(saved, fileno(stream));
+	close(saved);
+}
+
+char *test_blob(const struct setup_menu_root *sm_root, size_t *size)
+{
+	*size = cfr_setup_menu_size(sm_root);
+	char *blob = calloc(1, *size);
+	test_setup(!blob, "allocate a blob");
+
+	/* What it wrote is reported on stdout */
+	const int saved = test_mute(stdout);
+	struct lb_header header = { .buffer = blob };
+	cfr_write_setup_menu(&header, sm_root);
+	test_unmute(stdout, saved);
+
+	test_setup(cfr_le32_to_cpu(((const struct lb_cfr *)blob)->size) != *size,
+		   "size the menu up front");
+	return blob;
+}
+
+char *test_menu(enum cfr_form_directory_mode form_directory, bool form_checksums,
+		unsigned int extra, size_t *size)
+{
+	const struct sm_enum_range ranges[] = {
+		{ .label = "%v s", .start = 10, .count = 5, .step = 10, .decimals = 1 },
+		SM_ENUM_RANGE_END,
+	};
+	const struct sm_enum_value values[] = {
+		{ "Power off", 0 },
+		{ "Power on", 1 },
+		{ "Previous state", 2 },
+		SM_ENUM_VALUE_END,
+	};
+	const struct sm_object deep_contents[] = {
+		{ .kind = SM_OBJ_NUMBER, .sm_number = {
+			.object_id	= extra + 10,
+			.flags		= CFR_OPTFLAG_READONLY,
+			.opt_name	= "deep_limit",
+			.ui_name	= "Limit",
+			.default_value	= 5,
+		} },
+	};
+	const struct sm_object power_contents[] = {
+		{ .kind = SM_OBJ_BOOL, .sm_bool = {
+			.object_id	= extra + 8,
+			.opt_name	= "s3",
+			.ui_name	= "Suspend to RAM",
+			.default_value	= true,
+		} },
+		{ .kind = SM_OBJ_FORM, .sm_form = {
+			.object_id	= extra + 9,
+			.flags		= CFR_OPTFLAG_GRAYOUT,
+			.ui_name	= "Deep",
+			.obj_list	= deep_contents,
+			.num_objects	= ARRAY_SIZE(deep_contents),
+		} },
+	};
+	const struct sm_object main_fixed[] = {
+		{ .kind = SM_OBJ_ENUM, .sm_enum = {
+			.object_id	= extra + 2,
+			.opt_name	= "power_on_after_fail",
+			.ui_name	= "Restore AC power loss",
+			.ui_helptext	= "What to do when power is re-applied",
+			.default_value	= 1,
+			.ranges		= ranges,
+			.values		= values,
+		} },
+		{ .kind = SM_OBJ_NUMBER, .sm_number = {
+			.object_id	= extra + 3,
+			.opt_name	= "boot_delay",
+			.ui_name	= "Boot delay",
+			.default_value	= 3,
+		} },
+		{ .kind = SM_OBJ_BOOL, .sm_bool = {
+			.object_id	= extra + 4,
+			.opt_name	= "vmx",
+			.ui_name	= "VMX <virtualization>",
+		} },
+		{ .kind = SM_OBJ_VARCHAR, .sm_varchar = {
+			.object_id	= extra + 5,
+			.opt_name	= "serial",
+			.ui_name	= "Serial number",
+			.default_value	= "abc",
+		} },
+		{ .kind = SM_OBJ_COMMENT, .sm_comment = {
+			.object_id	= extra + 6,
+			.ui_name	= "Changes apply after a reboot",
+		} },
+		{ .kind = SM_OBJ_FORM, .sm_form = {
+			.object_id	= extra + 7,
+			.ui_name	= "Power",
+			.obj_list	= power_contents,
+			.num_objects	= ARRAY_SIZE(power_contents),
+		} },
+	};
+	struct sm_object *main_contents = calloc(extra + ARRAY_SIZE(main_fixed),
+						 sizeof(*main_contents));
+	char (*names)[24] = calloc(extra + 1, sizeof(*names));
+	test_setup(!main_contents || !names, "allocate the test menu");
+
+	/* The members of struct sm_object are const, so the list is filled by copying */
+	for (unsigned int i = 0; i < extra; i++) {
+		snprintf(names[i], sizeof(names[i]), "extra_%u", i);
+		const struct sm_object object = { .kind = SM_OBJ_BOOL, .sm_bool = {
+			.object_id	= i + 2,
+			.opt_name	= names[i],
+			.ui_name	= names[i],
+		} };
+		memcpy(&main_contents[i], &object, sizeof(object));
+	}
+	memcpy(&main_contents[extra], main_fixed, sizeof(main_fixed));
+
+	const struct sm_object board_contents[] = {
+		{ .kind = SM_OBJ_BOOL, .sm_bool = {
+			.object_id	= extra + 12,
+			.opt_name	= "led",
+			.ui_name	= "LED",
+		} },
+	};
+	const struct sm_obj_form root_contents[] = {
+		{
+			.object_id	= 1,
+			.ui_name	= "Main",
+			.obj_list	= main_contents,
+			.num_objects	= extra + ARRAY_SIZE(main_fixed),
+		},
+		{
+			.object_id	= extra + 11,
+			.ui_name	= "Board",
+			.obj_list	= board_contents,
+			.num_objects	= ARRAY_SIZE(board_contents),
+		},
+	};
+	const struct setup_menu_root sm_root = {
+		.form_list	= root_contents,
+		.num_forms	= ARRAY_SIZE(root_contents),
+		.form_directory	= form_directory,
+		.form_checksums	= form_checksums,
+	};
+
+	char *blob = test_blob(&sm_root, size);
+	free(names);
+	free(main_contents);
+	return blob;
+}
+
+char *test_nest_forms(unsigned int depth, size_t *size)
+{
+	struct cfr_builder *b = cfr_builder_new();
+	int ret = !b;
+
+	for (unsigned int i = 1; i <= depth; i++) {
+		ret = ret || cfr_builder_form_begin(b, i, 0, "Form");
+	}
+	for (unsigned int i = 1; i <= depth; i++) {
+		ret = ret || cfr_builder_form_end(b);
+	}
+
+	char *blob = NULL;
+	ret = ret || cfr_builder_finish(b, CFR_FORM_DIRECTORY_NONE, false, &blob, size);
+	cfr_builder_free(b);
+	test_setup(ret, "nest the forms");
+	return blob;
+}
+
+uint32_t test_find_id(const char *blob, const char *name)
+{
+	struct cfr_view *view = cfr_view_build(blob);
+	test_setup(!view, "build a view of the test menu");
+
+	uint32_t object_id = 0;
+	for (size_t i = 0; i < view->num_rows && !object_id; i++) {
+		const bool is_form = view->tag[i] == LB_TAG_CFR_OPTION_FORM;
+		if (!strcmp(cfr_view_string(view, is_form ? view->ui_name[i] : view->opt_name[i]),
+			    name)) {
+			object_id = view->object_id[i];
+		}
+	}
+	cfr_view_free(view);
+	return object_id;
+}
+
+uint32_t test_find_offset(const char *blob, const char *name)
+{
+	const uint32_t object_id = test_find_id(blob, name);
+	struct cfr_view *view = cfr_view_build(blob);
+	test_setup(!view, "build a view of the test menu");
+
+	uint32_t offset = 0;
+	for (size_t i = 0; i < view->num_rows && object_id && !offset; i++) {
+		if (view->object_id[i] == object_id) {
+			offset = view->offset[i];
+		}
+	}
+	cfr_view_free(view);
+	return offset;
+}
+
+uint32_t test_find_range(const char *blob, const char *name)
+{
+	const uint32_t offset = test_find_offset(blob, name);
+	const struct lb_record *option = (const struct lb_record *)(blob + offset);
+	const uint32_t end = offset + cfr_le32_to_cpu(option->size);
+
+	for (uint32_t off = offset + sizeof(struct lb_cfr_numeric_option); offset && off < end;) {
+		const struct lb_record *rec = (const struct lb_record *)(blob + off);
+		if (cfr_le32_to_cpu(rec->tag) == LB_TAG_CFR_ENUM_RANGE) {
+			return off;
+		}
+		off += cfr_le32_to_cpu(rec->size);
+	}
+	return 0;
+}
+
+bool test_checksum_ok(char *blob)
+{
+	struct lb_cfr *root = (struct lb_cfr *)blob;
+	const uint32_t checksum = root->checksum;
+
+	root->checksum = 0;
+	const bool ok = cfr_crc32(blob, cfr_le32_to_cpu(root->size)) == cfr_le32_to_cpu(checksum);
+	root->checksum = checksum;
+	return ok;
+}
+
+const char *test_tmp_path(const char *name)
+{
+	if (!tmp_dir_created) {
+		test_setup(!mkdtemp(tmp_dir), "create a temporary directory");
+		tmp_dir_created = true;
+	}
+	test_setup(num_tmp_paths == MAX_TMP_PATHS, "track more temporary files");
+
+	const size_t size = strlen(tmp_dir) + 1 + strlen(name) + 1;
+	char *path = malloc(size);
+	test_setup(!path, "allocate a temporary path");
+	snprintf(path, size, "%s/%s", tmp_dir, name);
+	tmp_paths[num_tmp_paths++] = path;
+	return path;
+}
+
+char *test_run(const char *command, int *status)
+{
+	FILE *stream = popen(command, "r");
+	test_setup(!stream, "run a program");
+
+	size_t len = 0, capacity = 4096;
+	char *output = malloc(capacity + 1);
+	test_setup(!output, "allocate the output of a program");
+	for (size_t n; (n = fread(output + len, 1, capacity - len, stream));) {
+		len += n;
+		if (len == capacity) {
+			capacity *= 2;
+			output = realloc(output, capacity + 1);
+			test_setup(!output, "allocate the output of a program");
+		}
+	}
+	output[len] = '\0';
+	*status = pclose(stream);
+	return output;
+}
+
+int test_write_file(const char *path, const void *data, size_t len)
+{
+	FILE *stream = fopen(path, "wb");
+	if (!stream) {
+		return -1;
+	}
+	int ret = fwrite(data, 1, len, stream) == len ? 0 : -1;
+	if (fclose(stream)) {
+		ret = -1;
+	}
+	return ret;
+}
+
+char *test_read_file(const char *path, size_t *len)
+{
+	FILE *stream = fopen(path, "rb");
+	if (!stream) {
+		return NULL;
+	}
+
+	size_t size = 0, capacity = 4096;
+	char *data = malloc(capacity + 1);
+	for (size_t n = 1; data && n;) {
+		if (size == capacity) {
+			capacity *= 2;
+			char *bigger = realloc(data, capacity + 1);
+			if (!bigger) {
+				free(data);
+				data = NULL;
+				break;
+			}
+			data = bigger;
+		}
+		n = fread(data + size, 1, capacity - size, stream);
+		size += n;
+	}
+	fclose(stream);
+	if (data) {
+		data[size] = '\0';
+		*len = size;
+	}
+	return data;
+}
@@ -0,0 +1,84 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+
+#ifndef CFR_TEST_H
+#define CFR_TEST_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "cfr.h"
+
+/*
+ * Every test is a program of its own, run from the top of the tree by
+ * `make check`. Checks keep going after a failure, and the program exits
+ * with an error if any of them failed.
+ */
+
+extern unsigned int test_failures;
+
+#define CHECK(cond)								\
+	do {									\
+		if (!(cond)) {							\
+			fprintf(stderr, "%s:%d: check failed: %s\n",		\
+				__FILE__, __LINE__, #cond);			\
+			test_failures++;					\
+		}								\
+	} while (0)
+
+/* Removes the temporary files, and returns the exit code for main() */
+int test_done(void);
+
+/*
+ * Sends what is written to the stream to /dev/null, for code that reports
+ * what the test expects it to. Returns what test_unmute() restores.
+ */
+int test_mute(FILE *stream);
+void test_unmute(FILE *stream, int saved);
+
+/* Writes the menu with cfr_write_setup_menu() into an allocated blob */
+char *test_blob(const struct setup_menu_root *sm_root, size_t *size);
+
+/*
+ * A menu with every kind of object: an enum with a range, a number, bools, a varchar
+ * and a comment, and forms nested two deep. Object IDs are handed out in
+ * menu order, like cfr_write does. `extra` inserts that many more bool
+ * options at the start of the first form, which shifts the IDs of
+ * everything after them. `form_directory` and `form_checksums` are passed
+ * on to the writer.
+ */
+char *test_menu(enum cfr_form_directory_mode form_directory, bool form_checksums,
+		unsigned int extra, size_t *size);
+
+/* `depth` forms, each the only object of the one before it */
+char *test_nest_forms(unsigned int depth, size_t *size);
+
+/* The object ID of the object with the option name, or UI name for forms, or 0 */
+uint32_t test_find_id(const char *blob, const char *name);
+
+/* The offset of the record of that object in the blob, or 0 */
+uint32_t test_find_offset(const char *blob, const char *name);
+
+/* The offset of the first range of the enum option with the name, or 0 */
+uint32_t test_find_range(const char *blob, const char *name);
+
+/* Whether the root checksum matches the blob */
+bool test_checksum_ok(char *blob);
+
+/*
+ * A path in a temporary directory that test_done() removes again. Paths
+ * in subdirectories are fine, as long as the subdirectory itself is asked
+ * for after them.
+ */
+const char *test_tmp_path(const char *name);
+
+/* Runs the shell command, and returns what it wrote to stdout */
+char *test_run(const char *command, int *status);
+
+int test_write_file(const char *path, const void *data, size_t len);
+
+/* The contents of the file with a NUL terminator after them, or NULL */
+char *test_read_file(const char *path, size_t *len);
+
+#endif	/* CFR_TEST_H */
@@ -0,0 +1,502 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+
+/* For kill() and nanosleep() */
+#define _POSIX_C_SOURCE 200809L
+
+#include <dirent.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include "cfr.h"
+#include "test.h"
+
+/* Long enough to cross the 16 and 32 byte blocks of the fast path */
+#define ESCAPE_LEN	70
+
+static const char specials[] = "&<>\"'";
+
+/* Renders the blob at `path` with the options, and returns the page */
+static char *to_html(const char *options, const char *path)
+{
+	static const char *html_path;
+	char cmd[512];
+	size_t len;
+
+	if (!html_path) {
+		html_path = test_tmp_path("out.html");
+	}
+
+	snprintf(cmd, sizeof(cmd), "./cfr_to_html %s %s %s", options, path, html_path);
+	CHECK(system(cmd) == 0);
+	char *html = test_read_file(html_path, &len);
+	CHECK(html);
+	return html;
+}
+
+/* The escaping cfr_to_html should do, one byte at a time */
+static void escape(char *dst, const char *src, bool attr)
+{
+	for (dst[0] = '\0'; *src; src++) {
+		const char c = *src;
+		const char *entity = c == '&' ? "&amp;" : c == '<' ? "&lt;" : c == '>' ? "&gt;" :
+				     attr && c == '"' ? "&quot;" : attr && c == '\'' ? "&#39;" : NULL;
+		if (entity) {
+			strcat(dst, entity);
+		} else {
+			strncat(dst, &c, 1);
+		}
+	}
+}
+
+static void test_escape(void)
+{
+	/* Every special character at every position, with a second one right after it */
+	enum { NUM_STRINGS = ESCAPE_LEN - 1 };
+	static char strings[NUM_STRINGS][ESCAPE_LEN + 1];
+	static char names[NUM_STRINGS][16];
+	struct sm_object *objects = calloc(NUM_STRINGS, sizeof(*objects));
+	CHECK(objects);
+	if (!objects) {
+		return;
+	}
+
+	for (size_t i = 0; i < NUM_STRINGS; i++) {
+		memset(strings[i], 'a' + i % 26, ESCAPE_LEN);
+		strings[i][i] = specials[i % strlen(specials)];
+		strings[i][i + 1] = specials[(i + 1) % strlen(specials)];
+		snprintf(names[i], sizeof(names[i]), "s%zu", i);
+
+		/* The members of struct sm_object are const, so the list is filled by copying */
+		const struct sm_object object = { .kind = SM_OBJ_VARCHAR, .sm_varchar = {
+			.object_id	= i + 2,
+			.opt_name	= names[i],
+			.ui_name	= strings[i],
+			.default_value	= strings[i],
+		} };
+		memcpy(&objects[i], &object, sizeof(object));
+	}
+	const struct sm_obj_form form = {
+		.object_id	= 1,
+		.ui_name	= "Main",
+		.obj_list	= objects,
+		.num_objects	= NUM_STRINGS,
+	};
+	const struct setup_menu_root sm_root = { .form_list = &form, .num_forms = 1 };
+
+	const char *path = test_tmp_path("escape.cfr");
+	size_t size;
+	char *blob = test_blob(&sm_root, &size);
+	CHECK(test_write_file(path, blob, size) == 0);
+	char *html = to_html("", path);
+
+	for (size_t i = 0; i < NUM_STRINGS && html; i++) {
+		char escaped[ESCAPE_LEN * 6 + 1], expected[ESCAPE_LEN * 6 + 32];
+
+		/* UI names are text, defaults are attribute values */
+		escape(escaped, strings[i], false);
+		snprintf(expected, sizeof(expected), ">%s</label>", escaped);
+		CHECK(strstr(html, expected));
+		escape(escaped, strings[i], true);
+		snprintf(expected, sizeof(expected), "value='%s'", escaped);
+		CHECK(strstr(html, expected));
+	}
+
+	free(html);
+	free(blob);
+	free(objects);
+}
+
+/* Minified pages only lack the indentation, also once the output has been flushed */
+static void test_minify(void)
+{
+	const char *path = test_tmp_path("minify.cfr");
+	size_t size;
+	char *blob = test_menu(CFR_FORM_DIRECTORY_NONE, false, 3000, &size);
+	CHECK(test_write_file(path, blob, size) == 0);
+	char *html = to_html("", path);
+	char *minified = to_html("--minify", path);
+
+	if (html && minified) {
+		char *expected = malloc(strlen(html) + 1);
+		CHECK(expected);
+		if (expected) {
+			/* Drop the tabs at the start of every line */
+			char *dst = expected;
+			for (const char *src = html; *src; src++) {
+				if (*src != '\t' || (src != html && src[-1] != '\n' && src[-1] != '\t')) {
+					*dst++ = *src;
+				}
+			}
+			*dst = '\0';
+			CHECK(strlen(html) > 256 * 1024);
+			CHECK(strstr(html, "\n\t"));
+			CHECK(!strcmp(minified, expected));
+			free(expected);
+		}
+	}
+
+	free(minified);
+	free(html);
+	free(blob);
+}
+
+/* Numbers are converted without printf */
+static void test_numbers(void)
+{
+	static const uint32_t numbers[] = { 0, 7, 10, 4294967295u };
+	struct sm_object objects[ARRAY_SIZE(numbers)];
+	char names[ARRAY_SIZE(numbers)][16];
+
+	for (size_t i = 0; i < ARRAY_SIZE(numbers); i++) {
+		snprintf(names[i], sizeof(names[i]), "n%zu", i);
+		const struct sm_object object = { .kind = SM_OBJ_NUMBER, .sm_number = {
+			.object_id	= 1000000000 + i,
+			.opt_name	= names[i],
+			.ui_name	= names[i],
+			.default_value	= numbers[i],
+		} };
+		memcpy(&objects[i], &object, sizeof(object));
+	}
+	const struct sm_obj_form form = {
+		.object_id	= 1,
+		.ui_name	= "Main",
+		.obj_list	= objects,
+		.num_objects	= ARRAY_SIZE(objects),
+	};
+	const struct setup_menu_root sm_root = { .form_list = &form, .num_forms = 1 };
+
+	const char *path = test_tmp_path("numbers.cfr");
+	size_t size;
+	char *blob = test_blob(&sm_root, &size);
+	CHECK(test_write_file(path, blob, size) == 0);
+	char *html = to_html("", path);
+
+	for (size_t i = 0; i < ARRAY_SIZE(numbers) && html; i++) {
+		char expected[128];
+		snprintf(expected, sizeof(expected), "id='object-%zu' name='n%zu' value='%u'",
+			 1000000000 + i, i, numbers[i]);
+		CHECK(strstr(html, expected));
+	}
+
+	free(html);
+	free(blob);
+}
+
+/* Every form goes to a fragment of its own, which only holds its own objects */
+static void test_split(void)
+{
+	static const struct {
+		uint32_t object_id;
+		const char *contains;
+		const char *lacks;
+	} fragments[] = {
+		{ 1, "data-src='form-7.html'", "Suspend to RAM" },
+		{ 7, "data-src='form-9.html'", "deep_limit" },
+		{ 9, "deep_limit", "boot_delay" },
+		{ 11, "LED", "boot_delay" },
+	};
+	const char *fragment_paths[ARRAY_SIZE(fragments)];
+	for (size_t i = 0; i < ARRAY_SIZE(fragments); i++) {
+		char name[32];
+		snprintf(name, sizeof(name), "split/form-%u.html", fragments[i].object_id);
+		fragment_paths[i] = test_tmp_path(name);
+	}
+	const char *index_path = test_tmp_path("split/index.html");
+	const char *dir = test_tmp_path("split");
+	const char *path = test_tmp_path("split.cfr");
+	char cmd[512];
+	size_t size, len;
+
+	char *blob = test_menu(CFR_FORM_DIRECTORY_NONE, false, 0, &size);
+	CHECK(test_write_file(path, blob, size) == 0);
+	snprintf(cmd, sizeof(cmd), "./cfr_to_html --split %s %s", dir, path);
+	CHECK(system(cmd) == 0);
+
+	char *index = test_read_file(index_path, &len);
+	CHECK(index && strstr(index, "data-src='form-1.html'"));
+	CHECK(index && strstr(index, "data-src='form-11.html'"));
+	CHECK(index && !strstr(index, "boot_delay"));
+	free(index);
+
+	for (size_t i = 0; i < ARRAY_SIZE(fragments); i++) {
+		char *fragment = test_read_file(fragment_paths[i], &len);
+		CHECK(fragment && strstr(fragment, fragments[i].contains));
+		CHECK(fragment && !strstr(fragment, fragments[i].lacks));
+		free(fragment);
+	}
+	free(blob);
+}
+
+/* Forms rendered by several workers come out exactly like those rendered by one */
+static void test_jobs(void)
+{
+	enum { NUM_FORMS = 40, PER_FORM = 50 };
+	static struct sm_object objects[NUM_FORMS][PER_FORM];
+	static struct sm_obj_form forms[NUM_FORMS];
+	static char names[NUM_FORMS][PER_FORM][16];
+
+	/* The members of the structs are const, so they are filled by copying */
+	for (size_t i = 0; i < NUM_FORMS; i++) {
+		for (size_t j = 0; j < PER_FORM; j++) {
+			snprintf(names[i][j], sizeof(names[i][j]), "o%zu_%zu", i, j);
+			const struct sm_object object = { .kind = SM_OBJ_NUMBER, .sm_number = {
+				.object_id	= NUM_FORMS + i * PER_FORM + j + 1,
+				.opt_name	= names[i][j],
+				.ui_name	= names[i][j],
+				.default_value	= i * j,
+			} };
+			memcpy(&objects[i][j], &object, sizeof(object));
+		}
+		const struct sm_obj_form form = {
+			.object_id	= i + 1,
+			.ui_name	= names[i][0],
+			.obj_list	= objects[i],
+			/* Forms of different sizes finish out of order */
+			.num_objects	= PER_FORM - (i * 7) % PER_FORM,
+		};
+		memcpy(&forms[i], &form, sizeof(form));
+	}
+	const struct setup_menu_root sm_root = { .form_list = forms, .num_forms = NUM_FORMS };
+
+	const char *path = test_tmp_path("jobs.cfr");
+	size_t size;
+	char *blob = test_blob(&sm_root, &size);
+	CHECK(test_write_file(path, blob, size) == 0);
+
+	static const char *const options[][2] = {
+		{ "--jobs 1", "--jobs 7" },
+		{ "--jobs 1 --minify", "--jobs 3 --minify" },
+	};
+	for (size_t i = 0; i < ARRAY_SIZE(options); i++) {
+		char *serial = to_html(options[i][0], path);
+		char *parallel = to_html(options[i][1], path);
+		CHECK(serial && parallel && !strcmp(serial, parallel));
+		CHECK(serial && strstr(serial, "o39_0"));
+		free(parallel);
+		free(serial);
+	}
+	free(blob);
+}
+
+/* Documents are cached per blob and per options, and served from the cache */
+static void test_cache(void)
+{
+	const char *path = test_tmp_path("cache.cfr");
+	size_t size, len;
+	char *blob = test_menu(CFR_FORM_DIRECTORY_NONE, false, 0, &size);
+	const struct lb_cfr *root = (const struct lb_cfr *)blob;
+	const char *entries[2];
+	for (size_t i = 0; i < ARRAY_SIZE(entries); i++) {
+		char name[64];
+		snprintf(name, sizeof(name), "cache/cfr-v1-%08x-%u-%zx.html",
+			 cfr_le32_to_cpu(root->checksum), cfr_le32_to_cpu(root->size), i);
+		entries[i] = test_tmp_path(name);
+	}
+	const char *dir = test_tmp_path("cache");
+	char options[256];
+
+	CHECK(test_write_file(path, blob, size) == 0);
+	CHECK(mkdir(dir, 0755) == 0);
+	snprintf(options, sizeof(options), "--cache %s", dir);
+
+	/* A miss renders the document into the cache, and serves it */
+	char *expected = to_html("", path);
+	char *html = to_html(options, path);
+	char *entry = test_read_file(entries[0], &len);
+	CHECK(expected && html && !strcmp(html, expected));
+	CHECK(expected && entry && !strcmp(entry, expected));
+	free(entry);
+	free(html);
+
+	/* A hit only serves what is in the cache */
+	CHECK(test_write_file(entries[0], "cached", strlen("cached")) == 0);
+	html = to_html(options, path);
+	CHECK(html && !strcmp(html, "cached"));
+	free(html);
+
+	/* Other options have an entry of their own */
+	snprintf(options, sizeof(options), "--minify --cache %s", dir);
+	html = to_html(options, path);
+	entry = test_read_file(entries[1], &len);
+	CHECK(html && entry && !strcmp(html, entry));
+	CHECK(html && expected && strcmp(html, expected) && strcmp(html, "cached"));
+	free(entry);
+	free(html);
+
+	/* Entries can be read by everyone, and no temporary files are left behind */
+	struct stat st;
+	CHECK(stat(entries[1], &st) == 0 && (st.st_mode & 0777) == 0644);
+	DIR *cache = opendir(dir);
+	size_t num_files = 0;
+	CHECK(cache);
+	for (const struct dirent *d; cache && (d = readdir(cache));) {
+		num_files += d->d_name[0] != '.';
+	}
+	if (cache) {
+		closedir(cache);
+	}
+	CHECK(num_files == ARRAY_SIZE(entries));
+
+	/* A blob changed behind its checksum must not get the entry of the original */
+	struct lb_cfr_numeric_option *led = (struct lb_cfr_numeric_option *)
+		(blob + test_find_offset(blob, "led"));
+	led->default_value = cfr_cpu_to_le32(1);
+	CHECK(test_write_file(path, blob, size) == 0);
+	free(expected);
+	expected = to_html("", path);
+	snprintf(options, sizeof(options), "--cache %s 2>/dev/null", dir);
+	html = to_html(options, path);
+	CHECK(expected && html && !strcmp(html, expected));
+	free(html);
+
+	free(expected);
+	free(blob);
+}
+
+/* Blobs with a damaged record anywhere are refused instead of rendered */
+static void test_damaged(void)
+{
+	const char *path = test_tmp_path("damaged.cfr");
+	const char *html_path = test_tmp_path("damaged.html");
+	char cmd[512];
+	size_t size;
+	char *blob = test_menu(CFR_FORM_DIRECTORY_NONE, false, 0, &size);
+	struct lb_record *record = (struct lb_record *)(blob + test_find_offset(blob, "deep_limit"));
+
+	record->size = 0;
+	CHECK(test_write_file(path, blob, size) == 0);
+	snprintf(cmd, sizeof(cmd), "./cfr_to_html %s %s 2>/dev/null", path, html_path);
+	CHECK(system(cmd) != 0);
+	free(blob);
+}
+
+/* The number of times `what` occurs in the file */
+static unsigned int count_in_file(const char *path, const char *what)
+{
+	size_t len;
+	char *data = test_read_file(path, &len);
+	unsigned int count = 0;
+	for (const char *p = data; p && (p = strstr(p, what)); p += strlen(what)) {
+		count++;
+	}
+	free(data);
+	return count;
+}
+
+/* Waits up to five seconds for `what` to occur `count` times in the file */
+static bool wait_for(const char *path, const char *what, unsigned int count)
+{
+	for (unsigned int i = 0; i < 500; i++) {
+		if (count_in_file(path, what) >= count) {
+			return true;
+		}
+		nanosleep(&(struct timespec) { .tv_nsec = 10 * 1000 * 1000 }, NULL);
+	}
+	return false;
+}
+
+/* The page in the file is the one cfr_to_html renders for the blob at `path` */
+static bool same_page(const char *html_path, const char *path)
+{
+	size_t len;
+	char *html = test_read_file(html_path, &len);
+	char *expected = to_html("", path);
+	const bool same = html && expected && !strcmp(html, expected);
+	free(expected);
+	free(html);
+	return same;
+}
+
+static void set_root_checksum(char *blob, size_t size)
+{
+	struct lb_cfr *root = (struct lb_cfr *)blob;
+	root->checksum = 0;
+	root->checksum = cfr_cpu_to_le32(cfr_crc32(blob, size));
+}
+
+/* Only forms that changed are rendered again, and corrupt ones are not taken from the cache */
+static void test_watch(void)
+{
+	const char *path = test_tmp_path("watch.cfr");
+	const char *new_path = test_tmp_path("watch.cfr.new");
+	const char *html_path = test_tmp_path("watch.html");
+	const char *log_path = test_tmp_path("watch.log");
+	size_t size;
+	char *blob = test_menu(CFR_FORM_DIRECTORY_NONE, true, 0, &size);
+	CHECK(test_write_file(path, blob, size) == 0);
+
+	const pid_t pid = fork();
+	if (pid == 0) {
+		freopen("/dev/null", "w", stdout);
+		freopen(log_path, "w", stderr);
+		execl("./cfr_to_html", "cfr_to_html", "--jobs", "2", "--watch", path, html_path,
+		      (char *)NULL);
+		_exit(127);
+	}
+	CHECK(pid > 0);
+	if (pid < 0) {
+		free(blob);
+		return;
+	}
+
+	CHECK(wait_for(log_path, "Updated", 1));
+	CHECK(count_in_file(log_path, "rendered 2 of 2 forms") == 1);
+	CHECK(same_page(html_path, path));
+
+	/* A new blob replacing the input by a rename only gets Main rendered again */
+	const uint32_t boot_delay = test_find_offset(blob, "boot_delay");
+	((struct lb_cfr_numeric_option *)(blob + boot_delay))->default_value = cfr_cpu_to_le32(7);
+	cfr_update_form_checksums(blob, boot_delay);
+	set_root_checksum(blob, size);
+	CHECK(test_write_file(new_path, blob, size) == 0);
+	CHECK(rename(new_path, path) == 0);
+	CHECK(wait_for(log_path, "Updated", 2));
+	CHECK(count_in_file(log_path, "rendered 1 of 2 forms") == 1);
+	CHECK(same_page(html_path, path));
+
+	/* Board no longer matches its CRC, which the cache must not hide */
+	size_t len;
+	char *previous = test_read_file(html_path, &len);
+	const uint32_t led = test_find_offset(blob, "led");
+	((struct lb_cfr_numeric_option *)(blob + led))->default_value = cfr_cpu_to_le32(1);
+	set_root_checksum(blob, size);
+	CHECK(test_write_file(path, blob, size) == 0);
+	CHECK(wait_for(log_path, "is corrupt", 1));
+	CHECK(count_in_file(log_path, "Updated") == 2);
+	char *html = test_read_file(html_path, &len);
+	CHECK(previous && html && !strcmp(previous, html));
+	free(html);
+	free(previous);
+
+	/* Removing the input ends the watch */
+	CHECK(unlink(path) == 0);
+	int status = -1;
+	for (unsigned int i = 0; i < 500 && waitpid(pid, &status, WNOHANG) != pid; i++) {
+		nanosleep(&(struct timespec) { .tv_nsec = 10 * 1000 * 1000 }, NULL);
+	}
+	CHECK(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+	if (!WIFEXITED(status)) {
+		kill(pid, SIGTERM);
+		waitpid(pid, NULL, 0);
+	}
+	free(blob);
+}
+
+int main(void)
+{
+	test_escape();
+	test_minify();
+	test_numbers();
+	test_split();
+	test_jobs();
+	test_cache();
+	test_damaged();
+	test_watch();
+	return test_done();
+}
@@ -0,0 +1,130 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "cfr.h"
+#include "cfr_tree.h"
+#include "test.h"
+
+static size_t row_of(const struct cfr_tree *tree, uint32_t offset)
+{
+	for (size_t i = 0; i < tree->num_rows; i++) {
+		if (tree->rows[i]->offset == offset) {
+			return i;
+		}
+	}
+	return SIZE_MAX;
+}
+
+/* Only what was expanded has rows, and collapsing forgets the children again */
+static void test_expand(void)
+{
+	size_t size, row;
+	char *blob = test_menu(CFR_FORM_DIRECTORY_NONE, false, 0, &size);
+	struct cfr_tree tree;
+
+	CHECK(cfr_tree_init(&tree, blob) == 0);
+	CHECK(tree.num_forms == 2 && tree.num_rows == 2);
+	CHECK(tree.rows[0]->offset == test_find_offset(blob, "Main"));
+	CHECK(tree.rows[1]->offset == test_find_offset(blob, "Board"));
+	CHECK(!tree.forms[0].children && !tree.forms[0].expanded);
+
+	/* The options of Main, with Power collapsed */
+	struct cfr_tree_node *main_form = &tree.forms[0];
+	CHECK(cfr_tree_is_expandable(blob, main_form));
+	CHECK(cfr_tree_expand(blob, main_form) == 0);
+	CHECK(main_form->num_children == 6);
+	CHECK(cfr_tree_build_rows(&tree, test_find_offset(blob, "boot_delay"), &row) == 0);
+	CHECK(tree.num_rows == 8);
+	CHECK(row == 2 && tree.rows[row]->depth == 1);
+	CHECK(!cfr_tree_is_expandable(blob, tree.rows[row]));
+	CHECK(tree.rows[row]->parent == test_find_offset(blob, "Main"));
+
+	/* Every value of the range gets a row, before the listed ones */
+	struct cfr_tree_node *option = tree.rows[row_of(&tree, test_find_offset(blob,
+									  "power_on_after_fail"))];
+	CHECK(cfr_tree_expand(blob, option) == 0);
+	CHECK(option->num_children == 8);
+	for (uint32_t i = 0; i < 5 && option->num_children == 8; i++) {
+		CHECK(cfr_tree_tag(blob, option->children[i].offset) == LB_TAG_CFR_ENUM_RANGE);
+		CHECK(option->children[i].index == i && option->children[i].depth == 2);
+	}
+	CHECK(cfr_tree_build_rows(&tree, 0, &row) == 0);
+	CHECK(tree.num_rows == 16 && row == 0);
+
+	/* Expanding again changes nothing */
+	CHECK(cfr_tree_expand(blob, option) == 0);
+	CHECK(option->num_children == 8);
+
+	cfr_tree_collapse(main_form);
+	CHECK(!main_form->children && !main_form->num_children && !main_form->expanded);
+	CHECK(cfr_tree_build_rows(&tree, test_find_offset(blob, "boot_delay"), &row) == 0);
+	CHECK(tree.num_rows == 2 && row == 0);
+
+	cfr_tree_free(&tree);
+	free(blob);
+}
+
+/* Nested forms are expanded one level at a time */
+static void test_nested(void)
+{
+	size_t size, row;
+	char *blob = test_nest_forms(5, &size);
+	struct cfr_tree tree;
+
+	CHECK(cfr_tree_init(&tree, blob) == 0);
+	struct cfr_tree_node *node = tree.num_forms == 1 ? &tree.forms[0] : NULL;
+	for (unsigned int depth = 0; node; depth++) {
+		CHECK(node->depth == depth);
+		CHECK(cfr_tree_expand(blob, node) == 0);
+		CHECK(node->num_children == (depth < 4));
+		node = node->num_children ? &node->children[0] : NULL;
+	}
+	CHECK(cfr_tree_build_rows(&tree, 0, &row) == 0);
+	CHECK(tree.num_rows == 5);
+
+	cfr_tree_free(&tree);
+	free(blob);
+}
+
+/* Ranges too large to be real are not expanded */
+static void test_large_range(void)
+{
+	size_t size;
+	char *blob = test_menu(CFR_FORM_DIRECTORY_NONE, false, 0, &size);
+	const uint32_t offset = test_find_offset(blob, "power_on_after_fail");
+	struct cfr_tree_node option = { .offset = offset };
+
+	struct lb_cfr_enum_range *range = NULL;
+	cfr_for_each_child(blob, offset, off) {
+		if (cfr_tree_tag(blob, off) == LB_TAG_CFR_ENUM_RANGE) {
+			range = (struct lb_cfr_enum_range *)(blob + off);
+		}
+	}
+	CHECK(range);
+	if (!range) {
+		free(blob);
+		return;
+	}
+
+	range->count = cfr_cpu_to_le32(CFR_ENUM_RANGE_MAX);
+	CHECK(cfr_tree_expand(blob, &option) == 0);
+	CHECK(option.num_children == CFR_ENUM_RANGE_MAX + 3);
+	cfr_tree_collapse(&option);
+
+	range->count = cfr_cpu_to_le32(UINT32_MAX);
+	CHECK(cfr_tree_expand(blob, &option) == 0);
+	CHECK(option.num_children == 3);
+	cfr_tree_collapse(&option);
+
+	free(blob);
+}
+
+int main(void)
+{
+	test_expand();
+	test_nested();
+	test_large_range();
+	return test_done();
+}
@@ -0,0 +1,129 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cfr.h"
+#include "cfr_file.h"
+#include "cfr_v2.h"
+#include "test.h"
+
+static void test_round_trip(void)
+{
+	for (unsigned int extra = 0; extra <= 300; extra += 100) {
+		size_t size, v2_len;
+		char *blob = test_menu(CFR_FORM_DIRECTORY_NONE, false, extra, &size);
+		char *v2 = NULL, *decoded = NULL;
+
+		CHECK(cfr_v2_encode(blob, &v2, &v2_len) == 0);
+		CHECK(v2 && cfr_is_v2(v2, v2_len));
+		CHECK(v2_len < size);
+		CHECK(v2 && cfr_v2_decode(v2, v2_len, &decoded) == 0);
+		CHECK(decoded && !memcmp(decoded, blob, size));
+
+		struct lb_cfr root;
+		CHECK(v2 && cfr_v2_read_header(v2, v2_len, &root) == 0);
+		CHECK(v2 && !memcmp(&root, blob, sizeof(root)));
+
+		free(decoded);
+		free(v2);
+		free(blob);
+	}
+}
+
+static void test_truncated(void)
+{
+	size_t size, v2_len;
+	char *blob = test_menu(CFR_FORM_DIRECTORY_NONE, false, 0, &size);
+	char *v2 = NULL;
+
+	CHECK(cfr_v2_encode(blob, &v2, &v2_len) == 0);
+	const int saved = test_mute(stderr);
+	for (size_t len = 0; v2 && len < v2_len; len++) {
+		char *decoded = NULL;
+		CHECK(cfr_v2_decode(v2, len, &decoded) != 0);
+		free(decoded);
+	}
+	test_unmute(stderr, saved);
+
+	free(v2);
+	free(blob);
+}
+
+static void test_corrupted(void)
+{
+	size_t size, v2_len;
+	char *blob = test_menu(CFR_FORM_DIRECTORY_NONE, false, 0, &size);
+	char *v2 = NULL;
+
+	/* Whatever the damage, the decoder does not return a blob other than the original */
+	CHECK(cfr_v2_encode(blob, &v2, &v2_len) == 0);
+	const int saved = test_mute(stderr);
+	for (size_t i = CFR_V2_MAGIC_LEN; v2 && i < v2_len; i++) {
+		char *decoded = NULL;
+		v2[i] ^= 0x20;
+		if (cfr_v2_decode(v2, v2_len, &decoded) == 0) {
+			const struct lb_cfr *root = (const struct lb_cfr *)decoded;
+			CHECK(cfr_le32_to_cpu(root->size) == size && !memcmp(decoded, blob, size));
+		}
+		v2[i] ^= 0x20;
+		free(decoded);
+	}
+	test_unmute(stderr, saved);
+
+	free(v2);
+	free(blob);
+}
+
+static void test_cfr_read_file(void)
+{
+	const char *path = test_tmp_path("menu.cfr2");
+	size_t size, v2_len;
+	char *blob = test_menu(CFR_FORM_DIRECTORY_NONE, false, 0, &size);
+	char *v2 = NULL, *read = NULL;
+
+	CHECK(cfr_v2_encode(blob, &v2, &v2_len) == 0);
+	CHECK(v2 && test_write_file(path, v2, v2_len) == 0);
+	CHECK(cfr_read_file(&read, path) == 0);
+	CHECK(read && !memcmp(read, blob, size));
+
+	free(read);
+	free(v2);
+	free(blob);
+}
+
+/* cfr_convert goes to the other format, and back */
+static void test_convert(void)
+{
+	const char *path = test_tmp_path("convert.cfr");
+	const char *v2_path = test_tmp_path("convert.cfr2");
+	const char *v1_path = test_tmp_path("convert-back.cfr");
+	char cmd[512];
+	size_t size, len;
+	char *blob = test_menu(CFR_FORM_DIRECTORY_NONE, false, 0, &size);
+
+	CHECK(test_write_file(path, blob, size) == 0);
+	snprintf(cmd, sizeof(cmd), "./cfr_convert %s %s >/dev/null", path, v2_path);
+	CHECK(system(cmd) == 0);
+	char *v2 = test_read_file(v2_path, &len);
+	CHECK(v2 && cfr_is_v2(v2, len));
+	snprintf(cmd, sizeof(cmd), "./cfr_convert --to v1 %s %s >/dev/null", v2_path, v1_path);
+	CHECK(system(cmd) == 0);
+	char *v1 = test_read_file(v1_path, &len);
+	CHECK(v1 && len == size && !memcmp(v1, blob, size));
+
+	free(v1);
+	free(v2);
+	free(blob);
+}
+
+int main(void)
+{
+	test_round_trip();
+	test_truncated();
+	test_corrupted();
+	test_cfr_read_file();
+	test_convert();
+	return test_done();
+}
@@ -0,0 +1,207 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+
+/* For access() */
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "cfr.h"
+#include "cfr_store.h"
+#include "cfr_values.h"
+#include "test.h"
+
+static const struct cfr_effective_value *by_name(const struct cfr_values *values,
+						 const char *name)
+{
+	return cfr_values_by_name(values, name, strlen(name));
+}
+
+static void test_defaults(void)
+{
+	size_t size;
+	char *blob = test_menu(CFR_FORM_DIRECTORY_ALL, true, 0, &size);
+	struct cfr_values *values = cfr_values_resolve(blob, NULL);
+	CHECK(values);
+	if (!values) {
+		free(blob);
+		return;
+	}
+
+	/* Every option, but no forms or comments */
+	CHECK(values->num_options == 7);
+	CHECK(values->num_rejected == 0);
+	for (size_t i = 0; i < values->num_options; i++) {
+		CHECK(cfr_value_is_default(&values->options[i]));
+	}
+
+	const struct cfr_effective_value *option = by_name(values, "boot_delay");
+	CHECK(option && option->value.u32 == 3);
+	CHECK(option && cfr_values_by_id(values, option->object_id) == option);
+	option = by_name(values, "serial");
+	CHECK(option && option->value.type == CFR_VALUE_STRING && !strcmp(option->value.str, "abc"));
+	option = by_name(values, "s3");
+	CHECK(option && option->value.u32 == 1);
+	option = by_name(values, "deep_limit");
+	CHECK(option && option->flags == CFR_OPTFLAG_READONLY);
+	CHECK(!by_name(values, "Main"));
+	CHECK(!by_name(values, "deep"));
+	CHECK(!cfr_values_by_id(values, 0));
+
+	cfr_values_free(values);
+	free(blob);
+}
+
+static void test_store(void)
+{
+	const char *path = test_tmp_path("values.log");
+	struct cfr_store_config config = CFR_STORE_DEFAULT_CONFIG;
+	config.background = false;
+	size_t size;
+	char *blob = test_menu(CFR_FORM_DIRECTORY_NONE, false, 0, &size);
+	struct cfr_store *store = cfr_store_open(path, &config);
+	CHECK(store);
+	if (!store) {
+		free(blob);
+		return;
+	}
+
+	CHECK(cfr_store_set_u32(store, test_find_id(blob, "boot_delay"), 7) == 0);
+	CHECK(cfr_store_set_u32(store, test_find_id(blob, "power_on_after_fail"), 30) == 0);
+	CHECK(cfr_store_set_string(store, test_find_id(blob, "serial"), "xyz", 3) == 0);
+	/* Not legal: not a value of the enum, not a bool, and the wrong type */
+	CHECK(cfr_store_set_u32(store, test_find_id(blob, "s3"), 2) == 0);
+	CHECK(cfr_store_set_string(store, test_find_id(blob, "vmx"), "1", 1) == 0);
+	CHECK(cfr_store_set_u32(store, 1000, 1) == 0);
+
+	struct cfr_values *values = cfr_values_resolve(blob, store);
+	CHECK(values);
+	if (values) {
+		const struct cfr_effective_value *option = by_name(values, "boot_delay");
+		CHECK(option && option->source == CFR_SOURCE_STORE && option->value.u32 == 7);
+		option = by_name(values, "power_on_after_fail");
+		CHECK(option && option->source == CFR_SOURCE_STORE && option->value.u32 == 30);
+		option = by_name(values, "serial");
+		CHECK(option && option->source == CFR_SOURCE_STORE &&
+		      !strcmp(option->value.str, "xyz"));
+		option = by_name(values, "s3");
+		CHECK(option && option->source == CFR_SOURCE_REJECTED && option->value.u32 == 1);
+		option = by_name(values, "vmx");
+		CHECK(option && option->source == CFR_SOURCE_REJECTED && option->value.u32 == 0);
+		CHECK(values->num_rejected == 2);
+	}
+
+	CHECK(cfr_store_set_u32(store, test_find_id(blob, "power_on_after_fail"), 35) == 0);
+	cfr_values_free(values);
+	values = cfr_values_resolve(blob, store);
+	CHECK(values && by_name(values, "power_on_after_fail")->source == CFR_SOURCE_REJECTED);
+
+	cfr_values_free(values);
+	CHECK(cfr_store_close(store) == 0);
+	free(blob);
+}
+
+/* cfr_values neither creates nor repairs the store it is given */
+static void test_store_read_only(void)
+{
+	const char *blob_path = test_tmp_path("values.cfr");
+	const char *path = test_tmp_path("values_ro.log");
+	char command[512];
+	int status;
+	size_t size;
+	char *blob = test_menu(CFR_FORM_DIRECTORY_NONE, false, 0, &size);
+	CHECK(test_write_file(blob_path, blob, size) == 0);
+
+	snprintf(command, sizeof(command), "./cfr_values --store %s %s 2>/dev/null",
+		 path, blob_path);
+	free(test_run(command, &status));
+	CHECK(status != 0);
+	CHECK(access(path, F_OK) == -1);
+
+	struct cfr_store_config config = CFR_STORE_DEFAULT_CONFIG;
+	config.background = false;
+	struct cfr_store *store = cfr_store_open(path, &config);
+	CHECK(store);
+	CHECK(store && cfr_store_set_u32(store, test_find_id(blob, "boot_delay"), 7) == 0);
+	CHECK(store && cfr_store_close(store) == 0);
+
+	/* A torn record at the end stays for the firmware to drop */
+	static const char torn[] = "torn";
+	FILE *stream = fopen(path, "ab");
+	CHECK(stream && fwrite(torn, 1, 4, stream) == 4);
+	CHECK(stream && fclose(stream) == 0);
+	struct stat before, after;
+	CHECK(stat(path, &before) == 0);
+
+	snprintf(command, sizeof(command), "./cfr_values --store %s %s boot_delay 2>/dev/null",
+		 path, blob_path);
+	char *output = test_run(command, &status);
+	CHECK(status == 0);
+	CHECK(strstr(output, "boot_delay = 7 (stored"));
+	CHECK(stat(path, &after) == 0 && after.st_size == before.st_size);
+	free(output);
+	free(blob);
+}
+
+/* Damaged strings must neither be read past their record nor hang the lookup */
+static void test_damaged_strings(void)
+{
+	size_t size;
+	char *blob = test_menu(CFR_FORM_DIRECTORY_NONE, false, 0, &size);
+	struct cfr_values *values = cfr_values_resolve(blob, NULL);
+	CHECK(values);
+	const struct cfr_effective_value *option = values ? by_name(values, "vmx") : NULL;
+	CHECK(option);
+	if (!option) {
+		cfr_values_free(values);
+		free(blob);
+		return;
+	}
+	const uint32_t offset = option->offset;
+	cfr_values_free(values);
+
+	/* The option name is the first child of the option */
+	struct lb_cfr_varbinary *name =
+		(struct lb_cfr_varbinary *)(blob + offset +
+					   cfr_record_header_size(LB_TAG_CFR_OPTION_BOOL));
+	CHECK(cfr_le32_to_cpu(name->tag) == LB_TAG_CFR_VARCHAR_OPT_NAME);
+	const struct lb_cfr_varbinary saved = *name;
+
+	const struct {
+		uint32_t size;
+		uint32_t data_length;
+		bool resolves;		/* Only the string is damaged, not the records */
+	} cases[] = {
+		{ 0, cfr_le32_to_cpu(saved.data_length), false },
+		{ 4, cfr_le32_to_cpu(saved.data_length), false },
+		{ 0x7fffffff, cfr_le32_to_cpu(saved.data_length), false },
+		{ cfr_le32_to_cpu(saved.size), 0x7fffffff, true },
+		{ cfr_le32_to_cpu(saved.size), cfr_le32_to_cpu(saved.size), true },
+	};
+	for (size_t i = 0; i < ARRAY_SIZE(cases); i++) {
+		name->size = cfr_cpu_to_le32(cases[i].size);
+		name->data_length = cfr_cpu_to_le32(cases[i].data_length);
+		values = cfr_values_resolve(blob, NULL);
+		CHECK(values || !cases[i].resolves);
+		if (values) {
+			CHECK(!by_name(values, "vmx"));
+			CHECK(by_name(values, "boot_delay"));
+		}
+		cfr_values_free(values);
+	}
+	*name = saved;
+
+	free(blob);
+}
+
+int main(void)
+{
+	test_defaults();
+	test_store();
+	test_store_read_only();
+	test_damaged_strings();
+	return test_done();
+}
@@ -0,0 +1,250 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cfr.h"
+#include "cfr_view.h"
+#include "test.h"
+
+static void test_rows(void)
+{
+	static const struct {
+		uint32_t tag;
+		uint32_t parent;
+		const char *name;	/* Option name, or UI name for forms and comments */
+	} rows[] = {
+		{ LB_TAG_CFR_OPTION_FORM,    CFR_VIEW_NO_PARENT, "Main" },
+		{ LB_TAG_CFR_OPTION_ENUM,    0, "power_on_after_fail" },
+		{ LB_TAG_CFR_OPTION_NUMBER,  0, "boot_delay" },
+		{ LB_TAG_CFR_OPTION_BOOL,    0, "vmx" },
+		{ LB_TAG_CFR_OPTION_VARCHAR, 0, "serial" },
+		{ LB_TAG_CFR_OPTION_COMMENT, 0, "Changes apply after a reboot" },
+		{ LB_TAG_CFR_OPTION_FORM,    0, "Power" },
+		{ LB_TAG_CFR_OPTION_BOOL,    6, "s3" },
+		{ LB_TAG_CFR_OPTION_FORM,    6, "Deep" },
+		{ LB_TAG_CFR_OPTION_NUMBER,  8, "deep_limit" },
+		{ LB_TAG_CFR_OPTION_FORM,    CFR_VIEW_NO_PARENT, "Board" },
+		{ LB_TAG_CFR_OPTION_BOOL,    10, "led" },
+	};
+	size_t size;
+	char *blob = test_menu(CFR_FORM_DIRECTORY_NONE, false, 0, &size);
+	struct cfr_view *view = cfr_view_build(blob);
+	CHECK(view && view->num_rows == ARRAY_SIZE(rows));
+	if (!view || view->num_rows != ARRAY_SIZE(rows)) {
+		cfr_view_free(view);
+		free(blob);
+		return;
+	}
+
+	/* Rows are in blob order, which is the order IDs are handed out in */
+	for (size_t i = 0; i < ARRAY_SIZE(rows); i++) {
+		const uint32_t name = view->opt_name[i] ? view->opt_name[i] : view->ui_name[i];
+		CHECK(view->object_id[i] == i + 1);
+		CHECK(view->tag[i] == rows[i].tag);
+		CHECK(view->parent[i] == rows[i].parent);
+		CHECK(!strcmp(cfr_view_string(view, name), rows[i].name));
+		CHECK(cfr_le32_to_cpu(((const struct lb_record *)(blob + view->offset[i]))->tag) ==
+		      rows[i].tag);
+	}
+
+	CHECK(view->flags[8] == CFR_OPTFLAG_GRAYOUT);
+	CHECK(view->flags[9] == CFR_OPTFLAG_READONLY);
+	CHECK(view->default_value[2] == 3);
+	CHECK(view->default_value[7] == 1);
+	CHECK(!strcmp(cfr_view_string(view, view->def_string[4]), "abc"));
+	CHECK(!strcmp(cfr_view_string(view, view->ui_helptext[1]),
+		      "What to do when power is re-applied"));
+	CHECK(!view->ui_helptext[2]);
+	CHECK(!strcmp(cfr_view_string(view, 0), ""));
+
+	/* Enum values */
+	static const struct {
+		uint32_t value;
+		const char *name;
+	} values[] = {
+		{ 10, "1.0 s" }, { 20, "2.0 s" }, { 30, "3.0 s" }, { 40, "4.0 s" }, { 50, "5.0 s" },
+		{ 0, "Power off" }, { 1, "Power on" }, { 2, "Previous state" },
+	};
+	CHECK(view->num_values == ARRAY_SIZE(values));
+	CHECK(view->value_count[1] == ARRAY_SIZE(values));
+	for (size_t i = 0; i < view->num_values && i < ARRAY_SIZE(values); i++) {
+		const uint32_t value = view->first_value[1] + i;
+		CHECK(view->value[value] == values[i].value);
+		CHECK(view->value_option[value] == 1);
+		CHECK(!strcmp(cfr_view_string(view, view->value_ui_name[value]), values[i].name));
+	}
+
+	cfr_view_free(view);
+	free(blob);
+}
+
+/* Enough rows for several bitmap words, and a partial one at the end */
+static void test_filters(void)
+{
+	size_t size;
+	char *blob = test_menu(CFR_FORM_DIRECTORY_NONE, false, 150, &size);
+	struct cfr_view *view = cfr_view_build(blob);
+	CHECK(view && view->num_rows == 162);
+	if (!view) {
+		free(blob);
+		return;
+	}
+
+	const size_t words = cfr_view_bitmap_words(view->num_rows);
+	uint64_t *bools = calloc(words, sizeof(*bools));
+	uint64_t *other = calloc(words, sizeof(*other));
+	uint32_t *rows = calloc(view->num_rows, sizeof(*rows));
+	CHECK(words == 3 && bools && other && rows);
+	if (!bools || !other || !rows) {
+		exit(1);
+	}
+
+	cfr_view_filter(view->tag, view->num_rows, CFR_VIEW_EQ, LB_TAG_CFR_OPTION_BOOL, bools);
+	CHECK(cfr_view_bitmap_count(bools, view->num_rows) == 153);
+	CHECK(!(bools[words - 1] >> (view->num_rows % 64)));
+
+	cfr_view_filter(view->tag, view->num_rows, CFR_VIEW_NE, LB_TAG_CFR_OPTION_BOOL, other);
+	CHECK(cfr_view_bitmap_count(other, view->num_rows) == 9);
+	cfr_view_bitmap_or(other, bools, view->num_rows);
+	CHECK(cfr_view_bitmap_count(other, view->num_rows) == view->num_rows);
+	CHECK(!(other[words - 1] >> (view->num_rows % 64)));
+
+	/* Bools that are on by default: only s3 */
+	cfr_view_filter(view->default_value, view->num_rows, CFR_VIEW_GT, 0, other);
+	cfr_view_bitmap_and(other, bools, view->num_rows);
+	CHECK(cfr_view_bitmap_rows(other, view->num_rows, rows) == 1);
+	CHECK(view->object_id[rows[0]] == test_find_id(blob, "s3"));
+
+	cfr_view_filter(view->object_id, view->num_rows, CFR_VIEW_LT, 11, other);
+	CHECK(cfr_view_bitmap_rows(other, view->num_rows, rows) == 10);
+	CHECK(rows[0] == 0 && rows[9] == 9);
+
+	cfr_view_filter(view->flags, view->num_rows, CFR_VIEW_ANY_BITS,
+			CFR_OPTFLAG_READONLY | CFR_OPTFLAG_GRAYOUT, other);
+	CHECK(cfr_view_bitmap_count(other, view->num_rows) == 2);
+	cfr_view_filter(view->flags, view->num_rows, CFR_VIEW_NO_BITS, CFR_OPTFLAG_READONLY, other);
+	CHECK(cfr_view_bitmap_count(other, view->num_rows) == view->num_rows - 1);
+
+	free(rows);
+	free(other);
+	free(bools);
+	cfr_view_free(view);
+	free(blob);
+}
+
+/* The offset of the first child of the record at `offset` with `tag`, or 0 */
+static uint32_t find_child(const char *blob, uint32_t offset, uint32_t tag)
+{
+	const struct lb_record *rec = (const struct lb_record *)(blob + offset);
+	const uint32_t end = offset + cfr_le32_to_cpu(rec->size);
+
+	for (uint32_t off = offset + cfr_record_header_size(cfr_le32_to_cpu(rec->tag)); off < end;) {
+		const struct lb_record *child = (const struct lb_record *)(blob + off);
+		if (cfr_le32_to_cpu(child->tag) == tag) {
+			return off;
+		}
+		off += cfr_le32_to_cpu(child->size);
+	}
+	return 0;
+}
+
+static void test_damaged(void)
+{
+	size_t size;
+	char *blob = test_menu(CFR_FORM_DIRECTORY_NONE, false, 0, &size);
+
+	/* An object too small for its fields, with its children after it */
+	struct lb_record *led = (struct lb_record *)(blob + test_find_offset(blob, "led"));
+	const uint32_t led_size = led->size;
+	led->size = cfr_cpu_to_le32(sizeof(*led));
+	int saved = test_mute(stderr);
+	struct cfr_view *view = cfr_view_build(blob);
+	test_unmute(stderr, saved);
+	CHECK(!view);
+	cfr_view_free(view);
+	led->size = led_size;
+
+	/* Ranges are expanded up to a limit */
+	const uint32_t range_off = find_child(blob, test_find_offset(blob, "power_on_after_fail"),
+					      LB_TAG_CFR_ENUM_RANGE);
+	CHECK(range_off);
+	struct lb_cfr_enum_range *range = (struct lb_cfr_enum_range *)(blob + range_off);
+	range->count = cfr_cpu_to_le32(CFR_ENUM_RANGE_MAX);
+	view = cfr_view_build(blob);
+	CHECK(view && view->num_values == CFR_ENUM_RANGE_MAX + 3);
+	cfr_view_free(view);
+
+	range->count = cfr_cpu_to_le32(UINT32_MAX);
+	saved = test_mute(stderr);
+	view = cfr_view_build(blob);
+	test_unmute(stderr, saved);
+	CHECK(!view);
+	cfr_view_free(view);
+
+	/* cfr_scan skips a file it can't read, and still counts the others */
+	const char *good = test_tmp_path("scan_good.cfr");
+	const char *bad = test_tmp_path("scan_bad.cfr");
+	char *good_blob = test_menu(CFR_FORM_DIRECTORY_NONE, false, 0, &size);
+	CHECK(test_write_file(good, good_blob, size) == 0);
+	CHECK(test_write_file(bad, blob, size) == 0);
+
+	char cmd[512];
+	int status;
+	snprintf(cmd, sizeof(cmd), "./cfr_scan --count %s %s 2>/dev/null", good, bad);
+	char *output = test_run(cmd, &status);
+	CHECK(status != 0 && !strcmp(output, "12\n"));
+	free(output);
+
+	free(good_blob);
+	free(blob);
+}
+
+static void test_scan(void)
+{
+	static const struct {
+		const char *filters;
+		const char *output;
+	} cases[] = {
+		{ "--count", "12\n" },
+		{ "--type bool --count", "3\n" },
+		{ "--type form --flags 2", "%s: 9 Deep\n" },
+		{ "--min-values 8", "%s: 2 power_on_after_fail\n" },
+		{ "--min-values 9 --count", "0\n" },
+		{ "--type number --non-zero-default", "%s: 3 boot_delay\n%s: 10 deep_limit\n" },
+	};
+	const char *path = test_tmp_path("scan.cfr");
+	size_t size;
+	char *blob = test_menu(CFR_FORM_DIRECTORY_NONE, false, 0, &size);
+	CHECK(test_write_file(path, blob, size) == 0);
+
+	for (size_t i = 0; i < ARRAY_SIZE(cases); i++) {
+		char cmd[512], expected[512];
+		int status;
+		snprintf(cmd, sizeof(cmd), "./cfr_scan %s %s", cases[i].filters, path);
+		snprintf(expected, sizeof(expected), cases[i].output, path, path);
+		char *output = test_run(cmd, &status);
+		CHECK(status == 0 && !strcmp(output, expected));
+		free(output);
+	}
+
+	/* Counts add up over several files */
+	char cmd[512];
+	int status;
+	snprintf(cmd, sizeof(cmd), "./cfr_scan --type bool --count %s %s", path, path);
+	char *output = test_run(cmd, &status);
+	CHECK(status == 0 && !strcmp(output, "6\n"));
+	free(output);
+
+	free(blob);
+}
+
+int main(void)
+{
+	test_rows();
+	test_filters();
+	test_damaged();
+	test_scan();
+	return test_done();
+}